@@ -33,6 +33,26 @@ I<libslack(agent)> - agent module
     typedef struct Agent Agent;
     typedef int agent_action_t(Agent *agent, void *arg);
     typedef int agent_reaction_t(Agent *agent, int fd, int revents, void *arg);
+    typedef int agent_task_t(Agent *agent, void *arg);
+    typedef struct agent_stats_t agent_stats_t;
+
+    #define AGENT_EDGE 0x100
+    #define AGENT_ONESHOT 0x200
+    #define AGENT_EXCLUSIVE 0x400
+    #define AGENT_STATS_BUCKETS 24
+
+    struct agent_stats_t
+    {
+        unsigned long turns;
+        unsigned long wait[AGENT_STATS_BUCKETS];
+        unsigned long events[AGENT_STATS_BUCKETS];
+        unsigned long reaction[AGENT_STATS_BUCKETS];
+        unsigned long action[AGENT_STATS_BUCKETS];
+        unsigned long lateness[AGENT_STATS_BUCKETS];
+        unsigned long cascade[AGENT_STATS_BUCKETS];
+        long slowest_reaction;
+        int slowest_fd;
+    };
 
     Agent *agent_create(void);
     Agent *agent_create_with_locker(Locker *locker);
@@ -40,6 +60,8 @@ I<libslack(agent)> - agent module
     Agent *agent_create_measured_with_locker(Locker *locker);
     Agent *agent_create_using_select(void);
     Agent *agent_create_using_select_with_locker(Locker *locker);
+    Agent *agent_create_using_epoll(void);
+    Agent *agent_create_using_epoll_with_locker(Locker *locker);
     void agent_release(Agent *agent);
     void *agent_destroy(Agent **agent);
     int agent_rdlock(const Agent *agent);
@@ -67,10 +89,25 @@ I<libslack(agent)> - agent module
     int agent_dadt_unlocked(Agent *agent, int fd);
     void *agent_schedule(Agent *agent, long sec, long usec, agent_action_t *action, void *arg);
     void *agent_schedule_unlocked(Agent *agent, long sec, long usec, agent_action_t *action, void *arg);
+    int agent_reschedule(Agent *agent, void *action_id, long sec, long usec);
+    int agent_reschedule_unlocked(Agent *agent, void *action_id, long sec, long usec);
     int agent_cancel(Agent *agent, void *action_id);
     int agent_cancel_unlocked(Agent *agent, void *action_id);
     int agent_start(Agent *agent);
     int agent_stop(Agent *agent);
+    int agent_spawn(Agent *agent, size_t stacksize, agent_task_t *task, void *arg);
+    int agent_spawn_unlocked(Agent *agent, size_t stacksize, agent_task_t *task, void *arg);
+    int agent_sleep(Agent *agent, long sec, long usec);
+    int agent_await_readable(Agent *agent, int fd, long sec, long usec);
+    int agent_await_writable(Agent *agent, int fd, long sec, long usec);
+    ssize_t agent_read(Agent *agent, int fd, long timeout, char *buf, size_t count);
+    ssize_t agent_write(Agent *agent, int fd, long timeout, const char *buf, size_t count);
+    int agent_stats_enable(Agent *agent);
+    int agent_stats_enable_unlocked(Agent *agent);
+    int agent_stats_disable(Agent *agent);
+    int agent_stats_disable_unlocked(Agent *agent);
+    int agent_stats(Agent *agent, agent_stats_t *stats);
+    int agent_stats_unlocked(Agent *agent, agent_stats_t *stats);
 
 =head1 DESCRIPTION
 
@@ -145,37 +182,66 @@ enum { DAYS = 10, HOURS = 24, MINUTES = 60, SECONDS = 60, JIFFIES = 100 };
 #include <sys/select.h>
 #endif
 
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#ifdef HAVE_UCONTEXT
+#include <ucontext.h>
+#endif
+
 typedef struct timewheel_t timewheel_t;
 typedef struct action_t action_t;
+typedef struct slab_t slab_t;
 typedef struct reaction_t reaction_t;
 typedef struct activity_t activity_t;
+typedef struct task_t task_t;
 typedef struct timeval timeval;
 
 #define POLL_SIZE 16
+#define ACTION_SLAB 64
+#define TASK_STACK (64 * 1024)
 
 enum { IDLE = 0, START = 1, STOP = 2 }; /* Agent states */
-enum { POLL = 0, SELECT = 1 };          /* Agent implementations */
+enum { POLL = 0, SELECT = 1, EPOLL = 2 }; /* Agent implementations */
+
+#define AGENT_FLAGS (AGENT_EDGE | AGENT_ONESHOT | AGENT_EXCLUSIVE)
+
+/*
+** The per-connection data is kept in parallel arrays indexed via the ids
+** map. The fields that are needed on every turn of the agent come first.
+** The pollfds array is scanned on every turn, reactions is only read for
+** connections that are ready, and activity is only allocated when an agent
+** created with agent_create_measured() actually sees an I/O event.
+*/
 
 struct Agent
 {
 	int state;              /* idle, start, stop */
-	ssize_t *ids;           /* map fd to array indexes */
-	size_t ids_size;        /* size of ids */
-	int method;             /* implementation method: poll() or select() */
+	int method;             /* implementation method: poll(), select() or epoll */
+	size_t length;          /* number of elements used in pollfd */
+	size_t size;            /* number of elements allocated in pollfd */
 	union
 	{
 #ifdef HAVE_POLL
 		struct pollfd *pfds;                      /* for poll() */
 #endif
 		struct { fd_set *rfds, *xfds, *wfds; } s; /* for select() */
+#ifdef HAVE_EPOLL
+		struct { int fd; struct epoll_event *evs; } e; /* for epoll */
+#endif
 	} u;
 	reaction_t *reactions;  /* reactions to input events */
 	activity_t *tempo;      /* activity of the agent itself */
-	activity_t *activity;   /* activity of each connection */
-	size_t size;            /* number of elements allocated in pollfd */
-	size_t length;          /* number of elements used in pollfd */
+	activity_t *activity;   /* activity of each connection (allocated lazily) */
+	ssize_t *ids;           /* map fd to array indexes */
+	size_t ids_size;        /* size of ids */
 	timewheel_t *timewheel; /* hierarchical timing wheel for scheduling */
 	size_t timers;          /* number of timers in the timewheel */
+	task_t *task;           /* the task that is currently running (if any) */
+	task_t *tasks;          /* all tasks (running, suspended and idle) */
+	task_t *idle;           /* finished tasks whose stacks can be reused */
+	agent_stats_t *stats;   /* loop statistics (if enabled) */
 	Locker *locker;         /* locking strategy for this agent */
 };
 
@@ -185,6 +251,10 @@ struct Agent
 #define readfds u.s.rfds
 #define writefds u.s.wfds
 #define exceptfds u.s.xfds
+#ifdef HAVE_EPOLL
+#define epollfd u.e.fd
+#define epollevents u.e.evs
+#endif
 
 struct action_t
 {
@@ -201,12 +271,38 @@ struct action_t
 	size_t jiffy;           /* index into jiffies */
 };
 
+struct slab_t
+{
+	slab_t *next;                  /* link to next slab */
+	action_t actions[ACTION_SLAB]; /* actions allocated from this slab */
+};
+
+#ifdef HAVE_UCONTEXT
+struct task_t
+{
+	task_t *next;           /* link to next task in tasks */
+	task_t *nextidle;       /* link to next task in idle */
+	Agent *agent;           /* the agent that runs this task */
+	agent_task_t *task;     /* function to call */
+	void *arg;              /* argument to pass to function */
+	char *stack;            /* the task's stack */
+	size_t stacksize;       /* size of stack */
+	ucontext_t context[1];  /* the task's context while suspended */
+	ucontext_t caller[1];   /* the context that resumed the task */
+	void *action_id;        /* pending timeout (if any) */
+	int fd;                 /* file descriptor being awaited (if any) */
+	int timedout;           /* did the timeout expire before fd was ready? */
+	int done;               /* has the task returned? */
+	int result;             /* the task's return value */
+};
+#endif
+
 struct reaction_t
 {
-	int fd;                     /* file descriptor */
-	int events;                 /* read/write/exception */
 	agent_reaction_t *reaction; /* function to call */
 	void *arg;                  /* argument to pass to function */
+	int fd;                     /* file descriptor */
+	int events;                 /* read/write/exception */
 };
 
 struct activity_t
@@ -231,6 +327,8 @@ struct timewheel_t
 	action_t *minutes[MINUTES]; /* timers for subsequent minutes */
 	action_t *seconds[SECONDS]; /* timers for subsequent seconds */
 	action_t *jiffies[JIFFIES]; /* timers for this second */
+	void *freelist;             /* unused actions */
+	slab_t *slabs;              /* memory for all actions */
 };
 
 /*
@@ -262,48 +360,107 @@ static timewheel_t *timewheel_create()
 
 C<static void timewheel_release(timewheel_t *timewheel)>
 
-Releases (deallocates) C<timewheel>.
+Releases (deallocates) C<timewheel> and the slabs of memory from which its
+actions were allocated.
 
 */
 
-static action_t *release_action(action_t *action)
+static void timewheel_release(timewheel_t *timewheel)
 {
-	action_t *next = dlink_next(action);
+	slab_t *slab;
+
+	if (!timewheel)
+		return;
 
-	mem_release(action);
+	while ((slab = timewheel->slabs))
+	{
+		timewheel->slabs = slab->next;
+		mem_release(slab);
+	}
 
-	return next;
+	mem_release(timewheel);
 }
 
-static void release_actions(action_t *action)
+/*
+
+C<static action_t *action_create(timewheel_t *timewheel)>
+
+Allocates an action from C<timewheel>'s free list. When the free list is
+exhausted, another slab of C<ACTION_SLAB> actions is allocated and added to
+the free list. Slabs are only deallocated by I<timewheel_release(3)>. On
+error, returns C<null> with C<errno> set appropriately.
+
+*/
+
+static action_t *action_create(timewheel_t *timewheel)
 {
-	while (action)
-		action = release_action(action);
+	if (!timewheel->freelist)
+	{
+		slab_t *slab = mem_new(slab_t); /* XXX decouple */
+
+		if (!slab)
+			return NULL;
+
+		slab->next = timewheel->slabs;
+		timewheel->slabs = slab;
+		timewheel->freelist = dlink_freelist_init(slab->actions, ACTION_SLAB, sizeof(action_t));
+	}
+
+	return dlink_alloc(&timewheel->freelist);
 }
 
-static void timewheel_release(timewheel_t *timewheel)
+/*
+
+C<static void action_release(timewheel_t *timewheel, action_t *action)>
+
+Returns C<action> to C<timewheel>'s free list.
+
+*/
+
+static void action_release(timewheel_t *timewheel, action_t *action)
 {
-	size_t i;
+	dlink_free(&timewheel->freelist, action);
+}
 
-	if (!timewheel)
-		return;
+/*
+
+C<static int activate(Agent *agent)>
+
+Allocates the activity data for C<agent>'s connections, if it hasn't been
+allocated already. This is deferred until it is needed so that measured
+agents don't pay for it until there is some activity to measure. On
+success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
 
-	for (i = 0; i < DAYS; ++i)
-		release_actions(timewheel->days[i]);
+*/
 
-	for (i = 0; i < HOURS; ++i)
-		release_actions(timewheel->hours[i]);
+static int activate(Agent *agent)
+{
+	if (agent->activity)
+		return 0;
 
-	for (i = 0; i < MINUTES; ++i)
-		release_actions(timewheel->minutes[i]);
+	if (!(agent->activity = mem_create(agent->size, activity_t))) /* XXX decouple */
+		return -1;
 
-	for (i = 0; i < SECONDS; ++i)
-		release_actions(timewheel->seconds[i]);
+	memset(agent->activity, 0, agent->size * sizeof(activity_t));
 
-	for (i = 0; i < JIFFIES; ++i)
-		release_actions(timewheel->jiffies[i]);
+	return 0;
+}
 
-	mem_release(timewheel);
+/*
+
+C<static const activity_t *connection_activity(Agent *agent, ssize_t id)>
+
+Returns the activity data for the connection at index C<id>. If no activity
+data has been allocated yet, returns activity data with no detail.
+
+*/
+
+static const activity_t *connection_activity(Agent *agent, ssize_t id)
+{
+	static const activity_t quiet;
+
+	return (agent->activity) ? &agent->activity[id] : &quiet;
 }
 
 /*
@@ -471,6 +628,62 @@ Agent *agent_create_using_select_with_locker(Locker *locker)
 
 /*
 
+=item C<Agent *agent_create_using_epoll(void)>
+
+Equivalent to I<agent_create(3)> except that the agent created will use
+I<epoll(7)> instead of I<poll(2)>. Unlike I<poll(2)>, the cost of waiting for
+I/O events with I<epoll(7)> doesn't depend on the number of connected file
+descriptors, and it supports the C<AGENT_EDGE>, C<AGENT_ONESHOT> and
+C<AGENT_EXCLUSIVE> flags natively (see I<agent_connect(3)>). Note, however,
+that I<epoll(7)> can't be used with regular files or directories. If this
+system does not have I<epoll(7)>, this is equivalent to I<agent_create(3)>.
+
+=cut
+
+*/
+
+Agent *agent_create_using_epoll(void)
+{
+	return agent_create_using_epoll_with_locker(NULL);
+}
+
+/*
+
+=item C<Agent *agent_create_using_epoll_with_locker(Locker *locker)>
+
+Equivalent to I<agent_create_using_epoll(3)> except that multiple threads
+accessing the new agent will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+Agent *agent_create_using_epoll_with_locker(Locker *locker)
+{
+#ifdef HAVE_EPOLL
+	Agent *agent = mem_new(Agent); /* XXX decouple */
+
+	if (!agent)
+		return NULL;
+
+	memset(agent, 0, sizeof(Agent));
+	agent->method = EPOLL;
+	agent->locker = locker;
+
+	if ((agent->epollfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+	{
+		mem_release(agent);
+		return NULL;
+	}
+
+	return agent;
+#else
+	return agent_create_with_locker(locker);
+#endif
+}
+
+/*
+
 =item C<void agent_release(Agent *agent)>
 
 Releases (deallocates) C<agent>.
@@ -492,6 +705,14 @@ void agent_release(Agent *agent)
 	locker = agent->locker;
 	mem_release(agent->ids);
 
+#ifdef HAVE_EPOLL
+	if (agent->method == EPOLL)
+	{
+		close(agent->epollfd);
+		mem_release(agent->epollevents);
+	}
+	else
+#endif
 #ifdef HAVE_POLL
 	if (agent->method == POLL)
 		mem_release(agent->pollfds);
@@ -507,6 +728,18 @@ void agent_release(Agent *agent)
 	mem_release(agent->tempo);
 	mem_release(agent->activity);
 	timewheel_release(agent->timewheel);
+	mem_release(agent->stats);
+
+#ifdef HAVE_UCONTEXT
+	while (agent->tasks)
+	{
+		task_t *task = agent->tasks;
+		agent->tasks = task->next;
+		mem_release(task->stack);
+		mem_release(task);
+	}
+#endif
+
 	mem_release(agent);
 	locker_unlock(locker);
 }
@@ -613,6 +846,42 @@ existing C<events>, C<reaction> and C<arg> are replaced with the new values.
 On success, returns C<0>. On error, returns C<-1> with C<errno> set
 appropriately.
 
+By default, events are level-triggered: C<reaction> is called on every turn
+of the agent for as long as the events of interest are pending. C<events>
+may also contain any of the following flags:
+
+=over 4
+
+=item C<AGENT_EDGE>
+
+Events are edge-triggered: C<reaction> is only called when new events
+arrive, so it must consume all pending input (e.g. by reading from a
+non-blocking C<fd> until it fails with C<EAGAIN>). With I<epoll(7)>, this
+avoids the cost of reporting the same events repeatedly. With I<poll(2)> and
+I<select(2)>, this flag is accepted but events remain level-triggered. This
+makes no difference to reactions that consume all pending input.
+
+=item C<AGENT_ONESHOT>
+
+After C<reaction> has been called once, C<fd> is disarmed. It remains
+connected (along with its activity data), but no further events are
+reported until C<fd> is re-armed by calling I<agent_connect(3)> again (e.g.
+from within C<reaction> when it is ready for more). This is supported by all
+agents. Note that an agent whose only connected file descriptors are
+disarmed, and which has no scheduled actions, will wait forever.
+
+=item C<AGENT_EXCLUSIVE>
+
+When the same file descriptor (e.g. a listening socket) is connected to
+multiple agents in separate threads, only one of them is woken up for each
+event, rather than all of them. With I<epoll(7)>, this avoids a thundering
+herd of agents racing to I<accept(2)> the same connection. With I<poll(2)>
+and I<select(2)>, this flag is accepted but has no effect. It may not be
+combined with C<AGENT_ONESHOT>. Changing the events of an already connected
+C<fd> to or from C<AGENT_EXCLUSIVE> disconnects and reconnects it.
+
+=back
+
 =cut
 
 */
@@ -649,7 +918,10 @@ int agent_connect_unlocked(Agent *agent, int fd, int events, agent_reaction_t *r
 {
 	/* Check the arguments */
 
-	if (!agent || fd < 0 || !reaction || !(events & (R_OK | W_OK | X_OK)) || (events & ~(R_OK | W_OK | X_OK)))
+	if (!agent || fd < 0 || !reaction || !(events & (R_OK | W_OK | X_OK)) || (events & ~(R_OK | W_OK | X_OK | AGENT_FLAGS)))
+		return set_errno(EINVAL);
+
+	if ((events & AGENT_ONESHOT) && (events & AGENT_EXCLUSIVE))
 		return set_errno(EINVAL);
 
 	/* Allocate or extend ids if necessary */
@@ -664,14 +936,19 @@ int agent_connect_unlocked(Agent *agent, int fd, int events, agent_reaction_t *r
 	}
 	else if (agent->ids_size <= fd)
 	{
-		if (!(agent->ids = mem_resize(&agent->ids, agent->ids_size << 1)))
+		size_t ids_size = agent->ids_size;
+
+		while (ids_size <= fd)
+			ids_size <<= 1;
+
+		if (!(agent->ids = mem_resize(&agent->ids, ids_size)))
 			return -1;
 
-		memset(agent->ids + agent->ids_size, 0xff, agent->ids_size * sizeof(ssize_t));
-		agent->ids_size <<= 1;
+		memset(agent->ids + agent->ids_size, 0xff, (ids_size - agent->ids_size) * sizeof(ssize_t));
+		agent->ids_size = ids_size;
 	}
 
-	/* Allocate or extend pollfds, reactions and activity, if necessary */
+	/* Allocate or extend pollfds, reactions and activity (if any), if necessary */
 
 	if (!agent->reactions)
 	{
@@ -685,19 +962,19 @@ int agent_connect_unlocked(Agent *agent, int fd, int events, agent_reaction_t *r
 		}
 #endif
 
+#ifdef HAVE_EPOLL
+		if (agent->method == EPOLL)
+		{
+			if (!(agent->epollevents = mem_create(POLL_SIZE, struct epoll_event)))
+				return -1;
+		}
+#endif
+
 		if (!(agent->reactions = mem_create(POLL_SIZE, reaction_t)))
 			return -1;
 
 		memset(agent->reactions, 0, POLL_SIZE * sizeof(reaction_t));
 
-		if (agent->tempo)
-		{
-			if (!(agent->activity = mem_create(POLL_SIZE, activity_t)))
-				return -1;
-
-			memset(agent->activity, 0, POLL_SIZE * sizeof(activity_t));
-		}
-
 		agent->size = POLL_SIZE;
 	}
 	else if (agent->length == agent->size)
@@ -712,12 +989,20 @@ int agent_connect_unlocked(Agent *agent, int fd, int events, agent_reaction_t *r
 		}
 #endif
 
+#ifdef HAVE_EPOLL
+		if (agent->method == EPOLL)
+		{
+			if (!mem_resize(&agent->epollevents, agent->size << 1))
+				return -1;
+		}
+#endif
+
 		if (!mem_resize(&agent->reactions, agent->size << 1))
 			return -1;
 
 		memset(agent->reactions + agent->size, 0, agent->size * sizeof(reaction_t));
 
-		if (agent->tempo)
+		if (agent->activity)
 		{
 			if (!mem_resize(&agent->activity, agent->size << 1))
 				return -1;
@@ -728,6 +1013,53 @@ int agent_connect_unlocked(Agent *agent, int fd, int events, agent_reaction_t *r
 		agent->size <<= 1;
 	}
 
+#ifdef HAVE_EPOLL
+	/* Add fd to the epoll set, or modify it if already connected */
+
+	if (agent->method == EPOLL)
+	{
+		struct epoll_event event[1];
+		ssize_t id = agent->ids[fd];
+		int op = (id == -1) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+
+		memset(event, 0, sizeof(struct epoll_event));
+		event->data.fd = fd;
+
+		if (events & R_OK)
+			event->events |= EPOLLIN;
+
+		if (events & X_OK)
+			event->events |= EPOLLPRI;
+
+		if (events & W_OK)
+			event->events |= EPOLLOUT;
+
+		if (events & AGENT_EDGE)
+			event->events |= EPOLLET;
+
+		if (events & AGENT_ONESHOT)
+			event->events |= EPOLLONESHOT;
+
+#ifdef EPOLLEXCLUSIVE
+		if (events & AGENT_EXCLUSIVE)
+			event->events |= EPOLLEXCLUSIVE;
+
+		/* EPOLLEXCLUSIVE can only be set (or cleared) when adding */
+
+		if (id != -1 && ((events | agent->reactions[id].events) & AGENT_EXCLUSIVE))
+		{
+			if (epoll_ctl(agent->epollfd, EPOLL_CTL_DEL, fd, NULL) == -1)
+				return -1;
+
+			op = EPOLL_CTL_ADD;
+		}
+#endif
+
+		if (epoll_ctl(agent->epollfd, op, fd, event) == -1)
+			return -1;
+	}
+#endif
+
 	/* Claim a new pollfd structure if not already connected */
 
 	if (agent->ids[fd] == -1)
@@ -753,7 +1085,17 @@ int agent_connect_unlocked(Agent *agent, int fd, int events, agent_reaction_t *r
 	}
 	else
 #endif
+	if (agent->method == SELECT)
 	{
+		if (agent->readfds)
+			FD_CLR(fd, agent->readfds);
+
+		if (agent->exceptfds)
+			FD_CLR(fd, agent->exceptfds);
+
+		if (agent->writefds)
+			FD_CLR(fd, agent->writefds);
+
 		if (events & R_OK && !agent->readfds)
 		{
 			if (!(agent->readfds = mem_new(fd_set)))
@@ -856,11 +1198,19 @@ int agent_disconnect_unlocked(Agent *agent, int fd)
 			return set_errno(EINVAL);
 	}
 	else
+#endif
+#ifdef HAVE_EPOLL
+	if (agent->method == EPOLL)
+	{
+		if (!agent->epollevents)
+			return set_errno(EINVAL);
+	}
+	else
 #endif
 		if (!agent->readfds && !agent->writefds && !agent->exceptfds)
 			return set_errno(EINVAL);
 
-	if (!agent->ids || !agent->reactions || (agent->tempo && !agent->activity) || agent->ids_size <= fd)
+	if (!agent->ids || !agent->reactions || agent->ids_size <= fd)
 		return set_errno(EINVAL);
 
 	/* Remove the agent from pollfds, reactions, activity and ids */
@@ -878,6 +1228,15 @@ int agent_disconnect_unlocked(Agent *agent, int fd)
 		memset(&agent->pollfds[last_id], 0, sizeof(struct pollfd));
 	}
 	else
+#endif
+#ifdef HAVE_EPOLL
+	if (agent->method == EPOLL)
+	{
+		/* Ignore errors: fd may have been closed (and removed) already */
+
+		epoll_ctl(agent->epollfd, EPOLL_CTL_DEL, fd, NULL);
+	}
+	else
 #endif
 	{
 		if (agent->readfds)
@@ -892,7 +1251,7 @@ int agent_disconnect_unlocked(Agent *agent, int fd)
 
 	agent->reactions[id] = agent->reactions[last_id];
 
-	if (agent->tempo)
+	if (agent->activity)
 		agent->activity[id] = agent->activity[last_id];
 
 	agent->ids[last_fd] = id;
@@ -900,7 +1259,7 @@ int agent_disconnect_unlocked(Agent *agent, int fd)
 
 	memset(&agent->reactions[last_id], 0, sizeof(reaction_t));
 
-	if (agent->tempo)
+	if (agent->activity)
 		memset(&agent->activity[last_id], 0, sizeof(activity_t));
 
 	agent->ids[fd] = -1;
@@ -968,7 +1327,7 @@ int agent_transfer_unlocked(Agent *agent, int fd, Agent *dst)
 
 	/* Check agent */
 
-	if (!agent->ids || !agent->reactions || !agent->tempo || !agent->activity || agent->ids_size <= fd)
+	if (!agent->ids || !agent->reactions || !agent->tempo || agent->ids_size <= fd)
 		return set_errno(EINVAL);
 
 	/* Check dst */
@@ -982,12 +1341,21 @@ int agent_transfer_unlocked(Agent *agent, int fd, Agent *dst)
 		return set_errno(EINVAL);
 
 	reaction = agent->reactions[id];
-	activity = agent->activity[id];
+	activity = *connection_activity(agent, id);
 
 	if (agent_connect(dst, reaction.fd, reaction.events, reaction.reaction, reaction.arg) == -1)
 		return -1;
 
-	dst->activity[dst->ids[fd]] = activity;
+	if (activity.detail)
+	{
+		if (activate(dst) == -1)
+		{
+			agent_disconnect(dst, fd);
+			return -1;
+		}
+
+		dst->activity[dst->ids[fd]] = activity;
+	}
 
 	if (agent_disconnect_unlocked(agent, fd) == -1)
 	{
@@ -1066,7 +1434,7 @@ int agent_send_unlocked(Agent *agent, int fd, int sockfd)
 
 	/* Check agent */
 
-	if (!agent->ids || !agent->reactions || !agent->tempo || !agent->activity || agent->ids_size <= fd)
+	if (!agent->ids || !agent->reactions || !agent->tempo || agent->ids_size <= fd)
 		return set_errno(EINVAL);
 
 	/* Transfer the connection and its activity data */
@@ -1075,7 +1443,7 @@ int agent_send_unlocked(Agent *agent, int fd, int sockfd)
 		return set_errno(EINVAL);
 
 	buf.reaction = agent->reactions[id];
-	buf.activity = agent->activity[id];
+	buf.activity = *connection_activity(agent, id);
 
 	if (sendfd(sockfd, &buf, sizeof buf, 0, fd) == -1)
 		return -1;
@@ -1163,7 +1531,13 @@ int agent_recv_unlocked(Agent *agent, int sockfd, agent_reaction_t *reaction, vo
 	if ((id = agent->ids[fd]) == -1)
 		return set_errno(EINVAL);
 
-	agent->activity[id] = buf.activity;
+	if (buf.activity.detail)
+	{
+		if (activate(agent) == -1)
+			return -1;
+
+		agent->activity[id] = buf.activity;
+	}
 
 	return 0;
 }
@@ -1237,7 +1611,7 @@ int agent_detail_unlocked(Agent *agent, int fd)
 
 	/* Check the agent */
 
-	if (!agent->ids || !agent->reactions || !agent->tempo || !agent->activity || agent->ids_size <= fd)
+	if (!agent->ids || !agent->reactions || !agent->tempo || agent->ids_size <= fd)
 		return set_errno(EINVAL);
 
 	/* Return the detail available for agent if fd is -1 */
@@ -1250,7 +1624,7 @@ int agent_detail_unlocked(Agent *agent, int fd)
 	if ((id = agent->ids[fd]) == -1)
 		return set_errno(EINVAL);
 
-	return agent->activity[id].detail;
+	return connection_activity(agent, id)->detail;
 }
 
 /*
@@ -1308,7 +1682,7 @@ const struct timeval * const agent_last_unlocked(Agent *agent, int fd)
 
 	/* Check the agent */
 
-	if (!agent->ids || !agent->reactions || !agent->tempo || !agent->activity || agent->ids_size <= fd)
+	if (!agent->ids || !agent->reactions || !agent->tempo || agent->ids_size <= fd)
 		return set_errnull(EINVAL);
 
 	/* Return the time of the last event handled by agent if fd is -1 */
@@ -1326,7 +1700,7 @@ const struct timeval * const agent_last_unlocked(Agent *agent, int fd)
 	if ((id = agent->ids[fd]) == -1)
 		return set_errnull(EINVAL);
 
-	if (agent->activity[id].detail == 0)
+	if (connection_activity(agent, id)->detail == 0)
 		return set_errnull(EINVAL);
 
 	return &agent->activity[id].since;
@@ -1387,7 +1761,7 @@ int agent_velocity_unlocked(Agent *agent, int fd)
 
 	/* Check the agent */
 
-	if (!agent->ids || !agent->reactions || !agent->tempo || !agent->activity || agent->ids_size <= fd)
+	if (!agent->ids || !agent->reactions || !agent->tempo || agent->ids_size <= fd)
 		return set_errno(EINVAL);
 
 	/* Return agent's velocity if fd is -1 */
@@ -1405,7 +1779,7 @@ int agent_velocity_unlocked(Agent *agent, int fd)
 	if ((id = agent->ids[fd]) == -1)
 		return set_errno(EINVAL);
 
-	if (agent->activity[id].detail < 2)
+	if (connection_activity(agent, id)->detail < 2)
 		return set_errno(EINVAL);
 
 	return agent->activity[id].dt;
@@ -1469,7 +1843,7 @@ int agent_acceleration_unlocked(Agent *agent, int fd)
 
 	/* Check the agent */
 
-	if (!agent->ids || !agent->reactions || !agent->tempo || !agent->activity || agent->ids_size <= fd)
+	if (!agent->ids || !agent->reactions || !agent->tempo || agent->ids_size <= fd)
 		return set_errno(EINVAL);
 
 	/* Return agent's acceleration if fd is -1 */
@@ -1487,7 +1861,7 @@ int agent_acceleration_unlocked(Agent *agent, int fd)
 	if ((id = agent->ids[fd]) == -1)
 		return set_errno(EINVAL);
 
-	if (agent->activity[id].detail < 3)
+	if (connection_activity(agent, id)->detail < 3)
 		return set_errno(EINVAL);
 
 	return agent->activity[id].ddt;
@@ -1552,7 +1926,7 @@ int agent_dadt_unlocked(Agent *agent, int fd)
 
 	/* Check the agent */
 
-	if (!agent->ids || !agent->reactions || !agent->tempo || !agent->activity || agent->ids_size <= fd)
+	if (!agent->ids || !agent->reactions || !agent->tempo || agent->ids_size <= fd)
 		return set_errno(EINVAL);
 
 	/* Return agent's dadt if fd is -1 */
@@ -1570,7 +1944,7 @@ int agent_dadt_unlocked(Agent *agent, int fd)
 	if ((id = agent->ids[fd]) == -1)
 		return set_errno(EINVAL);
 
-	if (agent->activity[id].detail < 4)
+	if (connection_activity(agent, id)->detail < 4)
 		return set_errno(EINVAL);
 
 	return agent->activity[id].dddt;
@@ -1645,48 +2019,79 @@ static void timeval_set(timeval *tv, long tv_sec, long tv_usec)
 	tv->tv_usec = tv_usec;
 }
 
+static long usec_between(timeval *start, timeval *end)
+{
+	timeval delta[1];
+
+	if (timercmp(end, start, < ))
+		return 0;
+
+	timeval_diff(start, end, delta);
+
+	return delta->tv_sec * 1000000 + delta->tv_usec;
+}
+
+static long usec_since(timeval *start)
+{
+	timeval now[1];
+
+	if (gettimeofday(now, NULL) == -1)
+		return 0;
+
+	return usec_between(start, now);
+}
+
+static void tally(unsigned long *histogram, long value)
+{
+	int bucket = 0;
+
+	/* Bucket i counts values from 2^(i-1) to 2^i - 1 (and the last, any more) */
+
+	while (value > 0 && bucket < AGENT_STATS_BUCKETS - 1)
+		value >>= 1, ++bucket;
+
+	++histogram[bucket];
+}
+
 static void install(action_t **parent, action_t *action)
 {
 	*parent = dlink_insert(*parent, action);
 	action->parent = parent;
 }
 
-void *agent_schedule_unlocked(Agent *agent, long sec, long usec, agent_action_t *action, void *arg)
+static void uninstall(action_t *action)
 {
-	action_t *event;
-	timeval now[1], delta[1], when[1];
-
-	if (!agent || sec < 0 || usec < 0 || !action)
-		return set_errnull(EINVAL);
-
-	/* Create the timewheel if necessary */
+	action_t *next = dlink_remove(action);
 
-	if (!agent->timewheel && !(agent->timewheel = timewheel_create()))
-		return NULL;
+	if (*action->parent == action)
+		*action->parent = next;
+}
 
+static int timewheel_now(timewheel_t *timewheel, timeval *now)
+{
 	/* Get the current time and adjust if it's gone backwards */
 
 	if (gettimeofday(now, NULL) == -1)
-		return NULL;
+		return -1;
 
-	if (timercmp(now, agent->timewheel->now, < ))
-		*agent->timewheel->now = *now;
+	if (timercmp(now, timewheel->now, < ))
+		*timewheel->now = *now;
 
-	/* Create the action */
+	return 0;
+}
 
-	if (!(event = mem_new(action_t))) /* XXX decouple */
-		return NULL;
+static void arrange(timewheel_t *timewheel, action_t *event, timeval *now, long sec, long usec)
+{
+	timeval delta[1], when[1];
 
 	timeval_set(delta, sec, usec);
 	timeval_add(now, delta, when);
 
 	event->when = *when;
-	event->action = action;
-	event->arg = arg;
 
 	/* Schedule the action */
 
-	timeval_diff(agent->timewheel->now, when, delta);
+	timeval_diff(timewheel->now, when, delta);
 
 	event->day = delta->tv_sec / (HOURS * MINUTES * SECONDS);
 	delta->tv_sec -= event->day * HOURS * MINUTES * SECONDS;
@@ -1701,31 +2106,59 @@ void *agent_schedule_unlocked(Agent *agent, long sec, long usec, agent_action_t
 
 	event->jiffy = delta->tv_usec / 10000;
 
-	if ((event->jiffy += agent->timewheel->jiffy) >= JIFFIES)
+	if ((event->jiffy += timewheel->jiffy) >= JIFFIES)
 		event->jiffy -= JIFFIES, ++event->second;
 
-	if ((event->second += agent->timewheel->second) >= SECONDS)
+	if ((event->second += timewheel->second) >= SECONDS)
 		event->second -= SECONDS, ++event->minute;
 
-	if ((event->minute += agent->timewheel->minute) >= MINUTES)
+	if ((event->minute += timewheel->minute) >= MINUTES)
 		event->minute -= MINUTES, ++event->hour;
 
-	if ((event->hour += agent->timewheel->hour) >= HOURS)
+	if ((event->hour += timewheel->hour) >= HOURS)
 		event->hour -= HOURS, ++event->day;
 
-	event->day += agent->timewheel->day;
+	event->day += timewheel->day;
 
-	if (event->day != agent->timewheel->day)
-		install(&agent->timewheel->days[event->day % DAYS], event);
-	else if (event->hour != agent->timewheel->hour)
-		install(&agent->timewheel->hours[event->hour], event);
-	else if (event->minute != agent->timewheel->minute)
-		install(&agent->timewheel->minutes[event->minute], event);
-	else if (event->second != agent->timewheel->second)
-		install(&agent->timewheel->seconds[event->second], event);
+	if (event->day != timewheel->day)
+		install(&timewheel->days[event->day % DAYS], event);
+	else if (event->hour != timewheel->hour)
+		install(&timewheel->hours[event->hour], event);
+	else if (event->minute != timewheel->minute)
+		install(&timewheel->minutes[event->minute], event);
+	else if (event->second != timewheel->second)
+		install(&timewheel->seconds[event->second], event);
 	else
-		install(&agent->timewheel->jiffies[event->jiffy], event);
+		install(&timewheel->jiffies[event->jiffy], event);
+}
 
+void *agent_schedule_unlocked(Agent *agent, long sec, long usec, agent_action_t *action, void *arg)
+{
+	action_t *event;
+	timeval now[1];
+
+	if (!agent || sec < 0 || usec < 0 || !action)
+		return set_errnull(EINVAL);
+
+	/* Create the timewheel if necessary */
+
+	if (!agent->timewheel && !(agent->timewheel = timewheel_create()))
+		return NULL;
+
+	if (timewheel_now(agent->timewheel, now) == -1)
+		return NULL;
+
+	/* Create the action */
+
+	if (!(event = action_create(agent->timewheel)))
+		return NULL;
+
+	event->action = action;
+	event->arg = arg;
+
+	/* Schedule the action */
+
+	arrange(agent->timewheel, event, now, sec, usec);
 	++agent->timers;
 
 	return event;
@@ -1733,13 +2166,79 @@ void *agent_schedule_unlocked(Agent *agent, long sec, long usec, agent_action_t
 
 /*
 
+=item C<int agent_reschedule(Agent *agent, void *action_id, long sec, long usec)>
+
+Reschedule the action, C<action_id>, that was scheduled with
+I<agent_schedule(3)>, so that it will be invoked in C<sec> seconds and
+C<usec> microseconds from now instead. The action's function and argument
+are unchanged. This is equivalent to, but cheaper than, calling
+I<agent_cancel(3)> followed by I<agent_schedule(3)> and the action identifier
+remains valid. It is useful for idle timeouts that are pushed back whenever
+there is activity. As with I<agent_cancel(3)>, it is the caller's
+responsibility to ensure that C<action_id> corresponds to an action that has
+not yet executed. On success, returns C<0>. On error, returns C<-1> with
+C<errno> set appropriately.
+
+=cut
+
+*/
+
+int agent_reschedule(Agent *agent, void *action_id, long sec, long usec)
+{
+	int ret, err;
+
+	if (!agent)
+		return set_errno(EINVAL);
+
+	if ((err = agent_wrlock(agent)))
+		return set_errno(err);
+
+	ret = agent_reschedule_unlocked(agent, action_id, sec, usec);
+
+	if ((err = agent_unlock(agent)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int agent_reschedule_unlocked(Agent *agent, void *action_id, long sec, long usec)>
+
+Equivalent to I<agent_reschedule(3)> except that C<agent> is not
+write-locked.
+
+=cut
+
+*/
+
+int agent_reschedule_unlocked(Agent *agent, void *action_id, long sec, long usec)
+{
+	action_t *event = action_id;
+	timeval now[1];
+
+	if (!agent || !event || sec < 0 || usec < 0 || !agent->timewheel || !agent->timers)
+		return set_errno(EINVAL);
+
+	if (timewheel_now(agent->timewheel, now) == -1)
+		return -1;
+
+	uninstall(event);
+	arrange(agent->timewheel, event, now, sec, usec);
+
+	return 0;
+}
+
+/*
+
 =item C<int agent_cancel(Agent *agent, void *action_id)>
 
 Cancel an action that was scheduled with I<agent_schedule(3)>. C<action_id>
 is the value returned by I<agent_schedule(3)>. It is the caller's
 responsibility to ensure that this function is not passed an C<action_id>
 that corresponds to an action that has already executed (since the action
-will have been deallocated). On success, returns C<0>. On error, returns
+will have been returned to the agent's pool of actions and may have been
+reused). On success, returns C<0>. On error, returns
 C<-1> with C<errno> set appropriately.
 
 =cut
@@ -1777,17 +2276,12 @@ Equivalent to I<agent_cancel(3)> except that C<agent> is not write-locked.
 int agent_cancel_unlocked(Agent *agent, void *action_id)
 {
 	action_t *event = action_id;
-	action_t *next;
 
 	if (!agent || !event || !agent->timewheel || !agent->timers)
 		return set_errno(EINVAL);
 
-	next = dlink_remove(event);
-
-	if (*event->parent == event)
-		*event->parent = next;
-
-	mem_release(event);
+	uninstall(event);
+	action_release(agent->timewheel, event);
 
 	--agent->timers;
 
@@ -1897,6 +2391,8 @@ static void next_minute(Agent *agent)
 static void next_second(Agent *agent)
 {
 	action_t *next, *action;
+	timeval start[1];
+	int timed = agent->stats && gettimeofday(start, NULL) != -1;
 
 	/* Install timers for the next second into jiffies array */
 
@@ -1913,6 +2409,9 @@ static void next_second(Agent *agent)
 		next = dlink_remove(action);
 		install(&agent->timewheel->jiffies[action->jiffy], action);
 	}
+
+	if (timed && agent->stats)
+		tally(agent->stats->cascade, usec_since(start));
 }
 
 static int timeout(Agent *agent)
@@ -1933,10 +2432,15 @@ static int timeout(Agent *agent)
 	return (i - agent->timewheel->jiffy) * 10;
 }
 
-static int act(agent_action_t *action, Agent *agent, void *arg)
+static int act(agent_action_t *action, Agent *agent, void *arg, timeval *when)
 {
+	timeval start[1];
+	int timed = agent->stats && gettimeofday(start, NULL) != -1;
 	int err, ret;
 
+	if (timed)
+		tally(agent->stats->lateness, usec_between(when, start));
+
 	if ((err = agent_unlock(agent)))
 		return set_errno(err);
 
@@ -1945,11 +2449,18 @@ static int act(agent_action_t *action, Agent *agent, void *arg)
 	if ((err = agent_wrlock(agent)))
 		return set_errno(err);
 
+	/* Statistics may have been disabled by the action */
+
+	if (timed && agent->stats)
+		tally(agent->stats->action, usec_since(start));
+
 	return ret;
 }
 
 static int react(agent_reaction_t *reaction, Agent *agent, int fd, int revents, void *arg)
 {
+	timeval start[1];
+	int timed = agent->stats && gettimeofday(start, NULL) != -1;
 	int err, ret;
 
 	if ((err = agent_unlock(agent)))
@@ -1960,6 +2471,21 @@ static int react(agent_reaction_t *reaction, Agent *agent, int fd, int revents,
 	if ((err = agent_wrlock(agent)))
 		return set_errno(err);
 
+	/* Statistics may have been disabled by the reaction */
+
+	if (timed && agent->stats)
+	{
+		long usec = usec_since(start);
+
+		tally(agent->stats->reaction, usec);
+
+		if (usec > agent->stats->slowest_reaction)
+		{
+			agent->stats->slowest_reaction = usec;
+			agent->stats->slowest_fd = fd;
+		}
+	}
+
 	return ret;
 }
 
@@ -1971,11 +2497,12 @@ static int expire(Agent *agent)
 	{
 		agent_action_t *action = event->action;
 		void *arg = event->arg;
+		timeval when = event->when;
 
 		if (agent_cancel_unlocked(agent, event) == -1)
 			return -1;
 
-		if (act(action, agent, arg) == -1)
+		if (act(action, agent, arg, &when) == -1)
 			return -1;
 	}
 
@@ -2023,14 +2550,11 @@ static int update(Agent *agent)
 	return 0;
 }
 
-static void measure(Agent *agent, int fd, timeval *now)
+static void measure(activity_t *activity, timeval *now)
 {
-	activity_t *activity;
 	timeval delta[1];
 	int msec, prev_dt, prev_ddt;
 
-	activity = (fd == -1) ? agent->tempo : &agent->activity[agent->ids[fd]];
-
 	switch (activity->detail)
 	{
 		case 0:
@@ -2087,6 +2611,34 @@ static int translate(int revents)
 	return ret;
 }
 
+#ifdef HAVE_EPOLL
+static int translate_epoll(uint32_t events)
+{
+	int ret = 0;
+
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		ret |= R_OK;
+
+	if (events & EPOLLPRI)
+		ret |= X_OK;
+
+	if (events & EPOLLOUT)
+		ret |= W_OK;
+
+	return ret;
+}
+#endif
+
+static void waited(Agent *agent, timeval *start, int nfds)
+{
+	if (!agent->stats)
+		return;
+
+	++agent->stats->turns;
+	tally(agent->stats->wait, usec_since(start));
+	tally(agent->stats->events, nfds);
+}
+
 #ifdef HAVE_LINUX_POLL_BUG
 #define tune(timo) (((timo) > 10) ? (timo) - 10 : (timo))
 #else
@@ -2109,6 +2661,7 @@ static int agent_start_unlocked(Agent *agent)
 
 	while ((agent->length || agent->timers) && agent->state != STOP)
 	{
+		timeval waiting[1];
 		int nfds, timo;
 		size_t i;
 
@@ -2116,6 +2669,9 @@ static int agent_start_unlocked(Agent *agent)
 
 		timo = timeout(agent);
 
+		if (agent->stats && gettimeofday(waiting, NULL) == -1)
+			return -1;
+
 #if HAVE_POLL
 		if (agent->method == POLL)
 		{
@@ -2133,6 +2689,8 @@ static int agent_start_unlocked(Agent *agent)
 				return -1;
 			}
 
+			waited(agent, waiting, nfds);
+
 			if (nfds) /* React to I/O events */
 			{
 				timeval now[1];
@@ -2141,23 +2699,31 @@ static int agent_start_unlocked(Agent *agent)
 					return -1;
 
 				if (agent->tempo)
-					measure(agent, -1, now);
+				{
+					if (activate(agent) == -1)
+						return -1;
+
+					measure(agent->tempo, now);
+				}
 
 				for (i = 0; nfds && i < agent->length; ++i)
 				{
 					if (agent->pollfds[i].revents)
 					{
-						agent_reaction_t *reaction = agent->reactions[i].reaction;
-						int fd = agent->reactions[i].fd;
+						reaction_t reaction = agent->reactions[i];
 						int revents = translate(agent->pollfds[i].revents);
-						void *arg = agent->reactions[i].arg;
 
 						agent->pollfds[i].revents = 0;
 
+						/* Disarm one-shot connections until reconnected */
+
+						if (reaction.events & AGENT_ONESHOT)
+							agent->pollfds[i].fd = -1;
+
 						if (agent->tempo)
-							measure(agent, fd, now);
+							measure(&agent->activity[i], now);
 
-						if (react(reaction, agent, fd, revents, arg) == -1)
+						if (react(reaction.reaction, agent, reaction.fd, revents, reaction.arg) == -1)
 							return -1;
 
 						--nfds;
@@ -2180,6 +2746,74 @@ static int agent_start_unlocked(Agent *agent)
 			}
 		}
 		else
+#endif
+#ifdef HAVE_EPOLL
+		if (agent->method == EPOLL)
+		{
+			struct epoll_event dummy;
+
+			if ((nfds = epoll_wait(agent->epollfd, agent->epollevents ? agent->epollevents : &dummy, agent->length ? agent->length : 1, timo)) == -1)
+			{
+				if (errno == EINTR)
+					agent->state = IDLE;
+
+				return -1;
+			}
+
+			waited(agent, waiting, nfds);
+
+			if (nfds) /* React to I/O events */
+			{
+				timeval now[1];
+
+				if (gettimeofday(now, NULL) == -1)
+					return -1;
+
+				if (agent->tempo)
+				{
+					if (activate(agent) == -1)
+						return -1;
+
+					measure(agent->tempo, now);
+				}
+
+				for (i = 0; i < nfds; ++i)
+				{
+					int fd = agent->epollevents[i].data.fd;
+					int revents = translate_epoll(agent->epollevents[i].events);
+					reaction_t reaction;
+					ssize_t id;
+
+					/* Skip connections dropped by an earlier reaction */
+
+					if (fd >= agent->ids_size || (id = agent->ids[fd]) == -1)
+						continue;
+
+					reaction = agent->reactions[id];
+
+					if (agent->tempo)
+						measure(&agent->activity[id], now);
+
+					if (react(reaction.reaction, agent, fd, revents, reaction.arg) == -1)
+						return -1;
+				}
+			}
+			else /* Perform scheduled actions */
+			{
+				timeval delta[1], result[1];
+
+				timeval_set(delta, 0, timo * 1000);
+				timeval_add(agent->timewheel->now, delta, result);
+				*agent->timewheel->now = *result;
+
+				if ((agent->timewheel->jiffy += timo / 10) == JIFFIES)
+					next_second(agent);
+
+				if (expire(agent) == -1)
+					return -1;
+			}
+		}
+		else
 #endif
 		{
 			timeval tv[1], *to;
@@ -2208,6 +2842,8 @@ static int agent_start_unlocked(Agent *agent)
 			if ((nfds = select(agent->ids_size, rfds, wfds, xfds, to)) == -1)
 				return -1;
 
+			waited(agent, waiting, nfds);
+
 			if (nfds) /* React to I/O events */
 			{
 				timeval now[1];
@@ -2216,7 +2852,12 @@ static int agent_start_unlocked(Agent *agent)
 					return -1;
 
 				if (agent->tempo)
-					measure(agent, -1, now);
+				{
+					if (activate(agent) == -1)
+						return -1;
+
+					measure(agent->tempo, now);
+				}
 
 				for (i = 0; nfds && i < agent->length; ++i)
 				{
@@ -2234,13 +2875,26 @@ static int agent_start_unlocked(Agent *agent)
 
 					if (revents)
 					{
-						agent_reaction_t *reaction = agent->reactions[i].reaction;
-						void *arg = agent->reactions[i].arg;
+						reaction_t reaction = agent->reactions[i];
+
+						/* Disarm one-shot connections until reconnected */
+
+						if (reaction.events & AGENT_ONESHOT)
+						{
+							if (agent->readfds)
+								FD_CLR(fd, agent->readfds);
+
+							if (agent->writefds)
+								FD_CLR(fd, agent->writefds);
+
+							if (agent->exceptfds)
+								FD_CLR(fd, agent->exceptfds);
+						}
 
 						if (agent->tempo)
-							measure(agent, fd, now);
+							measure(&agent->activity[i], now);
 
-						if (react(reaction, agent, fd, revents, arg) == -1)
+						if (react(reaction.reaction, agent, fd, revents, reaction.arg) == -1)
 							return -1;
 
 						--nfds;
@@ -2338,95 +2992,700 @@ int agent_stop(Agent *agent)
 
 /*
 
-=back
+=item C<int agent_spawn(Agent *agent, size_t stacksize, agent_task_t *task, void *arg)>
+
+Creates a new task (a coroutine with its own stack of C<stacksize> bytes, or
+64KiB if C<stacksize> is zero) that will call C<task> with C<agent> and
+C<arg> as arguments when C<agent> is next running. Tasks let protocol code
+be written sequentially rather than as a state machine spread across
+reactions. A task runs in the thread that is running C<agent> until it calls
+I<agent_sleep(3)>, I<agent_await_readable(3)>, I<agent_await_writable(3)>,
+I<agent_read(3)> or I<agent_write(3)>. These suspend the task, and let
+C<agent> run other tasks, actions and reactions, until the task can
+continue. When C<task> returns, its stack is kept for reuse by a later task
+with the same C<stacksize>. If C<task> returns C<-1>, I<agent_start(3)>
+returns C<-1> as it would for an action or reaction. On success, returns
+C<0>. On error, returns C<-1> with C<errno> set appropriately (C<ENOSYS> if
+this system does not support tasks).
 
-=head1 ERRORS
+=cut
 
-On error, C<errno> is set either by an underlying function, or as follows:
+*/
 
-=over 4
+#ifdef HAVE_UCONTEXT
+static void task_main(unsigned int hi, unsigned int lo)
+{
+	/* The task pointer is split in two because makecontext() takes int arguments */
 
-=item C<EINVAL>
+	task_t *task = (task_t *)(((unsigned long)hi << 16 << 16) | (unsigned long)lo);
 
-When arguments to any of the functions is invalid.
+	task->result = task->task(task->agent, task->arg);
+	task->done = 1;
+	setcontext(task->caller);
+}
 
-When I<agent_start(3)> is called on an agent that isn't idle.
+static int resume(task_t *task)
+{
+	Agent *agent = task->agent;
+	task_t *prev = agent->task;
+	int ret, err;
 
-When I<agent_stop(3)> is called on an agent that isn't started.
+	agent->task = task;
+	ret = swapcontext(task->caller, task->context);
+	agent->task = prev;
 
-=back
+	if (ret == -1 || !task->done)
+		return ret;
 
-=head1 MT-Level
+	/* The task has returned, so its stack can be reused */
 
-I<MT-Disciplined>
+	if ((err = agent_wrlock(agent)))
+		return set_errno(err);
 
-=head1 SCALABILITY
+	task->nextidle = agent->idle;
+	agent->idle = task;
 
-There are two aspects to the scalability of agents: scalability with respect
-to the number of scheduled actions, and scalability with respect to the
-number of connected file descriptors.
+	if ((err = agent_unlock(agent)))
+		return set_errno(err);
 
-The timers for scheduled actions are multiplexed over the timeout facility
-provided by I<poll(2)> using a state of the art data structure for timing
-facilities (hierarchical timing wheels) which guarantees constant time to
-start and stop timers and constant average time to maintain timers so that
-thousands of timers may be outstanding without performance penalty.
+	return task->result;
+}
 
-Adding and removing connected file descriptors take constant time but
-maintaining them is I<O(n)> where I<n> is the number of connected file
-descriptors. That wouldn't be a problem if all of the file descriptors were
-active since work would have to be done reacting to all the events anyway,
-but if only a few file descriptors are active, both the kernel and the
-application waste significant effort examining the elements of the C<pollfd>
-array that correspond to the inactive file descriptors. Over a WAN such as
-the internet, inactive file descriptors typically far outnumber active file
-descriptors since many connections can be waiting for lost packets to be
-retransmitted.
+static int suspend(task_t *task)
+{
+	if (swapcontext(task->context, task->caller) == -1)
+		return -1;
 
-To implement a portable internet service that scales well with respect to
-the number of inactive file descriptors, use two agents, each running in its
-own thread. The first only deals with active file descriptors. The second
-only deals with inactive file descriptors. These agents swap file
-descriptors between themselves as their activity changes. Agents can measure
-the activity of each file descriptor to facilitate this. The result is one
-thread being woken up frequently but only dealing with a small number of
-active file descriptors each time, and another thread being woken up
-infrequently and dealing with a large number of file descriptors each time.
-The second thread still wastes effort but it does so less often. Credit goes
-to Richard Gooch for this I<"fast/slow lane"> approach. To reduce overhead
-further, more agents could be created to deal with the inactive file
-descriptors (multiple slow lanes) but it's unlikely to be worthwhile on
-hosts with a single processor. Note that one process can pass an open file
-descriptor to another process, so these agents could exist in separate
-processes but it's not as fast.
+	return (task->timedout) ? set_errno(ETIMEDOUT) : 0;
+}
 
-The simpler, traditional approach is to just have multiple pre-forked
-servers, each I<accept(2)>ing connections. The set of connections will then
-be split between the servers. Experiments indicate that the connections are
-split evenly between the servers, but if the active connections are split
-between multiple servers, then the context switching overhead of multiple
-threads waking up could outweigh the savings gained by splitting up the
-connections into smaller sets. In the worst case, all of the threads might
-be woken up at the same time, resulting in the entire set of connections
-being processed. This is precisely the problem we are trying to avoid, but
-we've added context switching overhead as well. Another thing to note is
-that since this method is usually implemented with I<select(3)>, rather than
-I<poll(2)>, the effort wasted is far greater. Consider 1000 connections
-split between 10 pre-forked servers using I<select(3)>. Assume for
-simplicity that the first 100 connections are handled by the first server,
-the next 100 connections are handled by the second server, and so on. Due to
-the fact that I<select(2)> uses bitsets to record the file descriptors of
-interest, and has to check every bit up to the one corresponding to the
-highest numbered file descriptor, the total number of bits checked would be
-1000 + 900 + 800 + 700 + 600 + 500 + 400 + 300 + 200 + 100 = 5500. In the
-worst case it would be 1000 + 999 + 998 + 997 + 996 + 995 + 994 + 993 + 992
-+ 991 = 9955. That's an order of magnitude more work than the obvious
-single-threaded approach.
+static int launch(Agent *agent, void *arg)
+{
+	return resume((task_t *)arg);
+}
+#endif
 
-=cut
+int agent_spawn(Agent *agent, size_t stacksize, agent_task_t *task, void *arg)
+{
+	int ret, err;
 
-XXX Add throughput/timing results for: single thread select/poll, multiple
-thread select/poll, fast/slow lane
+	if (!agent)
+		return set_errno(EINVAL);
+
+	if ((err = agent_wrlock(agent)))
+		return set_errno(err);
+
+	ret = agent_spawn_unlocked(agent, stacksize, task, arg);
+
+	if ((err = agent_unlock(agent)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int agent_spawn_unlocked(Agent *agent, size_t stacksize, agent_task_t *task, void *arg)>
+
+Equivalent to I<agent_spawn(3)> except that C<agent> is not write-locked.
+
+=cut
+
+*/
+
+int agent_spawn_unlocked(Agent *agent, size_t stacksize, agent_task_t *task, void *arg)
+{
+#ifdef HAVE_UCONTEXT
+	task_t *t, **prev;
+	unsigned long addr;
+
+	if (!agent || !task)
+		return set_errno(EINVAL);
+
+	if (!stacksize)
+		stacksize = TASK_STACK;
+
+	/* Reuse an idle task's stack if possible, otherwise allocate a new one */
+
+	for (prev = &agent->idle; *prev && (*prev)->stacksize != stacksize; prev = &(*prev)->nextidle)
+		;
+
+	if ((t = *prev))
+		*prev = t->nextidle;
+	else
+	{
+		if (!(t = mem_new(task_t)))
+			return -1;
+
+		if (!(t->stack = mem_create(stacksize, char)))
+		{
+			mem_release(t);
+			return -1;
+		}
+
+		t->stacksize = stacksize;
+		t->next = agent->tasks;
+		agent->tasks = t;
+	}
+
+	t->nextidle = NULL;
+	t->agent = agent;
+	t->task = task;
+	t->arg = arg;
+	t->action_id = NULL;
+	t->fd = -1;
+	t->timedout = 0;
+	t->done = 0;
+	t->result = 0;
+
+	if (getcontext(t->context) == -1)
+		goto failed;
+
+	t->context->uc_stack.ss_sp = t->stack;
+	t->context->uc_stack.ss_size = t->stacksize;
+	t->context->uc_link = NULL;
+	addr = (unsigned long)t;
+	makecontext(t->context, (void (*)(void))task_main, 2, (unsigned int)(addr >> 16 >> 16), (unsigned int)(addr & 0xffffffff));
+
+	/* Start the task in the thread that runs the agent */
+
+	if (!agent_schedule_unlocked(agent, 0, 0, launch, t))
+		goto failed;
+
+	return 0;
+
+failed:
+	t->nextidle = agent->idle;
+	agent->idle = t;
+
+	return -1;
+#else
+	if (!agent || !task)
+		return set_errno(EINVAL);
+
+	return set_errno(ENOSYS);
+#endif
+}
+
+#ifdef HAVE_UCONTEXT
+static int awoken(Agent *agent, int fd, int revents, void *arg)
+{
+	task_t *task = arg;
+
+	if (agent_disconnect(agent, fd) == -1)
+		return -1;
+
+	if (task->action_id && agent_cancel(agent, task->action_id) == -1)
+		return -1;
+
+	task->action_id = NULL;
+	task->fd = -1;
+
+	return resume(task);
+}
+
+static int expired(Agent *agent, void *arg)
+{
+	task_t *task = arg;
+
+	/* The action has been released by the agent before calling this */
+
+	task->action_id = NULL;
+	task->timedout = 1;
+
+	if (task->fd != -1 && agent_disconnect(agent, task->fd) == -1)
+		return -1;
+
+	task->fd = -1;
+
+	return resume(task);
+}
+
+static int await(Agent *agent, int fd, int events, long sec, long usec)
+{
+	task_t *task;
+	int err;
+
+	if (!agent || (fd < 0 && sec < 0) || usec < 0)
+		return set_errno(EINVAL);
+
+	/* Only tasks can wait without blocking the agent */
+
+	if (!(task = agent->task))
+		return set_errno(EINVAL);
+
+	if ((err = agent_wrlock(agent)))
+		return set_errno(err);
+
+	if (fd >= 0 && fd < agent->ids_size && agent->ids[fd] != -1)
+	{
+		agent_unlock(agent);
+		return set_errno(EBUSY);
+	}
+
+	task->timedout = 0;
+	task->fd = -1;
+
+	if (fd >= 0 && agent_connect_unlocked(agent, fd, events, awoken, task) == -1)
+	{
+		agent_unlock(agent);
+		return -1;
+	}
+
+	task->fd = fd;
+
+	if (sec >= 0 && !(task->action_id = agent_schedule_unlocked(agent, sec, usec, expired, task)))
+	{
+		err = errno;
+
+		if (fd >= 0)
+			agent_disconnect_unlocked(agent, fd);
+
+		agent_unlock(agent);
+		return set_errno(err);
+	}
+
+	if ((err = agent_unlock(agent)))
+		return set_errno(err);
+
+	return suspend(task);
+}
+#endif
+
+/*
+
+=item C<int agent_sleep(Agent *agent, long sec, long usec)>
+
+Suspends the current task for C<sec> seconds and C<usec> microseconds. While
+it sleeps, C<agent> runs other tasks, actions and reactions. This must only
+be called from within a task (see I<agent_spawn(3)>). On success, returns
+C<0>. On error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int agent_sleep(Agent *agent, long sec, long usec)
+{
+#ifdef HAVE_UCONTEXT
+	if (sec < 0)
+		return set_errno(EINVAL);
+
+	if (await(agent, -1, 0, sec, usec) == -1 && errno != ETIMEDOUT)
+		return -1;
+
+	return 0;
+#else
+	return set_errno(EINVAL);
+#endif
+}
+
+/*
+
+=item C<int agent_await_readable(Agent *agent, int fd, long sec, long usec)>
+
+Suspends the current task until C<fd> is readable (or has out of band data),
+or until C<sec> seconds and C<usec> microseconds have passed. If C<sec> is
+negative, there is no timeout. While the task waits, C<fd> is connected to
+C<agent>, so it must not already be connected to C<agent>. This must only be
+called from within a task (see I<agent_spawn(3)>). It is the task equivalent
+of I<read_timeout(3)>. On success, returns C<0>. On error, returns C<-1>
+with C<errno> set appropriately (C<ETIMEDOUT> if it timed out, C<EBUSY> if
+C<fd> is already connected).
+
+=cut
+
+*/
+
+int agent_await_readable(Agent *agent, int fd, long sec, long usec)
+{
+#ifdef HAVE_UCONTEXT
+	if (fd < 0)
+		return set_errno(EINVAL);
+
+	return await(agent, fd, R_OK | X_OK, sec, usec);
+#else
+	return set_errno(EINVAL);
+#endif
+}
+
+/*
+
+=item C<int agent_await_writable(Agent *agent, int fd, long sec, long usec)>
+
+Equivalent to I<agent_await_readable(3)> except that the current task is
+suspended until C<fd> is writable. It is the task equivalent of
+I<write_timeout(3)>.
+
+=cut
+
+*/
+
+int agent_await_writable(Agent *agent, int fd, long sec, long usec)
+{
+#ifdef HAVE_UCONTEXT
+	if (fd < 0)
+		return set_errno(EINVAL);
+
+	return await(agent, fd, W_OK, sec, usec);
+#else
+	return set_errno(EINVAL);
+#endif
+}
+
+/*
+
+=item C<ssize_t agent_read(Agent *agent, int fd, long timeout, char *buf, size_t count)>
+
+Equivalent to I<net_read(3)> except that, instead of blocking, the current
+task is suspended (see I<agent_await_readable(3)>) whenever C<fd> isn't
+readable. If C<timeout> is negative, there is no timeout. This must only be
+called from within a task (see I<agent_spawn(3)>).
+
+=cut
+
+*/
+
+ssize_t agent_read(Agent *agent, int fd, long timeout, char *buf, size_t count)
+{
+	char *b;
+	ssize_t bytes;
+
+	for (b = buf; count; count -= bytes, b += bytes)
+	{
+		if (agent_await_readable(agent, fd, timeout, 0) == -1)
+			return -1;
+
+		if ((bytes = read(fd, b, count)) == -1)
+			return -1;
+
+		if (bytes == 0)
+			break;
+	}
+
+	return b - buf;
+}
+
+/*
+
+=item C<ssize_t agent_write(Agent *agent, int fd, long timeout, const char *buf, size_t count)>
+
+Equivalent to I<net_write(3)> except that, instead of blocking, the current
+task is suspended (see I<agent_await_writable(3)>) whenever C<fd> isn't
+writable. If C<timeout> is negative, there is no timeout. This must only be
+called from within a task (see I<agent_spawn(3)>).
+
+=cut
+
+*/
+
+ssize_t agent_write(Agent *agent, int fd, long timeout, const char *buf, size_t count)
+{
+	const char *b;
+	ssize_t bytes;
+
+	for (b = buf; count; count -= bytes, b += bytes)
+	{
+		if (agent_await_writable(agent, fd, timeout, 0) == -1)
+			return -1;
+
+		if ((bytes = write(fd, b, count)) == -1)
+			return -1;
+
+		if (bytes == 0)
+			break;
+	}
+
+	return b - buf;
+}
+
+/*
+
+=item C<int agent_stats_enable(Agent *agent)>
+
+Starts collecting statistics about the health of C<agent>'s loop: how long it
+waits for I/O events and timers, how many I/O events it handles per turn,
+how long reactions and actions take to run, how late actions are, and how
+long it takes to cascade timers from the coarser levels of the timing wheel
+into the next second. Collecting them costs a few calls to I<gettimeofday(2)>
+per turn, so it is off by default. If statistics are already being
+collected, they are reset. On success, returns C<0>. On error, returns C<-1>
+with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int agent_stats_enable(Agent *agent)
+{
+	int ret, err;
+
+	if (!agent)
+		return set_errno(EINVAL);
+
+	if ((err = agent_wrlock(agent)))
+		return set_errno(err);
+
+	ret = agent_stats_enable_unlocked(agent);
+
+	if ((err = agent_unlock(agent)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int agent_stats_enable_unlocked(Agent *agent)>
+
+Equivalent to I<agent_stats_enable(3)> except that C<agent> is not
+write-locked.
+
+=cut
+
+*/
+
+int agent_stats_enable_unlocked(Agent *agent)
+{
+	if (!agent)
+		return set_errno(EINVAL);
+
+	if (!agent->stats && !(agent->stats = mem_new(agent_stats_t))) /* XXX decouple */
+		return -1;
+
+	memset(agent->stats, 0, sizeof(agent_stats_t));
+	agent->stats->slowest_fd = -1;
+
+	return 0;
+}
+
+/*
+
+=item C<int agent_stats_disable(Agent *agent)>
+
+Stops collecting statistics for C<agent> and discards those collected so far.
+On success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+int agent_stats_disable(Agent *agent)
+{
+	int ret, err;
+
+	if (!agent)
+		return set_errno(EINVAL);
+
+	if ((err = agent_wrlock(agent)))
+		return set_errno(err);
+
+	ret = agent_stats_disable_unlocked(agent);
+
+	if ((err = agent_unlock(agent)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int agent_stats_disable_unlocked(Agent *agent)>
+
+Equivalent to I<agent_stats_disable(3)> except that C<agent> is not
+write-locked.
+
+=cut
+
+*/
+
+int agent_stats_disable_unlocked(Agent *agent)
+{
+	if (!agent)
+		return set_errno(EINVAL);
+
+	mem_release(agent->stats);
+	agent->stats = NULL;
+
+	return 0;
+}
+
+/*
+
+=item C<int agent_stats(Agent *agent, agent_stats_t *stats)>
+
+Copies the statistics collected for C<agent> since I<agent_stats_enable(3)>
+was called into C<stats>. Each histogram has C<AGENT_STATS_BUCKETS> counts.
+The first counts values of zero, and bucket C<i> counts values from
+C<2^(i-1)> up to (but not including) C<2^i>. The last bucket also counts any
+larger values. Durations are measured in microseconds. C<turns> is the
+number of times that C<agent> waited for I/O events or timers, C<wait> is
+the time spent waiting, C<events> is the number of I/O events per turn,
+C<reaction> and C<action> are the time taken by reactions and actions (and
+tasks, which run inside them), C<lateness> is how long after their
+scheduled time actions were executed, and C<cascade> is the time taken to
+move timers into the next second (and, at the end of each minute, hour and
+day, into the next minute, hour and day). C<slowest_reaction> is the
+duration of the slowest reaction, and C<slowest_fd> is the file descriptor
+that it reacted to (or C<-1>). On success, returns C<0>. On error, returns
+C<-1> with C<errno> set appropriately (C<EINVAL> if statistics are not being
+collected for C<agent>).
+
+=cut
+
+*/
+
+int agent_stats(Agent *agent, agent_stats_t *stats)
+{
+	int ret, err;
+
+	if (!agent)
+		return set_errno(EINVAL);
+
+	if ((err = agent_rdlock(agent)))
+		return set_errno(err);
+
+	ret = agent_stats_unlocked(agent, stats);
+
+	if ((err = agent_unlock(agent)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int agent_stats_unlocked(Agent *agent, agent_stats_t *stats)>
+
+Equivalent to I<agent_stats(3)> except that C<agent> is not read-locked.
+
+=cut
+
+*/
+
+int agent_stats_unlocked(Agent *agent, agent_stats_t *stats)
+{
+	if (!agent || !agent->stats || !stats)
+		return set_errno(EINVAL);
+
+	*stats = *agent->stats;
+
+	return 0;
+}
+
+/*
+
+=back
+
+=head1 ERRORS
+
+On error, C<errno> is set either by an underlying function, or as follows:
+
+=over 4
+
+=item C<EINVAL>
+
+When arguments to any of the functions is invalid.
+
+When I<agent_start(3)> is called on an agent that isn't idle.
+
+When I<agent_stop(3)> is called on an agent that isn't started.
+
+When I<agent_sleep(3)>, I<agent_await_readable(3)>,
+I<agent_await_writable(3)>, I<agent_read(3)> or I<agent_write(3)> is called
+from outside a task.
+
+=item C<EBUSY>
+
+When I<agent_await_readable(3)> or I<agent_await_writable(3)> is called for
+a file descriptor that is already connected to the agent.
+
+=item C<ETIMEDOUT>
+
+When I<agent_await_readable(3)>, I<agent_await_writable(3)>,
+I<agent_read(3)> or I<agent_write(3)> times out.
+
+=item C<ENOSYS>
+
+When I<agent_spawn(3)> is called on a system without I<makecontext(3)>.
+
+=back
+
+=head1 MT-Level
+
+I<MT-Disciplined>
+
+=head1 SCALABILITY
+
+There are two aspects to the scalability of agents: scalability with respect
+to the number of scheduled actions, and scalability with respect to the
+number of connected file descriptors.
+
+The timers for scheduled actions are multiplexed over the timeout facility
+provided by I<poll(2)> using a state of the art data structure for timing
+facilities (hierarchical timing wheels) which guarantees constant time to
+start and stop timers and constant average time to maintain timers so that
+thousands of timers may be outstanding without performance penalty. The
+memory for actions is allocated in slabs and recycled through a free list,
+so scheduling, rescheduling and cancelling timers don't usually allocate or
+deallocate any memory at all.
+
+Adding and removing connected file descriptors take constant time but
+maintaining them is I<O(n)> where I<n> is the number of connected file
+descriptors. That wouldn't be a problem if all of the file descriptors were
+active since work would have to be done reacting to all the events anyway,
+but if only a few file descriptors are active, both the kernel and the
+application waste significant effort examining the elements of the C<pollfd>
+array that correspond to the inactive file descriptors. Over a WAN such as
+the internet, inactive file descriptors typically far outnumber active file
+descriptors since many connections can be waiting for lost packets to be
+retransmitted.
+
+To implement a portable internet service that scales well with respect to
+the number of inactive file descriptors, use two agents, each running in its
+own thread. The first only deals with active file descriptors. The second
+only deals with inactive file descriptors. These agents swap file
+descriptors between themselves as their activity changes. Agents can measure
+the activity of each file descriptor to facilitate this. The result is one
+thread being woken up frequently but only dealing with a small number of
+active file descriptors each time, and another thread being woken up
+infrequently and dealing with a large number of file descriptors each time.
+The second thread still wastes effort but it does so less often. Credit goes
+to Richard Gooch for this I<"fast/slow lane"> approach. To reduce overhead
+further, more agents could be created to deal with the inactive file
+descriptors (multiple slow lanes) but it's unlikely to be worthwhile on
+hosts with a single processor. Note that one process can pass an open file
+descriptor to another process, so these agents could exist in separate
+processes but it's not as fast.
+
+The simpler, traditional approach is to just have multiple pre-forked
+servers, each I<accept(2)>ing connections. The set of connections will then
+be split between the servers. Experiments indicate that the connections are
+split evenly between the servers, but if the active connections are split
+between multiple servers, then the context switching overhead of multiple
+threads waking up could outweigh the savings gained by splitting up the
+connections into smaller sets. In the worst case, all of the threads might
+be woken up at the same time, resulting in the entire set of connections
+being processed. This is precisely the problem we are trying to avoid, but
+we've added context switching overhead as well. Another thing to note is
+that since this method is usually implemented with I<select(3)>, rather than
+I<poll(2)>, the effort wasted is far greater. Consider 1000 connections
+split between 10 pre-forked servers using I<select(3)>. Assume for
+simplicity that the first 100 connections are handled by the first server,
+the next 100 connections are handled by the second server, and so on. Due to
+the fact that I<select(2)> uses bitsets to record the file descriptors of
+interest, and has to check every bit up to the one corresponding to the
+highest numbered file descriptor, the total number of bits checked would be
+1000 + 900 + 800 + 700 + 600 + 500 + 400 + 300 + 200 + 100 = 5500. In the
+worst case it would be 1000 + 999 + 998 + 997 + 996 + 995 + 994 + 993 + 992
++ 991 = 9955. That's an order of magnitude more work than the obvious
+single-threaded approach.
+
+=cut
+
+XXX Add throughput/timing results for: single thread select/poll, multiple
+thread select/poll, fast/slow lane
 
 XXX The EXAMPLES section below contains a skeleton implementation of an
 internet service that is scalable with respect to the number of inactive
@@ -2454,10 +3713,7 @@ Trivial example: Read from stdin and timeout after 5 seconds with no input
         // Reschedule timeout for 5 seconds into the future
         // Note: action hasn't executed or we wouldn't be here
 
-        if (agent_cancel(agent, timeout) == -1)
-            return -1;
-
-        if (!(timeout = agent_schedule(agent, 5, 0, action, NULL)))
+        if (agent_reschedule(agent, timeout, 5, 0) == -1)
             return -1;
 
         // Read from fd and write to stdout
@@ -2504,6 +3760,39 @@ Trivial example: Read from stdin and timeout after 5 seconds with no input
         return (rc == -1) ? EXIT_FAILURE : EXIT_SUCCESS;
     }
 
+The same echo written as a task, which reads each line sequentially and gives
+up after 5 seconds of silence:
+
+    #include <slack/std.h>
+    #include <slack/agent.h>
+
+    int echo(Agent *agent, void *arg)
+    {
+        char buf[BUFSIZ];
+        ssize_t bytes;
+
+        while (agent_await_readable(agent, STDIN_FILENO, 5, 0) != -1)
+        {
+            if ((bytes = read(STDIN_FILENO, buf, BUFSIZ)) <= 0)
+                return (int)bytes;
+
+            if (agent_write(agent, STDOUT_FILENO, -1, buf, bytes) == -1)
+                return -1;
+        }
+
+        return (errno == ETIMEDOUT) ? 0 : -1;
+    }
+
+    int main()
+    {
+        Agent *agent;
+
+        if (!(agent = agent_create()) || agent_spawn(agent, 0, echo, NULL) == -1)
+            return EXIT_FAILURE;
+
+        return (agent_start(agent) == -1) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
 =cut
 
 XXX Show example of twin fast/slow lane agents swapping fds for scalability
@@ -2535,14 +3824,16 @@ systems that don't have I<poll(2)> (e.g. I<Mac OS X>), agents will always
 use I<select(2)> and hence can't be used in a fast/slow lane server.
 
 It is an error to call I<agent_cancel(3)> for an action that has already
-happened (because the memory associated with the action is deallocated when
-it is executed). Unfortunately, there is no guaranteed atomic way to tell if
-an action has already occurred. If it is necessary to be able to safely
-cancel scheduled actions, the client must provide the necessary safeguards
-itself. This could prove difficult. The simplest safe way to cancel is to do
-so from another action that was scheduled at least 10ms before the action
-being cancelled. Alternatively, you could disable, rather than cancel, an
-action by modifying a global variable that it checks before doing anything.
+happened (because the memory associated with the action is returned to the
+agent's pool of actions when it is executed and may be reused by a
+subsequent call to I<agent_schedule(3)>). Unfortunately, there is no
+guaranteed atomic way to tell if an action has already occurred. If it is
+necessary to be able to safely cancel scheduled actions, the client must
+provide the necessary safeguards itself. This could prove difficult. The
+simplest safe way to cancel is to do so from another action that was
+scheduled at least 10ms before the action being cancelled. Alternatively,
+you could disable, rather than cancel, an action by modifying a global
+variable that it checks before doing anything.
 
 If an action or reaction take a long time to run, and an action scheduled
 for the near future misses its schedule, the agent will catch up, executing
@@ -2863,45 +4154,244 @@ static int sender(Agent *agent, void *arg)
 	if (++progress == 10)
 		++state, progress = 0;
 
-	if (state == 10)
-	{
-		if (close(*fd) == -1)
-			++errors, printf("Test1: failed to close(WR)\n");
+	if (state == 10)
+	{
+		if (close(*fd) == -1)
+			++errors, printf("Test1: failed to close(WR)\n");
+
+		return 0;
+	}
+
+	if (!agent_schedule(agent, sec, usec, sender, arg))
+		return -1;
+
+	return 0;
+}
+
+static int oobrecv(Agent *agent, int fd, int revents, void *arg)
+{
+	char oob;
+
+	if (revents == X_OK)
+		printf("Test1: Out Of Band data arrives with revents == X_OK\n");
+	else if (revents == R_OK)
+		printf("Test1: Out Of Band data arrives with revents == R_OK\n");
+	else if (revents == (R_OK | X_OK))
+		printf("Test1: Out Of Band data arrives with revents == R_OK | X_OK\n");
+	else
+		printf("Test1: Out Of Band data arrives with revents == %d\n", revents);
+
+	if (recv(fd, &oob, 1, MSG_OOB) == -1)
+	{
+		++errors, printf("Test1: recv(MSG_OOB) failed (%s)\n", strerror(errno));
+		return -1;
+	}
+
+	if (agent_disconnect(agent, fd) == -1)
+		++errors, printf("Test1: agent_disconnect(RD) failed (%s)\n", strerror(errno));
+	if (close(fd) == -1)
+		++errors, printf("Test1: close(RD) failed (%s)\n", strerror(errno));
+
+	return 0;
+}
+
+static int dispatcher(Agent *agent, int fd, int revents, void *arg)
+{
+	long *count = arg;
+
+	if (--*count == 0)
+		return agent_stop(agent);
+
+	return 0;
+}
+
+static double dispatch_time(int measured, int nfds, int stride)
+{
+	Agent *agent;
+	int pipefds[256][2];
+	long count = 1000000;
+	timeval start[1], end[1];
+	double elapsed = -1.0;
+	int i, ok = 1;
+
+	if (!(agent = (measured) ? agent_create_measured() : agent_create()))
+		return -1.0;
+
+	for (i = 0; i < nfds; ++i)
+		if (pipe(pipefds[i]) == -1)
+			break;
+
+	nfds = i;
+
+	for (i = 0; i < nfds; ++i)
+	{
+		if (agent_connect(agent, pipefds[i][0], R_OK, dispatcher, &count) == -1)
+			ok = 0;
+
+		if (i % stride == 0 && write(pipefds[i][1], "", 1) == -1)
+			ok = 0;
+	}
+
+	if (ok && gettimeofday(start, NULL) != -1 && agent_start(agent) != -1 && gettimeofday(end, NULL) != -1)
+		elapsed = ((end->tv_sec - start->tv_sec) * 1000000.0 + (end->tv_usec - start->tv_usec)) * 1000.0 / (1000000 - count);
+
+	for (i = 0; i < nfds; ++i)
+		close(pipefds[i][0]), close(pipefds[i][1]);
+
+	agent_destroy(&agent);
+
+	return elapsed;
+}
+
+typedef struct trigger_t trigger_t;
+
+struct trigger_t
+{
+	int rd;
+	int wr;
+	int count;
+	int rearmed;
+};
+
+static int trigger(Agent *agent, int fd, int revents, void *arg)
+{
+	trigger_t *trig = arg;
+	char buf[1];
+
+	if (read(fd, buf, 1) == -1)
+	{
+		++errors, printf("Test1: read() failed (%s)\n", strerror(errno));
+		return -1;
+	}
+
+	++trig->count;
+
+	return 0;
+}
+
+static int rearm(Agent *agent, void *arg)
+{
+	trigger_t *trig = arg;
+
+	trig->rearmed = trig->count;
+
+	return agent_connect(agent, trig->rd, R_OK | AGENT_ONESHOT, trigger, trig);
+}
+
+static int feed(Agent *agent, void *arg)
+{
+	trigger_t *trig = arg;
+
+	return (write(trig->wr, "x", 1) == 1) ? 0 : -1;
+}
+
+static int finish(Agent *agent, void *arg)
+{
+	trigger_t *trig = arg;
+
+	return agent_disconnect(agent, trig->rd);
+}
+
+#ifdef HAVE_UCONTEXT
+typedef struct pingpong_t pingpong_t;
+
+struct pingpong_t
+{
+	int fd;
+	int count;
+};
+
+static int pinger(Agent *agent, void *arg)
+{
+	pingpong_t *pp = arg;
+	char buf[4];
+	int i;
+
+	for (i = 0; i < 10; ++i)
+	{
+		if (agent_write(agent, pp->fd, 5, "ping", 4) != 4)
+			return -1;
+
+		if (agent_read(agent, pp->fd, 5, buf, 4) != 4 || memcmp(buf, "pong", 4))
+			return -1;
+
+		++pp->count;
+	}
+
+	return 0;
+}
+
+static int ponger(Agent *agent, void *arg)
+{
+	pingpong_t *pp = arg;
+	char buf[4];
+	int i;
+
+	for (i = 0; i < 10; ++i)
+	{
+		if (agent_read(agent, pp->fd, 5, buf, 4) != 4 || memcmp(buf, "ping", 4))
+			return -1;
+
+		if (agent_write(agent, pp->fd, 5, "pong", 4) != 4)
+			return -1;
+
+		++pp->count;
+	}
+
+	return 0;
+}
+
+static int sleeper(Agent *agent, void *arg)
+{
+	int *count = arg;
+
+	if (agent_sleep(agent, 0, (*count % 5) * 10000) == -1)
+		return -1;
+
+	++*count;
+
+	return 0;
+}
+
+static int waiter(Agent *agent, void *arg)
+{
+	pingpong_t *pp = arg;
 
-		return 0;
-	}
+	pp->count = (agent_await_readable(agent, pp->fd, 0, 50000) == -1) ? errno : 0;
 
-	if (!agent_schedule(agent, sec, usec, sender, arg))
-		return -1;
+	if (pp->count == EBUSY)
+		return agent_disconnect(agent, pp->fd);
 
 	return 0;
 }
 
-static int oobrecv(Agent *agent, int fd, int revents, void *arg)
+static int failer(Agent *agent, void *arg)
 {
-	char oob;
+	return set_errno(EPERM);
+}
+#endif
 
-	if (revents == X_OK)
-		printf("Test1: Out Of Band data arrives with revents == X_OK\n");
-	else if (revents == R_OK)
-		printf("Test1: Out Of Band data arrives with revents == R_OK\n");
-	else if (revents == (R_OK | X_OK))
-		printf("Test1: Out Of Band data arrives with revents == R_OK | X_OK\n");
-	else
-		printf("Test1: Out Of Band data arrives with revents == %d\n", revents);
+static int sluggish(Agent *agent, int fd, int revents, void *arg)
+{
+	char buf[1];
 
-	if (recv(fd, &oob, 1, MSG_OOB) == -1)
-	{
-		++errors, printf("Test1: recv(MSG_OOB) failed (%s)\n", strerror(errno));
+	if (read(fd, buf, 1) == -1)
 		return -1;
-	}
 
-	if (agent_disconnect(agent, fd) == -1)
-		++errors, printf("Test1: agent_disconnect(RD) failed (%s)\n", strerror(errno));
-	if (close(fd) == -1)
-		++errors, printf("Test1: close(RD) failed (%s)\n", strerror(errno));
+	nap(0, 20000);
 
-	return 0;
+	return agent_disconnect(agent, fd);
+}
+
+static unsigned long total(unsigned long *histogram)
+{
+	unsigned long sum = 0;
+	int i;
+
+	for (i = 0; i < AGENT_STATS_BUCKETS; ++i)
+		sum += histogram[i];
+
+	return sum;
 }
 
 static int slow(Agent *agent, void *arg)
@@ -2943,10 +4433,14 @@ int main(int ac, char **av)
 	int no_accuracy2 = 1;
 	int no_accuracy3 = 1;
 	int no_delay = 1;
+	int no_dispatch = 1;
+	Agent *(*create[3])(void) = { agent_create, agent_create_using_select, agent_create_using_epoll };
+	const char *created[3] = { "agent_create", "agent_create_using_select", "agent_create_using_epoll" };
+	int method;
 
 	if (ac == 2 && !strcmp(av[1], "help"))
 	{
-		printf("usage: %s [help|activity|oob|accuracy(1|2|3) [#]|delay]\n", *av);
+		printf("usage: %s [help|activity|oob|accuracy(1|2|3) [#]|delay|dispatch]\n", *av);
 		return EXIT_SUCCESS;
 	}
 
@@ -3568,6 +5062,7 @@ int main(int ac, char **av)
 	if (ac == 2 && !strcmp(av[1], "delay"))
 	{
 		printf("Checking delays caused by long-running actions/reactions\n");
+		no_delay = 0;
 
 		if (!(agent = agent_create()))
 			++errors, printf("Test127: agent_create() failed (%s)\n", strerror(errno));
@@ -3592,6 +5087,462 @@ int main(int ac, char **av)
 		}
 	}
 
+	/* Test rescheduling and recycling actions */
+
+	if (!(agent = agent_create()))
+		++errors, printf("Test133: agent_create() failed (%s)\n", strerror(errno));
+	else
+	{
+		void *ids[200], *id;
+		int count = 0;
+		int recycled = 0;
+		time_t start = time(NULL);
+		int i, j;
+
+		for (i = 0; i < 200; ++i)
+			if (!(ids[i] = agent_schedule(agent, 10, 0, actor, &count)))
+				++errors, printf("Test134: agent_schedule(actor) failed (%s)\n", strerror(errno));
+
+		for (i = 0; i < 200; ++i)
+			if (ids[i] && agent_cancel(agent, ids[i]) == -1)
+				++errors, printf("Test135: agent_cancel(actor) failed (%s)\n", strerror(errno));
+
+		for (i = 0; i < 200; ++i)
+		{
+			if (!(id = agent_schedule(agent, 0, 20000, actor, &count)))
+				++errors, printf("Test136: agent_schedule(actor) failed (%s)\n", strerror(errno));
+
+			for (j = 0; j < 200; ++j)
+				if (id == ids[j])
+					++recycled;
+		}
+
+		if (recycled != 200)
+			++errors, printf("Test137: agent_schedule(actor) failed (recycled %d actions, not %d)\n", recycled, 200);
+
+		if (!(id = agent_schedule(agent, 10, 0, actor, &count)))
+			++errors, printf("Test138: agent_schedule(actor) failed (%s)\n", strerror(errno));
+		else if (agent_reschedule(agent, id, 0, 30000) == -1)
+			++errors, printf("Test139: agent_reschedule(actor) failed (%s)\n", strerror(errno));
+		else if (agent_start(agent) == -1)
+			++errors, printf("Test140: agent_start() failed (%s)\n", strerror(errno));
+		else if (count != 201)
+			++errors, printf("Test141: count = %d, not %d\n", count, 201);
+		else if (time(NULL) - start > 5)
+			++errors, printf("Test142: agent_reschedule(actor) failed (took %ds, not < %ds)\n", (int)(time(NULL) - start), 5);
+
+		if (agent_reschedule(NULL, ids[0], 0, 0) != -1)
+			++errors, printf("Test143: agent_reschedule(agent == NULL) failed\n");
+
+		if (agent_reschedule(agent, NULL, 0, 0) != -1)
+			++errors, printf("Test144: agent_reschedule(action_id == NULL) failed\n");
+
+		agent_destroy(&agent);
+		if (agent)
+			++errors, printf("Test145: agent_destroy() failed (%s)\n", strerror(errno));
+	}
+
+	/* Test reactions (using epoll) */
+
+	if (!(agent = agent_create_using_epoll()))
+		++errors, printf("Test146: agent_create_using_epoll() failed (%s)\n", strerror(errno));
+	else
+	{
+		int pipefds[2];
+		int rdcount = 0;
+		int wrcount = 0;
+
+		if (pipe(pipefds) == -1)
+			++errors, printf("Test147: failed to perform test: pipe() failed (%s)\n", strerror(errno));
+		else
+		{
+			if (agent_connect(agent, pipefds[0], R_OK, reader, &rdcount) == -1)
+				++errors, printf("Test148: agent_connect(pipefds[RD]) failed (%s)\n", strerror(errno));
+			else if (agent_connect(agent, pipefds[1], W_OK, writer, &wrcount) == -1)
+				++errors, printf("Test149: agent_connect(pipefds[WR]) failed (%s)\n", strerror(errno));
+			else if (agent_start(agent) == -1)
+				++errors, printf("Test150: agent_start() failed (%s)\n", strerror(errno));
+			else if (rdcount != 10)
+				++errors, printf("Test151: rdcount = %d, not %d\n", rdcount, 10);
+			else if (wrcount != 10)
+				++errors, printf("Test152: wrcount = %d, not %d\n", wrcount, 10);
+
+			close(pipefds[0]);
+			close(pipefds[1]);
+		}
+
+		agent_destroy(&agent);
+		if (agent)
+			++errors, printf("Test153: agent_destroy() failed (%s)\n", strerror(errno));
+	}
+
+	/* Test actions (using epoll) */
+
+	if (!(agent = agent_create_using_epoll()))
+		++errors, printf("Test154: agent_create_using_epoll() failed (%s)\n", strerror(errno));
+	else
+	{
+		int count = 0;
+
+		if (!agent_schedule(agent, 0, 20000, actor, &count))
+			++errors, printf("Test155: agent_schedule(actor) failed (%s)\n", strerror(errno));
+		else if (!agent_schedule(agent, 0, 30000, actor, &count))
+			++errors, printf("Test156: agent_schedule(actor) failed (%s)\n", strerror(errno));
+		else if (!agent_schedule(agent, 0, 40000, actor, &count))
+			++errors, printf("Test157: agent_schedule(actor) failed (%s)\n", strerror(errno));
+		else if (agent_start(agent) == -1)
+			++errors, printf("Test158: agent_start() failed (%s)\n", strerror(errno));
+		else if (count != 3)
+			++errors, printf("Test159: count = %d, not %d\n", count, 3);
+
+		agent_destroy(&agent);
+		if (agent)
+			++errors, printf("Test160: agent_destroy() failed (%s)\n", strerror(errno));
+	}
+
+	/* Test one-shot and exclusive reactions (using poll, select and epoll) */
+
+	for (method = 0; method < 3; ++method)
+	{
+		if (!(agent = create[method]()))
+			++errors, printf("Test161: %s() failed (%s)\n", created[method], strerror(errno));
+		else
+		{
+			trigger_t trig[1];
+			int pipefds[2];
+
+			memset(trig, 0, sizeof(trigger_t));
+
+			if (pipe(pipefds) == -1)
+				++errors, printf("Test162: failed to perform test: pipe() failed (%s)\n", strerror(errno));
+			else
+			{
+				trig->rd = pipefds[0];
+				trig->wr = pipefds[1];
+
+				/* Pending input would be reported on every turn if level-triggered */
+
+				if (write(pipefds[1], "xxx", 3) != 3)
+					++errors, printf("Test163: %s: failed to perform test: write() failed (%s)\n", created[method], strerror(errno));
+				else if (agent_connect(agent, pipefds[0], R_OK | AGENT_ONESHOT, trigger, trig) == -1)
+					++errors, printf("Test164: %s: agent_connect(AGENT_ONESHOT) failed (%s)\n", created[method], strerror(errno));
+				else if (!agent_schedule(agent, 0, 50000, rearm, trig))
+					++errors, printf("Test165: %s: agent_schedule(rearm) failed (%s)\n", created[method], strerror(errno));
+				else if (!agent_schedule(agent, 0, 100000, finish, trig))
+					++errors, printf("Test166: %s: agent_schedule(finish) failed (%s)\n", created[method], strerror(errno));
+				else if (agent_start(agent) == -1)
+					++errors, printf("Test167: %s: agent_start() failed (%s)\n", created[method], strerror(errno));
+				else if (trig->rearmed != 1)
+					++errors, printf("Test168: %s: count before rearm = %d, not %d\n", created[method], trig->rearmed, 1);
+				else if (trig->count != 2)
+					++errors, printf("Test169: %s: count = %d, not %d\n", created[method], trig->count, 2);
+
+				close(pipefds[0]);
+				close(pipefds[1]);
+			}
+
+			if (pipe(pipefds) == -1)
+				++errors, printf("Test170: failed to perform test: pipe() failed (%s)\n", strerror(errno));
+			else
+			{
+				int count = 0;
+
+				if (agent_connect(agent, pipefds[0], R_OK, reader, &count) == -1)
+					++errors, printf("Test171: %s: agent_connect() failed (%s)\n", created[method], strerror(errno));
+				else if (agent_connect(agent, pipefds[0], R_OK | AGENT_EXCLUSIVE, reader, &count) == -1)
+					++errors, printf("Test172: %s: agent_connect(AGENT_EXCLUSIVE) failed (%s)\n", created[method], strerror(errno));
+				else if (agent_connect(agent, pipefds[0], R_OK | AGENT_ONESHOT | AGENT_EXCLUSIVE, reader, &count) != -1)
+					++errors, printf("Test173: %s: agent_connect(AGENT_ONESHOT | AGENT_EXCLUSIVE) failed\n", created[method]);
+				else if (errno != EINVAL)
+					++errors, printf("Test174: %s: agent_connect(AGENT_ONESHOT | AGENT_EXCLUSIVE) failed (errno = %s, not %s)\n", created[method], strerror(errno), strerror(EINVAL));
+				else if (write(pipefds[1], "x", 1) != 1 || close(pipefds[1]) == -1)
+					++errors, printf("Test175: %s: failed to perform test: write() failed (%s)\n", created[method], strerror(errno));
+				else if (agent_start(agent) == -1)
+					++errors, printf("Test176: %s: agent_start() failed (%s)\n", created[method], strerror(errno));
+				else if (count != 1)
+					++errors, printf("Test177: %s: count = %d, not %d\n", created[method], count, 1);
+
+				close(pipefds[0]);
+				close(pipefds[1]);
+			}
+
+			agent_destroy(&agent);
+			if (agent)
+				++errors, printf("Test178: agent_destroy() failed (%s)\n", strerror(errno));
+		}
+	}
+
+#ifdef HAVE_EPOLL
+	/* Test edge-triggered reactions (using epoll) */
+
+	if (!(agent = agent_create_using_epoll()))
+		++errors, printf("Test179: agent_create_using_epoll() failed (%s)\n", strerror(errno));
+	else
+	{
+		trigger_t trig[1];
+		int pipefds[2];
+
+		memset(trig, 0, sizeof(trigger_t));
+
+		if (pipe(pipefds) == -1)
+			++errors, printf("Test180: failed to perform test: pipe() failed (%s)\n", strerror(errno));
+		else
+		{
+			trig->rd = pipefds[0];
+			trig->wr = pipefds[1];
+
+			if (write(pipefds[1], "xxx", 3) != 3)
+				++errors, printf("Test181: failed to perform test: write() failed (%s)\n", strerror(errno));
+			else if (agent_connect(agent, pipefds[0], R_OK | AGENT_EDGE, trigger, trig) == -1)
+				++errors, printf("Test182: agent_connect(AGENT_EDGE) failed (%s)\n", strerror(errno));
+			else if (!agent_schedule(agent, 0, 50000, feed, trig))
+				++errors, printf("Test183: agent_schedule(feed) failed (%s)\n", strerror(errno));
+			else if (!agent_schedule(agent, 0, 100000, finish, trig))
+				++errors, printf("Test184: agent_schedule(finish) failed (%s)\n", strerror(errno));
+			else if (agent_start(agent) == -1)
+				++errors, printf("Test185: agent_start() failed (%s)\n", strerror(errno));
+			else if (trig->count != 2)
+				++errors, printf("Test186: count = %d, not %d\n", trig->count, 2);
+
+			close(pipefds[0]);
+			close(pipefds[1]);
+		}
+
+		agent_destroy(&agent);
+		if (agent)
+			++errors, printf("Test187: agent_destroy() failed (%s)\n", strerror(errno));
+	}
+#endif
+
+#ifdef HAVE_UCONTEXT
+	/* Test tasks */
+
+	if (!(agent = agent_create()))
+		++errors, printf("Test188: agent_create() failed (%s)\n", strerror(errno));
+	else
+	{
+		pingpong_t ping[1], pong[1];
+		int sockfds[2];
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockfds) == -1)
+			++errors, printf("Test189: failed to perform test: socketpair() failed (%s)\n", strerror(errno));
+		else
+		{
+			ping->fd = sockfds[0], ping->count = 0;
+			pong->fd = sockfds[1], pong->count = 0;
+
+			if (agent_spawn(agent, 0, pinger, ping) == -1)
+				++errors, printf("Test190: agent_spawn(pinger) failed (%s)\n", strerror(errno));
+			else if (agent_spawn(agent, 16 * 1024, ponger, pong) == -1)
+				++errors, printf("Test191: agent_spawn(ponger) failed (%s)\n", strerror(errno));
+			else if (agent_start(agent) == -1)
+				++errors, printf("Test192: agent_start() failed (%s)\n", strerror(errno));
+			else if (ping->count != 10)
+				++errors, printf("Test193: ping count = %d, not %d\n", ping->count, 10);
+			else if (pong->count != 10)
+				++errors, printf("Test194: pong count = %d, not %d\n", pong->count, 10);
+
+			close(sockfds[0]);
+			close(sockfds[1]);
+		}
+
+		agent_destroy(&agent);
+		if (agent)
+			++errors, printf("Test195: agent_destroy() failed (%s)\n", strerror(errno));
+	}
+
+	/* Test many tasks and the reuse of their stacks */
+
+	if (!(agent = agent_create()))
+		++errors, printf("Test196: agent_create() failed (%s)\n", strerror(errno));
+	else
+	{
+		int count = 0;
+		int i;
+
+		for (i = 0; i < 100; ++i)
+			if (agent_spawn(agent, 0, sleeper, &count) == -1)
+				++errors, printf("Test197: agent_spawn(sleeper) failed (%s)\n", strerror(errno));
+
+		if (agent_start(agent) == -1)
+			++errors, printf("Test198: agent_start() failed (%s)\n", strerror(errno));
+		else if (count != 100)
+			++errors, printf("Test199: count = %d, not %d\n", count, 100);
+
+		for (i = 0; i < 100; ++i)
+			if (agent_spawn(agent, 0, sleeper, &count) == -1)
+				++errors, printf("Test200: agent_spawn(sleeper) failed (%s)\n", strerror(errno));
+
+		if (agent_start(agent) == -1)
+			++errors, printf("Test201: agent_start() failed (%s)\n", strerror(errno));
+		else if (count != 200)
+			++errors, printf("Test202: count = %d, not %d\n", count, 200);
+
+		agent_destroy(&agent);
+		if (agent)
+			++errors, printf("Test203: agent_destroy() failed (%s)\n", strerror(errno));
+	}
+
+	/* Test task timeouts and errors */
+
+	if (!(agent = agent_create()))
+		++errors, printf("Test204: agent_create() failed (%s)\n", strerror(errno));
+	else
+	{
+		pingpong_t wait[1];
+		int pipefds[2];
+		int count = 0;
+
+		if (pipe(pipefds) == -1)
+			++errors, printf("Test205: failed to perform test: pipe() failed (%s)\n", strerror(errno));
+		else
+		{
+			wait->fd = pipefds[0], wait->count = 0;
+
+			if (agent_spawn(agent, 0, waiter, wait) == -1)
+				++errors, printf("Test206: agent_spawn(waiter) failed (%s)\n", strerror(errno));
+			else if (agent_start(agent) == -1)
+				++errors, printf("Test207: agent_start() failed (%s)\n", strerror(errno));
+			else if (wait->count != ETIMEDOUT)
+				++errors, printf("Test208: agent_await_readable() failed (errno = %s, not %s)\n", strerror(wait->count), strerror(ETIMEDOUT));
+
+			if (agent_connect(agent, pipefds[0], R_OK, reader, &count) == -1)
+				++errors, printf("Test209: agent_connect() failed (%s)\n", strerror(errno));
+			else if (agent_spawn(agent, 0, waiter, wait) == -1)
+				++errors, printf("Test210: agent_spawn(waiter) failed (%s)\n", strerror(errno));
+			else if (agent_start(agent) == -1)
+				++errors, printf("Test211: agent_start() failed (%s)\n", strerror(errno));
+			else if (wait->count != EBUSY)
+				++errors, printf("Test212: agent_await_readable(connected fd) failed (errno = %s, not %s)\n", strerror(wait->count), strerror(EBUSY));
+
+			close(pipefds[0]);
+			close(pipefds[1]);
+		}
+
+		if (agent_spawn(agent, 0, failer, NULL) == -1)
+			++errors, printf("Test213: agent_spawn(failer) failed (%s)\n", strerror(errno));
+		else if (agent_start(agent) != -1)
+			++errors, printf("Test214: agent_start(failer) failed\n");
+		else if (errno != EPERM)
+			++errors, printf("Test215: agent_start(failer) failed (errno = %s, not %s)\n", strerror(errno), strerror(EPERM));
+
+		if (agent_spawn(NULL, 0, sleeper, &count) != -1)
+			++errors, printf("Test216: agent_spawn(agent == NULL) failed\n");
+		else if (errno != EINVAL)
+			++errors, printf("Test217: agent_spawn(agent == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+
+		if (agent_spawn(agent, 0, NULL, &count) != -1)
+			++errors, printf("Test218: agent_spawn(task == NULL) failed\n");
+		else if (errno != EINVAL)
+			++errors, printf("Test219: agent_spawn(task == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+
+		if (agent_sleep(agent, 0, 0) != -1)
+			++errors, printf("Test220: agent_sleep(outside a task) failed\n");
+		else if (errno != EINVAL)
+			++errors, printf("Test221: agent_sleep(outside a task) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+
+		agent_destroy(&agent);
+		if (agent)
+			++errors, printf("Test222: agent_destroy() failed (%s)\n", strerror(errno));
+	}
+#endif
+
+	/* Test loop statistics */
+
+	if (!(agent = agent_create()))
+		++errors, printf("Test223: agent_create() failed (%s)\n", strerror(errno));
+	else
+	{
+		agent_stats_t stats[1];
+		int pipefds[2], slowfds[2];
+		int rdcount = 0;
+		int wrcount = 0;
+		int count = 0;
+
+		if (agent_stats_enable(agent) == -1)
+			++errors, printf("Test224: agent_stats_enable() failed (%s)\n", strerror(errno));
+		else if (pipe(pipefds) == -1)
+			++errors, printf("Test225: failed to perform test: pipe() failed (%s)\n", strerror(errno));
+		else
+		{
+			if (pipe(slowfds) == -1)
+				++errors, printf("Test226: failed to perform test: pipe() failed (%s)\n", strerror(errno));
+			else
+			{
+				if (agent_connect(agent, pipefds[0], R_OK, reader, &rdcount) == -1)
+					++errors, printf("Test227: agent_connect(pipefds[RD]) failed (%s)\n", strerror(errno));
+				else if (agent_connect(agent, pipefds[1], W_OK, writer, &wrcount) == -1)
+					++errors, printf("Test228: agent_connect(pipefds[WR]) failed (%s)\n", strerror(errno));
+				else if (write(slowfds[1], "x", 1) != 1 || agent_connect(agent, slowfds[0], R_OK, sluggish, NULL) == -1)
+					++errors, printf("Test229: agent_connect(slowfds[RD]) failed (%s)\n", strerror(errno));
+				else if (!agent_schedule(agent, 0, 20000, actor, &count))
+					++errors, printf("Test230: agent_schedule(actor) failed (%s)\n", strerror(errno));
+				else if (!agent_schedule(agent, 1, 0, actor, &count))
+					++errors, printf("Test231: agent_schedule(actor) failed (%s)\n", strerror(errno));
+				else if (agent_start(agent) == -1)
+					++errors, printf("Test232: agent_start() failed (%s)\n", strerror(errno));
+				else if (agent_stats(agent, stats) == -1)
+					++errors, printf("Test233: agent_stats() failed (%s)\n", strerror(errno));
+				else
+				{
+					if (stats->turns == 0)
+						++errors, printf("Test234: turns = %lu, not > %d\n", stats->turns, 0);
+
+					if (total(stats->events) != stats->turns)
+						++errors, printf("Test235: events total = %lu, not %lu\n", total(stats->events), stats->turns);
+
+					if (total(stats->reaction) != 22)
+						++errors, printf("Test236: reactions = %lu, not %d\n", total(stats->reaction), 22);
+
+					if (total(stats->action) != 2)
+						++errors, printf("Test237: actions = %lu, not %d\n", total(stats->action), 2);
+
+					if (total(stats->lateness) != 2)
+						++errors, printf("Test238: lateness total = %lu, not %d\n", total(stats->lateness), 2);
+
+					if (total(stats->cascade) == 0)
+						++errors, printf("Test239: cascades = %lu, not > %d\n", total(stats->cascade), 0);
+
+					if (stats->slowest_fd != slowfds[0])
+						++errors, printf("Test240: slowest_fd = %d, not %d\n", stats->slowest_fd, slowfds[0]);
+
+					if (stats->slowest_reaction < 20000)
+						++errors, printf("Test241: slowest_reaction = %ld, not >= %d\n", stats->slowest_reaction, 20000);
+				}
+
+				close(slowfds[0]);
+				close(slowfds[1]);
+			}
+
+			close(pipefds[0]);
+			close(pipefds[1]);
+		}
+
+		if (agent_stats_disable(agent) == -1)
+			++errors, printf("Test242: agent_stats_disable() failed (%s)\n", strerror(errno));
+		else if (agent_stats(agent, stats) != -1)
+			++errors, printf("Test243: agent_stats(disabled) failed\n");
+		else if (errno != EINVAL)
+			++errors, printf("Test244: agent_stats(disabled) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+
+		agent_destroy(&agent);
+		if (agent)
+			++errors, printf("Test245: agent_destroy() failed (%s)\n", strerror(errno));
+	}
+
+	/* Time the dispatch of reactions to I/O events */
+
+	if (ac == 2 && !strcmp(av[1], "dispatch"))
+	{
+		printf("Timing: reaction dispatch per I/O event (256 connected fds)\n");
+		no_dispatch = 0;
+
+		printf("  %-39s %g ns\n", "all ready", dispatch_time(0, 256, 1));
+		printf("  %-39s %g ns\n", "1/16 ready", dispatch_time(0, 256, 16));
+		printf("  %-39s %g ns\n", "all ready (measured)", dispatch_time(1, 256, 1));
+		printf("  %-39s %g ns\n", "1/16 ready (measured)", dispatch_time(1, 256, 16));
+	}
+
 	/* XXX Test MT */
 
 	/* XXX Test fast/slow lane */
@@ -3599,134 +5550,134 @@ int main(int ac, char **av)
 	/* Test errors */
 
 	if (!(agent = agent_create()))
-		++errors, printf("Test133: agent_create() failed (%s)\n", strerror(errno));
+		++errors, printf("Test246: agent_create() failed (%s)\n", strerror(errno));
 	else
 	{
 		if (agent_connect(NULL, 0, R_OK, reader, NULL) != -1)
-			++errors, printf("Test134: agent_connect(agent == NULL) failed\n");
+			++errors, printf("Test247: agent_connect(agent == NULL) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test135: agent_connect(agent == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test248: agent_connect(agent == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_connect(agent, -1, R_OK, reader, NULL) != -1)
-			++errors, printf("Test136: agent_connect(fd == -1) failed\n");
+			++errors, printf("Test249: agent_connect(fd == -1) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test137: agent_connect(fd == -1) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test250: agent_connect(fd == -1) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_connect(agent, 0, 0, reader, NULL) != -1)
-			++errors, printf("Test138: agent_connect(events == 0) failed\n");
+			++errors, printf("Test251: agent_connect(events == 0) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test139: agent_connect(events == 0) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test252: agent_connect(events == 0) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_connect(agent, 0, -1, reader, NULL) != -1)
-			++errors, printf("Test140: agent_connect(events == -1) failed\n");
+			++errors, printf("Test253: agent_connect(events == -1) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test141: agent_connect(events == -1) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test254: agent_connect(events == -1) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_connect(agent, 0, R_OK, NULL, NULL) != -1)
-			++errors, printf("Test142: agent_connect(reaction == NULL) failed\n");
+			++errors, printf("Test255: agent_connect(reaction == NULL) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test143: agent_connect(reaction == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test256: agent_connect(reaction == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_disconnect(NULL, 0) != -1)
-			++errors, printf("Test144: agent_disconnect(agent == NULL) failed\n");
+			++errors, printf("Test257: agent_disconnect(agent == NULL) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test145: agent_disconnect(agent == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test258: agent_disconnect(agent == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_disconnect(agent, -1) != -1)
-			++errors, printf("Test146: agent_disconnect(fd == -1) failed\n");
+			++errors, printf("Test259: agent_disconnect(fd == -1) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test147: agent_disconnect(fd == -1) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test260: agent_disconnect(fd == -1) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_disconnect(agent, 0) != -1)
-			++errors, printf("Test148: agent_disconnect(unconnected fd) failed\n");
+			++errors, printf("Test261: agent_disconnect(unconnected fd) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test149: agent_disconnect(unconnected fd) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test262: agent_disconnect(unconnected fd) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_velocity(NULL, 0) != -1)
-			++errors, printf("Test150: agent_velocity(agent == NULL) failed\n");
+			++errors, printf("Test263: agent_velocity(agent == NULL) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test151: agent_velocity(agent == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test264: agent_velocity(agent == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_velocity(agent, -1) != -1)
-			++errors, printf("Test152: agent_velocity(fd == -1) failed\n");
+			++errors, printf("Test265: agent_velocity(fd == -1) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test153: agent_velocity(fd == -1) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test266: agent_velocity(fd == -1) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_velocity(agent, 0) != -1)
-			++errors, printf("Test154: agent_velocity(unconnected fd) failed\n");
+			++errors, printf("Test267: agent_velocity(unconnected fd) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test155: agent_velocity(unconnected fd) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test268: agent_velocity(unconnected fd) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_schedule(NULL, 0, 0, actor, NULL) != NULL)
-			++errors, printf("Test156: agent_schedule(agent == NULL) failed\n");
+			++errors, printf("Test269: agent_schedule(agent == NULL) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test157: agent_schedule(agent == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test270: agent_schedule(agent == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_schedule(agent, -1, 0, actor, NULL) != NULL)
-			++errors, printf("Test158: agent_schedule(sec == -1) failed\n");
+			++errors, printf("Test271: agent_schedule(sec == -1) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test159: agent_schedule(sec == -1) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test272: agent_schedule(sec == -1) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_schedule(agent, 0, -1, actor, NULL) != NULL)
-			++errors, printf("Test160: agent_schedule(usec == -1) failed\n");
+			++errors, printf("Test273: agent_schedule(usec == -1) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test161: agent_schedule(usec == -1) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test274: agent_schedule(usec == -1) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_schedule(agent, 0, 0, NULL, NULL) != NULL)
-			++errors, printf("Test162: agent_schedule(action == NULL) failed\n");
+			++errors, printf("Test275: agent_schedule(action == NULL) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test163: agent_schedule(action == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test276: agent_schedule(action == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_cancel(NULL, (void *)1) != -1)
-			++errors, printf("Test164: agent_cancel(agent == NULL) failed\n");
+			++errors, printf("Test277: agent_cancel(agent == NULL) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test165: agent_cancel(agent == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test278: agent_cancel(agent == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_cancel(agent, NULL) != -1)
-			++errors, printf("Test166: agent_cancel(action_id == NULL) failed\n");
+			++errors, printf("Test279: agent_cancel(action_id == NULL) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test167: agent_cancel(action_id == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test280: agent_cancel(action_id == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_cancel(agent, (void *)1) != -1)
-			++errors, printf("Test168: agent_cancel(never scheduled an action) failed\n");
+			++errors, printf("Test281: agent_cancel(never scheduled an action) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test169: agent_cancel(never scheduled an action) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test282: agent_cancel(never scheduled an action) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_start(NULL) != -1)
-			++errors, printf("Test170: agent_start(agent == NULL) failed\n");
+			++errors, printf("Test283: agent_start(agent == NULL) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test171: agent_start(agent == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test284: agent_start(agent == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		if (agent_stop(NULL) != -1)
-			++errors, printf("Test172: agent_stop(agent == NULL) failed\n");
+			++errors, printf("Test285: agent_stop(agent == NULL) failed\n");
 		else if (errno != EINVAL)
-			++errors, printf("Test173: agent_stop(agent == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
+			++errors, printf("Test286: agent_stop(agent == NULL) failed (errno = %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
 		agent_destroy(&agent);
 		if (agent)
-			++errors, printf("Test174: agent_destroy() failed (%s)\n", strerror(errno));
+			++errors, printf("Test287: agent_destroy() failed (%s)\n", strerror(errno));
 	}
 
 	/* Test assumption: memset(&ptr, 0, sizeof(void *)) same as NULL */
 
 	memset(&ptr, 0, sizeof(void *));
 	if (ptr != NULL)
-		++errors, printf("Test175: assumption failed: memset(&ptr, 0, sizeof(void *)) not == NULL\n");
+		++errors, printf("Test288: assumption failed: memset(&ptr, 0, sizeof(void *)) not == NULL\n");
 
 	/* Test assumption: memset(&num, 0, sizeof(int)) same as 0 */
 
 	memset(&num, 0, sizeof(int));
 	if (num != 0)
-		++errors, printf("Test176: assumption failed: memset(&num, 0, sizeof(int)) not == 0\n");
+		++errors, printf("Test289: assumption failed: memset(&num, 0, sizeof(int)) not == 0\n");
 
 	/* Test assumption: memset(&num, 0xff, sizeof(int)) same as -1 */
 
 	memset(&num, 0xff, sizeof(int));
 	if (num != -1)
-		++errors, printf("Test177: assumption failed: memset(&num, 0xff, sizeof(int)) not == -1\n");
+		++errors, printf("Test290: assumption failed: memset(&num, 0xff, sizeof(int)) not == -1\n");
 
 	if (errors)
-		printf("%d/177 tests failed\n", errors);
+		printf("%d/290 tests failed\n", errors);
 	else
 		printf("All tests passed\n");
 
@@ -3772,6 +5723,13 @@ int main(int ac, char **av)
 		printf("    Rerun the test with \"%s delay\" (takes about 1s).\n", *av);
 	}
 
+	if (no_dispatch)
+	{
+		printf("\n");
+		printf("    Note: You can also perform reaction dispatch timing tests.\n");
+		printf("    Rerun the test with \"%s dispatch\".\n", *av);
+	}
+
 	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -28,6 +28,26 @@
 typedef struct Agent Agent;
 typedef int agent_action_t(Agent *agent, void *arg);
 typedef int agent_reaction_t(Agent *agent, int fd, int revents, void *arg);
+typedef int agent_task_t(Agent *agent, void *arg);
+typedef struct agent_stats_t agent_stats_t;
+
+#define AGENT_EDGE 0x100
+#define AGENT_ONESHOT 0x200
+#define AGENT_EXCLUSIVE 0x400
+#define AGENT_STATS_BUCKETS 24
+
+struct agent_stats_t
+{
+	unsigned long turns;                         /* number of waits for I/O events or timers */
+	unsigned long wait[AGENT_STATS_BUCKETS];     /* time spent waiting (usec) */
+	unsigned long events[AGENT_STATS_BUCKETS];   /* I/O events per turn */
+	unsigned long reaction[AGENT_STATS_BUCKETS]; /* time taken by reactions (usec) */
+	unsigned long action[AGENT_STATS_BUCKETS];   /* time taken by actions (usec) */
+	unsigned long lateness[AGENT_STATS_BUCKETS]; /* lateness of actions (usec) */
+	unsigned long cascade[AGENT_STATS_BUCKETS];  /* time taken to cascade timers (usec) */
+	long slowest_reaction;                       /* time taken by slowest reaction (usec) */
+	int slowest_fd;                              /* file descriptor of slowest reaction */
+};
 
 _begin_decls
 Agent *agent_create(void);
@@ -36,6 +56,8 @@ Agent *agent_create_measured(void);
 Agent *agent_create_measured_with_locker(Locker *locker);
 Agent *agent_create_using_select(void);
 Agent *agent_create_using_select_with_locker(Locker *locker);
+Agent *agent_create_using_epoll(void);
+Agent *agent_create_using_epoll_with_locker(Locker *locker);
 void agent_release(Agent *agent);
 void *agent_destroy(Agent **agent);
 int agent_rdlock(const Agent *agent);
@@ -63,10 +85,25 @@ int agent_dadt(Agent *agent, int fd);
 int agent_dadt_unlocked(Agent *agent, int fd);
 void *agent_schedule(Agent *agent, long sec, long usec, agent_action_t *action, void *arg);
 void *agent_schedule_unlocked(Agent *agent, long sec, long usec, agent_action_t *action, void *arg);
+int agent_reschedule(Agent *agent, void *action_id, long sec, long usec);
+int agent_reschedule_unlocked(Agent *agent, void *action_id, long sec, long usec);
 int agent_cancel(Agent *agent, void *action_id);
 int agent_cancel_unlocked(Agent *agent, void *action_id);
 int agent_start(Agent *agent);
 int agent_stop(Agent *agent);
+int agent_spawn(Agent *agent, size_t stacksize, agent_task_t *task, void *arg);
+int agent_spawn_unlocked(Agent *agent, size_t stacksize, agent_task_t *task, void *arg);
+int agent_sleep(Agent *agent, long sec, long usec);
+int agent_await_readable(Agent *agent, int fd, long sec, long usec);
+int agent_await_writable(Agent *agent, int fd, long sec, long usec);
+ssize_t agent_read(Agent *agent, int fd, long timeout, char *buf, size_t count);
+ssize_t agent_write(Agent *agent, int fd, long timeout, const char *buf, size_t count);
+int agent_stats_enable(Agent *agent);
+int agent_stats_enable_unlocked(Agent *agent);
+int agent_stats_disable(Agent *agent);
+int agent_stats_disable_unlocked(Agent *agent);
+int agent_stats(Agent *agent, agent_stats_t *stats);
+int agent_stats_unlocked(Agent *agent, agent_stats_t *stats);
 _end_decls
 
 #endif
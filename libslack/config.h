@@ -232,6 +232,12 @@
 /* Define if we have a poll() that aborts when pollfds is null */
 /* #undef HAVE_POLL_THAT_ABORTS_WHEN_POLLFDS_IS_NULL */
 
+/* Define if we have epoll_create1() and epoll_wait() (Linux) */
+#define HAVE_EPOLL 1
+
+/* Define if we have getcontext(), makecontext() and swapcontext() */
+#define HAVE_UCONTEXT 1
+
 #endif
 
 /* vi:set ts=4 sw=4: */
@@ -40,6 +40,8 @@
 #include <slack/prog.h>
 #include <slack/prop.h>
 #include <slack/pseudo.h>
+#include <slack/queue.h>
+#include <slack/rope.h>
 #include <slack/sig.h>
 #include <slack/str.h>
 
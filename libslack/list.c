@@ -120,6 +120,12 @@ I<libslack(list)> - list module
     List *list_splice_with_locker_unlocked(Locker *locker, List *list, ssize_t index, ssize_t range, list_copy_t *copy);
     List *list_sort(List *list, list_cmp_t *cmp);
     List *list_sort_unlocked(List *list, list_cmp_t *cmp);
+    List *list_sort_parallel(List *list, list_cmp_t *cmp, size_t threads);
+    List *list_sort_parallel_unlocked(List *list, list_cmp_t *cmp, size_t threads);
+    List *list_sort_int(List *list);
+    List *list_sort_int_unlocked(List *list);
+    List *list_sort_strings(List *list);
+    List *list_sort_strings_unlocked(List *list);
     void list_apply(List *list, list_action_t *action, void *data);
     void list_apply_rdlocked(List *list, list_action_t *action, void *data);
     void list_apply_wrlocked(List *list, list_action_t *action, void *data);
@@ -132,6 +138,18 @@ I<libslack(list)> - list module
     List *list_grep_unlocked(List *list, list_query_t *grep, void *data);
     List *list_grep_with_locker(Locker *locker, List *list, list_query_t *grep, void *data);
     List *list_grep_with_locker_unlocked(Locker *locker, List *list, list_query_t *grep, void *data);
+    void list_apply_parallel(List *list, list_action_t *action, void *data, size_t threads);
+    void list_apply_parallel_rdlocked(List *list, list_action_t *action, void *data, size_t threads);
+    void list_apply_parallel_wrlocked(List *list, list_action_t *action, void *data, size_t threads);
+    void list_apply_parallel_unlocked(List *list, list_action_t *action, void *data, size_t threads);
+    List *list_map_parallel(List *list, list_release_t *destroy, list_map_t *map, void *data, size_t threads);
+    List *list_map_parallel_unlocked(List *list, list_release_t *destroy, list_map_t *map, void *data, size_t threads);
+    List *list_map_parallel_with_locker(Locker *locker, List *list, list_release_t *destroy, list_map_t *map, void *data, size_t threads);
+    List *list_map_parallel_with_locker_unlocked(Locker *locker, List *list, list_release_t *destroy, list_map_t *map, void *data, size_t threads);
+    List *list_grep_parallel(List *list, list_query_t *grep, void *data, size_t threads);
+    List *list_grep_parallel_unlocked(List *list, list_query_t *grep, void *data, size_t threads);
+    List *list_grep_parallel_with_locker(Locker *locker, List *list, list_query_t *grep, void *data, size_t threads);
+    List *list_grep_parallel_with_locker_unlocked(Locker *locker, List *list, list_query_t *grep, void *data, size_t threads);
     ssize_t list_query(List *list, ssize_t *index, list_query_t *query, void *data);
     ssize_t list_query_unlocked(List *list, ssize_t *index, list_query_t *query, void *data);
     Lister *lister_create(List *list);
@@ -163,6 +181,13 @@ insert items owned by one list into a list that doesn't own its own items
 unless you know that the source list (and all of the shared items) will
 outlive the destination list.
 
+The items are kept in a single vector, so any item can be accessed in
+constant time. Free space is kept at both ends of the vector as needed, so
+adding or removing items at either end (e.g. with I<list_push(3)> and
+I<list_shift(3)> when a list is used as a queue) takes constant amortised
+time. Inserting or removing items elsewhere moves the items on whichever
+side of the change is shorter.
+
 =over 4
 
 =cut
@@ -187,36 +212,170 @@ struct List
 	size_t size;             /* number of item slots allocated */
 	size_t length;           /* number of items used */
 	void **list;             /* vector of items (void *) */
+	size_t front;            /* number of free slots allocated before the first item */
 	list_release_t *destroy; /* item destructor, if any */
 	Lister *lister;          /* built-in iterator */
 	Locker *locker;          /* locking strategy for this object */
 };
 
+typedef void list_task_t(void *arg);
+typedef struct list_job_t list_job_t;
+typedef struct list_pool_t list_pool_t;
+typedef struct sort_task_t sort_task_t;
+typedef struct chunk_task_t chunk_task_t;
+
 struct Lister
 {
 	List *list;              /* the list being iterated over */
 	ssize_t index;           /* the index of the current item */
 };
 
+struct list_job_t
+{
+	list_task_t *task;       /* the function to run */
+	void *args;              /* the array of arguments, one per task */
+	size_t size;             /* the size of each argument */
+	size_t tasks;            /* the number of tasks */
+	size_t next;             /* the next task to claim */
+	size_t done;             /* the number of finished tasks */
+	list_job_t *link;        /* the next job with unclaimed tasks */
+};
+
+struct list_pool_t
+{
+	pthread_mutex_t lock;    /* protects the rest */
+	pthread_cond_t work;     /* signalled when jobs are queued */
+	pthread_cond_t done;     /* signalled when a job finishes */
+	list_job_t *jobs;        /* jobs with unclaimed tasks */
+	size_t workers;          /* the number of worker threads */
+};
+
+struct sort_task_t
+{
+	void **src;              /* the items to sort or merge */
+	void **dst;              /* where to merge them */
+	size_t lo;               /* the start of the first run */
+	size_t mid;              /* the start of the second run (if merging) */
+	size_t hi;               /* the end of the last run */
+	list_cmp_t *cmp;         /* item comparison function */
+};
+
+struct chunk_task_t
+{
+	List *list;              /* the list being traversed */
+	size_t lo;               /* the index of the chunk's first item */
+	size_t hi;               /* the index after the chunk's last item */
+	list_action_t *action;   /* the apply callback */
+	list_map_t *map;         /* the map callback */
+	list_query_t *grep;      /* the grep callback */
+	void *data;              /* the callback's data */
+	void **out;              /* where to store mapped or matching items */
+	size_t found;            /* the number of matching items */
+};
+
 #ifndef TEST
 
 /* Minimum list length: must be a power of 2 */
 
 static const size_t MIN_LIST_SIZE = 4;
 
+/* Lists shorter than this are sorted by a single thread */
+
+static const size_t PARALLEL_SORT_MIN = 50000;
+
+/* Upper limit on the size of the worker pool shared by all lists */
+
+static const size_t MAX_POOL_WORKERS = 64;
+
+/* Number of chunks per thread for parallel apply/map/grep (for balance) */
+
+static const size_t CHUNKS_PER_THREAD = 4;
+
+/* The worker pool */
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+static list_pool_t pool =
+{
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	NULL,
+	0
+};
+
+/* The start of the memory allocated for a list's items */
+
+#define vector(list) (((list)->list) ? (list)->list - (list)->front : NULL)
+
+/*
+
+C<void reclaim(List *list, size_t length)>
+
+Slides the first C<length> items of C<list> to the start of its allocated
+memory, so that the free slots in front of them (left by removing items
+from the front) can be used at the end instead.
+
+*/
+
+static void reclaim(List *list, size_t length)
+{
+	if (!list->front)
+		return;
+
+	memmove(list->list - list->front, list->list, length * sizeof(*list->list));
+	list->list -= list->front;
+	list->size += list->front;
+	list->front = 0;
+}
+
+/*
+
+C<int headroom(List *list, size_t front)>
+
+Reallocates C<list> with C<front> free slots before its first item, so
+that items can be inserted near the front without moving the rest. On
+success, returns C<0>. On error, returns C<-1>.
+
+*/
+
+static int headroom(List *list, size_t front)
+{
+	size_t size = (list->size) ? list->size : MIN_LIST_SIZE;
+	void **base;
+
+	if (!(base = mem_create(front + size, void *)))
+		return -1;
+
+	if (list->length)
+		memcpy(base + front, list->list, list->length * sizeof(*list->list));
+
+	mem_release(vector(list));
+	list->list = base + front;
+	list->front = front;
+	list->size = size;
+
+	return 0;
+}
+
 /*
 
 C<int grow(List *list, size_t items)>
 
 Allocates enough memory to add C<item> extra items to C<list> if necessary.
-On success, returns C<0>. On error, returns C<-1>.
+Free slots in front of the items are reused first if there are more of
+them than items. On success, returns C<0>. On error, returns C<-1>.
 
 */
 
 static int grow(List *list, size_t items)
 {
+	void **base;
 	int grown = 0;
 
+	if (list->length + items > list->size && list->front > list->length)
+		reclaim(list, list->length);
+
 	while (list->length + items > list->size)
 	{
 		if (list->size)
@@ -228,7 +387,14 @@ static int grow(List *list, size_t items)
 	}
 
 	if (grown)
-		return mem_resize(&list->list, list->size) ? 0 : -1;
+	{
+		base = vector(list);
+
+		if (!mem_resize(&base, list->front + list->size))
+			return -1;
+
+		list->list = base + list->front;
+	}
 
 	return 0;
 }
@@ -238,17 +404,23 @@ static int grow(List *list, size_t items)
 C<int shrink(List *list, size_t items)>
 
 Allocates less memory for removing C<items> items from C<list> if necessary.
-On success, returns C<0>. On error, returns C<-1>.
+Free slots in front of the items are reclaimed first when there are more
+than twice as many of them as remaining items. On success, returns C<0>. On
+error, returns C<-1>.
 
 */
 
 static int shrink(List *list, size_t items)
 {
+	void **base;
 	int shrunk = 0;
 
+	if (list->front > 2 * (list->length - items) + MIN_LIST_SIZE)
+		reclaim(list, list->length - items);
+
 	while (list->length - items < list->size >> 1)
 	{
-		if (list->size == MIN_LIST_SIZE)
+		if (list->size >> 1 < MIN_LIST_SIZE)
 			break;
 
 		list->size >>= 1;
@@ -256,7 +428,14 @@ static int shrink(List *list, size_t items)
 	}
 
 	if (shrunk)
-		return mem_resize(&list->list, list->size) ? 0 : -1;
+	{
+		base = vector(list);
+
+		if (!mem_resize(&base, list->front + list->size))
+			return -1;
+
+		list->list = base + list->front;
+	}
 
 	return 0;
 }
@@ -266,12 +445,31 @@ static int shrink(List *list, size_t items)
 C<int expand(List *list, ssize_t index, size_t range)>
 
 Slides C<list>'s items, starting at C<index>, C<range> slots to the right to
-make room for more. On success, returns C<0>. On error, returns C<-1>.
+make room for more. If there are fewer items before C<index> than after it,
+those items slide C<range> slots to the left instead, into the free slots
+in front of the list (which are reallocated, with room for as many items as
+there already are, when there aren't enough). This makes inserting at the
+front (e.g. I<list_unshift(3)>) take constant amortised time. On success,
+returns C<0>. On error, returns C<-1>.
 
 */
 
 static int expand(List *list, ssize_t index, size_t range)
 {
+	if (index < list->length - index)
+	{
+		if (list->front < range && headroom(list, list->length + range) == -1)
+			return -1;
+
+		memmove(list->list - range, list->list, index * sizeof(*list->list));
+		list->list -= range;
+		list->front -= range;
+		list->size += range;
+		list->length += range;
+
+		return 0;
+	}
+
 	if (grow(list, range) == -1)
 		return -1;
 
@@ -286,14 +484,25 @@ static int expand(List *list, ssize_t index, size_t range)
 C<int contract(List *list, ssize_t index, size_t range)>
 
 Slides C<list>'s items, starting at C<index> + C<range>, C<range> slots to
-the left to close a gap starting at C<index>. On success, returns C<0>. On
-error, returns C<-1>.
+the left to close a gap starting at C<index>. If there are fewer items
+before the gap than after it, those items slide C<range> slots to the right
+instead, leaving free slots in front of the list. This makes removing from
+the front (e.g. I<list_shift(3)>) take constant amortised time. On success,
+returns C<0>. On error, returns C<-1>.
 
 */
 
 static int contract(List *list, ssize_t index, size_t range)
 {
-	memmove(list->list + index, list->list + index + range, (list->length - index - range) * sizeof(*list->list));
+	if (index < list->length - index - range)
+	{
+		memmove(list->list + range, list->list, index * sizeof(*list->list));
+		list->list += range;
+		list->front += range;
+		list->size -= range;
+	}
+	else
+		memmove(list->list + index, list->list + index + range, (list->length - index - range) * sizeof(*list->list));
 
 	if (shrink(list, range) == -1)
 		return -1;
@@ -442,6 +651,7 @@ List *list_create_with_locker(Locker *locker, list_release_t *destroy)
 
 	list->size = list->length = 0;
 	list->list = NULL;
+	list->front = 0;
 	list->destroy = destroy;
 	list->lister = NULL;
 	list->locker = locker;
@@ -609,7 +819,7 @@ void list_release(List *list)
 	if (list->list)
 	{
 		killitems(list, 0, list->length);
-		mem_release(list->list);
+		mem_release(vector(list));
 	}
 
 	mem_release(list);
@@ -2237,225 +2447,807 @@ List *list_sort_unlocked(List *list, list_cmp_t *cmp)
 
 /*
 
-=item C<void list_apply(List *list, list_action_t *action, void *data)>
+C<size_t list_threads(size_t threads)>
 
-Invokes C<action> for each of C<list>'s items. The arguments passed to
-C<action> are the item, a pointer to the loop variable containing the item's
-position within C<list>, and C<data>. On error, sets C<errno> appropriately.
+Returns C<threads>, or the number of online processors if C<threads> is
+zero.
 
-=cut
+*/
+
+static size_t list_threads(size_t threads)
+{
+	long cpus;
+
+	if (threads)
+		return threads;
+
+	return ((cpus = sysconf(_SC_NPROCESSORS_ONLN)) > 0) ? (size_t)cpus : 1;
+}
+
+/*
+
+C<void pool_child(void)>
+
+Resets the worker pool in the child process after I<fork(2)>. The workers
+are not inherited, so the pool starts again with none.
 
 */
 
-void list_apply(List *list, list_action_t *action, void *data)
+static void pool_child(void)
 {
-	list_apply_wrlocked(list, action, data);
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.work, NULL);
+	pthread_cond_init(&pool.done, NULL);
+	pool.jobs = NULL;
+	pool.workers = 0;
 }
 
 /*
 
-=item C<void list_apply_rdlocked(List *list, list_action_t *action, void *data)>
+C<void pool_init(void)>
 
-Equivalent to I<list_apply(3)> except that C<list> is read-locked rather
-than write-locked. Use this in preference to I<list_apply(3)> when C<list>
-and its items will not be modified during the iteration.
+Registers I<pool_child()> with I<pthread_atfork(3)>. Called once, the first
+time that I<list_run()> runs tasks in parallel.
 
-=cut
+*/
+
+static void pool_init(void)
+{
+	pthread_atfork(NULL, NULL, pool_child);
+}
+
+/*
+
+C<void *pool_claim(list_job_t *job)>
+
+Claims the next unclaimed task of C<job>, and returns its argument. When
+the last task is claimed, C<job> is removed from the pool's queue. Must be
+called with the pool locked.
 
 */
 
-void list_apply_rdlocked(List *list, list_action_t *action, void *data)
+static void *pool_claim(list_job_t *job)
 {
-	int err;
+	list_job_t **link;
+	size_t i = job->next++;
 
-	if (!list || !action)
+	if (job->next == job->tasks)
 	{
-		set_errno(EINVAL);
-		return;
+		for (link = &pool.jobs; *link; link = &(*link)->link)
+		{
+			if (*link == job)
+			{
+				*link = job->link;
+				break;
+			}
+		}
 	}
 
-	if ((err = list_rdlock(list)))
-	{
-		set_errno(err);
-		return;
-	}
+	return (char *)job->args + i * job->size;
+}
 
-	list_apply_unlocked(list, action, data);
+/*
 
-	if ((err = list_unlock(list)))
-		set_errno(err);
+C<void pool_finish(list_job_t *job)>
+
+Records that one of C<job>'s tasks has finished, and wakes up the thread
+waiting for C<job> when it was the last. Must be called with the pool
+locked.
+
+*/
+
+static void pool_finish(list_job_t *job)
+{
+	if (++job->done == job->tasks)
+		pthread_cond_broadcast(&pool.done);
 }
 
 /*
 
-=item C<void list_apply_wrlocked(List *list, list_action_t *action, void *data)>
-
-Equivalent to I<list_apply(3)> except that this function name makes the fact
-that C<list> is write-locked explicit.
+C<void *pool_worker(void *arg)>
 
-=cut
+Thread start routine for the workers in the pool. Waits for jobs to be
+queued by I<list_run()>, and runs their tasks, forever.
 
 */
 
-void list_apply_wrlocked(List *list, list_action_t *action, void *data)
+static void *pool_worker(void *arg)
 {
-	int err;
+	list_job_t *job;
+	void *task;
 
-	if (!list || !action)
-	{
-		set_errno(EINVAL);
-		return;
-	}
+	pthread_mutex_lock(&pool.lock);
 
-	if ((err = list_wrlock(list)))
+	for (;;)
 	{
-		set_errno(err);
-		return;
+		while (!(job = pool.jobs))
+			pthread_cond_wait(&pool.work, &pool.lock);
+
+		task = pool_claim(job);
+		pthread_mutex_unlock(&pool.lock);
+		job->task(task);
+		pthread_mutex_lock(&pool.lock);
+		pool_finish(job);
 	}
 
-	list_apply_unlocked(list, action, data);
-
-	if ((err = list_unlock(list)))
-		set_errno(err);
+	return NULL;
 }
 
 /*
 
-=item C<void list_apply_unlocked(List *list, list_action_t *action, void *data)>
-
-Equivalent to I<list_apply(3)> except that C<list> is not write-locked.
+C<int list_run(list_task_t *task, void *args, size_t size, size_t tasks)>
 
-=cut
+Calls C<task> once for each of the C<tasks> arguments (each C<size> bytes)
+in the array C<args>, in parallel. The tasks are queued for a pool of
+worker threads that is shared by all lists, and that is started on demand
+(up to C<64> threads) and then reused. The calling thread runs tasks as
+well, so all tasks are run even if no worker threads can be created, and
+tasks can safely call I<list_run()> themselves. Returns when every task has
+finished. On success, returns C<0>. On error, returns C<-1> with C<errno>
+set appropriately.
 
 */
 
-void list_apply_unlocked(List *list, list_action_t *action, void *data)
+static int list_run(list_task_t *task, void *args, size_t size, size_t tasks)
 {
-	size_t i;
+	pthread_attr_t attr;
+	pthread_t id;
+	list_job_t job;
+	size_t workers;
+	void *arg;
+	int err;
 
-	if (!list || !action)
+	if (tasks <= 1)
 	{
-		set_errno(EINVAL);
-		return;
+		if (tasks)
+			task(args);
+
+		return 0;
 	}
 
-	for (i = 0; i < list->length; ++i)
-		action(list->list[i], &i, data);
+	if ((err = pthread_once(&pool_once, pool_init)))
+		return set_errno(err);
+
+	job.task = task;
+	job.args = args;
+	job.size = size;
+	job.tasks = tasks;
+	job.next = 0;
+	job.done = 0;
+
+	if ((err = pthread_mutex_lock(&pool.lock)))
+		return set_errno(err);
+
+	/* Start more workers if needed */
+
+	if ((workers = tasks - 1) > MAX_POOL_WORKERS)
+		workers = MAX_POOL_WORKERS;
+
+	if (pool.workers < workers && !pthread_attr_init(&attr))
+	{
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+		while (pool.workers < workers && !pthread_create(&id, &attr, pool_worker, NULL))
+			++pool.workers;
+
+		pthread_attr_destroy(&attr);
+	}
+
+	/* Queue the job, and help run it */
+
+	job.link = pool.jobs;
+	pool.jobs = &job;
+	pthread_cond_broadcast(&pool.work);
+
+	while (job.next < job.tasks)
+	{
+		arg = pool_claim(&job);
+		pthread_mutex_unlock(&pool.lock);
+		task(arg);
+		pthread_mutex_lock(&pool.lock);
+		pool_finish(&job);
+	}
+
+	while (job.done < job.tasks)
+		pthread_cond_wait(&pool.done, &pool.lock);
+
+	pthread_mutex_unlock(&pool.lock);
+
+	return 0;
 }
 
 /*
 
-=item C<List *list_map(List *list, list_release_t *destroy, list_map_t *map, void *data)>
-
-Creates and returns a new list containing the return values of C<map>,
-invoked once for each item in C<list>. The arguments passed to C<map> are
-the item, a pointer to the loop variable containing the item's position
-within C<list>, and C<data>. C<destroy> will be the item destructor for the
-new list. It is the caller's responsibility to deallocate the new list with
-I<list_release(3)> or I<list_destroy(3)>. It is strongly recommended to use
-I<list_destroy(3)>, because it also sets the pointer variable to C<null>. On
-success, returns the new list. On error, returns C<null> with C<errno> set
-appropriately.
+C<void sort_run(void *arg)>
 
-=cut
+Sorts the run of items described by the I<sort_task_t> C<arg> in place, as
+I<list_sort(3)> would.
 
 */
 
-List *list_map(List *list, list_release_t *destroy, list_map_t *map, void *data)
+static void sort_run(void *arg)
 {
-	return list_map_with_locker(NULL, list, destroy, map, data);
+	sort_task_t *task = arg;
+
+	((task->hi - task->lo >= 10000) ? hsort : qsort)(task->src + task->lo, task->hi - task->lo, sizeof(void *), task->cmp);
 }
 
 /*
 
-=item C<List *list_map_unlocked(List *list, list_release_t *destroy, list_map_t *map, void *data)>
-
-Equivalent to I<list_map(3)> except that C<list> is not read-locked.
+C<void sort_merge(void *arg)>
 
-=cut
+Merges the adjacent sorted runs described by the I<sort_task_t> C<arg>
+into its destination.
 
 */
 
-List *list_map_unlocked(List *list, list_release_t *destroy, list_map_t *map, void *data)
+static void sort_merge(void *arg)
 {
-	return list_map_with_locker_unlocked(NULL, list, destroy, map, data);
+	sort_task_t *task = arg;
+	void **a = task->src + task->lo, **a_end = task->src + task->mid;
+	void **b = task->src + task->mid, **b_end = task->src + task->hi;
+	void **dst = task->dst + task->lo;
+
+	while (a < a_end && b < b_end)
+		*dst++ = (task->cmp(b, a) < 0) ? *b++ : *a++;
+
+	memcpy(dst, a, (a_end - a) * sizeof(void *));
+	dst += a_end - a;
+	memcpy(dst, b, (b_end - b) * sizeof(void *));
 }
 
 /*
 
-=item C<List *list_map_with_locker(Locker *locker, List *list, list_release_t *destroy, list_map_t *map, void *data)>
+=item C<List *list_sort_parallel(List *list, list_cmp_t *cmp, size_t threads)>
 
-Equivalent to I<list_map(3)> except that multiple threads accessing the new
-list will be synchronised by C<locker>.
+Equivalent to I<list_sort(3)> except that large lists are sorted by
+C<threads> threads (or by one thread per online processor if C<threads> is
+zero). The list is divided into one run per thread, and the runs are
+sorted in parallel, and then merged together in pairs (also in parallel)
+into a temporary vector and back. C<cmp> must be safe to call from
+multiple threads at once. Lists with fewer than C<50000> items are sorted
+by I<list_sort(3)> directly. On success, returns C<list>. On error, returns
+C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-List *list_map_with_locker(Locker *locker, List *list, list_release_t *destroy, list_map_t *map, void *data)
+List *list_sort_parallel(List *list, list_cmp_t *cmp, size_t threads)
 {
-	List *mapping;
+	List *ret;
 	int err;
 
-	if (!list || !map)
+	if (!list)
 		return set_errnull(EINVAL);
 
-	if ((err = list_rdlock(list)))
+	if ((err = list_wrlock(list)))
 		return set_errnull(err);
 
-	mapping = list_map_with_locker_unlocked(locker, list, destroy, map, data);
+	ret = list_sort_parallel_unlocked(list, cmp, threads);
 
 	if ((err = list_unlock(list)))
-	{
-		list_release(mapping);
 		return set_errnull(err);
-	}
 
-	return mapping;
+	return ret;
 }
 
 /*
 
-=item C<List *list_map_with_locker_unlocked(Locker *locker, List *list, list_release_t *destroy, list_map_t *map, void *data)>
+=item C<List *list_sort_parallel_unlocked(List *list, list_cmp_t *cmp, size_t threads)>
 
-Equivalent to I<list_map_with_locker(3)> except that C<list> is not
-read-locked.
+Equivalent to I<list_sort_parallel(3)> except that C<list> is not
+write-locked.
 
 =cut
 
 */
 
-List *list_map_with_locker_unlocked(Locker *locker, List *list, list_release_t *destroy, list_map_t *map, void *data)
+List *list_sort_parallel_unlocked(List *list, list_cmp_t *cmp, size_t threads)
 {
-	List *mapping;
-	size_t i;
+	sort_task_t *task;
+	size_t *bound;
+	void **src, **dst, **tmp;
+	size_t runs, pairs, i;
 
-	if (!list || !map)
+	if (!list || !cmp)
 		return set_errnull(EINVAL);
 
-	if (!(mapping = list_create_with_locker(locker, destroy)))
+	if (!list->list || !list->length)
+		return set_errnull(EINVAL);
+
+	if ((runs = list_threads(threads)) == 1 || list->length < PARALLEL_SORT_MIN)
+		return list_sort_unlocked(list, cmp);
+
+	if (!(tmp = mem_create(list->length, void *)))
 		return NULL;
 
-	for (i = 0; i < list->length; ++i)
+	if (!(task = mem_create(runs, sort_task_t)) || !(bound = mem_create(runs + 1, size_t)))
 	{
-		if (!list_append(mapping, map(list->list[i], &i, data)))
-		{
-			list_release(mapping);
-			return NULL;
-		}
+		mem_release(task);
+		mem_release(tmp);
+		return NULL;
 	}
 
-	return mapping;
-}
+	/* Sort one run per thread */
 
-/*
+	for (i = 0; i <= runs; ++i)
+		bound[i] = list->length / runs * i + ((i == runs) ? list->length % runs : 0);
 
-=item C<List *list_grep(List *list, list_query_t *grep, void *data)>
+	for (i = 0; i < runs; ++i)
+	{
+		task[i].src = list->list;
+		task[i].lo = bound[i];
+		task[i].hi = bound[i + 1];
+		task[i].cmp = cmp;
+	}
 
-Creates and returns a new list by invoking C<grep> for each item in C<list>,
-and appending the items for which C<grep> returned a non-zero value. The
-arguments passed to C<grep> are the item, a pointer to the loop variable
-containing the item's position within C<list>, and C<data>. It is the
+	list_run(sort_run, task, sizeof(sort_task_t), runs);
+
+	/* Merge pairs of runs back and forth until only one remains */
+
+	for (src = list->list, dst = tmp; runs > 1; runs = (runs + 1) / 2)
+	{
+		pairs = (runs + 1) / 2;
+
+		for (i = 0; i < pairs; ++i)
+		{
+			task[i].src = src;
+			task[i].dst = dst;
+			task[i].lo = bound[2 * i];
+			task[i].mid = (2 * i + 1 < runs) ? bound[2 * i + 1] : bound[runs];
+			task[i].hi = (2 * i + 2 < runs) ? bound[2 * i + 2] : bound[runs];
+			task[i].cmp = cmp;
+		}
+
+		list_run(sort_merge, task, sizeof(sort_task_t), pairs);
+
+		for (i = 0; i < pairs; ++i)
+			bound[i] = task[i].lo;
+
+		bound[pairs] = list->length;
+		tmp = src, src = dst, dst = tmp;
+	}
+
+	if (src != list->list)
+		memcpy(list->list, src, list->length * sizeof(void *));
+
+	mem_release((src != list->list) ? src : dst);
+	mem_release(bound);
+	mem_release(task);
+
+	return list;
+}
+
+/*
+
+=item C<List *list_sort_int(List *list)>
+
+Sorts the items in C<list>, which must all be integers (i.e. added with
+I<list_append_int(3)> or similar), into ascending order using a radix sort.
+This doesn't compare items at all, and takes time proportional to the
+length of the list. On success, returns C<list>. On error, returns C<null>
+with C<errno> set appropriately.
+
+=cut
+
+*/
+
+List *list_sort_int(List *list)
+{
+	List *ret;
+	int err;
+
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if ((err = list_wrlock(list)))
+		return set_errnull(err);
+
+	ret = list_sort_int_unlocked(list);
+
+	if ((err = list_unlock(list)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<List *list_sort_int_unlocked(List *list)>
+
+Equivalent to I<list_sort_int(3)> except that C<list> is not write-locked.
+
+=cut
+
+*/
+
+#define INT_KEY(item) ((unsigned int)(int)(long)(item) ^ (1u << (sizeof(int) * CHAR_BIT - 1)))
+
+List *list_sort_int_unlocked(List *list)
+{
+	size_t count[256];
+	void **src, **dst, **tmp;
+	size_t shift, i, sum, next;
+
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if (!list->list || !list->length)
+		return set_errnull(EINVAL);
+
+	if (!(tmp = mem_create(list->length, void *)))
+		return NULL;
+
+	/* One counting pass per byte, least significant first, skipping uniform bytes */
+
+	for (src = list->list, dst = tmp, shift = 0; shift < sizeof(int) * CHAR_BIT; shift += 8)
+	{
+		memset(count, 0, sizeof(count));
+
+		for (i = 0; i < list->length; ++i)
+			++count[(INT_KEY(src[i]) >> shift) & 0xff];
+
+		if (count[(INT_KEY(src[0]) >> shift) & 0xff] == list->length)
+			continue;
+
+		for (i = 0, sum = 0; i < 256; ++i)
+			next = sum + count[i], count[i] = sum, sum = next;
+
+		for (i = 0; i < list->length; ++i)
+			dst[count[(INT_KEY(src[i]) >> shift) & 0xff]++] = src[i];
+
+		tmp = src, src = dst, dst = tmp;
+	}
+
+	if (src != list->list)
+		memcpy(list->list, src, list->length * sizeof(void *));
+
+	mem_release((src != list->list) ? src : dst);
+
+	return list;
+}
+
+/*
+
+C<void string_sort(char **a, size_t n, size_t depth)>
+
+Sorts the C<n> strings in C<a>, which are identical before offset
+C<depth>, with a multikey quicksort (Bentley and Sedgewick). Each step
+partitions the strings by a single character, so common prefixes are only
+examined once. Short ranges are finished with an insertion sort.
+
+*/
+
+#define STRING_CHAR(s) ((unsigned char)(s)[depth])
+#define STRING_SWAP(i, j) (t = a[i], a[i] = a[j], a[j] = t)
+
+static void string_sort(char **a, size_t n, size_t depth)
+{
+	size_t lt, gt, i, j, m;
+	int v, c;
+	char *t;
+
+	while (n > 16)
+	{
+		/* Move the median of three characters to the front, as the pivot */
+
+		m = n / 2;
+
+		if (STRING_CHAR(a[m]) < STRING_CHAR(a[0]))
+			STRING_SWAP(m, 0);
+		if (STRING_CHAR(a[n - 1]) < STRING_CHAR(a[0]))
+			STRING_SWAP(n - 1, 0);
+		if (STRING_CHAR(a[n - 1]) < STRING_CHAR(a[m]))
+			STRING_SWAP(n - 1, m);
+
+		STRING_SWAP(0, m);
+		v = STRING_CHAR(a[0]);
+
+		for (lt = 0, i = 1, gt = n; i < gt; )
+		{
+			if ((c = STRING_CHAR(a[i])) < v)
+				STRING_SWAP(lt, i), ++lt, ++i;
+			else if (c > v)
+				--gt, STRING_SWAP(i, gt);
+			else
+				++i;
+		}
+
+		string_sort(a, lt, depth);
+		string_sort(a + gt, n - gt, depth);
+
+		if (!v)
+			return;
+
+		a += lt;
+		n = gt - lt;
+		++depth;
+	}
+
+	for (i = 1; i < n; ++i)
+		for (j = i; j > 0 && strcmp(a[j - 1] + depth, a[j] + depth) > 0; --j)
+			STRING_SWAP(j - 1, j);
+}
+
+/*
+
+=item C<List *list_sort_strings(List *list)>
+
+Sorts the items in C<list>, which must all be strings, into the order
+defined by I<strcmp(3)>, using a multikey quicksort. This examines each
+character of a common prefix once, rather than in every comparison, and
+makes no calls through a comparison function. On success, returns C<list>.
+On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+List *list_sort_strings(List *list)
+{
+	List *ret;
+	int err;
+
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if ((err = list_wrlock(list)))
+		return set_errnull(err);
+
+	ret = list_sort_strings_unlocked(list);
+
+	if ((err = list_unlock(list)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<List *list_sort_strings_unlocked(List *list)>
+
+Equivalent to I<list_sort_strings(3)> except that C<list> is not
+write-locked.
+
+=cut
+
+*/
+
+List *list_sort_strings_unlocked(List *list)
+{
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if (!list->list || !list->length)
+		return set_errnull(EINVAL);
+
+	string_sort((char **)list->list, list->length, 0);
+
+	return list;
+}
+
+/*
+
+=item C<void list_apply(List *list, list_action_t *action, void *data)>
+
+Invokes C<action> for each of C<list>'s items. The arguments passed to
+C<action> are the item, a pointer to the loop variable containing the item's
+position within C<list>, and C<data>. On error, sets C<errno> appropriately.
+
+=cut
+
+*/
+
+void list_apply(List *list, list_action_t *action, void *data)
+{
+	list_apply_wrlocked(list, action, data);
+}
+
+/*
+
+=item C<void list_apply_rdlocked(List *list, list_action_t *action, void *data)>
+
+Equivalent to I<list_apply(3)> except that C<list> is read-locked rather
+than write-locked. Use this in preference to I<list_apply(3)> when C<list>
+and its items will not be modified during the iteration.
+
+=cut
+
+*/
+
+void list_apply_rdlocked(List *list, list_action_t *action, void *data)
+{
+	int err;
+
+	if (!list || !action)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	if ((err = list_rdlock(list)))
+	{
+		set_errno(err);
+		return;
+	}
+
+	list_apply_unlocked(list, action, data);
+
+	if ((err = list_unlock(list)))
+		set_errno(err);
+}
+
+/*
+
+=item C<void list_apply_wrlocked(List *list, list_action_t *action, void *data)>
+
+Equivalent to I<list_apply(3)> except that this function name makes the fact
+that C<list> is write-locked explicit.
+
+=cut
+
+*/
+
+void list_apply_wrlocked(List *list, list_action_t *action, void *data)
+{
+	int err;
+
+	if (!list || !action)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	if ((err = list_wrlock(list)))
+	{
+		set_errno(err);
+		return;
+	}
+
+	list_apply_unlocked(list, action, data);
+
+	if ((err = list_unlock(list)))
+		set_errno(err);
+}
+
+/*
+
+=item C<void list_apply_unlocked(List *list, list_action_t *action, void *data)>
+
+Equivalent to I<list_apply(3)> except that C<list> is not write-locked.
+
+=cut
+
+*/
+
+void list_apply_unlocked(List *list, list_action_t *action, void *data)
+{
+	size_t i;
+
+	if (!list || !action)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	for (i = 0; i < list->length; ++i)
+		action(list->list[i], &i, data);
+}
+
+/*
+
+=item C<List *list_map(List *list, list_release_t *destroy, list_map_t *map, void *data)>
+
+Creates and returns a new list containing the return values of C<map>,
+invoked once for each item in C<list>. The arguments passed to C<map> are
+the item, a pointer to the loop variable containing the item's position
+within C<list>, and C<data>. C<destroy> will be the item destructor for the
+new list. It is the caller's responsibility to deallocate the new list with
+I<list_release(3)> or I<list_destroy(3)>. It is strongly recommended to use
+I<list_destroy(3)>, because it also sets the pointer variable to C<null>. On
+success, returns the new list. On error, returns C<null> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+List *list_map(List *list, list_release_t *destroy, list_map_t *map, void *data)
+{
+	return list_map_with_locker(NULL, list, destroy, map, data);
+}
+
+/*
+
+=item C<List *list_map_unlocked(List *list, list_release_t *destroy, list_map_t *map, void *data)>
+
+Equivalent to I<list_map(3)> except that C<list> is not read-locked.
+
+=cut
+
+*/
+
+List *list_map_unlocked(List *list, list_release_t *destroy, list_map_t *map, void *data)
+{
+	return list_map_with_locker_unlocked(NULL, list, destroy, map, data);
+}
+
+/*
+
+=item C<List *list_map_with_locker(Locker *locker, List *list, list_release_t *destroy, list_map_t *map, void *data)>
+
+Equivalent to I<list_map(3)> except that multiple threads accessing the new
+list will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *list_map_with_locker(Locker *locker, List *list, list_release_t *destroy, list_map_t *map, void *data)
+{
+	List *mapping;
+	int err;
+
+	if (!list || !map)
+		return set_errnull(EINVAL);
+
+	if ((err = list_rdlock(list)))
+		return set_errnull(err);
+
+	mapping = list_map_with_locker_unlocked(locker, list, destroy, map, data);
+
+	if ((err = list_unlock(list)))
+	{
+		list_release(mapping);
+		return set_errnull(err);
+	}
+
+	return mapping;
+}
+
+/*
+
+=item C<List *list_map_with_locker_unlocked(Locker *locker, List *list, list_release_t *destroy, list_map_t *map, void *data)>
+
+Equivalent to I<list_map_with_locker(3)> except that C<list> is not
+read-locked.
+
+=cut
+
+*/
+
+List *list_map_with_locker_unlocked(Locker *locker, List *list, list_release_t *destroy, list_map_t *map, void *data)
+{
+	List *mapping;
+	size_t i;
+
+	if (!list || !map)
+		return set_errnull(EINVAL);
+
+	if (!(mapping = list_create_with_locker(locker, destroy)))
+		return NULL;
+
+	for (i = 0; i < list->length; ++i)
+	{
+		if (!list_append(mapping, map(list->list[i], &i, data)))
+		{
+			list_release(mapping);
+			return NULL;
+		}
+	}
+
+	return mapping;
+}
+
+/*
+
+=item C<List *list_grep(List *list, list_query_t *grep, void *data)>
+
+Creates and returns a new list by invoking C<grep> for each item in C<list>,
+and appending the items for which C<grep> returned a non-zero value. The
+arguments passed to C<grep> are the item, a pointer to the loop variable
+containing the item's position within C<list>, and C<data>. It is the
 caller's responsibility to deallocate the new list with I<list_release(3)>
 or I<list_destroy(3)>. It is strongly recommended to use I<list_destroy(3)>,
 because it also sets the pointer variable to C<null>. Note that the new list
@@ -2466,49 +3258,521 @@ the new list. On error, returns C<null> with C<errno> set appropriately.
 
 */
 
-List *list_grep(List *list, list_query_t *grep, void *data)
+List *list_grep(List *list, list_query_t *grep, void *data)
+{
+	return list_grep_with_locker(NULL, list, grep, data);
+}
+
+/*
+
+=item C<List *list_grep_unlocked(List *list, list_query_t *grep, void *data)>
+
+Equivalent to I<list_grep(3)> except that C<list> is not read-locked.
+
+=cut
+
+*/
+
+List *list_grep_unlocked(List *list, list_query_t *grep, void *data)
+{
+	return list_grep_with_locker_unlocked(NULL, list, grep, data);
+}
+
+/*
+
+=item C<List *list_grep_with_locker(Locker *locker, List *list, list_query_t *grep, void *data)>
+
+Equivalent to I<list_grep(3)> except that multiple threads accessing the new
+list will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *list_grep_with_locker(Locker *locker, List *list, list_query_t *grep, void *data)
+{
+	List *grepping;
+	int err;
+
+	if (!list || !list)
+		return set_errnull(EINVAL);
+
+	if ((err = list_rdlock(list)))
+		return set_errnull(err);
+
+	grepping = list_grep_with_locker_unlocked(locker, list, grep, data);
+
+	if ((err = list_unlock(list)))
+	{
+		list_release(grepping);
+		return set_errnull(err);
+	}
+
+	return grepping;
+}
+
+/*
+
+=item C<List *list_grep_with_locker_unlocked(Locker *locker, List *list, list_query_t *grep, void *data)>
+
+Equivalent to I<list_grep_with_locker(3)> except that C<list> is not
+read-locked.
+
+=cut
+
+*/
+
+List *list_grep_with_locker_unlocked(Locker *locker, List *list, list_query_t *grep, void *data)
+{
+	List *grepping;
+	size_t i;
+
+	if (!list || !list)
+		return set_errnull(EINVAL);
+
+	if (!(grepping = list_create(NULL)))
+		return NULL;
+
+	for (i = 0; i < list->length; ++i)
+	{
+		if (grep(list->list[i], &i, data))
+		{
+			if (!list_append(grepping, list->list[i]))
+			{
+				list_release(grepping);
+				return NULL;
+			}
+		}
+	}
+
+	return grepping;
+}
+
+/*
+
+C<size_t chunk_count(const List *list, size_t threads)>
+
+Returns the number of chunks that C<list> should be divided into for
+processing by C<threads> threads (or by one thread per online processor if
+C<threads> is zero). Several chunks are used per thread so that the work is
+spread evenly even when some items take longer than others. Returns C<1>
+when the list should be processed sequentially.
+
+*/
+
+static size_t chunk_count(const List *list, size_t threads)
+{
+	size_t chunks;
+
+	if ((threads = list_threads(threads)) == 1)
+		return 1;
+
+	chunks = threads * CHUNKS_PER_THREAD;
+
+	return (chunks < list->length) ? chunks : (list->length) ? list->length : 1;
+}
+
+/*
+
+C<chunk_task_t *chunk_create(List *list, size_t chunks, void **out)>
+
+Creates and returns an array of C<chunks> tasks that divide C<list> into
+contiguous chunks of (nearly) equal length. C<out> is the vector where each
+task stores its results (at the same indexes as the items they came from).
+The callbacks and their data must be set by the caller. It is the caller's
+responsibility to deallocate the array with I<mem_release(3)>. On success,
+returns the array. On error, returns C<null> with C<errno> set
+appropriately.
+
+*/
+
+static chunk_task_t *chunk_create(List *list, size_t chunks, void **out)
+{
+	chunk_task_t *task;
+	size_t i;
+
+	if (!(task = mem_create(chunks, chunk_task_t)))
+		return NULL;
+
+	for (i = 0; i < chunks; ++i)
+	{
+		task[i].list = list;
+		task[i].lo = list->length / chunks * i + ((i < list->length % chunks) ? i : list->length % chunks);
+		task[i].hi = list->length / chunks * (i + 1) + ((i + 1 < list->length % chunks) ? i + 1 : list->length % chunks);
+		task[i].action = NULL;
+		task[i].map = NULL;
+		task[i].grep = NULL;
+		task[i].data = NULL;
+		task[i].out = out;
+		task[i].found = 0;
+	}
+
+	return task;
+}
+
+/*
+
+C<void apply_chunk(void *arg)>
+
+Invokes the action of the I<chunk_task_t> C<arg> for each item in its chunk.
+
+*/
+
+static void apply_chunk(void *arg)
+{
+	chunk_task_t *task = arg;
+	size_t i;
+
+	for (i = task->lo; i < task->hi; ++i)
+		task->action(task->list->list[i], &i, task->data);
+}
+
+/*
+
+C<void map_chunk(void *arg)>
+
+Invokes the map function of the I<chunk_task_t> C<arg> for each item in its
+chunk, and stores each return value at the item's index in the task's output
+vector.
+
+*/
+
+static void map_chunk(void *arg)
+{
+	chunk_task_t *task = arg;
+	size_t i;
+
+	for (i = task->lo; i < task->hi; ++i)
+		task->out[i] = task->map(task->list->list[i], &i, task->data);
+}
+
+/*
+
+C<void grep_chunk(void *arg)>
+
+Invokes the grep function of the I<chunk_task_t> C<arg> for each item in its
+chunk, and stores the matching items, in order, in the task's output vector
+starting at the index of the chunk's first item.
+
+*/
+
+static void grep_chunk(void *arg)
+{
+	chunk_task_t *task = arg;
+	size_t i;
+
+	for (i = task->lo; i < task->hi; ++i)
+		if (task->grep(task->list->list[i], &i, task->data))
+			task->out[task->lo + task->found++] = task->list->list[i];
+}
+
+/*
+
+=item C<void list_apply_parallel(List *list, list_action_t *action, void *data, size_t threads)>
+
+Equivalent to I<list_apply(3)> except that C<list> is divided into
+contiguous chunks that are processed by C<threads> threads (or by one
+thread per online processor if C<threads> is zero) from a pool of worker
+threads that is shared by all lists. C<action> is still passed each item's
+real position within C<list>, but items are not necessarily visited in
+order, so C<action> must be safe to call from multiple threads at once. On
+error, sets C<errno> appropriately.
+
+=cut
+
+*/
+
+void list_apply_parallel(List *list, list_action_t *action, void *data, size_t threads)
+{
+	list_apply_parallel_wrlocked(list, action, data, threads);
+}
+
+/*
+
+=item C<void list_apply_parallel_rdlocked(List *list, list_action_t *action, void *data, size_t threads)>
+
+Equivalent to I<list_apply_parallel(3)> except that C<list> is read-locked
+rather than write-locked. Use this in preference to
+I<list_apply_parallel(3)> when C<list> and its items will not be modified
+during the iteration.
+
+=cut
+
+*/
+
+void list_apply_parallel_rdlocked(List *list, list_action_t *action, void *data, size_t threads)
+{
+	int err;
+
+	if (!list || !action)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	if ((err = list_rdlock(list)))
+	{
+		set_errno(err);
+		return;
+	}
+
+	list_apply_parallel_unlocked(list, action, data, threads);
+
+	if ((err = list_unlock(list)))
+		set_errno(err);
+}
+
+/*
+
+=item C<void list_apply_parallel_wrlocked(List *list, list_action_t *action, void *data, size_t threads)>
+
+Equivalent to I<list_apply_parallel(3)> except that this function name
+makes the fact that C<list> is write-locked explicit.
+
+=cut
+
+*/
+
+void list_apply_parallel_wrlocked(List *list, list_action_t *action, void *data, size_t threads)
+{
+	int err;
+
+	if (!list || !action)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	if ((err = list_wrlock(list)))
+	{
+		set_errno(err);
+		return;
+	}
+
+	list_apply_parallel_unlocked(list, action, data, threads);
+
+	if ((err = list_unlock(list)))
+		set_errno(err);
+}
+
+/*
+
+=item C<void list_apply_parallel_unlocked(List *list, list_action_t *action, void *data, size_t threads)>
+
+Equivalent to I<list_apply_parallel(3)> except that C<list> is not
+write-locked.
+
+=cut
+
+*/
+
+void list_apply_parallel_unlocked(List *list, list_action_t *action, void *data, size_t threads)
+{
+	chunk_task_t *task;
+	size_t chunks, i;
+
+	if (!list || !action)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	if ((chunks = chunk_count(list, threads)) == 1)
+	{
+		list_apply_unlocked(list, action, data);
+		return;
+	}
+
+	if (!(task = chunk_create(list, chunks, NULL)))
+		return;
+
+	for (i = 0; i < chunks; ++i)
+	{
+		task[i].action = action;
+		task[i].data = data;
+	}
+
+	list_run(apply_chunk, task, sizeof(chunk_task_t), chunks);
+	mem_release(task);
+}
+
+/*
+
+=item C<List *list_map_parallel(List *list, list_release_t *destroy, list_map_t *map, void *data, size_t threads)>
+
+Equivalent to I<list_map(3)> except that C<list> is divided into
+contiguous chunks that are processed by C<threads> threads (or by one
+thread per online processor if C<threads> is zero) from a pool of worker
+threads that is shared by all lists. C<map> must be safe to call from
+multiple threads at once. The new list's items are in the same order as
+the items in C<list> that they came from, regardless of the order in which
+C<map> was invoked. On success, returns the new list. On error, returns
+C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+List *list_map_parallel(List *list, list_release_t *destroy, list_map_t *map, void *data, size_t threads)
+{
+	return list_map_parallel_with_locker(NULL, list, destroy, map, data, threads);
+}
+
+/*
+
+=item C<List *list_map_parallel_unlocked(List *list, list_release_t *destroy, list_map_t *map, void *data, size_t threads)>
+
+Equivalent to I<list_map_parallel(3)> except that C<list> is not
+read-locked.
+
+=cut
+
+*/
+
+List *list_map_parallel_unlocked(List *list, list_release_t *destroy, list_map_t *map, void *data, size_t threads)
+{
+	return list_map_parallel_with_locker_unlocked(NULL, list, destroy, map, data, threads);
+}
+
+/*
+
+=item C<List *list_map_parallel_with_locker(Locker *locker, List *list, list_release_t *destroy, list_map_t *map, void *data, size_t threads)>
+
+Equivalent to I<list_map_parallel(3)> except that multiple threads
+accessing the new list will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *list_map_parallel_with_locker(Locker *locker, List *list, list_release_t *destroy, list_map_t *map, void *data, size_t threads)
+{
+	List *mapping;
+	int err;
+
+	if (!list || !map)
+		return set_errnull(EINVAL);
+
+	if ((err = list_rdlock(list)))
+		return set_errnull(err);
+
+	mapping = list_map_parallel_with_locker_unlocked(locker, list, destroy, map, data, threads);
+
+	if ((err = list_unlock(list)))
+	{
+		list_release(mapping);
+		return set_errnull(err);
+	}
+
+	return mapping;
+}
+
+/*
+
+=item C<List *list_map_parallel_with_locker_unlocked(Locker *locker, List *list, list_release_t *destroy, list_map_t *map, void *data, size_t threads)>
+
+Equivalent to I<list_map_parallel_with_locker(3)> except that C<list> is
+not read-locked.
+
+=cut
+
+*/
+
+List *list_map_parallel_with_locker_unlocked(Locker *locker, List *list, list_release_t *destroy, list_map_t *map, void *data, size_t threads)
+{
+	List *mapping;
+	chunk_task_t *task;
+	size_t chunks, i;
+
+	if (!list || !map)
+		return set_errnull(EINVAL);
+
+	if ((chunks = chunk_count(list, threads)) == 1)
+		return list_map_with_locker_unlocked(locker, list, destroy, map, data);
+
+	if (!(mapping = list_create_with_locker(locker, destroy)))
+		return NULL;
+
+	if (grow(mapping, list->length) == -1 || !(task = chunk_create(list, chunks, mapping->list)))
+	{
+		list_release(mapping);
+		return NULL;
+	}
+
+	for (i = 0; i < chunks; ++i)
+	{
+		task[i].map = map;
+		task[i].data = data;
+	}
+
+	list_run(map_chunk, task, sizeof(chunk_task_t), chunks);
+	mapping->length = list->length;
+	mem_release(task);
+
+	return mapping;
+}
+
+/*
+
+=item C<List *list_grep_parallel(List *list, list_query_t *grep, void *data, size_t threads)>
+
+Equivalent to I<list_grep(3)> except that C<list> is divided into
+contiguous chunks that are processed by C<threads> threads (or by one
+thread per online processor if C<threads> is zero) from a pool of worker
+threads that is shared by all lists. C<grep> must be safe to call from
+multiple threads at once. The matching items are concatenated in chunk
+order, so they are in the same order as in C<list>, regardless of the
+order in which C<grep> was invoked. On success, returns the new list. On
+error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+List *list_grep_parallel(List *list, list_query_t *grep, void *data, size_t threads)
 {
-	return list_grep_with_locker(NULL, list, grep, data);
+	return list_grep_parallel_with_locker(NULL, list, grep, data, threads);
 }
 
 /*
 
-=item C<List *list_grep_unlocked(List *list, list_query_t *grep, void *data)>
+=item C<List *list_grep_parallel_unlocked(List *list, list_query_t *grep, void *data, size_t threads)>
 
-Equivalent to I<list_grep(3)> except that C<list> is not read-locked.
+Equivalent to I<list_grep_parallel(3)> except that C<list> is not
+read-locked.
 
 =cut
 
 */
 
-List *list_grep_unlocked(List *list, list_query_t *grep, void *data)
+List *list_grep_parallel_unlocked(List *list, list_query_t *grep, void *data, size_t threads)
 {
-	return list_grep_with_locker_unlocked(NULL, list, grep, data);
+	return list_grep_parallel_with_locker_unlocked(NULL, list, grep, data, threads);
 }
 
 /*
 
-=item C<List *list_grep_with_locker(Locker *locker, List *list, list_query_t *grep, void *data)>
+=item C<List *list_grep_parallel_with_locker(Locker *locker, List *list, list_query_t *grep, void *data, size_t threads)>
 
-Equivalent to I<list_grep(3)> except that multiple threads accessing the new
-list will be synchronised by C<locker>.
+Equivalent to I<list_grep_parallel(3)> except that multiple threads
+accessing the new list will be synchronised by C<locker>.
 
 =cut
 
 */
 
-List *list_grep_with_locker(Locker *locker, List *list, list_query_t *grep, void *data)
+List *list_grep_parallel_with_locker(Locker *locker, List *list, list_query_t *grep, void *data, size_t threads)
 {
 	List *grepping;
 	int err;
 
-	if (!list || !list)
+	if (!list || !grep)
 		return set_errnull(EINVAL);
 
 	if ((err = list_rdlock(list)))
 		return set_errnull(err);
 
-	grepping = list_grep_with_locker_unlocked(locker, list, grep, data);
+	grepping = list_grep_parallel_with_locker_unlocked(locker, list, grep, data, threads);
 
 	if ((err = list_unlock(list)))
 	{
@@ -2521,38 +3785,57 @@ List *list_grep_with_locker(Locker *locker, List *list, list_query_t *grep, void
 
 /*
 
-=item C<List *list_grep_with_locker_unlocked(Locker *locker, List *list, list_query_t *grep, void *data)>
+=item C<List *list_grep_parallel_with_locker_unlocked(Locker *locker, List *list, list_query_t *grep, void *data, size_t threads)>
 
-Equivalent to I<list_grep_with_locker(3)> except that C<list> is not
-read-locked.
+Equivalent to I<list_grep_parallel_with_locker(3)> except that C<list> is
+not read-locked.
 
 =cut
 
 */
 
-List *list_grep_with_locker_unlocked(Locker *locker, List *list, list_query_t *grep, void *data)
+List *list_grep_parallel_with_locker_unlocked(Locker *locker, List *list, list_query_t *grep, void *data, size_t threads)
 {
 	List *grepping;
-	size_t i;
+	chunk_task_t *task;
+	size_t chunks, i;
 
-	if (!list || !list)
+	if (!list || !grep)
 		return set_errnull(EINVAL);
 
-	if (!(grepping = list_create(NULL)))
+	if ((chunks = chunk_count(list, threads)) == 1)
+		return list_grep_with_locker_unlocked(locker, list, grep, data);
+
+	if (!(grepping = list_create_with_locker(locker, NULL)))
 		return NULL;
 
-	for (i = 0; i < list->length; ++i)
+	if (grow(grepping, list->length) == -1 || !(task = chunk_create(list, chunks, grepping->list)))
 	{
-		if (grep(list->list[i], &i, data))
-		{
-			if (!list_append(grepping, list->list[i]))
-			{
-				list_release(grepping);
-				return NULL;
-			}
-		}
+		list_release(grepping);
+		return NULL;
+	}
+
+	for (i = 0; i < chunks; ++i)
+	{
+		task[i].grep = grep;
+		task[i].data = data;
 	}
 
+	list_run(grep_chunk, task, sizeof(chunk_task_t), chunks);
+
+	/* Concatenate each chunk's matches in order */
+
+	for (i = 0; i < chunks; ++i)
+	{
+		if (grepping->length != task[i].lo)
+			memmove(grepping->list + grepping->length, grepping->list + task[i].lo, task[i].found * sizeof(void *));
+
+		grepping->length += task[i].found;
+	}
+
+	shrink(grepping, 0);
+	mem_release(task);
+
 	return grepping;
 }
 
@@ -3546,6 +4829,9 @@ I<locker(3)>
 #ifdef TEST
 
 #include <slack/str.h>
+#include <slack/hsort.h>
+
+#include <sys/time.h>
 
 char action_data[1024];
 
@@ -3566,6 +4852,146 @@ int sort_cmp(const char **a, const char **b)
 	return strcmp(*a, *b);
 }
 
+int int_cmp(void * const *a, void * const *b)
+{
+	int x = (int)(long)*a, y = (int)(long)*b;
+
+	return (x > y) - (x < y);
+}
+
+/* Returns a list of n random integers, or random strings sharing prefixes */
+
+List *random_list(size_t n, int strings)
+{
+	static const char *prefix[] = { "", "a", "abc", "abcabcabc", "zz", "common/path/to/" };
+	char buf[64];
+	List *list;
+	size_t i;
+
+	if (!(list = list_create((strings) ? free : NULL)))
+		return NULL;
+
+	for (i = 0; i < n; ++i)
+	{
+		if (!strings)
+		{
+			list_append_int(list, rand() - RAND_MAX / 2);
+			continue;
+		}
+
+		snprintf(buf, sizeof(buf), "%s%d", prefix[rand() % 6], rand() % (int)(n / 2 + 1));
+		list_append(list, strdup(buf));
+	}
+
+	return list;
+}
+
+/* Returns the number of items in a that are out of order, or differ from b */
+
+int unsorted(List *a, List *b, list_cmp_t *cmp)
+{
+	size_t i;
+	int bad = 0;
+
+	for (i = 1; i < list_length(a); ++i)
+		if (cmp(&a->list[i - 1], &a->list[i]) > 0)
+			++bad;
+
+	for (i = 0; b && i < list_length(a); ++i)
+		if (cmp(&a->list[i], &b->list[i]))
+			++bad;
+
+	return bad;
+}
+
+double bench_elapsed(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+
+	return (end.tv_sec - start->tv_sec) + (end.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+void bench_sort(const char *name, int strings, int how)
+{
+	struct timeval start;
+	list_cmp_t *cmp = (strings) ? (list_cmp_t *)sort_cmp : (list_cmp_t *)int_cmp;
+	List *list;
+
+	srand(1);
+
+	if (!(list = random_list(1000000, strings)))
+	{
+		printf("Failed to create list\n");
+		exit(EXIT_FAILURE);
+	}
+
+	gettimeofday(&start, NULL);
+
+	switch (how)
+	{
+		case 0: qsort(list->list, list->length, sizeof(void *), cmp); break;
+		case 1: hsort(list->list, list->length, sizeof(void *), cmp); break;
+		case 2: list_sort_parallel(list, cmp, 0); break;
+		case 3: (strings) ? list_sort_strings(list) : list_sort_int(list); break;
+	}
+
+	printf("%-8s %-9s 1000000 items %.3fs\n", (strings) ? "strings" : "ints", name, bench_elapsed(&start));
+
+	if (unsorted(list, NULL, cmp))
+		printf("%s sort failed\n", name);
+
+	list_release(list);
+}
+
+/* A map function with enough arithmetic to be worth parallelising */
+
+int hashf(int item, size_t *index, void *data)
+{
+	unsigned int h = (unsigned int)item;
+	int i;
+
+	for (i = 0; i < 100; ++i)
+		h = h * 31 + (h >> 7);
+
+	return (int)h;
+}
+
+void bench_map(const char *name, size_t threads)
+{
+	struct timeval start;
+	List *list, *mapping;
+
+	srand(1);
+
+	if (!(list = random_list(1000000, 0)))
+	{
+		printf("Failed to create list\n");
+		exit(EXIT_FAILURE);
+	}
+
+	gettimeofday(&start, NULL);
+	mapping = (threads) ? list_map_parallel(list, NULL, (list_map_t *)hashf, NULL, 0) : list_map(list, NULL, (list_map_t *)hashf, NULL);
+	printf("%-8s %-9s 1000000 items %.3fs\n", "map", name, bench_elapsed(&start));
+
+	list_release(mapping);
+	list_release(list);
+}
+
+void test_bench(void)
+{
+	static const char *name[] = { "qsort", "hsort", "parallel", "radix" };
+	int strings, how;
+
+	for (strings = 0; strings < 2; ++strings)
+		for (how = 0; how < 4; ++how)
+			bench_sort(name[how], strings, how);
+
+	bench_map("serial", 0);
+	bench_map("parallel", 1);
+}
+
 int mapf(int item, size_t *index, int *sum)
 {
 	return (sum) ? *sum += item : item;
@@ -3576,6 +5002,30 @@ int grepf(int item, size_t *index, int *data)
 	return !(item & 1);
 }
 
+void seenf(int item, size_t *index, int *seen)
+{
+	seen[*index] = item;
+}
+
+int indexf(int item, size_t *index, void *data)
+{
+	return item + (int)*index;
+}
+
+int same(List *a, List *b)
+{
+	size_t i;
+
+	if (list_length(a) != list_length(b))
+		return 0;
+
+	for (i = 0; i < list_length(a); ++i)
+		if (list_item(a, i) != list_item(b, i))
+			return 0;
+
+	return 1;
+}
+
 #define RD 0
 #define WR 1
 List *mtlist = NULL;
@@ -3810,7 +5260,13 @@ int main(int ac, char **av)
 
 	if (ac == 2 && !strcmp(av[1], "help"))
 	{
-		printf("usage: %s [help|debug]\n", *av);
+		printf("usage: %s [help|debug|bench]\n", *av);
+		return EXIT_SUCCESS;
+	}
+
+	if (ac == 2 && !strcmp(av[1], "bench"))
+	{
+		test_bench();
 		return EXIT_SUCCESS;
 	}
 
@@ -4481,6 +5937,216 @@ int main(int ac, char **av)
 		list_destroy(&a);
 	}
 
+	/* Test constant time shift/unshift and edits near either end */
+
+	TEST_ACT(172, a = list_create(NULL))
+	else
+	{
+		int i, bad = 0;
+
+		for (i = 0; i < 1000; ++i)
+			list_push_int(a, i);
+
+		for (i = 0; i < 100000; ++i)
+		{
+			list_push_int(a, 1000 + i);
+			if (list_shift_int(a) != i)
+				++bad;
+		}
+
+		if (bad || list_length(a) != 1000 || list_item_int(a, 0) != 100000)
+			++errors, printf("Test172: list_push()/list_shift() queue failed (%d out of order, length %d)\n", bad, (int)list_length(a));
+
+		if (a->front + a->size > 4 * 1000 + 64)
+			++errors, printf("Test173: list_push()/list_shift() queue uses %d slots for 1000 items\n", (int)(a->front + a->size));
+
+		list_destroy(&a);
+	}
+
+	TEST_ACT(174, a = list_create(NULL))
+	else
+	{
+		int i, bad = 0;
+
+		for (i = 0; i < 1000; ++i)
+			list_unshift_int(a, i);
+
+		for (i = 0; i < 1000; ++i)
+			if (list_item_int(a, i) != 999 - i)
+				++bad;
+
+		for (i = 0; i < 10000; ++i)
+		{
+			list_unshift_int(a, -i);
+			if (list_shift_int(a) != -i)
+				++bad;
+		}
+
+		if (bad || list_length(a) != 1000)
+			++errors, printf("Test174: list_unshift()/list_shift() failed (%d out of order, length %d)\n", bad, (int)list_length(a));
+
+		list_destroy(&a);
+	}
+
+	/* Compare random edits with a plain array */
+
+	TEST_ACT(175, a = list_create(NULL))
+	else
+	{
+		int model[2000];
+		int i, j, length = 0, bad = 0, index, range;
+
+		srand(175);
+
+		for (i = 0; i < 20000; ++i)
+		{
+			index = (length) ? rand() % (length + 1) : 0;
+
+			if (length < 1500 && (rand() % 2 || length < 10))
+			{
+				memmove(model + index + 1, model + index, (length - index) * sizeof(int));
+				model[index] = i;
+				++length;
+				list_insert_int(a, index, i);
+			}
+			else
+			{
+				index = rand() % length;
+				range = 1 + rand() % ((length - index < 3) ? length - index : 3);
+				memmove(model + index, model + index + range, (length - index - range) * sizeof(int));
+				length -= range;
+				list_remove_range(a, index, range);
+			}
+
+			if (list_length(a) != length)
+				++bad;
+		}
+
+		for (j = 0; j < length; ++j)
+			if (list_item_int(a, j) != model[j])
+				++bad;
+
+		if (bad)
+			++errors, printf("Test175: random list_insert()/list_remove_range() failed %d times\n", bad);
+
+		list_destroy(&a);
+	}
+
+	/* Test list_sort_parallel, list_sort_int, list_sort_strings */
+
+	srand(176);
+
+	if (!(a = random_list(200000, 0)) || !(b = list_copy(a, NULL)) || !(c = list_copy(a, NULL)))
+		++errors, printf("Test176: random_list() failed\n");
+	else
+	{
+		list_sort(b, (list_cmp_t *)int_cmp);
+
+		if (!list_sort_parallel(a, (list_cmp_t *)int_cmp, 4) || unsorted(a, b, (list_cmp_t *)int_cmp))
+			++errors, printf("Test176: list_sort_parallel(200000 ints, 4 threads) failed\n");
+
+		list_destroy(&a);
+
+		if (!(a = list_copy(b, NULL)) || !list_shift(a) || !list_sort_parallel(a, (list_cmp_t *)int_cmp, 3) || list_length(a) != 199999 || unsorted(a, NULL, (list_cmp_t *)int_cmp))
+			++errors, printf("Test177: list_sort_parallel(199999 ints, 3 threads) failed\n");
+
+		list_destroy(&a);
+
+		if (!list_sort_int(c) || unsorted(c, b, (list_cmp_t *)int_cmp))
+			++errors, printf("Test178: list_sort_int(200000 ints) failed\n");
+
+		list_destroy(&b);
+		list_destroy(&c);
+	}
+
+	if (!(a = random_list(100000, 1)) || !(b = list_copy(a, (list_copy_t *)strdup)))
+		++errors, printf("Test179: random_list() failed\n");
+	else
+	{
+		list_append(a, strdup(""));
+		list_append(b, strdup(""));
+		list_sort(b, (list_cmp_t *)sort_cmp);
+
+		if (!list_sort_strings(a) || unsorted(a, b, (list_cmp_t *)sort_cmp))
+			++errors, printf("Test179: list_sort_strings(100001 strings) failed\n");
+
+		list_destroy(&a);
+
+		if (!(a = list_copy(b, (list_copy_t *)strdup)) || !list_sort_parallel(a, (list_cmp_t *)sort_cmp, 0) || unsorted(a, b, (list_cmp_t *)sort_cmp))
+			++errors, printf("Test180: list_sort_parallel(100001 strings) failed\n");
+
+		list_destroy(&a);
+		list_destroy(&b);
+	}
+
+	TEST_ACT(181, !list_sort_parallel(NULL, (list_cmp_t *)int_cmp, 0) && !list_sort_int(NULL) && !list_sort_strings(NULL))
+
+	/* Test list_apply_parallel, list_map_parallel, list_grep_parallel */
+
+	if (!(a = random_list(10007, 0)))
+		++errors, printf("Test182: random_list() failed\n");
+	else
+	{
+		int *seen = mem_create(10007, int);
+		size_t n;
+
+		if (!seen)
+			++errors, printf("Test182: mem_create() failed\n");
+		else
+		{
+			for (n = 0; n < 10007; ++n)
+				seen[n] = ~list_item_int(a, n);
+
+			list_apply_parallel(a, (list_action_t *)seenf, seen, 4);
+
+			for (n = 0; n < 10007; ++n)
+				if (seen[n] != list_item_int(a, n))
+					break;
+
+			if (n != 10007)
+				++errors, printf("Test182: list_apply_parallel(10007 ints, 4 threads) failed (item %d)\n", (int)n);
+
+			mem_release(seen);
+		}
+
+		if (!(b = list_map(a, NULL, (list_map_t *)indexf, NULL)) || !(c = list_map_parallel(a, NULL, (list_map_t *)indexf, NULL, 4)) || !same(b, c))
+			++errors, printf("Test183: list_map_parallel(10007 ints, 4 threads) failed\n");
+
+		list_destroy(&b);
+		list_destroy(&c);
+
+		if (!(b = list_grep(a, (list_query_t *)grepf, NULL)) || !(c = list_grep_parallel(a, (list_query_t *)grepf, NULL, 7)) || !same(b, c))
+			++errors, printf("Test184: list_grep_parallel(10007 ints, 7 threads) failed\n");
+
+		list_destroy(&b);
+		list_destroy(&c);
+		list_destroy(&a);
+	}
+
+	if (!(a = list_make(NULL, (void *)1, (void *)2, (void *)3, NULL)))
+		++errors, printf("Test185: list_make() failed\n");
+	else
+	{
+		if (!(b = list_map_parallel(a, NULL, (list_map_t *)indexf, NULL, 8)) || list_length(b) != 3 || list_item_int(b, 0) != 1 || list_item_int(b, 1) != 3 || list_item_int(b, 2) != 5)
+			++errors, printf("Test185: list_map_parallel(3 items, 8 threads) failed\n");
+
+		list_destroy(&b);
+
+		if (!(b = list_grep_parallel(a, (list_query_t *)grepf, NULL, 8)) || list_length(b) != 1 || list_item_int(b, 0) != 2)
+			++errors, printf("Test185: list_grep_parallel(3 items, 8 threads) failed\n");
+
+		list_destroy(&b);
+		list_remove_range(a, 0, -1);
+
+		if (!(b = list_map_parallel(a, NULL, (list_map_t *)indexf, NULL, 8)) || list_length(b) != 0)
+			++errors, printf("Test185: list_map_parallel(empty, 8 threads) failed\n");
+
+		list_destroy(&b);
+		list_destroy(&a);
+	}
+
+	TEST_ACT(186, !list_map_parallel(NULL, NULL, (list_map_t *)indexf, NULL, 0) && !list_grep_parallel(NULL, (list_query_t *)grepf, NULL, 0) && !list_map_parallel_with_locker(NULL, NULL, NULL, (list_map_t *)indexf, NULL, 0))
+
 	/* Test MT Safety */
 
 	debug = av[1] && !strcmp(av[1], "debug");
@@ -4498,10 +6164,10 @@ int main(int ac, char **av)
 		locker = locker_create_rwlock(&rwlock);
 
 	if (!locker)
-		++errors, printf("Test172: locker_create_rwlock() failed\n");
+		++errors, printf("Test187: locker_create_rwlock() failed\n");
 	else
 	{
-		mt_test(173, locker);
+		mt_test(188, locker);
 		locker_destroy(&locker);
 	}
 
@@ -4511,23 +6177,27 @@ int main(int ac, char **av)
 		locker = locker_create_mutex(&mutex);
 
 	if (!locker)
-		++errors, printf("Test174: locker_create_mutex() failed\n");
+		++errors, printf("Test189: locker_create_mutex() failed\n");
 	else
 	{
-		mt_test(175, locker);
+		mt_test(190, locker);
 		locker_destroy(&locker);
 	}
 
 	/* Test assumption: sizeof(int) <= sizeof(void *) */
 
 	if (sizeof(int) > sizeof(void *))
-		++errors, printf("Test176: assumption failed: sizeof(int) > sizeof(void *): int lists are limited to %d bytes\n", (int)sizeof(void *));
+		++errors, printf("Test191: assumption failed: sizeof(int) > sizeof(void *): int lists are limited to %d bytes\n", (int)sizeof(void *));
 
 	if (errors)
-		printf("%d/176 tests failed\n", errors);
+		printf("%d/191 tests failed\n", errors);
 	else
 		printf("All tests passed\n");
 
+	printf("\n");
+	printf("    Note: You can also compare the performance of sorting and mapping.\n");
+	printf("    Rerun the test with \"%s bench\".\n", *av);
+
 	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -120,6 +120,12 @@ List *list_splice_with_locker(Locker *locker, List *list, ssize_t index, ssize_t
 List *list_splice_with_locker_unlocked(Locker *locker, List *list, ssize_t index, ssize_t range, list_copy_t *copy);
 List *list_sort(List *list, list_cmp_t *cmp);
 List *list_sort_unlocked(List *list, list_cmp_t *cmp);
+List *list_sort_parallel(List *list, list_cmp_t *cmp, size_t threads);
+List *list_sort_parallel_unlocked(List *list, list_cmp_t *cmp, size_t threads);
+List *list_sort_int(List *list);
+List *list_sort_int_unlocked(List *list);
+List *list_sort_strings(List *list);
+List *list_sort_strings_unlocked(List *list);
 void list_apply(List *list, list_action_t *action, void *data);
 void list_apply_rdlocked(List *list, list_action_t *action, void *data);
 void list_apply_wrlocked(List *list, list_action_t *action, void *data);
@@ -132,6 +138,18 @@ List *list_grep(List *list, list_query_t *grep, void *data);
 List *list_grep_unlocked(List *list, list_query_t *grep, void *data);
 List *list_grep_with_locker(Locker *locker, List *list, list_query_t *grep, void *data);
 List *list_grep_with_locker_unlocked(Locker *locker, List *list, list_query_t *grep, void *data);
+void list_apply_parallel(List *list, list_action_t *action, void *data, size_t threads);
+void list_apply_parallel_rdlocked(List *list, list_action_t *action, void *data, size_t threads);
+void list_apply_parallel_wrlocked(List *list, list_action_t *action, void *data, size_t threads);
+void list_apply_parallel_unlocked(List *list, list_action_t *action, void *data, size_t threads);
+List *list_map_parallel(List *list, list_release_t *destroy, list_map_t *map, void *data, size_t threads);
+List *list_map_parallel_unlocked(List *list, list_release_t *destroy, list_map_t *map, void *data, size_t threads);
+List *list_map_parallel_with_locker(Locker *locker, List *list, list_release_t *destroy, list_map_t *map, void *data, size_t threads);
+List *list_map_parallel_with_locker_unlocked(Locker *locker, List *list, list_release_t *destroy, list_map_t *map, void *data, size_t threads);
+List *list_grep_parallel(List *list, list_query_t *grep, void *data, size_t threads);
+List *list_grep_parallel_unlocked(List *list, list_query_t *grep, void *data, size_t threads);
+List *list_grep_parallel_with_locker(Locker *locker, List *list, list_query_t *grep, void *data, size_t threads);
+List *list_grep_parallel_with_locker_unlocked(Locker *locker, List *list, list_query_t *grep, void *data, size_t threads);
 ssize_t list_query(List *list, ssize_t *index, list_query_t *query, void *data);
 ssize_t list_query_unlocked(List *list, ssize_t *index, list_query_t *query, void *data);
 Lister *lister_create(List *list);
@@ -180,7 +180,7 @@ SLACK_TARGET := $(SLACK_SRCDIR)/lib$(SLACK_NAME).a
 SLACK_INSTALL := $(SLACK_ID).a
 SLACK_INSTALL_LINK := lib$(SLACK_NAME).a
 SLACK_CONFIG := $(SLACK_SRCDIR)/lib$(SLACK_NAME)-config
-SLACK_MODULES := agent coproc daemon err fio $(GETOPT) hsort lim link list locker map mem msg net prog prop pseudo sig $(SNPRINTF) str $(VSSCANF)
+SLACK_MODULES := agent coproc daemon err fio $(GETOPT) hsort lim link list locker map mem msg net prog prop pseudo queue rope sig $(SNPRINTF) str $(VSSCANF)
 SLACK_HEADERS := std lib hdr socks
 SLACK_LIB_PODS := libslack
 SLACK_APP_PODS := libslack-config
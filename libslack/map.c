@@ -38,6 +38,7 @@ I<libslack(map)> - map module
     typedef list_cmp_t map_cmp_t;
     typedef size_t map_hash_t(size_t table_size, const void *key);
     typedef void map_action_t(void *key, void *item, void *data);
+    typedef size_t map_length_t(const void *value);
 
     Map *map_create(map_release_t *destroy);
     Map *map_create_sized(size_t size, map_release_t *destroy);
@@ -51,6 +52,17 @@ I<libslack(map)> - map module
     Map *map_create_generic_sized(size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy);
     Map *map_create_generic_with_locker(Locker *locker, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy);
     Map *map_create_generic_with_locker_sized(Locker *locker, size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy);
+    Map *map_create_flat(map_release_t *destroy);
+    Map *map_create_flat_with_locker(Locker *locker, map_release_t *destroy);
+    Map *map_create_flat_generic_with_locker_sized(Locker *locker, size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy);
+    Map *map_create_concurrent(size_t stripes, map_release_t *destroy);
+    Map *map_create_concurrent_generic(size_t stripes, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy);
+    Map *map_create_with_pool(Pool *pool, map_release_t *destroy);
+    Map *map_create_generic_with_pool(Pool *pool, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy);
+    Map *map_create_ordered(map_release_t *destroy);
+    Map *map_create_ordered_with_locker(Locker *locker, map_release_t *destroy);
+    Map *map_create_ordered_generic_with_locker(Locker *locker, map_copy_t *copy, map_cmp_t *cmp, map_release_t *key_destroy, map_release_t *value_destroy);
+    Map *map_open_mmap(const char *path);
     int map_rdlock(const Map *map);
     int map_wrlock(const Map *map);
     int map_unlock(const Map *map);
@@ -70,6 +82,12 @@ I<libslack(map)> - map module
     int map_remove_unlocked(Map *map, const void *key);
     void *map_get(Map *map, const void *key);
     void *map_get_unlocked(const Map *map, const void *key);
+    ssize_t map_get_many(Map *map, const void **keys, size_t n, void **values);
+    ssize_t map_get_many_unlocked(const Map *map, const void **keys, size_t n, void **values);
+    const Mapping *map_lower_bound(Map *map, const void *key);
+    const Mapping *map_lower_bound_unlocked(const Map *map, const void *key);
+    const Mapping *map_upper_bound(Map *map, const void *key);
+    const Mapping *map_upper_bound_unlocked(const Map *map, const void *key);
     Mapper *mapper_create(Map *map);
     Mapper *mapper_create_rdlocked(Map *map);
     Mapper *mapper_create_wrlocked(Map *map);
@@ -82,6 +100,7 @@ I<libslack(map)> - map module
     void *mapper_next(Mapper *mapper);
     const Mapping *mapper_next_mapping(Mapper *mapper);
     void mapper_remove(Mapper *mapper);
+    int mapper_seek(Mapper *mapper, const void *key);
     int map_has_next(Map *map);
     void map_break(Map *map);
     void *map_next(Map *map);
@@ -103,6 +122,7 @@ I<libslack(map)> - map module
     void map_apply_unlocked(Map *map, map_action_t *action, void *data);
     ssize_t map_size(Map *map);
     ssize_t map_size_unlocked(const Map *map);
+    int map_freeze(Map *map, const char *path, map_length_t *length);
 
 =head1 DESCRIPTION
 
@@ -111,9 +131,71 @@ mappings from one object to another object, also known as hashes or
 associative arrays. I<Map>s may own their items. I<Map>s created with a
 non-C<null> destroy function use that function to destroy an item when it is
 removed from the map and to destroy each item when the map itself it
-destroyed. I<Map>s are hash tables with C<11> buckets by default. They grow
-when necessary, approximately doubling in size each time up to a maximum
-size of C<26,214,401> buckets.
+destroyed. I<Map>s are hash tables with C<16> buckets by default. They grow
+when necessary, doubling in size each time up to a maximum size of
+C<33,554,432> buckets.
+
+The default hash function processes string keys a word at a time, and maps
+that use it have power of two sizes, so buckets are chosen by masking the
+hash value rather than by division. I<Map>s created with a client hash
+function instead have prime sizes, starting at C<11> and approximately
+doubling up to a maximum of C<26,214,401> buckets. The client hash function
+is always called with the maximum size (C<26,214,401>), and the result is
+reduced modulo the actual size. Either way, each mapping keeps the full hash
+value of its key, so keys are never rehashed when a map grows, and keys are
+only compared when their hash values are equal.
+
+By default, each bucket is a chain (a I<List>) of mappings. I<Map>s created
+with I<map_create_flat(3)> (and similar functions) use open addressing
+instead. Their buckets are slots in a single flat array, and collisions are
+resolved with linear probing using the I<Robin Hood> strategy (mappings that
+are further from their home slot displace those that are nearer to theirs).
+Each slot records the home slot of its mapping, so lookups only compare the
+keys of mappings with the same hash value, and don't have to visit any
+chains. This is usually faster and uses less memory than chaining, but the
+table is kept at most three quarters full, rather than at most two mappings
+per bucket on average. The rest of the API is identical.
+
+When a chained I<Map> grows, its existing mappings are not all moved at once.
+Instead, the old buckets are kept, and each subsequent insertion or removal
+moves the mappings in a few of them into the new buckets (without copying
+their keys). Lookups and iteration cover both sets of buckets until this is
+done. This avoids long pauses when large maps grow.
+
+I<Map>s created with I<map_create_concurrent(3)> (and similar functions)
+can be shared between threads without a I<Locker>. Their buckets are divided
+into stripes, each with its own read-write lock, so I<map_get(3)>,
+I<map_add(3)>, I<map_put(3)>, I<map_insert(3)> and I<map_remove(3)> only lock
+the stripe that their key belongs to, and operations on keys in different
+stripes proceed in parallel. Growing the map locks every stripe. Iterators
+created with I<mapper_create(3)> (or I<mapper_create_rdlocked(3)>) lock one
+stripe at a time as they visit its buckets, so other threads can update the
+rest of the map during an iteration (but the map won't grow until the
+iterator is released, so a thread must not add to the map while iterating
+over it). All other functions, and I<map_rdlock(3)> and I<map_wrlock(3)>,
+lock every stripe.
+
+I<Map>s created with I<map_create_ordered(3)> (and similar functions) keep
+their mappings sorted by key in a I<skip list> (a sorted linked list with
+express lanes, where each mapping is on a randomly chosen number of lanes,
+each four times sparser than the one below). Searching, insertion and
+removal take logarithmic time, and iteration visits the mappings in order
+of their keys (so I<map_keys(3)> returns a sorted list).
+I<map_lower_bound(3)> and I<map_upper_bound(3)> find the nearest mappings
+to a key, and I<mapper_seek(3)> positions an iterator at a key, so ranges of
+keys can be visited without examining the rest of the map.
+
+A map with string keys can be frozen into a file with I<map_freeze(3)>.
+The file contains a I<minimal perfect hash> table (built with the I<hash and
+displace> method), so every key has its own slot, and no two keys share a
+bucket. All references within the file are offsets, so it doesn't matter
+where it is mapped into memory. I<map_open_mmap(3)> maps such a file into
+memory (read-only and shared, so every process that opens it uses the same
+physical memory), and returns a frozen I<Map>. Lookups hash the key,
+examine one displacement, and compare the key in one slot, directly within
+the file. Nothing is read or copied when the map is opened. Frozen maps can
+be searched and iterated over like any other map, but they can't be
+modified.
 
 =over 4
 
@@ -132,16 +214,38 @@ size of C<26,214,401> buckets.
 #include "config.h"
 #include "std.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "map.h"
 #include "mem.h"
 #include "err.h"
 #include "locker.h"
 
+typedef struct slot_t slot_t;
+typedef struct stripe_t stripe_t;
+typedef struct striping_t striping_t;
+typedef struct frozen_t frozen_t;
+typedef struct frozen_slot_t frozen_slot_t;
+typedef struct skipnode_t skipnode_t;
+typedef struct skiplist_t skiplist_t;
+
 struct Map
 {
 	size_t size;                  /* number of buckets */
 	size_t items;                 /* number of items */
-	List **chain;                 /* array of hash buckets */
+	List **chain;                 /* array of hash buckets (if chained) */
+	List **old_chain;             /* buckets before an unfinished resize (if chained) */
+	size_t old_size;              /* number of buckets before an unfinished resize */
+	size_t migrated;              /* number of old buckets migrated so far */
+	int masked;                   /* whether sizes are powers of two (default hash function) */
+	slot_t *slots;                /* array of slots (if open addressed) */
+	striping_t *striping;         /* striped locks (if concurrent) */
+	Pool *pool;                   /* pool for mappings and key copies (or null) */
+	skiplist_t *skiplist;         /* sorted mappings (if ordered) */
+	char *image;                  /* memory mapped image (if frozen) */
+	size_t image_size;            /* size of the memory mapped image */
 	map_hash_t *hash;             /* hash function */
 	map_copy_t *copy;             /* key copy function */
 	map_cmp_t *cmp;               /* key comparison function */
@@ -155,6 +259,7 @@ struct Mapping
 {
 	void *key;                    /* a map key */
 	void *value;                  /* a map value */
+	size_t hash;                  /* the full hash value of the key */
 	map_release_t *key_destroy;   /* destructor function for key */
 	map_release_t *value_destroy; /* destructor function for value */
 };
@@ -166,6 +271,66 @@ struct Mapper
 	ssize_t item_index;       /* the index of the current item */
 	ssize_t next_chain_index; /* the index of the chain of the next item */
 	ssize_t next_item_index;  /* the index of the next item */
+	size_t origin;            /* the empty slot before the first (if open addressed) */
+	ssize_t stripe;           /* the stripe currently locked (if concurrent) */
+	int locking;              /* whether stripes are locked: 0 no, 1 read, 2 write */
+	Mapping frozen;           /* the current mapping (if frozen) */
+	skipnode_t *node;         /* the node before the next mapping (if ordered) */
+};
+
+struct slot_t
+{
+	size_t home;              /* the slot that the mapping hashes to */
+	Mapping *mapping;         /* the mapping in this slot (or null if empty) */
+};
+
+struct stripe_t
+{
+	pthread_rwlock_t lock;    /* lock for the buckets in this stripe */
+	size_t items;             /* number of items in this stripe */
+};
+
+struct striping_t
+{
+	pthread_rwlock_t resize;  /* read-locked by mappers, write-locked to resize */
+	int exclusive;            /* whether every stripe is write-locked */
+	size_t num_stripes;       /* number of stripes (a power of two) */
+	stripe_t *stripe;         /* array of stripes */
+};
+
+struct skipnode_t
+{
+	Mapping *mapping;         /* the mapping (or null in the head node) */
+	skipnode_t *next[1];      /* the next node on each level (allocated to fit) */
+};
+
+struct skiplist_t
+{
+	skipnode_t *head;         /* the head node (on every level) */
+	size_t levels;            /* number of levels in use */
+	size_t random;            /* random number generator state */
+};
+
+/*
+** A frozen image is a frozen_t header, followed by count displacements
+** (size_t), followed by count frozen_slot_t slots, followed by the values and
+** keys. All positions within the image are offsets from its start.
+*/
+
+struct frozen_t
+{
+	char magic[8];            /* "slackmap" */
+	size_t version;           /* image format version */
+	size_t word;              /* sizeof(size_t) when the image was written */
+	size_t count;             /* number of mappings (and slots and buckets) */
+	size_t size;              /* size of the image in bytes */
+};
+
+struct frozen_slot_t
+{
+	size_t hash;              /* the full hash value of the key */
+	size_t key;               /* offset of the key (a string) */
+	size_t value;             /* offset of the value (or 0 if null) */
 };
 
 #ifndef TEST
@@ -185,6 +350,54 @@ static const size_t num_table_sizes = sizeof(table_sizes) / sizeof(table_sizes[0
 
 static const double table_resize_factor = 2.0;
 
+/* Load factor that must be reached before an open addressed map grows */
+
+static const double slot_resize_factor = 0.75;
+
+/* Number of old buckets migrated by each insertion or removal after a resize */
+
+static const size_t table_migrate_rate = 4;
+
+/* Smallest and largest power of two table sizes (for the default hash function) */
+
+static const size_t table_min_pow2 = 16;
+static const size_t table_max_pow2 = 33554432;
+
+/* Default number of stripes for concurrent maps */
+
+static const size_t stripes_default = 16;
+
+/* Range of full hash values requested from client hash functions */
+
+#define hash_range (table_sizes[num_table_sizes - 1])
+
+/* Maximum number of levels in ordered maps */
+
+#define skip_max_levels 32
+
+/* Number of keys hashed and prefetched together by map_get_many() */
+
+#define map_batch_size 16
+
+/* Prefetch memory that will be read soon (where supported) */
+
+#ifdef __GNUC__
+#define map_prefetch_address(address) __builtin_prefetch(address)
+#else
+#define map_prefetch_address(address)
+#endif
+
+/* Identification of frozen images, and the largest seed tried per bucket */
+
+static const char frozen_magic[8] = { 's', 'l', 'a', 'c', 'k', 'm', 'a', 'p' };
+static const size_t frozen_version = 1;
+static const size_t frozen_max_seed = 1000000;
+
+/* The displacements, slots and data of a frozen map */
+
+#define frozen_displacements(map) ((const size_t *)((map)->image + sizeof(frozen_t)))
+#define frozen_slots(map) ((const frozen_slot_t *)(frozen_displacements(map) + (map)->items))
+
 #if 0
 /*
 
@@ -209,2928 +422,6170 @@ static size_t hash(size_t size, const void *key)
 
 /*
 
-C<size_t hash(size_t size, const void *key)>
+C<size_t string_hash_seeded(const char *key, size_t seed)>
 
-Hash function from The Practice of Programming by Kernighan and Pike (p57).
-Returns a hash value (in the range 0..size-1) for C<key>.
+Returns a full hash value for the string C<key>. The string is consumed a
+word at a time, with each word multiplied into the hash and then folded
+back onto itself (in the manner of I<wyhash> and I<xxh3>), so the low bits,
+which are all that a power of two sized table looks at, depend on every
+byte. Each C<seed> selects an unrelated hash function (for building
+perfect hash tables).
 
 */
 
-static size_t hash(size_t size, const void *key)
+#define HASH_MULTIPLIER ((size_t)0x9e3779b97f4a7c15ULL)
+#define HASH_FOLD (sizeof(size_t) * 4)
+
+static size_t string_hash_seeded(const char *key, size_t seed)
 {
-	const unsigned char *k = key;
-	size_t h = 0;
+	size_t len = strlen(key);
+	size_t h = (len ^ seed) * HASH_MULTIPLIER;
+	size_t word;
 
-	while (*k)
-		h *= 31, h += *k++;
+	for (; len >= sizeof(size_t); key += sizeof(size_t), len -= sizeof(size_t))
+	{
+		memcpy(&word, key, sizeof(size_t));
+		h = (h ^ word) * HASH_MULTIPLIER;
+		h ^= h >> HASH_FOLD;
+	}
 
-	return h % size;
+	word = 0;
+	memcpy(&word, key, len);
+	h = (h ^ word) * HASH_MULTIPLIER;
+	h ^= h >> HASH_FOLD;
+	h *= HASH_MULTIPLIER;
+	h ^= h >> HASH_FOLD;
+
+	return h;
 }
 
 /*
 
-C<Mapping *mapping_create(const void *key, void *value, map_release_t *destroy)>
+C<size_t string_hash(const char *key)>
 
-Creates a new mapping from C<key> to C<value>. C<destroy> is the destructor
-function for C<value>. On success, returns the new mapping. On error,
-returns C<null> with C<errno> set appropriately.
+Returns the full hash value for the string C<key> used by the default hash
+function.
 
 */
 
-static Mapping *mapping_create(void *key, void *value, map_release_t *key_destroy, map_release_t *value_destroy)
+static size_t string_hash(const char *key)
 {
-	Mapping *mapping;
-
-	if (!(mapping = mem_new(Mapping))) /* XXX decouple */
-		return NULL;
-
-	mapping->key = key;
-	mapping->value = value;
-	mapping->key_destroy = key_destroy;
-	mapping->value_destroy = value_destroy;
-
-	return mapping;
+	return string_hash_seeded(key, 0);
 }
 
 /*
 
-C<void mapping_release(Mapping *mapping)>
+C<size_t default_hash(size_t size, const void *key)>
 
-Releases (deallocates) C<mapping>, destroying its value if necessary.
+The default hash function. Returns a hash value (in the range 0..size-1) for
+C<key>. Maps that use it call I<string_hash()> directly, and mask the
+result, instead.
 
 */
 
-static void mapping_release(Mapping *mapping)
+static size_t default_hash(size_t size, const void *key)
 {
-	if (!mapping)
-		return;
+	return string_hash(key) % size;
+}
 
-	if (mapping->key_destroy)
-		mapping->key_destroy(mapping->key);
+/*
 
-	if (mapping->value_destroy)
-		mapping->value_destroy(mapping->value);
+C<size_t map_bucket(const Map *map, size_t size, size_t hash)>
 
-	mem_release(mapping);
+Returns the bucket (or home slot) for the full hash value C<hash> in a table
+of C<size> buckets in C<map>.
+
+*/
+
+static size_t map_bucket(const Map *map, size_t size, size_t hash)
+{
+	return (map->masked) ? hash & (size - 1) : hash % size;
 }
 
 /*
 
-=item C<Map *map_create(map_release_t *destroy)>
+C<int map_hash(const Map *map, const void *key, size_t *hash)>
 
-Creates a small I<Map> with string keys and C<destroy> as its item
-destructor. It is the caller's responsibility to deallocate the new map with
-I<map_release(3)> or I<map_destroy(3)>. It is strongly recommended to use
-I<map_destroy(3)>, because it also sets the pointer variable to C<null>. On
-success, returns the new map. On error, returns C<null> with C<errno> set
+Stores the full hash value of C<key> in C<*hash>. This is independent of
+the size of C<map>, so it can be kept with the mapping and reused after
+resizing. For client hash functions, this is the hash value for a table
+with the largest size (which is then reduced modulo the actual size). On
+success, returns C<0>. On error, returns C<-1> with C<errno> set
 appropriately.
 
-=cut
-
 */
 
-Map *map_create(map_release_t *destroy)
+static int map_hash(const Map *map, const void *key, size_t *hash)
 {
-	return map_create_sized_with_hash(table_sizes[0], (map_hash_t *)hash, destroy);
+	if (map->hash == (map_hash_t *)default_hash)
+	{
+		*hash = string_hash(key);
+		return 0;
+	}
+
+	if ((*hash = map->hash(hash_range, key)) >= hash_range)
+		return set_errno(EINVAL);
+
+	return 0;
 }
 
 /*
 
-=item C<Map *map_create_sized(size_t size, map_release_t *destroy)>
-
-Equivalent to I<map_create(3)> except that the initial number of buckets is
-approximately C<size>. The actual size will be the first prime greater than
-or equal to C<size> in a prebuilt sequence of primes between C<11> and
-C<26,214,401> that double at each step.
+C<size_t map_items(const Map *map)>
 
-=cut
+Returns the number of items in C<map>. Concurrent maps count the items in
+each stripe separately.
 
 */
 
-Map *map_create_sized(size_t size, map_release_t *destroy)
+static size_t map_items(const Map *map)
 {
-	return map_create_sized_with_hash(size, (map_hash_t *)hash, destroy);
+	size_t i, items = 0;
+
+	if (!map->striping)
+		return map->items;
+
+	for (i = 0; i < map->striping->num_stripes; ++i)
+		items += map->striping->stripe[i].items;
+
+	return items;
 }
 
 /*
 
-=item C<Map *map_create_with_hash(map_hash_t *hash, map_release_t *destroy)>
-
-Equivalent to I<map_create(3)> except that C<hash> is used as the hash
-function. The arguments to C<hash> are a I<size_t> specifying the number of
-buckets, and a I<const void *> specifying the key to hash. It must return a
-I<size_t> between zero and the table size - 1.
+C<void map_tally(Map *map, size_t hash, int delta)>
 
-=cut
+Adds C<delta> to the number of items in C<map> (or in the stripe of
+C<hash> if C<map> is concurrent).
 
 */
 
-Map *map_create_with_hash(map_hash_t *hash, map_release_t *destroy)
+static void map_tally(Map *map, size_t hash, int delta)
 {
-	return map_create_sized_with_hash(table_sizes[0], hash, destroy);
+	if (map->striping)
+		map->striping->stripe[hash & (map->striping->num_stripes - 1)].items += delta;
+	else
+		map->items += delta;
 }
 
 /*
 
-=item C<Map *map_create_sized_with_hash(size_t size, map_hash_t *hash, map_release_t *destroy)>
-
-Equivalent to I<map_create_sized(3)> except that C<hash> is used as the hash
-function. The arguments to C<hash> are a I<size_t> specifying the number of
-buckets, and a I<const void *> specifying the key to hash. It must return a
-I<size_t> between zero and the table size - 1.
+C<void *map_pool_alloc(Pool *pool, size_t size)>
 
-=cut
+Allocates C<size> bytes from C<pool>, aligned for storing pointers (since
+I<pool_alloc(3)> doesn't align anything). On success, returns the memory.
+On error, returns C<null> with C<errno> set appropriately.
 
 */
 
-Map *map_create_sized_with_hash(size_t size, map_hash_t *hash, map_release_t *destroy)
+static void *map_pool_alloc(Pool *pool, size_t size)
 {
-	return map_create_generic_sized(size, (map_copy_t *)mem_strdup, (map_cmp_t *)strcmp, hash, (map_release_t *)free, destroy);
+	char *next;
+	size_t pad;
+
+	if (!(next = pool_alloc(pool, 0)))
+		return NULL;
+
+	if ((pad = (size_t)next % sizeof(void *)) && !pool_alloc(pool, sizeof(void *) - pad))
+		return NULL;
+
+	return pool_alloc(pool, size);
 }
 
 /*
 
-=item C<Map *map_create_with_locker(Locker *locker, map_release_t *destroy)>
-
-Equivalent to I<map_create(3)> except that multiple threads accessing the
-new map will be synchronised by C<locker>.
+C<Mapping *mapping_create(Pool *pool, void *key, void *value, size_t hash, map_release_t *key_destroy, map_release_t *value_destroy)>
 
-=cut
+Creates a new mapping from C<key> (whose full hash value is C<hash>) to
+C<value>. C<key_destroy> and C<value_destroy> are the destructor functions
+for C<key> and C<value>. If C<pool> is not C<null>, the mapping is
+allocated from it. On success, returns the new mapping. On error, returns
+C<null> with C<errno> set appropriately.
 
 */
 
-Map *map_create_with_locker(Locker *locker, map_release_t *destroy)
+static Mapping *mapping_create(Pool *pool, void *key, void *value, size_t hash, map_release_t *key_destroy, map_release_t *value_destroy)
 {
-	return map_create_with_locker_sized_with_hash(locker, table_sizes[0], (map_hash_t *)hash, destroy);
+	Mapping *mapping;
+
+	if (!(mapping = (pool) ? map_pool_alloc(pool, sizeof(Mapping)) : mem_new(Mapping))) /* XXX decouple */
+		return NULL;
+
+	mapping->key = key;
+	mapping->value = value;
+	mapping->hash = hash;
+	mapping->key_destroy = key_destroy;
+	mapping->value_destroy = value_destroy;
+
+	return mapping;
 }
 
 /*
 
-=item C<Map *map_create_with_locker_sized(Locker *locker, size_t size, map_release_t *destroy)>
-
-Equivalent to I<map_create_sized(3)> except that multiple threads accessing
-the new map will be synchronised by C<locker>.
+C<void mapping_release(Mapping *mapping)>
 
-=cut
+Releases (deallocates) C<mapping>, destroying its value if necessary.
 
 */
 
-Map *map_create_with_locker_sized(Locker *locker, size_t size, map_release_t *destroy)
+static void mapping_release(Mapping *mapping)
 {
-	return map_create_with_locker_sized_with_hash(locker, size, (map_hash_t *)hash, destroy);
+	if (!mapping)
+		return;
+
+	if (mapping->key_destroy)
+		mapping->key_destroy(mapping->key);
+
+	if (mapping->value_destroy)
+		mapping->value_destroy(mapping->value);
+
+	mem_release(mapping);
 }
 
 /*
 
-=item C<Map *map_create_with_locker_with_hash(Locker *locker, map_hash_t *hash, map_release_t *destroy)>
-
-Equivalent to I<map_create_with_hash(3)> except that multiple threads
-accessing the new map will be synchronised by C<locker>.
+C<void mapping_abandon(Mapping *mapping)>
 
-=cut
+Equivalent to I<mapping_release()> for mappings allocated from a pool. The
+key and value are destroyed if necessary, but the mapping itself is left
+for the pool to deallocate.
 
 */
 
-Map *map_create_with_locker_with_hash(Locker *locker, map_hash_t *hash, map_release_t *destroy)
+static void mapping_abandon(Mapping *mapping)
 {
-	return map_create_with_locker_sized_with_hash(locker, table_sizes[0], hash, destroy);
+	if (!mapping)
+		return;
+
+	if (mapping->key_destroy)
+		mapping->key_destroy(mapping->key);
+
+	if (mapping->value_destroy)
+		mapping->value_destroy(mapping->value);
 }
 
 /*
 
-=item C<Map *map_create_with_locker_sized_with_hash(Locker *locker, size_t size, map_hash_t *hash, map_release_t *destroy)>
-
-Equivalent to I<map_create_sized_with_hash(3)> except that multiple threads
-accessing the new map will be synchronised by C<locker>.
+C<List *chain_create(const Map *map)>
 
-=cut
+Creates an empty bucket for the chained C<map>. On success, returns the
+bucket. On error, returns C<null> with C<errno> set appropriately.
 
 */
 
-Map *map_create_with_locker_sized_with_hash(Locker *locker, size_t size, map_hash_t *hash, map_release_t *destroy)
+static List *chain_create(const Map *map)
 {
-	return map_create_generic_with_locker_sized(locker, size, (map_copy_t *)mem_strdup, (map_cmp_t *)strcmp, hash, (map_release_t *)free, destroy);
+	return list_create((map_release_t *)((map->pool) ? mapping_abandon : mapping_release));
 }
 
 /*
 
-=item C<Map *map_create_generic(map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)>
-
-Equivalent to I<map_create(3)> except that the mapping keys can be of any
-type. C<copy> is used to copy mapping keys. The argument to C<copy> is the
-key to be copied. It must return a copy of its argument. C<cmp> is used to
-compare mapping keys. The arguments to C<cmp> are two keys to be compared.
-It must return < 0 if the first compares less than the second, 0 if they
-compare equal and > 0 if the first compares greater than the second. C<hash>
-is the hash function. The arguments to C<hash> are a I<size_t> specifying
-the number of buckets, and a I<const void *> specifying the key to hash. It
-must return a I<size_t> between zero and the table size - 1. C<key_destroy>
-is the destructor for mapping keys. C<value_destroy> is the destructor for
-mapping values. On success, returns the new map. On error, returns C<null>
-with C<errno> set appropriately.
+C<int map_copy(const Map *map, const void *key, void **copy)>
 
-=cut
+Stores a copy of C<key> in C<*copy>, made with the copy function of C<map>,
+or in its pool if it has one but no copy function (i.e. for string keys).
+On success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
 
 */
 
-Map *map_create_generic(map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)
+static int map_copy(const Map *map, const void *key, void **copy)
 {
-	return map_create_generic_with_locker_sized(NULL, table_sizes[0], copy, cmp, hash, key_destroy, value_destroy);
+	size_t length;
+
+	if (map->copy)
+	{
+		*copy = map->copy(key);
+		return 0;
+	}
+
+	length = strlen(key) + 1;
+
+	if (!(*copy = pool_alloc(map->pool, length)))
+		return -1;
+
+	memcpy(*copy, key, length);
+
+	return 0;
 }
 
 /*
 
-=item C<Map *map_create_generic_sized(size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)>
-
-Equivalent to I<map_create_generic(3)> except that the initial number of
-buckets is approximately C<size>. The actual size will be the first prime
-greater than or equal to C<size> in a prebuilt sequence of primes between C<11>
-and C<26,214,401> that double at each step.
+C<size_t slot_distance(size_t size, size_t i, size_t home)>
 
-=cut
+Returns the distance from C<home> to slot C<i> (with wraparound) in an open
+addressed table of C<size> slots.
 
 */
 
-Map *map_create_generic_sized(size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)
+static size_t slot_distance(size_t size, size_t i, size_t home)
 {
-	return map_create_generic_with_locker_sized(NULL, size, copy, cmp, hash, key_destroy, value_destroy);
+	return (i >= home) ? i - home : i + size - home;
 }
 
-/*
+#define slot_next(size, i) (((i) + 1 == (size)) ? 0 : (i) + 1)
 
-=item C<Map *map_create_generic_with_locker(Locker *locker, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)>
+/*
 
-Equivalent to I<map_create_generic(3)> except that multiple threads
-accessing the new map will be synchronised by C<locker>.
+C<ssize_t slot_find(const Map *map, size_t hash, const void *key)>
 
-=cut
+Returns the index of the slot in C<map> that contains C<key> whose full hash
+value is C<hash>, or C<-1> if there is none. Keys are only compared when the
+home slots and the full hash values match. The search stops early at the
+first slot whose mapping is nearer to its home than C<key> would be to its
+home slot (C<hash & mask>, or C<hash % size> with a client hash function),
+because Robin Hood insertion would have placed C<key> before it.
 
 */
 
-Map *map_create_generic_with_locker(Locker *locker, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)
+static ssize_t slot_find(const Map *map, size_t hash, const void *key)
 {
-	return map_create_generic_with_locker_sized(locker, table_sizes[0], copy, cmp, hash, key_destroy, value_destroy);
+	size_t h = map_bucket(map, map->size, hash);
+	size_t i, dist;
+
+	for (i = h, dist = 0; map->slots[i].mapping; i = slot_next(map->size, i), ++dist)
+	{
+		if (slot_distance(map->size, i, map->slots[i].home) < dist)
+			break;
+
+		if (map->slots[i].home == h && map->slots[i].mapping->hash == hash && !map->cmp(map->slots[i].mapping->key, key))
+			return i;
+	}
+
+	return -1;
 }
 
 /*
 
-=item C<Map *map_create_generic_with_locker_sized(Locker *locker, size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)>
-
-Equivalent to I<map_create_generic_sized(3)> except that multiple threads
-accessing the new map will be synchronised by C<locker>.
+C<void slot_place(slot_t *slots, size_t size, size_t home, Mapping *mapping)>
 
-=cut
+Places C<mapping>, whose home slot is C<home>, into the open addressed table
+C<slots> of C<size> slots, which must have at least one empty slot. Any
+mapping that is nearer to its home slot than the one being placed is
+displaced further along.
 
 */
 
-Map *map_create_generic_with_locker_sized(Locker *locker, size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)
+static void slot_place(slot_t *slots, size_t size, size_t home, Mapping *mapping)
 {
-	Map *map;
-	size_t i;
+	slot_t entry, tmp;
+	size_t i, dist, d;
+
+	entry.home = home;
+	entry.mapping = mapping;
 
-	for (i = 0; i < num_table_sizes; ++i)
+	for (i = home, dist = 0; slots[i].mapping; i = slot_next(size, i), ++dist)
 	{
-		if (table_sizes[i] >= size)
+		if ((d = slot_distance(size, i, slots[i].home)) < dist)
 		{
-			size = table_sizes[i];
-			break;
+			tmp = slots[i], slots[i] = entry, entry = tmp;
+			dist = d;
 		}
 	}
 
-	if (i == num_table_sizes)
-		return set_errnull(EINVAL);
+	slots[i] = entry;
+}
 
-	if (!(map = mem_new(Map))) /* XXX decouple */
-		return NULL;
+/*
 
-	if (!(map->chain = mem_create(size, List *)))
-	{
-		mem_release(map);
-		return NULL;
-	}
+C<void slot_remove(Map *map, size_t i)>
 
-	map->size = size;
-	map->items = 0;
-	memset(map->chain, 0, map->size * sizeof(List *));
-	map->hash = hash;
-	map->copy = copy;
-	map->cmp = cmp;
-	map->key_destroy = key_destroy;
-	map->value_destroy = value_destroy;
-	map->mapper = NULL;
-	map->locker = locker;
+Removes (and releases) the mapping in slot C<i> of C<map>. The mappings that
+follow it in the same cluster, and that aren't in their home slot, are
+shifted back by one slot, so no tombstones are needed.
 
-	return map;
+*/
+
+static void slot_remove(Map *map, size_t i)
+{
+	size_t j;
+
+	mapping_release(map->slots[i].mapping);
+
+	for (j = slot_next(map->size, i); map->slots[j].mapping && map->slots[j].home != j; i = j, j = slot_next(map->size, j))
+		map->slots[i] = map->slots[j];
+
+	map->slots[i].mapping = NULL;
+	--map->items;
 }
 
 /*
 
-=item C<int map_rdlock(const Map *map)>
-
-Claims a read lock on C<map> (if C<map> was created with a I<Locker>). This
-is needed when multiple read-only I<map(3)> module functions need to be
-called atomically. It is the client's responsibility to call
-I<map_unlock(3)> after the atomic operation. The only functions that may be
-called on C<map> between calls to I<map_rdlock(3)> and I<map_unlock(3)> are
-any read-only I<map(3)> module functions whose name ends with C<_unlocked>.
-On success, returns C<0>. On error, returns an error code.
+C<size_t frozen_slot(size_t count, size_t hash, size_t displacement, const char *key)>
 
-=cut
+Returns the slot of C<key> (whose full hash value is C<hash>) in a frozen
+image with C<count> slots, given the displacement of its bucket. Buckets
+that hold a single key store the complement of its slot directly. Other
+buckets store the seed of the hash function that places all of their keys
+in free slots.
 
 */
 
-#define map_rdlock(map) ((map) ? locker_rdlock((map)->locker) : EINVAL)
-#define map_wrlock(map) ((map) ? locker_wrlock((map)->locker) : EINVAL)
-#define map_unlock(map) ((map) ? locker_unlock((map)->locker) : EINVAL)
-
-int (map_rdlock)(const Map *map)
+static size_t frozen_slot(size_t count, size_t hash, size_t displacement, const char *key)
 {
-	return map_rdlock(map);
+	if (displacement > (size_t)-1 / 2)
+		return ~displacement;
+
+	return string_hash_seeded(key, displacement) % count;
 }
 
 /*
 
-=item C<int map_wrlock(const Map *map)>
-
-Claims a write lock on C<map> (if C<map> was created with a I<Locker>). This
-is needed when multiple read/write I<map(3)> module functions need to be
-called atomically. It is the client's responsibility to subsequently call
-I<map_unlock(3)>. The only functions that may be called on C<map> between
-calls to I<map_wrlock(3)> and I<map_unlock(3)> are any I<map(3)> module
-functions whose name ends with C<_unlocked>. On success, returns C<0>. On
-error, returns an error code.
+C<ssize_t frozen_find(const Map *map, const void *key, size_t hash)>
 
-=cut
+Returns the slot of C<key> (whose full hash value is C<hash>) in the frozen
+C<map>, or C<-1> if C<key> isn't present. Every key has a slot, so this
+never probes. The stored hash is compared before the key, so absent keys are
+rarely compared.
 
 */
 
-int (map_wrlock)(const Map *map)
+static ssize_t frozen_find(const Map *map, const void *key, size_t hash)
 {
-	return map_wrlock(map);
-}
+	const frozen_slot_t *slot;
+	size_t i;
 
-/*
+	if (!map->items)
+		return -1;
 
-=item C<int map_unlock(const Map *map)>
+	i = frozen_slot(map->items, hash, frozen_displacements(map)[hash % map->items], key);
 
-Unlocks a read or write lock on C<map> obtained with I<map_rdlock(3)> or
-I<map_wrlock(3)> (if C<map> was created with a C<locker>). On success,
-returns C<0>. On error, returns an error code.
+	if (i >= map->items)
+		return -1;
 
-=cut
+	slot = frozen_slots(map) + i;
 
-*/
+	if (slot->hash != hash || slot->key >= map->image_size || slot->value >= map->image_size || strcmp(map->image + slot->key, key))
+		return -1;
 
-int (map_unlock)(const Map *map)
-{
-	return map_unlock(map);
+	return i;
 }
 
 /*
 
-=item C<void map_release(Map *map)>
-
-Releases (deallocates) C<map>, destroying its items if necessary. On error,
-sets C<errno> appropriately.
+C<skipnode_t *skipnode_create(Mapping *mapping, size_t levels)>
 
-=cut
+Creates a skip list node for C<mapping> on C<levels> levels. On success,
+returns the new node. On error, returns C<null> with C<errno> set
+appropriately.
 
 */
 
-void map_release(Map *map)
+static skipnode_t *skipnode_create(Mapping *mapping, size_t levels)
 {
-	size_t i;
+	skipnode_t *node;
+	size_t l;
 
-	if (!map)
-		return;
+	if (!(node = (skipnode_t *)mem_create(sizeof(skipnode_t) + (levels - 1) * sizeof(skipnode_t *), char))) /* XXX decouple */
+		return NULL;
 
-	for (i = 0; i < map->size; ++i)
-		list_release(map->chain[i]);
+	node->mapping = mapping;
 
-	mem_release(map->chain);
-	mem_release(map);
+	for (l = 0; l < levels; ++l)
+		node->next[l] = NULL;
+
+	return node;
 }
 
 /*
 
-=item C<void *map_destroy(Map **map)>
-
-Destroys (deallocates and sets to C<null>) C<*map>. Returns C<null>.
-B<Note:> maps shared by multiple threads must not be destroyed until after
-all threads have finished with it.
+C<size_t skip_level(skiplist_t *skiplist)>
 
-=cut
+Returns a random number of levels for a new node in C<skiplist>. Each
+additional level is a quarter as likely as the one before.
 
 */
 
-void *map_destroy(Map **map)
+static size_t skip_level(skiplist_t *skiplist)
 {
-	if (map && *map)
-	{
-		map_release(*map);
-		*map = NULL;
-	}
+	size_t level, bits;
 
-	return NULL;
+	skiplist->random = skiplist->random * (size_t)6364136223846793005ULL + (size_t)1442695040888963407ULL;
+
+	for (level = 1, bits = skiplist->random >> 16; level < skip_max_levels && !(bits & 3); bits >>= 2)
+		++level;
+
+	return level;
 }
 
 /*
 
-=item C<int map_own(Map *map, map_release_t *destroy)>
-
-Causes C<map> to take ownership of its items. The items will be destroyed
-using C<destroy> when their mappings are removed from C<map> or when C<map>
-is destroyed. On success, returns C<0>. On error, returns C<-1> with
-C<errno> set appropriately.
+C<skipnode_t *skip_find(const Map *map, const void *key, skipnode_t **update)>
 
-=cut
+Searches the ordered C<map> for the first mapping whose key is not less
+than C<key>. Returns the node of that mapping, or C<null> if there is none.
+If C<update> is not C<null>, the last node before that point on each level
+is stored in it.
 
 */
 
-int map_own(Map *map, map_release_t *destroy)
+static skipnode_t *skip_find(const Map *map, const void *key, skipnode_t **update)
 {
-	int ret;
-	int err;
-
-	if (!map || !destroy)
-		return set_errno(EINVAL);
-
-	if ((err = map_wrlock(map)))
-		return set_errno(err);
+	skipnode_t *node = map->skiplist->head;
+	size_t l = map->skiplist->levels;
 
-	ret = map_own_unlocked(map, destroy);
+	while (l--)
+	{
+		while (node->next[l] && map->cmp(node->next[l]->mapping->key, key) < 0)
+			node = node->next[l];
 
-	if ((err = map_unlock(map)))
-		return set_errno(err);
+		if (update)
+			update[l] = node;
+	}
 
-	return ret;
+	return node->next[0];
 }
 
 /*
 
-=item C<int map_own_unlocked(Map *map, map_release_t *destroy)>
-
-Equivalent to I<map_own(3)> except that C<map> is not write-locked.
+C<int skip_insert(Map *map, const void *key, void *value, int replace)>
 
-=cut
+Implements I<map_insert_unlocked(3)> for ordered maps.
 
 */
 
-int map_own_unlocked(Map *map, map_release_t *destroy)
+static int skip_insert(Map *map, const void *key, void *value, int replace)
 {
-	ssize_t length;
-	size_t c, i;
+	skiplist_t *skiplist = map->skiplist;
+	skipnode_t *update[skip_max_levels], *node;
+	Mapping *mapping;
+	size_t levels, l;
+	void *copy;
 
-	if (!map || !destroy)
-		return set_errno(EINVAL);
+	if ((node = skip_find(map, key, update)) && !map->cmp(node->mapping->key, key) && !replace)
+		return -1;
 
-	if (destroy == map->value_destroy)
-		return 0;
+	if (map_copy(map, key, &copy) == -1)
+		return -1;
 
-	map->value_destroy = destroy;
+	if (!(mapping = mapping_create(map->pool, copy, value, 0, map->key_destroy, map->value_destroy)))
+		return -1;
 
-	for (c = 0; c < map->size; ++c)
+	if (node && !map->cmp(node->mapping->key, key))
 	{
-		List *chain = map->chain[c];
+		mapping_release(node->mapping);
+		node->mapping = mapping;
 
-		if (!chain)
-			continue;
+		return 0;
+	}
 
-		if ((length = list_length_unlocked(chain)) == -1)
-			return -1;
+	if (!(node = skipnode_create(mapping, levels = skip_level(skiplist))))
+	{
+		mapping_release(mapping);
+		return -1;
+	}
 
-		for (i = 0; i < length; ++i)
-		{
-			Mapping *mapping = (Mapping *)list_item_unlocked(chain, i);
-			mapping->value_destroy = destroy;
-		}
+	for (; skiplist->levels < levels; ++skiplist->levels)
+		update[skiplist->levels] = skiplist->head;
+
+	for (l = 0; l < levels; ++l)
+	{
+		node->next[l] = update[l]->next[l];
+		update[l]->next[l] = node;
 	}
 
+	++map->items;
+
 	return 0;
 }
 
 /*
 
-=item C<map_release_t *map_disown(Map *map)>
-
-Causes C<map> to relinquish ownership of its items. The items will not be
-destroyed when their mappings are removed from C<map> or when C<map> is
-destroyed. On success, returns the previous destroy function, if any. On
-error, returns C<null> with C<errno> set appropriately.
+C<skipnode_t *skip_remove(Map *map, const void *key)>
 
-=cut
+Removes (and releases) the mapping for C<key> from the ordered C<map>. On
+success, returns the node that preceded it. On error, returns C<null> with
+C<errno> set appropriately.
 
 */
 
-map_release_t *map_disown(Map *map)
+static skipnode_t *skip_remove(Map *map, const void *key)
 {
-	map_release_t *ret;
-	int err;
+	skiplist_t *skiplist = map->skiplist;
+	skipnode_t *update[skip_max_levels], *node;
+	size_t l;
 
-	if (!map)
-		return (map_release_t *)set_errnullf(EINVAL);
+	if (!(node = skip_find(map, key, update)) || map->cmp(node->mapping->key, key))
+		return set_errnull(ENOENT);
 
-	if ((err = map_wrlock(map)))
-		return (map_release_t *)set_errnullf(err);
+	for (l = 0; l < skiplist->levels && update[l]->next[l] == node; ++l)
+		update[l]->next[l] = node->next[l];
 
-	ret = map_disown_unlocked(map);
+	while (skiplist->levels > 1 && !skiplist->head->next[skiplist->levels - 1])
+		--skiplist->levels;
 
-	if ((err = map_unlock(map)))
-		return (map_release_t *)set_errnullf(err);
+	mapping_release(node->mapping);
+	mem_release(node);
+	--map->items;
 
-	return ret;
+	return update[0];
 }
 
 /*
 
-=item C<map_release_t *map_disown_unlocked(Map *map)>
+=item C<Map *map_create(map_release_t *destroy)>
 
-Equivalent to I<map_disown(3)> except that C<map> is not write-locked.
+Creates a small I<Map> (with C<16> buckets) with string keys and C<destroy>
+as its item destructor. It uses the default hash function, so its size is
+always a power of two (see I<map_create_sized(3)>). It is the caller's
+responsibility to deallocate the new map with I<map_release(3)> or
+I<map_destroy(3)>. It is strongly recommended to use
+I<map_destroy(3)>, because it also sets the pointer variable to C<null>. On
+success, returns the new map. On error, returns C<null> with C<errno> set
+appropriately.
 
 =cut
 
 */
 
-map_release_t *map_disown_unlocked(Map *map)
+Map *map_create(map_release_t *destroy)
 {
-	ssize_t length;
-	size_t c, i;
-	map_release_t *destroy;
-
-	if (!map)
-		return (map_release_t *)set_errnullf(EINVAL);
-
-	if (!map->value_destroy)
-		return NULL;
+	return map_create_sized_with_hash(table_sizes[0], (map_hash_t *)default_hash, destroy);
+}
 
-	destroy = map->value_destroy;
-	map->value_destroy = NULL;
+/*
 
-	for (c = 0; c < map->size; ++c)
-	{
-		List *chain = map->chain[c];
+=item C<Map *map_create_sized(size_t size, map_release_t *destroy)>
 
-		if (!chain)
-			continue;
+Equivalent to I<map_create(3)> except that the initial number of buckets is
+approximately C<size>. Because the default hash function is used, the actual
+size will be the first power of two greater than or equal to C<size>
+between C<16> and C<33,554,432>, so that buckets can be chosen by masking
+the hash value.
 
-		if ((length = list_length_unlocked(chain)) == -1)
-			return NULL;
+=cut
 
-		for (i = 0; i < length; ++i)
-		{
-			Mapping *mapping = (Mapping *)list_item_unlocked(chain, i);
-			mapping->value_destroy = NULL;
-		}
-	}
+*/
 
-	return destroy;
+Map *map_create_sized(size_t size, map_release_t *destroy)
+{
+	return map_create_sized_with_hash(size, (map_hash_t *)default_hash, destroy);
 }
 
 /*
 
-C<static int map_resize(Map *map)>
+=item C<Map *map_create_with_hash(map_hash_t *hash, map_release_t *destroy)>
 
-Resizes C<map> to use the next prime in a prebuilt sequence of primes
-between C<11> and C<26,214,401> that is greater than the current size. On
-success, returns C<0>. On error, returns C<-1> with C<errno> set
-appropriately.
+Equivalent to I<map_create(3)> except that C<hash> is used as the hash
+function. The arguments to C<hash> are a I<size_t> specifying the number of
+buckets, and a I<const void *> specifying the key to hash. It must return a
+I<size_t> between zero and the table size - 1.
+
+=cut
 
 */
 
-static int map_resize(Map *map)
+Map *map_create_with_hash(map_hash_t *hash, map_release_t *destroy)
 {
-	size_t size = 0;
-	size_t i;
-	Mapper *mapper;
-	Map *new_map;
+	return map_create_sized_with_hash(table_sizes[0], hash, destroy);
+}
 
-	if (!map)
-		return set_errno(EINVAL);
+/*
 
-	for (i = 1; i < num_table_sizes; ++i)
-	{
-		if (table_sizes[i] > map->size)
-		{
-			size = table_sizes[i];
-			break;
-		}
-	}
+=item C<Map *map_create_sized_with_hash(size_t size, map_hash_t *hash, map_release_t *destroy)>
 
-	if (i == num_table_sizes || size == 0)
-		return set_errno(EINVAL);
+Equivalent to I<map_create_sized(3)> except that C<hash> is used as the hash
+function. The arguments to C<hash> are a I<size_t> specifying the number of
+buckets, and a I<const void *> specifying the key to hash. It must return a
+I<size_t> between zero and the table size - 1. With a client hash function,
+the actual size will be the first prime greater than or equal to C<size> in
+a prebuilt sequence of primes between C<11> and C<26,214,401> that double at
+each step.
 
-	if (!(new_map = map_create_generic_sized(size, map->copy, map->cmp, map->hash, map->key_destroy, map->value_destroy)))
-		return -1;
+=cut
 
-	if (!(mapper = mapper_create_unlocked(map)))
-	{
-		map_release(new_map);
-		return -1;
-	}
+*/
 
-	while (mapper_has_next(mapper) == 1)
-	{
-		const Mapping *mapping = mapper_next_mapping(mapper);
+Map *map_create_sized_with_hash(size_t size, map_hash_t *hash, map_release_t *destroy)
+{
+	return map_create_generic_sized(size, (map_copy_t *)mem_strdup, (map_cmp_t *)strcmp, hash, (map_release_t *)free, destroy);
+}
 
-		if (map_add_unlocked(new_map, mapping->key, mapping->value) == -1)
-		{
-			mapper_release_unlocked(mapper);
-			map_release(new_map);
-			return -1;
-		}
-	}
+/*
 
-	mapper_release_unlocked(mapper);
+=item C<Map *map_create_with_locker(Locker *locker, map_release_t *destroy)>
 
-	errno = 0;
-	if (map_disown_unlocked(map) == NULL && errno)
-	{
-		map_release(new_map);
-		return -1;
-	}
+Equivalent to I<map_create(3)> except that multiple threads accessing the
+new map will be synchronised by C<locker>.
 
-	for (i = 0; i < map->size; ++i)
-		list_release(map->chain[i]);
-	mem_release(map->chain);
+=cut
 
-	map->size = new_map->size;
-	map->items = new_map->items;
-	map->chain = new_map->chain;
-	map->value_destroy = new_map->value_destroy;
-	mem_release(new_map);
+*/
 
-	return 0;
+Map *map_create_with_locker(Locker *locker, map_release_t *destroy)
+{
+	return map_create_with_locker_sized_with_hash(locker, table_sizes[0], (map_hash_t *)default_hash, destroy);
 }
 
 /*
 
-=item C<int map_add(Map *map, const void *key, void *value)>
+=item C<Map *map_create_with_locker_sized(Locker *locker, size_t size, map_release_t *destroy)>
 
-Adds the C<(key, value)> mapping to C<map>, if C<key> is not already
-present. Note that C<key> is copied but C<value> is not. On success, returns
-C<0>. On error, returns C<-1> with C<errno> set appropriately.
+Equivalent to I<map_create_sized(3)> except that multiple threads accessing
+the new map will be synchronised by C<locker>. The actual size is a power of
+two between C<16> and C<33,554,432>, as for I<map_create_sized(3)>.
 
 =cut
 
 */
 
-int map_add(Map *map, const void *key, void *value)
+Map *map_create_with_locker_sized(Locker *locker, size_t size, map_release_t *destroy)
 {
-	return map_insert(map, key, value, 0);
+	return map_create_with_locker_sized_with_hash(locker, size, (map_hash_t *)default_hash, destroy);
 }
 
 /*
 
-=item C<int map_add_unlocked(Map *map, const void *key, void *value)>
+=item C<Map *map_create_with_locker_with_hash(Locker *locker, map_hash_t *hash, map_release_t *destroy)>
 
-Equivalent to I<map_add(3)> except that C<map> is not write-locked.
+Equivalent to I<map_create_with_hash(3)> except that multiple threads
+accessing the new map will be synchronised by C<locker>.
 
 =cut
 
 */
 
-int map_add_unlocked(Map *map, const void *key, void *value)
+Map *map_create_with_locker_with_hash(Locker *locker, map_hash_t *hash, map_release_t *destroy)
 {
-	return map_insert_unlocked(map, key, value, 0);
+	return map_create_with_locker_sized_with_hash(locker, table_sizes[0], hash, destroy);
 }
 
 /*
 
-=item C<int map_put(Map *map, const void *key, void *value)>
+=item C<Map *map_create_with_locker_sized_with_hash(Locker *locker, size_t size, map_hash_t *hash, map_release_t *destroy)>
 
-Adds the C<(key, value)> mapping to C<map>, replacing any existing C<(key,
-value)> mapping. Note that C<key> is copied but C<value> is not. On success,
-returns C<0>. On error, returns C<-1> with C<errno> set appropriately.
+Equivalent to I<map_create_sized_with_hash(3)> except that multiple threads
+accessing the new map will be synchronised by C<locker>.
 
 =cut
 
 */
 
-int map_put(Map *map, const void *key, void *value)
+Map *map_create_with_locker_sized_with_hash(Locker *locker, size_t size, map_hash_t *hash, map_release_t *destroy)
 {
-	return map_insert(map, key, value, 1);
+	return map_create_generic_with_locker_sized(locker, size, (map_copy_t *)mem_strdup, (map_cmp_t *)strcmp, hash, (map_release_t *)free, destroy);
 }
 
 /*
 
-=item C<int map_put_unlocked(Map *map, const void *key, void *value)>
+=item C<Map *map_create_generic(map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)>
 
-Equivalent to I<map_put(3)> except that C<map> is not write-locked.
+Equivalent to I<map_create(3)> except that the mapping keys can be of any
+type. C<copy> is used to copy mapping keys. The argument to C<copy> is the
+key to be copied. It must return a copy of its argument. C<cmp> is used to
+compare mapping keys. The arguments to C<cmp> are two keys to be compared.
+It must return < 0 if the first compares less than the second, 0 if they
+compare equal and > 0 if the first compares greater than the second. C<hash>
+is the hash function. The arguments to C<hash> are a I<size_t> specifying
+the number of buckets, and a I<const void *> specifying the key to hash. It
+must return a I<size_t> between zero and the table size - 1. C<key_destroy>
+is the destructor for mapping keys. C<value_destroy> is the destructor for
+mapping values. On success, returns the new map. On error, returns C<null>
+with C<errno> set appropriately.
 
 =cut
 
 */
 
-int map_put_unlocked(Map *map, const void *key, void *value)
+Map *map_create_generic(map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)
 {
-	return map_insert_unlocked(map, key, value, 1);
+	return map_create_generic_with_locker_sized(NULL, table_sizes[0], copy, cmp, hash, key_destroy, value_destroy);
 }
 
 /*
 
-=item C<int map_insert(Map *map, const void *key, void *value, int replace)>
+=item C<Map *map_create_generic_sized(size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)>
 
-Adds the C<(key, value)> mapping to C<map>, replacing any existing C<(key,
-value)> mapping, if C<replace> is non-zero. Note that C<key> is copied but
-C<value> is not. On success, returns C<0>. On error, or if C<key> is already
-present and C<replace> is zero, returns C<-1> with C<errno> set
-appropriately.
+Equivalent to I<map_create_generic(3)> except that the initial number of
+buckets is approximately C<size>. Because C<hash> is a client hash function,
+the actual size will be the first prime greater than or equal to C<size> in
+a prebuilt sequence of primes between C<11> and C<26,214,401> that double at
+each step.
 
 =cut
 
 */
 
-int map_insert(Map *map, const void *key, void *value, int replace)
+Map *map_create_generic_sized(size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)
 {
-	int ret;
-	int err;
-
-	if (!map || !key)
-		return set_errno(EINVAL);
-
-	if ((err = map_wrlock(map)))
-		return set_errno(err);
-
-	ret = map_insert_unlocked(map, key, value, replace);
-
-	if ((err = map_unlock(map)))
-		return set_errno(err);
-
-	return ret;
+	return map_create_generic_with_locker_sized(NULL, size, copy, cmp, hash, key_destroy, value_destroy);
 }
 
 /*
 
-=item C<int map_insert_unlocked(Map *map, const void *key, void *value, int replace)>
+=item C<Map *map_create_generic_with_locker(Locker *locker, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)>
 
-Equivalent to I<map_insert(3)> except that C<map> is not write-locked.
+Equivalent to I<map_create_generic(3)> except that multiple threads
+accessing the new map will be synchronised by C<locker>.
 
 =cut
 
 */
 
-int map_insert_unlocked(Map *map, const void *key, void *value, int replace)
+Map *map_create_generic_with_locker(Locker *locker, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)
 {
-	Mapping *mapping;
-	List *chain;
-	ssize_t length;
-	size_t h, c;
+	return map_create_generic_with_locker_sized(locker, table_sizes[0], copy, cmp, hash, key_destroy, value_destroy);
+}
 
-	if (!map || !key)
-		return set_errno(EINVAL);
+/*
 
-	if ((double)map->items / (double)map->size >= (double)table_resize_factor)
-		if (map_resize(map) == -1)
-			return -1;
+=item C<Map *map_create_generic_with_locker_sized(Locker *locker, size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)>
 
-	if ((h = map->hash(map->size, key)) >= map->size)
-		return set_errno(EINVAL);
+Equivalent to I<map_create_generic_sized(3)> except that multiple threads
+accessing the new map will be synchronised by C<locker>.
 
-	if (!map->chain[h] && !(map->chain[h] = list_create((map_release_t *)mapping_release)))
-		return -1;
+=cut
 
-	chain = map->chain[h];
+*/
 
-	if ((length = list_length_unlocked(chain)) == -1)
-		return -1;
+static Map *map_create_table(Locker *locker, size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy, int flat, size_t stripes);
 
-	for (c = 0; c < length; ++c)
-	{
-		mapping = (Mapping *)list_item_unlocked(chain, c);
+Map *map_create_generic_with_locker_sized(Locker *locker, size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)
+{
+	return map_create_table(locker, size, copy, cmp, hash, key_destroy, value_destroy, 0, 0);
+}
 
-		if (!map->cmp(mapping->key, key))
-		{
-			if (replace && list_remove_unlocked(chain, c))
-				break;
+/*
 
-			return -1;
-		}
-	}
+=item C<Map *map_create_flat(map_release_t *destroy)>
 
-	if (!(mapping = mapping_create(map->copy(key), value, map->key_destroy, map->value_destroy)))
-		return -1;
+Equivalent to I<map_create(3)> except that the map created uses open
+addressing (with Robin Hood linear probing in a single flat array of slots)
+rather than chaining (with a list of mappings in each bucket). See the
+DESCRIPTION section for details.
 
-	if (!list_append_unlocked(chain, mapping))
-	{
-		mapping_release(mapping);
-		return -1;
-	}
+=cut
 
-	++map->items;
+*/
 
-	return 0;
+Map *map_create_flat(map_release_t *destroy)
+{
+	return map_create_flat_with_locker(NULL, destroy);
 }
 
 /*
 
-=item C<int map_remove(Map *map, const void *key)>
+=item C<Map *map_create_flat_with_locker(Locker *locker, map_release_t *destroy)>
 
-Removes C<(key, value)> mapping from C<map> if it is present. If C<map> was
-created with a destroy function, then the value will be destroyed. On
-success, returns C<0>. On error, returns C<-1> with C<errno> set
-appropriately.
+Equivalent to I<map_create_flat(3)> except that multiple threads accessing
+the new map will be synchronised by C<locker>.
 
 =cut
 
 */
 
-int map_remove(Map *map, const void *key)
+Map *map_create_flat_with_locker(Locker *locker, map_release_t *destroy)
 {
-	int ret;
-	int err;
+	return map_create_flat_generic_with_locker_sized(locker, table_sizes[0], (map_copy_t *)mem_strdup, (map_cmp_t *)strcmp, (map_hash_t *)default_hash, (map_release_t *)free, destroy);
+}
 
-	if (!map || !key)
-		return set_errno(EINVAL);
+/*
 
-	if ((err = map_wrlock(map)))
-		return set_errno(err);
+=item C<Map *map_create_flat_generic_with_locker_sized(Locker *locker, size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)>
 
-	ret = map_remove_unlocked(map, key);
+Equivalent to I<map_create_generic_with_locker_sized(3)> except that the map
+created uses open addressing rather than chaining. C<locker> may be C<null>.
+The home slot of each mapping is chosen using C<hash> in the same way as a
+bucket is for chained maps.
 
-	if ((err = map_unlock(map)))
-		return set_errno(err);
+=cut
 
-	return ret;
+*/
+
+Map *map_create_flat_generic_with_locker_sized(Locker *locker, size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)
+{
+	return map_create_table(locker, size, copy, cmp, hash, key_destroy, value_destroy, 1, 0);
 }
 
 /*
 
-=item C<int map_remove_unlocked(Map *map, const void *key)>
+=item C<Map *map_create_concurrent(size_t stripes, map_release_t *destroy)>
 
-Equivalent to I<map_remove(3)> except that C<map> is not write-locked.
+Equivalent to I<map_create(3)> except that the map created is safe to share
+between threads, and its buckets are divided into C<stripes> stripes (rounded
+up to a power of two, or C<16> if C<stripes> is zero), each with its own
+read-write lock. See the DESCRIPTION section for details.
 
 =cut
 
 */
 
-int map_remove_unlocked(Map *map, const void *key)
+Map *map_create_concurrent(size_t stripes, map_release_t *destroy)
 {
-	List *chain;
-	ssize_t length;
-	size_t h, c;
+	return map_create_concurrent_generic(stripes, (map_copy_t *)mem_strdup, (map_cmp_t *)strcmp, (map_hash_t *)default_hash, (map_release_t *)free, destroy);
+}
 
-	if (!map || !key)
-		return set_errno(EINVAL);
+/*
 
-	if ((h = map->hash(map->size, key)) >= map->size)
-		return set_errno(EINVAL);
+=item C<Map *map_create_concurrent_generic(size_t stripes, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)>
 
-	if (!(chain = map->chain[h]))
-		return set_errno(ENOENT);
+Equivalent to I<map_create_generic(3)> except that the map created is
+concurrent, with C<stripes> stripes, as with I<map_create_concurrent(3)>.
+Concurrent maps always have power of two sizes, so the full hash values
+returned by C<hash> should have well distributed low bits.
 
-	if ((length = list_length_unlocked(chain)) == -1)
-		return -1;
+=cut
 
-	for (c = 0; c < length; ++c)
-	{
-		Mapping *mapping = (Mapping *)list_item_unlocked(chain, c);
+*/
 
-		if (!map->cmp(mapping->key, key))
-		{
-			if (!list_remove_unlocked(chain, c))
-				return -1;
+Map *map_create_concurrent_generic(size_t stripes, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)
+{
+	size_t n;
 
-			--map->items;
+	for (n = 1; n < ((stripes) ? stripes : stripes_default) && n < table_max_pow2; n <<= 1)
+		;
 
-			return 0;
-		}
-	}
+	if (n < stripes)
+		return set_errnull(EINVAL);
 
-	return set_errno(ENOENT);
+	return map_create_table(NULL, n, copy, cmp, hash, key_destroy, value_destroy, 0, n);
 }
 
 /*
 
-=item C<void *map_get(Map *map, const void *key)>
+=item C<Map *map_create_with_pool(Pool *pool, map_release_t *destroy)>
 
-Returns the value associated with C<key> in C<map>, or C<null> if there is
-none. On error, returns C<null> with C<errno> set appropriately.
+Equivalent to I<map_create(3)> except that the mappings, and the copies of
+their (string) keys, are allocated from C<pool> rather than with
+I<malloc(3)>. This makes loading large maps much faster. The memory isn't
+returned to C<pool> when mappings are removed, or when the map is
+released. It is all deallocated together when C<pool> is released (which
+must not happen before the map is released). Values are still destroyed
+with C<destroy> as usual. When C<pool> is full, additions fail with
+C<errno> set to C<ENOSPC>.
 
 =cut
 
 */
 
-void *map_get(Map *map, const void *key)
+Map *map_create_with_pool(Pool *pool, map_release_t *destroy)
 {
-	void *ret;
-	int err;
-
-	if (!map || !key)
-		return set_errnull(EINVAL);
-
-	if ((err = map_rdlock(map)))
-		return set_errnull(err);
-
-	ret = map_get_unlocked(map, key);
-
-	if ((err = map_unlock(map)))
-		return set_errnull(err);
-
-	return ret;
+	return map_create_generic_with_pool(pool, NULL, (map_cmp_t *)strcmp, (map_hash_t *)default_hash, NULL, destroy);
 }
 
 /*
 
-=item C<void *map_get_unlocked(const Map *map, const void *key)>
+=item C<Map *map_create_generic_with_pool(Pool *pool, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)>
 
-Equivalent to I<map_get(3)> except that C<map> is not read-locked.
+Equivalent to I<map_create_generic(3)> except that the mappings are
+allocated from C<pool>, as with I<map_create_with_pool(3)>. If C<copy> is
+C<null>, the keys must be strings, and they are copied into C<pool> as
+well (so C<key_destroy> should be C<null>). Otherwise, keys are copied with
+C<copy> and destroyed with C<key_destroy> as usual.
 
 =cut
 
 */
 
-void *map_get_unlocked(const Map *map, const void *key)
+Map *map_create_generic_with_pool(Pool *pool, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy)
 {
-	List *chain;
-	ssize_t length;
-	size_t h, c;
-
-	if (!map || !key)
-		return set_errnull(EINVAL);
+	Map *map;
 
-	if ((h = map->hash(map->size, key)) >= map->size)
+	if (!pool)
 		return set_errnull(EINVAL);
 
-	if (!(chain = map->chain[h]))
-		return set_errnull(ENOENT);
-
-	if ((length = list_length_unlocked(chain)) == -1)
+	if (!(map = map_create_table(NULL, table_sizes[0], copy, cmp, hash, key_destroy, value_destroy, 0, 0)))
 		return NULL;
 
-	for (c = 0; c < length; ++c)
-	{
-		Mapping *mapping = (Mapping *)list_item_unlocked(chain, c);
-
-		if (!map->cmp(mapping->key, key))
-			return mapping->value;
-	}
+	map->pool = pool;
 
-	return set_errnull(ENOENT);
+	return map;
 }
 
 /*
 
-=item C<Mapper *mapper_create(Map *map)>
+=item C<Map *map_create_ordered(map_release_t *destroy)>
 
-Creates an iterator for C<map>. The iterator keeps C<map> write-locked until
-it is released with I<mapper_release(3)> or I<mapper_destroy(3)>. Note that
-the iterator itself is not locked, so it must not be shared between threads.
-On success, returns the iterator. On error, returns C<null> with C<errno>
-set appropriately.
+Equivalent to I<map_create(3)> except that the map created keeps its
+mappings sorted by key (compared with I<strcmp(3)>) in a skip list, rather
+than in a hash table. Iteration visits the mappings in order, and
+I<map_lower_bound(3)>, I<map_upper_bound(3)> and I<mapper_seek(3)> can be
+used.
 
 =cut
 
 */
 
-Mapper *mapper_create(Map *map)
+Map *map_create_ordered(map_release_t *destroy)
 {
-	return mapper_create_wrlocked(map);
+	return map_create_ordered_generic_with_locker(NULL, (map_copy_t *)mem_strdup, (map_cmp_t *)strcmp, (map_release_t *)free, destroy);
 }
 
 /*
 
-=item C<Mapper *mapper_create_rdlocked(Map *map)>
+=item C<Map *map_create_ordered_with_locker(Locker *locker, map_release_t *destroy)>
 
-Equivalent to I<mapper_create(3)> except that C<map> is read-locked rather
-than write-locked. Use this in preference to I<mapper_create(3)> when no
-calls to I<mapper_remove(3)> will be made during the iteration.
+Equivalent to I<map_create_ordered(3)> except that multiple threads
+accessing the new map will be synchronised by C<locker>.
 
 =cut
 
 */
 
-Mapper *mapper_create_rdlocked(Map *map)
+Map *map_create_ordered_with_locker(Locker *locker, map_release_t *destroy)
 {
-	int err;
-
-	if (!map)
-		return set_errnull(EINVAL);
-
-	if ((err = map_rdlock(map)))
-		return set_errnull(err);
-
-	return mapper_create_unlocked(map);
+	return map_create_ordered_generic_with_locker(locker, (map_copy_t *)mem_strdup, (map_cmp_t *)strcmp, (map_release_t *)free, destroy);
 }
 
 /*
 
-=item C<Mapper *mapper_create_wrlocked(Map *map)>
+=item C<Map *map_create_ordered_generic_with_locker(Locker *locker, map_copy_t *copy, map_cmp_t *cmp, map_release_t *key_destroy, map_release_t *value_destroy)>
 
-Equivalent to I<mapper_create(3)> except that this function name makes the
-fact that C<map> is write-locked explicit.
+Equivalent to I<map_create_generic_with_locker(3)> except that the map
+created is ordered by C<cmp>, as with I<map_create_ordered(3)>. No hash
+function is needed.
 
 =cut
 
 */
 
-Mapper *mapper_create_wrlocked(Map *map)
+Map *map_create_ordered_generic_with_locker(Locker *locker, map_copy_t *copy, map_cmp_t *cmp, map_release_t *key_destroy, map_release_t *value_destroy)
 {
-	int err;
+	Map *map;
 
-	if (!map)
+	if (!copy || !cmp)
 		return set_errnull(EINVAL);
 
-	if ((err = map_wrlock(map)))
-		return set_errnull(err);
+	if (!(map = map_create_table(locker, table_min_pow2, copy, cmp, (map_hash_t *)default_hash, key_destroy, value_destroy, 0, 0)))
+		return NULL;
 
-	return mapper_create_unlocked(map);
+	mem_release(map->chain);
+	map->chain = NULL;
+	map->size = 0;
+
+	if (!(map->skiplist = mem_new(skiplist_t)) || !(map->skiplist->head = skipnode_create(NULL, skip_max_levels)))
+	{
+		mem_release(map->skiplist);
+		mem_release(map);
+		return NULL;
+	}
+
+	map->skiplist->levels = 1;
+	map->skiplist->random = (size_t)map;
+
+	return map;
 }
 
 /*
 
-=item C<Mapper *mapper_create_unlocked(Map *map)>
-
-Equivalent to I<mapper_create(3)> except that C<map> is not write-locked.
+=item C<Map *map_open_mmap(const char *path)>
+
+Creates a frozen map from the file C<path>, which must have been created by
+I<map_freeze(3)> on a host with the same word size and byte order. The
+file is mapped into memory (read-only and shared), and I<map_get(3)>
+searches it directly, so opening the map takes the same time regardless of
+its size, and the memory is shared by all processes that open the same
+file. The keys and values returned by the map point into the file. They
+must not be modified, and they are only valid until the map is released.
+Frozen maps can't be modified, and they don't need a I<Locker> to be shared
+between threads. It is the caller's responsibility to deallocate the new
+map with I<map_release(3)> or I<map_destroy(3)>, which unmaps the file. On
+success, returns the new map. On error, returns C<null> with C<errno> set
+appropriately (C<EINVAL> if C<path> isn't a frozen map).
 
 =cut
 
 */
 
-Mapper *mapper_create_unlocked(Map *map)
+Map *map_open_mmap(const char *path)
 {
-	Mapper *mapper;
+	const frozen_t *header;
+	struct stat status[1];
+	Map *map;
+	char *image;
+	size_t count;
+	int fd;
 
-	if (!map)
+	if (!path)
 		return set_errnull(EINVAL);
 
-	if (!(mapper = mem_new(Mapper))) /* XXX decouple */
+	if ((fd = open(path, O_RDONLY)) == -1)
 		return NULL;
 
-	mapper->map = map;
-	mapper->chain_index = -1;
-	mapper->item_index = -1;
-	mapper->next_chain_index = -1;
-	mapper->next_item_index = -1;
-
-	return mapper;
-}
-
-/*
+	if (fstat(fd, status) == -1)
+	{
+		close(fd);
+		return NULL;
+	}
 
-=item C<void mapper_release(Mapper *mapper)>
+	if (status->st_size < sizeof(frozen_t))
+	{
+		close(fd);
+		return set_errnull(EINVAL);
+	}
 
-Releases (deallocates) C<mapper> and unlocks the associated map.
+	image = mmap(NULL, (size_t)status->st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
 
-=cut
+	if (image == MAP_FAILED)
+		return NULL;
 
-*/
+	/* Check the header, and that every key is followed by a nul byte */
 
-void mapper_release(Mapper *mapper)
-{
-	int err;
+	header = (const frozen_t *)image;
+	count = header->count;
 
-	if (!mapper)
-		return;
+	if (memcmp(header->magic, frozen_magic, sizeof(frozen_magic)) || header->version != frozen_version || header->word != sizeof(size_t) ||
+		header->size != (size_t)status->st_size || count > (header->size - sizeof(frozen_t)) / (sizeof(size_t) + sizeof(frozen_slot_t)) ||
+		(count && image[header->size - 1] != '\0'))
+	{
+		munmap(image, (size_t)status->st_size);
+		return set_errnull(EINVAL);
+	}
 
-	if ((err = map_unlock(mapper->map)))
+	if (!(map = map_create_table(NULL, table_min_pow2, NULL, (map_cmp_t *)strcmp, (map_hash_t *)default_hash, NULL, NULL, 0, 0)))
 	{
-		set_errno(err);
-		return;
+		munmap(image, (size_t)status->st_size);
+		return NULL;
 	}
 
-	mem_release(mapper);
+	mem_release(map->chain);
+	map->chain = NULL;
+	map->size = count;
+	map->items = count;
+	map->image = image;
+	map->image_size = header->size;
+
+	return map;
 }
 
 /*
 
-=item C<void mapper_release_unlocked(Mapper *mapper)>
-
-Equivalent to I<mapper_release(3)> except that the associated map is not
-unlocked.
+C<Map *map_create_table(Locker *locker, size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy, int flat, size_t stripes)>
 
-=cut
+Creates a map with chained buckets, or with open addressed slots if C<flat>
+is non-zero. If C<stripes> is non-zero, the (chained) map is concurrent,
+with C<stripes> striped locks.
 
 */
 
-void mapper_release_unlocked(Mapper *mapper)
+static Map *map_create_table(Locker *locker, size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy, int flat, size_t stripes)
 {
-	if (!mapper)
-		return;
+	Map *map;
+	size_t i;
 
-	mem_release(mapper);
-}
+	if (hash == (map_hash_t *)default_hash || stripes)
+	{
+		for (i = table_min_pow2; (i < size || i < stripes) && i < table_max_pow2; i <<= 1)
+			;
 
-/*
+		if (i < size)
+			return set_errnull(EINVAL);
 
-=item C<void *mapper_destroy(Mapper **mapper)>
+		size = i;
+	}
+	else
+	{
+		for (i = 0; i < num_table_sizes; ++i)
+		{
+			if (table_sizes[i] >= size)
+			{
+				size = table_sizes[i];
+				break;
+			}
+		}
 
-Destroys (deallocates and sets to C<null>) C<*mapper> and unlocks the
-associated map. Returns C<null>. On error, sets C<errno> appropriately.
+		if (i == num_table_sizes)
+			return set_errnull(EINVAL);
+	}
 
-=cut
+	if (!(map = mem_new(Map))) /* XXX decouple */
+		return NULL;
 
-*/
+	map->chain = NULL;
+	map->old_chain = NULL;
+	map->old_size = 0;
+	map->migrated = 0;
+	map->masked = (hash == (map_hash_t *)default_hash || stripes);
+	map->slots = NULL;
+	map->striping = NULL;
+	map->pool = NULL;
+	map->skiplist = NULL;
+	map->image = NULL;
+	map->image_size = 0;
+
+	if (flat)
+	{
+		if (!(map->slots = mem_create(size, slot_t)))
+		{
+			mem_release(map);
+			return NULL;
+		}
 
-void *mapper_destroy(Mapper **mapper)
-{
-	if (mapper && *mapper)
+		memset(map->slots, 0, size * sizeof(slot_t));
+	}
+	else
 	{
-		mapper_release(*mapper);
-		*mapper = NULL;
+		if (!(map->chain = mem_create(size, List *)))
+		{
+			mem_release(map);
+			return NULL;
+		}
+
+		memset(map->chain, 0, size * sizeof(List *));
 	}
 
-	return NULL;
+	if (stripes)
+	{
+		if (!(map->striping = mem_new(striping_t)))
+		{
+			mem_release(map->chain);
+			mem_release(map);
+			return NULL;
+		}
+
+		if (!(map->striping->stripe = mem_create(stripes, stripe_t)))
+		{
+			mem_release(map->striping);
+			mem_release(map->chain);
+			mem_release(map);
+			return NULL;
+		}
+
+		map->striping->exclusive = 0;
+		map->striping->num_stripes = stripes;
+		pthread_rwlock_init(&map->striping->resize, NULL);
+
+		for (i = 0; i < stripes; ++i)
+		{
+			pthread_rwlock_init(&map->striping->stripe[i].lock, NULL);
+			map->striping->stripe[i].items = 0;
+		}
+	}
+
+	map->size = size;
+	map->items = 0;
+	map->hash = hash;
+	map->copy = copy;
+	map->cmp = cmp;
+	map->key_destroy = key_destroy;
+	map->value_destroy = value_destroy;
+	map->mapper = NULL;
+	map->locker = locker;
+
+	return map;
 }
 
 /*
 
-=item C<void *mapper_destroy_unlocked(Mapper **mapper)>
-
-Equivalent to I<mapper_destroy(3)> except that the associated map is not
-unlocked.
+C<int striping_lock(const Map *map, int write)>
 
-=cut
+Read-locks (or write-locks if C<write> is non-zero) every stripe of the
+concurrent C<map>, as well as the lock that excludes resizing. On success,
+returns C<0>. On error, returns an error code.
 
 */
 
-void *mapper_destroy_unlocked(Mapper **mapper)
+static int striping_lock(const Map *map, int write)
 {
-	if (mapper && *mapper)
+	striping_t *striping = map->striping;
+	size_t i;
+	int err;
+
+	if ((err = (write) ? pthread_rwlock_wrlock(&striping->resize) : pthread_rwlock_rdlock(&striping->resize)))
+		return err;
+
+	for (i = 0; i < striping->num_stripes; ++i)
 	{
-		mapper_release_unlocked(*mapper);
-		*mapper = NULL;
+		if ((err = (write) ? pthread_rwlock_wrlock(&striping->stripe[i].lock) : pthread_rwlock_rdlock(&striping->stripe[i].lock)))
+		{
+			while (i--)
+				pthread_rwlock_unlock(&striping->stripe[i].lock);
+
+			pthread_rwlock_unlock(&striping->resize);
+
+			return err;
+		}
 	}
 
-	return NULL;
+	if (write)
+		striping->exclusive = 1;
+
+	return 0;
 }
 
 /*
 
-=item C<int mapper_has_next(Mapper *mapper)>
-
-Returns whether or not there is another item in the map over which C<mapper>
-is iterating. On error, returns C<-1> with C<errno> set appropriately.
+C<int striping_unlock(const Map *map)>
 
-=cut
+Unlocks every stripe of the concurrent C<map> locked by I<striping_lock()>.
+On success, returns C<0>. On error, returns an error code.
 
 */
 
-int mapper_has_next(Mapper *mapper)
+static int striping_unlock(const Map *map)
 {
-	List *chain;
-	ssize_t length;
+	striping_t *striping = map->striping;
+	size_t i;
+	int err, ret = 0;
 
-	if (!mapper)
-		return set_errno(EINVAL);
+	if (striping->exclusive)
+		striping->exclusive = 0;
 
-	/* Find the current/first chain */
+	for (i = striping->num_stripes; i--; )
+		if ((err = pthread_rwlock_unlock(&striping->stripe[i].lock)))
+			ret = err;
 
-	mapper->next_chain_index = mapper->chain_index;
-	mapper->next_item_index = mapper->item_index;
+	if ((err = pthread_rwlock_unlock(&striping->resize)))
+		ret = err;
 
-	if (mapper->next_chain_index == -1)
-		++mapper->next_chain_index;
+	return ret;
+}
 
-	while (mapper->next_chain_index < mapper->map->size && !mapper->map->chain[mapper->next_chain_index])
-		++mapper->next_chain_index;
+/*
 
-	if (mapper->next_chain_index == mapper->map->size)
-		return 0;
+C<int striping_lock_key(const Map *map, const void *key, int write, stripe_t **stripe)>
 
-	chain = mapper->map->chain[mapper->next_chain_index];
+Read-locks (or write-locks if C<write> is non-zero) the stripe of the
+concurrent C<map> that C<key> belongs to, and stores it in C<*stripe>. On
+success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
 
-	/* Find the next item */
+*/
 
-	if ((length = list_length_unlocked(chain)) == -1)
+static int striping_lock_key(const Map *map, const void *key, int write, stripe_t **stripe)
+{
+	size_t hash;
+	int err;
+
+	if (map_hash(map, key, &hash) == -1)
 		return -1;
 
-	if (++mapper->next_item_index < length)
-		return 1;
+	*stripe = &map->striping->stripe[hash & (map->striping->num_stripes - 1)];
 
-	do
-	{
-		++mapper->next_chain_index;
+	if ((err = (write) ? pthread_rwlock_wrlock(&(*stripe)->lock) : pthread_rwlock_rdlock(&(*stripe)->lock)))
+		return set_errno(err);
 
-		while (mapper->next_chain_index < mapper->map->size && !mapper->map->chain[mapper->next_chain_index])
-			++mapper->next_chain_index;
+	return 0;
+}
 
-		if (mapper->next_chain_index == mapper->map->size)
-			return 0;
+/*
 
-		chain = mapper->map->chain[mapper->next_chain_index];
+=item C<int map_rdlock(const Map *map)>
 
-		if ((length = list_length_unlocked(chain)) == -1)
-			return -1;
-	}
-	while (length == 0);
+Claims a read lock on C<map> (if C<map> was created with a I<Locker>). This
+is needed when multiple read-only I<map(3)> module functions need to be
+called atomically. It is the client's responsibility to call
+I<map_unlock(3)> after the atomic operation. The only functions that may be
+called on C<map> between calls to I<map_rdlock(3)> and I<map_unlock(3)> are
+any read-only I<map(3)> module functions whose name ends with C<_unlocked>.
+On success, returns C<0>. On error, returns an error code.
 
-	mapper->next_item_index = 0;
+=cut
 
-	return 1;
+*/
+
+#define map_rdlock(map) ((map) ? ((map)->striping) ? striping_lock((map), 0) : locker_rdlock((map)->locker) : EINVAL)
+#define map_wrlock(map) ((map) ? ((map)->striping) ? striping_lock((map), 1) : locker_wrlock((map)->locker) : EINVAL)
+#define map_unlock(map) ((map) ? ((map)->striping) ? striping_unlock((map)) : locker_unlock((map)->locker) : EINVAL)
+
+int (map_rdlock)(const Map *map)
+{
+	return map_rdlock(map);
 }
 
 /*
 
-=item C<void *mapper_next(Mapper *mapper)>
+=item C<int map_wrlock(const Map *map)>
 
-Returns the next item in the map over which C<mapper> is iterating. On
-error, returns C<null> with C<errno> set appropriately.
+Claims a write lock on C<map> (if C<map> was created with a I<Locker>). This
+is needed when multiple read/write I<map(3)> module functions need to be
+called atomically. It is the client's responsibility to subsequently call
+I<map_unlock(3)>. The only functions that may be called on C<map> between
+calls to I<map_wrlock(3)> and I<map_unlock(3)> are any I<map(3)> module
+functions whose name ends with C<_unlocked>. On success, returns C<0>. On
+error, returns an error code.
 
 =cut
 
 */
 
-void *mapper_next(Mapper *mapper)
+int (map_wrlock)(const Map *map)
 {
-	if (!mapper)
-		return set_errnull(EINVAL);
-
-	return mapper_next_mapping(mapper)->value;
+	return map_wrlock(map);
 }
 
 /*
 
-=item C<const Mapping *mapper_next_mapping(Mapper *mapper)>
+=item C<int map_unlock(const Map *map)>
 
-Returns the next mapping (key, value) pair in the map over which C<mapper>
-is iterating. On error, returns C<null> with C<errno> set appropriately.
+Unlocks a read or write lock on C<map> obtained with I<map_rdlock(3)> or
+I<map_wrlock(3)> (if C<map> was created with a C<locker>). On success,
+returns C<0>. On error, returns an error code.
 
 =cut
 
 */
 
-const Mapping *mapper_next_mapping(Mapper *mapper)
+int (map_unlock)(const Map *map)
 {
-	if (!mapper)
-		return set_errnull(EINVAL);
-
-	mapper->chain_index = mapper->next_chain_index;
-	mapper->item_index = mapper->next_item_index;
-
-	return (Mapping *)list_item_unlocked(mapper->map->chain[mapper->chain_index], mapper->item_index);
+	return map_unlock(map);
 }
 
 /*
 
-=item C<void mapper_remove(Mapper *mapper)>
+=item C<void map_release(Map *map)>
 
-Removes the current item in the iteration C<mapper>. The next item in the
-iteration is the item following the removed item, if any. This must be
-called after I<mapper_next(3)>. On error, sets C<errno> appropriately.
+Releases (deallocates) C<map>, destroying its items if necessary. On error,
+sets C<errno> appropriately.
 
 =cut
 
 */
 
-void mapper_remove(Mapper *mapper)
+void map_release(Map *map)
 {
-	if (!mapper)
-	{
-		set_errno(EINVAL);
+	size_t i;
+
+	if (!map)
 		return;
-	}
 
-	if (mapper->item_index == -1)
+	if (map->image)
 	{
-		set_errno(EINVAL);
-		return;
+		munmap(map->image, map->image_size);
 	}
+	else if (map->skiplist)
+	{
+		skipnode_t *node, *next;
 
-	list_remove_unlocked(mapper->map->chain[mapper->chain_index], (size_t)mapper->item_index--);
-	--mapper->map->items;
-}
+		for (node = map->skiplist->head; node; node = next)
+		{
+			next = node->next[0];
+			mapping_release(node->mapping);
+			mem_release(node);
+		}
 
-/*
+		mem_release(map->skiplist);
+	}
+	else if (map->slots)
+	{
+		for (i = 0; i < map->size; ++i)
+			mapping_release(map->slots[i].mapping);
 
-=item C<int map_has_next(Map *map)>
+		mem_release(map->slots);
+	}
+	else
+	{
+		for (i = 0; i < map->size; ++i)
+			list_release(map->chain[i]);
 
-Returns whether or not there is another item in C<map> using an internal
-iterator. The first time this is called, a new internal I<Mapper> will be
-created (Note: There can be only one at any time for a given map). When
-there are no more items, returns C<0> and destroys the internal iterator.
-When it returns C<1>, use I<map_next(3)> to retrieve the next item. On
-error, returns C<-1> with C<errno> set appropriately.
-
-Note: If an iteration using an internal iterator terminates before the end
-of the map, it is the caller's responsibility to call I<map_break(3)>.
-Failure to do so will cause the internal iterator to leak. It will also
-break the next call to I<map_has_next(3)> which will continue where the
-current iteration stopped rather than starting at the beginning again.
-I<map_release(3)> assumes that there is no internal iterator, so it is the
-caller's responsibility to complete the iteration, or call I<map_break(3)>
-before releasing C<map> with I<map_release(3)> or I<map_destroy(3)>.
-
-Note: The internal I<Mapper> does not lock C<map> so this function is not
-threadsafe. It can only be used with maps created in the current function
-(to guarantee that no other thread can access it). This practice should be
-observed even in single-threaded applications to avoid breaking iterator
-semantics (possible with nested function calls). If C<map> is a parameter or
-a variable declared outside the function, it is best to create an explicit
-I<Mapper> instead. If this function is used on such maps instead, it is the
-caller's responsibility to explicitly lock C<map> first with
-I<map_wrlock(3)> and explicitly unlock it with I<map_unlock(3)>. Do this
-even if you are writing single-threaded code, in case your function may one
-day be used in a multi-threaded application.
-
-=cut
-
-*/
+		mem_release(map->chain);
 
-int map_has_next(Map *map)
-{
-	int has;
+		for (i = 0; i < map->old_size; ++i)
+			list_release(map->old_chain[i]);
 
-	if (!map)
-		return set_errno(EINVAL);
+		mem_release(map->old_chain);
+	}
 
-	if (!map->mapper && !(map->mapper = mapper_create_unlocked(map)))
-		return -1;
+	if (map->striping)
+	{
+		for (i = 0; i < map->striping->num_stripes; ++i)
+			pthread_rwlock_destroy(&map->striping->stripe[i].lock);
 
-	if ((has = mapper_has_next(map->mapper)) != 1)
-		map_break(map);
+		pthread_rwlock_destroy(&map->striping->resize);
+		mem_release(map->striping->stripe);
+		mem_release(map->striping);
+	}
 
-	return has;
+	mem_release(map);
 }
 
 /*
 
-=item C<void map_break(Map *map)>
+=item C<void *map_destroy(Map **map)>
 
-Unlocks C<map> and destroys its internal iterator. Must be used only when an
-iteration using an internal iterator has terminated before reaching the end
-of C<map>. On error, returns C<null> with C<errno> set appropriately.
+Destroys (deallocates and sets to C<null>) C<*map>. Returns C<null>.
+B<Note:> maps shared by multiple threads must not be destroyed until after
+all threads have finished with it.
 
 =cut
 
 */
 
-void map_break(Map *map)
+void *map_destroy(Map **map)
 {
-	if (!map)
+	if (map && *map)
 	{
-		set_errno(EINVAL);
-		return;
+		map_release(*map);
+		*map = NULL;
 	}
 
-	mapper_destroy_unlocked(&map->mapper);
+	return NULL;
 }
 
 /*
 
-=item C<void *map_next(Map *map)>
-
-Returns the next item in C<map> using its internal iterator. On error,
-returns C<null> with C<errno> set appropriately.
+C<int chain_own(List **chain, size_t size, map_release_t *destroy)>
 
-=cut
+Sets the value destructor of every mapping in the C<size> buckets of
+C<chain> to C<destroy>. On success, returns C<0>. On error, returns C<-1>
+with C<errno> set appropriately.
 
 */
 
-void *map_next(Map *map)
+static int chain_own(List **chain, size_t size, map_release_t *destroy)
 {
-	if (!map || !map->mapper)
-		return set_errnull(EINVAL);
-
-	return mapper_next(map->mapper);
-}
-
-/*
-
-=item C<const Mapping *map_next_mapping(Map *map)>
-
-Returns the next mapping (key, value) pair in C<map> using its internal
-iterator. On error, returns C<-1> with C<errno> set appropriately.
+	ssize_t length;
+	size_t c, i;
 
-=cut
+	for (c = 0; c < size; ++c)
+	{
+		if (!chain[c])
+			continue;
 
-*/
+		if ((length = list_length_unlocked(chain[c])) == -1)
+			return -1;
 
-const Mapping *map_next_mapping(Map *map)
-{
-	if (!map || !map->mapper)
-		return set_errnull(EINVAL);
+		for (i = 0; i < length; ++i)
+		{
+			Mapping *mapping = (Mapping *)list_item_unlocked(chain[c], i);
+			mapping->value_destroy = destroy;
+		}
+	}
 
-	return mapper_next_mapping(map->mapper);
+	return 0;
 }
 
 /*
 
-=item C<void map_remove_current(Map *map)>
-
-Removes the current item in C<map> using its internal iterator. The next
-item in the iteration is the item following the removed item, if any. This
-must be called after I<map_next(3)>.
+C<void skip_own(Map *map, map_release_t *destroy)>
 
-=cut
+Sets the value destructor of every mapping in the ordered C<map> to
+C<destroy>.
 
 */
 
-void map_remove_current(Map *map)
+static void skip_own(Map *map, map_release_t *destroy)
 {
-	if (!map || !map->mapper)
-	{
-		set_errno(EINVAL);
-		return;
-	}
+	skipnode_t *node;
 
-	mapper_remove(map->mapper);
+	for (node = map->skiplist->head->next[0]; node; node = node->next[0])
+		node->mapping->value_destroy = destroy;
 }
 
 /*
 
-=item C<const void *mapping_key(const Mapping *mapping)>
+=item C<int map_own(Map *map, map_release_t *destroy)>
 
-Returns the key in C<mapping>. On error, returns C<null> with C<errno> set
-appropriately.
+Causes C<map> to take ownership of its items. The items will be destroyed
+using C<destroy> when their mappings are removed from C<map> or when C<map>
+is destroyed. On success, returns C<0>. On error, returns C<-1> with
+C<errno> set appropriately.
 
 =cut
 
 */
 
-const void *mapping_key(const Mapping *mapping)
+int map_own(Map *map, map_release_t *destroy)
 {
-	if (!mapping)
-		return set_errnull(EINVAL);
-
-	return mapping->key;
-}
-
-/*
-
-=item C<const void *mapping_value(const Mapping *mapping)>
+	int ret;
+	int err;
 
-Returns the value in C<mapping>. On error, returns C<null> with C<errno> set
-appropriately.
+	if (!map || !destroy)
+		return set_errno(EINVAL);
 
-=cut
+	if ((err = map_wrlock(map)))
+		return set_errno(err);
 
-*/
+	ret = map_own_unlocked(map, destroy);
 
-const void *mapping_value(const Mapping *mapping)
-{
-	if (!mapping)
-		return set_errnull(EINVAL);
+	if ((err = map_unlock(map)))
+		return set_errno(err);
 
-	return mapping->value;
+	return ret;
 }
 
 /*
 
-=item C<List *map_keys(Map *map)>
+=item C<int map_own_unlocked(Map *map, map_release_t *destroy)>
 
-Creates and returns a list of all of the keys contained in C<map>. It is the
-caller's responsibility to deallocate the new list with I<list_release(3)>
-or I<list_destroy(3)>. It is strongly recommended to use I<list_destroy(3)>,
-because it also sets the pointer variable to C<null>. The keys in the new
-list are owned by C<map>, so the list returned must not outlive C<map>. On
-error, returns C<null> with C<errno> set appropriately.
+Equivalent to I<map_own(3)> except that C<map> is not write-locked.
 
 =cut
 
 */
 
-List *map_keys(Map *map)
+int map_own_unlocked(Map *map, map_release_t *destroy)
 {
-	return map_keys_with_locker(NULL, map);
-}
+	size_t c;
 
-/*
+	if (!map || !destroy)
+		return set_errno(EINVAL);
 
-=item C<List *map_keys_unlocked(Map *map)>
+	if (map->image)
+		return set_errno(EPERM);
 
-Equivalent to I<map_keys(3)> except that C<map> is not read-locked.
+	if (destroy == map->value_destroy)
+		return 0;
 
-=cut
+	map->value_destroy = destroy;
 
-*/
+	if (map->skiplist)
+	{
+		skip_own(map, destroy);
+		return 0;
+	}
 
-List *map_keys_unlocked(Map *map)
-{
-	return map_keys_with_locker_unlocked(NULL, map);
+	if (map->slots)
+	{
+		for (c = 0; c < map->size; ++c)
+			if (map->slots[c].mapping)
+				map->slots[c].mapping->value_destroy = destroy;
+
+		return 0;
+	}
+
+	if (chain_own(map->chain, map->size, destroy) == -1 || chain_own(map->old_chain, map->old_size, destroy) == -1)
+		return -1;
+
+	return 0;
 }
 
 /*
 
-=item C<List *map_keys_with_locker(Locker *locker, Map *map)>
+=item C<map_release_t *map_disown(Map *map)>
 
-Equivalent to I<map_keys(3)> except that multiple threads accessing the list
-returned will be synchronised by C<locker>.
+Causes C<map> to relinquish ownership of its items. The items will not be
+destroyed when their mappings are removed from C<map> or when C<map> is
+destroyed. On success, returns the previous destroy function, if any. On
+error, returns C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-List *map_keys_with_locker(Locker *locker, Map *map)
+map_release_t *map_disown(Map *map)
 {
-	List *keys;
+	map_release_t *ret;
 	int err;
 
 	if (!map)
-		return set_errnull(EINVAL);
+		return (map_release_t *)set_errnullf(EINVAL);
 
-	if ((err = map_rdlock(map)))
-		return set_errnull(err);
+	if ((err = map_wrlock(map)))
+		return (map_release_t *)set_errnullf(err);
 
-	keys = map_keys_with_locker_unlocked(locker, map);
+	ret = map_disown_unlocked(map);
 
 	if ((err = map_unlock(map)))
-		return set_errnull(err);
+		return (map_release_t *)set_errnullf(err);
 
-	return keys;
+	return ret;
 }
 
 /*
 
-=item C<List *map_keys_with_locker_unlocked(Locker *locker, Map *map)>
+=item C<map_release_t *map_disown_unlocked(Map *map)>
 
-Equivalent to I<map_keys_with_locker(3)> except that C<map> is not
-read-locked.
+Equivalent to I<map_disown(3)> except that C<map> is not write-locked.
 
 =cut
 
 */
 
-List *map_keys_with_locker_unlocked(Locker *locker, Map *map)
+map_release_t *map_disown_unlocked(Map *map)
 {
-	Mapper *mapper;
-	List *keys;
+	size_t c;
+	map_release_t *destroy;
 
 	if (!map)
-		return set_errnull(EINVAL);
+		return (map_release_t *)set_errnullf(EINVAL);
 
-	if (!(keys = list_create_with_locker(locker, NULL)))
+	if (!map->value_destroy)
 		return NULL;
 
-	if (!(mapper = mapper_create_unlocked(map)))
+	destroy = map->value_destroy;
+	map->value_destroy = NULL;
+
+	if (map->skiplist)
 	{
-		list_release(keys);
-		return NULL;
+		skip_own(map, NULL);
+		return destroy;
 	}
 
-	while (mapper_has_next(mapper) == 1)
+	if (map->slots)
 	{
-		const Mapping *mapping = mapper_next_mapping(mapper);
+		for (c = 0; c < map->size; ++c)
+			if (map->slots[c].mapping)
+				map->slots[c].mapping->value_destroy = NULL;
 
-		if (!list_append(keys, mapping->key))
-		{
-			list_destroy(&keys);
-			break;
-		}
+		return destroy;
 	}
 
-	mapper_release_unlocked(mapper);
+	if (chain_own(map->chain, map->size, NULL) == -1 || chain_own(map->old_chain, map->old_size, NULL) == -1)
+		return NULL;
 
-	return keys;
+	return destroy;
 }
 
 /*
 
-=item C<List *map_values(Map *map)>
-
-Creates and returns a list of all of the values contained in C<map>. It is
-the caller's responsibility to deallocate the new list with
-I<list_release(3)> or I<list_destroy(3)>. It is strongly recommended to use
-I<list_destroy(3)>, because it also sets the pointer variable to C<null>.
-The values in the list are not owned by the list, so it must not outlive the
-owner of the items in C<map>. On error, returns C<null> with C<errno> set
-appropriately.
+C<int map_migrate(Map *map, size_t buckets)>
 
-=cut
+Moves the mappings in the next C<buckets> old buckets of C<map> (left over
+from its last resize) into the new buckets. The mappings themselves are
+reused, so keys are neither copied nor destroyed. When the last old bucket
+has been migrated, the old buckets are released. On success, returns C<0>.
+On error, returns C<-1> with C<errno> set appropriately.
 
 */
 
-List *map_values(Map *map)
+static int map_migrate(Map *map, size_t buckets)
 {
-	return map_values_with_locker(NULL, map);
-}
+	List *old;
+	Mapping *mapping;
+	size_t h;
 
-/*
+	for (; buckets && map->migrated < map->old_size; --buckets, ++map->migrated)
+	{
+		if (!(old = map->old_chain[map->migrated]))
+			continue;
 
-=item C<List *map_values_unlocked(Map *map)>
+		while (list_length_unlocked(old) > 0)
+		{
+			mapping = (Mapping *)list_item_unlocked(old, list_length_unlocked(old) - 1);
+			h = map_bucket(map, map->size, mapping->hash);
 
-Equivalent to I<map_values(3)> except that C<map> is not read-locked.
+			if (!map->chain[h] && !(map->chain[h] = chain_create(map)))
+				return -1;
 
-=cut
+			if (!list_append_unlocked(map->chain[h], mapping))
+				return -1;
 
-*/
+			list_pop_unlocked(old);
+		}
 
-List *map_values_unlocked(Map *map)
-{
-	return map_values_with_locker_unlocked(NULL, map);
+		list_release(old);
+		map->old_chain[map->migrated] = NULL;
+	}
+
+	if (map->migrated == map->old_size)
+	{
+		mem_release(map->old_chain);
+		map->old_chain = NULL;
+		map->old_size = 0;
+		map->migrated = 0;
+	}
+
+	return 0;
 }
 
 /*
 
-=item C<List *map_values_with_locker(Locker *locker, Map *map)>
-
-Equivalent to I<map_values(3)> except that multiple threads accessing the
-list returned will be synchronised by C<locker>.
+C<static int map_resize(Map *map)>
 
-=cut
+Resizes C<map> to use the next prime in a prebuilt sequence of primes
+between C<11> and C<26,214,401> that is greater than the current size (or
+to double the current size, up to C<33,554,432>, for maps that use the
+default hash function). On
+success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
 
 */
 
-List *map_values_with_locker(Locker *locker, Map *map)
+static int map_resize(Map *map)
 {
-	List *values;
-	int err;
+	size_t size = 0;
+	size_t i;
+	List **chain;
 
 	if (!map)
-		return set_errnull(EINVAL);
+		return set_errno(EINVAL);
 
-	if ((err = map_rdlock(map)))
-		return set_errnull(err);
+	if (map->masked)
+	{
+		if (map->size >= table_max_pow2)
+			return set_errno(EINVAL);
 
-	values = map_values_with_locker_unlocked(locker, map);
+		size = map->size << 1;
+	}
+	else
+	{
+		for (i = 1; i < num_table_sizes; ++i)
+		{
+			if (table_sizes[i] > map->size)
+			{
+				size = table_sizes[i];
+				break;
+			}
+		}
 
-	if ((err = map_unlock(map)))
-		return set_errnull(err);
+		if (i == num_table_sizes || size == 0)
+			return set_errno(EINVAL);
+	}
 
-	return values;
-}
+	/* Open addressed maps move their existing mappings into the new slots */
 
-/*
+	if (map->slots)
+	{
+		slot_t *slots;
 
-=item C<List *map_values_with_locker_unlocked(Locker *locker, Map *map)>
+		if (!(slots = mem_create(size, slot_t)))
+			return -1;
 
-Equivalent to I<map_values_with_locker(3)> except that C<map> is not
-read-locked.
+		memset(slots, 0, size * sizeof(slot_t));
 
-=cut
+		for (i = 0; i < map->size; ++i)
+			if (map->slots[i].mapping)
+				slot_place(slots, size, map_bucket(map, size, map->slots[i].mapping->hash), map->slots[i].mapping);
 
-*/
+		mem_release(map->slots);
+		map->slots = slots;
+		map->size = size;
 
-List *map_values_with_locker_unlocked(Locker *locker, Map *map)
-{
-	Mapper *mapper;
-	List *values;
+		return 0;
+	}
 
-	if (!map)
-		return set_errnull(EINVAL);
+	/*
+	** Chained maps keep their old buckets, and their mappings are migrated
+	** into the new buckets a few at a time by subsequent insertions and
+	** removals (see map_migrate()). Any previous resize must finish first.
+	*/
 
-	if (!(values = list_create_with_locker(locker, NULL)))
-		return NULL;
+	if (map->old_chain && map_migrate(map, map->old_size) == -1)
+		return -1;
 
-	if (!(mapper = mapper_create_unlocked(map)))
-	{
-		list_release(values);
-		return NULL;
-	}
+	if (!(chain = mem_create(size, List *)))
+		return -1;
 
-	while (mapper_has_next(mapper) == 1)
-	{
-		const Mapping *mapping = mapper_next_mapping(mapper);
+	memset(chain, 0, size * sizeof(List *));
 
-		if (!list_append(values, mapping->value))
-		{
-			list_destroy(&values);
-			break;
-		}
-	}
+	map->old_chain = map->chain;
+	map->old_size = map->size;
+	map->migrated = 0;
+	map->chain = chain;
+	map->size = size;
 
-	mapper_release_unlocked(mapper);
+	/* Concurrent maps can't migrate later, since stripes are locked separately */
 
-	return values;
+	if (map->striping)
+		return map_migrate(map, map->old_size);
+
+	return 0;
 }
 
 /*
 
-=item C<void map_apply(Map *map, map_action_t *action, void *data)>
+=item C<int map_add(Map *map, const void *key, void *value)>
 
-Invokes C<action> for each of C<map>'s items. The arguments passed to
-C<action> are the key, the item, and C<data>. On error, sets C<errno>
-appropriately.
+Adds the C<(key, value)> mapping to C<map>, if C<key> is not already
+present. Note that C<key> is copied but C<value> is not. On success, returns
+C<0>. On error, returns C<-1> with C<errno> set appropriately.
 
 =cut
 
 */
 
-void map_apply(Map *map, map_action_t *action, void *data)
+int map_add(Map *map, const void *key, void *value)
 {
-	map_apply_wrlocked(map, action, data);
+	return map_insert(map, key, value, 0);
 }
 
 /*
 
-=item C<void map_apply_rdlocked(Map *map, map_action_t *action, void *data)>
+=item C<int map_add_unlocked(Map *map, const void *key, void *value)>
 
-Equivalent to I<map_apply(3)> except that C<map> is read-locked rather than
-write-locked. Use this in preference to I<map_apply(3)> when C<map> and its
-items will not be modified during the iteration.
+Equivalent to I<map_add(3)> except that C<map> is not write-locked.
 
 =cut
 
 */
 
-void map_apply_rdlocked(Map *map, map_action_t *action, void *data)
+int map_add_unlocked(Map *map, const void *key, void *value)
 {
-	int err;
-
-	if (!map || !action)
-	{
-		set_errno(EINVAL);
-		return;
-	}
-
-	if ((err = map_rdlock(map)))
-	{
-		set_errno(err);
-		return;
-	}
-
-	map_apply_unlocked(map, action, data);
-
-	if ((err = map_unlock(map)))
-	{
-		set_errno(err);
-		return;
-	}
+	return map_insert_unlocked(map, key, value, 0);
 }
 
 /*
 
-=item C<void map_apply_wrlocked(Map *map, map_action_t *action, void *data)>
+=item C<int map_put(Map *map, const void *key, void *value)>
 
-Equivalent to I<map_apply(3)> except that this function name makes the fact
-that C<map> is write-locked explicit.
+Adds the C<(key, value)> mapping to C<map>, replacing any existing C<(key,
+value)> mapping. Note that C<key> is copied but C<value> is not. On success,
+returns C<0>. On error, returns C<-1> with C<errno> set appropriately.
 
 =cut
 
 */
 
-void map_apply_wrlocked(Map *map, map_action_t *action, void *data)
+int map_put(Map *map, const void *key, void *value)
 {
-	int err;
-
-	if (!map || !action)
-	{
-		set_errno(EINVAL);
-		return;
-	}
-
-	if ((err = map_wrlock(map)))
-	{
-		set_errno(err);
-		return;
-	}
-
-	map_apply_unlocked(map, action, data);
-
-	if ((err = map_unlock(map)))
-	{
-		set_errno(err);
-		return;
-	}
+	return map_insert(map, key, value, 1);
 }
 
 /*
 
-=item C<void map_apply_unlocked(Map *map, map_action_t *action, void *data)>
+=item C<int map_put_unlocked(Map *map, const void *key, void *value)>
 
-Equivalent to I<map_apply(3)> except that C<map> is not write-locked.
+Equivalent to I<map_put(3)> except that C<map> is not write-locked.
 
 =cut
 
 */
 
-void map_apply_unlocked(Map *map, map_action_t *action, void *data)
+int map_put_unlocked(Map *map, const void *key, void *value)
 {
-	Mapper *mapper;
-
-	if (!map || !action)
-	{
-		set_errno(EINVAL);
-		return;
-	}
-
-	if (!(mapper = mapper_create_unlocked(map)))
-		return;
-
-	while (mapper_has_next(mapper) == 1)
-	{
-		const Mapping *mapping = mapper_next_mapping(mapper);
-		action(mapping->key, mapping->value, data);
-	}
-
-	mapper_release_unlocked(mapper);
+	return map_insert_unlocked(map, key, value, 1);
 }
 
 /*
 
-=item C<ssize_t map_size(Map *map)>
-
-Returns the number of mappings in C<map>. On error, returns C<-1> with
-C<errno> set appropriately.
+C<int striping_grow(Map *map)>
 
-=cut
+Resizes the concurrent C<map> if it has too many items for its size. This
+write-locks every stripe, so it must be called without holding any of them.
+On success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
 
 */
 
-ssize_t map_size(Map *map)
+static int striping_grow(Map *map)
 {
-	size_t size;
+	int ret = 0;
 	int err;
 
-	if (!map)
-		return set_errno(EINVAL);
-
-	if ((err = map_rdlock(map)))
+	if ((err = striping_lock(map, 1)))
 		return set_errno(err);
 
-	size = map->items;
+	if ((double)map_items(map) / (double)map->size >= (double)table_resize_factor)
+		ret = map_resize(map);
 
-	if ((err = map_unlock(map)))
+	if ((err = striping_unlock(map)))
 		return set_errno(err);
 
-	return size;
+	return ret;
 }
 
 /*
 
-=item C<ssize_t map_size_unlocked(const Map *map)>
+=item C<int map_insert(Map *map, const void *key, void *value, int replace)>
 
-Equivalent to I<map_size(3)> except that C<map> is not read-locked.
+Adds the C<(key, value)> mapping to C<map>, replacing any existing C<(key,
+value)> mapping, if C<replace> is non-zero. Note that C<key> is copied but
+C<value> is not. On success, returns C<0>. On error, or if C<key> is already
+present and C<replace> is zero, returns C<-1> with C<errno> set
+appropriately.
 
 =cut
 
 */
 
-ssize_t map_size_unlocked(const Map *map)
+int map_insert(Map *map, const void *key, void *value, int replace)
 {
-	if (!map)
+	int ret;
+	int err;
+
+	if (!map || !key)
 		return set_errno(EINVAL);
 
-	return map->items;
-}
+	if (map->striping)
+	{
+		stripe_t *stripe;
 
-/*
+		if (striping_lock_key(map, key, 1, &stripe) == -1)
+			return -1;
 
-=back
+		/* Estimate the load from this stripe, and grow (locking every stripe) if needed */
 
-=head1 ERRORS
+		if ((double)(stripe->items * map->striping->num_stripes) / (double)map->size >= (double)table_resize_factor)
+		{
+			if ((err = pthread_rwlock_unlock(&stripe->lock)))
+				return set_errno(err);
 
-On error, C<errno> is set either by an underlying function, or as follows:
+			if (striping_grow(map) == -1 || striping_lock_key(map, key, 1, &stripe) == -1)
+				return -1;
+		}
 
-=over 4
+		ret = map_insert_unlocked(map, key, value, replace);
 
-=item C<EINVAL>
+		if ((err = pthread_rwlock_unlock(&stripe->lock)))
+			return set_errno(err);
 
-When arguments are C<null> or out of range.
+		return ret;
+	}
 
-=item C<ENOENT>
+	if ((err = map_wrlock(map)))
+		return set_errno(err);
 
-When I<map_get(3)> tries to get, or I<map_remove(3)> tries to remove, a
-non-existent mapping.
+	ret = map_insert_unlocked(map, key, value, replace);
 
-=back
+	if ((err = map_unlock(map)))
+		return set_errno(err);
 
-=head1 MT-Level
+	return ret;
+}
 
-I<MT-Disciplined>
+/*
 
-By default, I<Map>s are not I<MT-Safe> because most programs are
-single-threaded, and synchronisation doesn't come for free. Even in
-multi-threaded programs, not all I<Map>s are necessarily shared between
-multiple threads.
+C<int chain_find(const Map *map, size_t hash, const void *key, List **chain, size_t *index)>
 
-When a I<Map> is shared between multiple threads which need to be
-synchronised, the method of synchronisation must be carefully selected by
-the client code. There are tradeoffs between concurrency and overhead. The
-greater the concurrency, the greater the overhead. More locks give greater
-concurrency, but have greater overhead. Readers/Writer locks can give
-greater concurrency than Mutex, locks but have greater overhead. One lock
-for each I<Map> may be required, or one lock for all (or a set of) I<Map>s
-may be more appropriate.
+Searches for C<key>, whose full hash value is C<hash>, in the chained
+buckets of C<map>. Keys are only compared when the full hash values match.
+While C<map> is being resized, the old bucket that C<key> hashed to is
+searched as well. If C<key> is found, sets C<*chain> and C<*index> to its
+location and returns C<1>. If not, returns C<0>. On error, returns C<-1>
+with C<errno> set appropriately.
 
-Generally, the best synchronisation strategy for a given application can
-only be determined by testing/benchmarking the written application. It is
-important to be able to experiment with the synchronisation strategy at this
-stage of development without pain.
+*/
 
-To facilitate this, I<Map>s can be created with
-I<map_create_with_locker(3)>, which takes a I<Locker> argument. The
-I<Locker> specifies a lock and a set of functions for manipulating the lock.
-Each I<Map> can have its own lock by creating a separate I<Locker> for each
-I<Map>. Multiple I<Map>s can share the same lock by sharing the same
-I<Locker>. Only the application developer can determine what is appropriate
-for each application on a case by case basis.
+static int chain_find(const Map *map, size_t hash, const void *key, List **chain, size_t *index)
+{
+	ssize_t length;
+	size_t c;
+	int old;
 
-I<MT-Disciplined> means that the application developer has a mechanism for
-specifying the synchronisation requirements to be applied to library code.
+	for (old = 0; old < 2; ++old)
+	{
+		if (old && !map->old_chain)
+			break;
 
-=head1 EXAMPLES
+		if (!(*chain = (old) ? map->old_chain[map_bucket(map, map->old_size, hash)] : map->chain[map_bucket(map, map->size, hash)]))
+			continue;
 
-Create a map that doesn't own its items, populate it, and then iterate over
-its values with the internal iterator to print the values:
+		if ((length = list_length_unlocked(*chain)) == -1)
+			return -1;
 
-    #include <slack/std.h>
-    #include <slack/map.h>
+		for (c = 0; c < length; ++c)
+		{
+			Mapping *mapping = (Mapping *)list_item_unlocked(*chain, c);
 
-    int main()
-    {
-        Map *map;
+			if (mapping->hash == hash && !map->cmp(mapping->key, key))
+			{
+				*index = c;
+				return 1;
+			}
+		}
+	}
 
-        if (!(map = map_create(NULL)))
-            return EXIT_FAILURE;
+	return 0;
+}
 
-        map_add(map, "abc", "123");
-        map_add(map, "def", "456");
-        map_add(map, "ghi", "789");
+/*
 
-        while (map_has_next(map) == 1)
-            printf("%s\n", (char *)map_next(map));
+C<int slot_insert(Map *map, const void *key, void *value, int replace)>
 
-        map_destroy(&map);
+Implements I<map_insert_unlocked(3)> for open addressed maps.
 
-        return EXIT_SUCCESS;
-    }
+*/
 
-Create a map that does own its items, populate it, and then iterate over its
-items with an external iterator to print its keys and values:
+static int slot_insert(Map *map, const void *key, void *value, int replace)
+{
+	Mapping *mapping;
+	ssize_t i;
+	size_t hash;
 
-    #include <slack/std.h>
-    #include <slack/map.h>
+	if ((double)(map->items + 1) > (double)map->size * slot_resize_factor)
+		if (map_resize(map) == -1)
+			return -1;
 
-    int main()
-    {
-        Map *map;
-        Mapper *mapper;
+	if (map_hash(map, key, &hash) == -1)
+		return -1;
 
-        if (!(map = map_create(free)))
-            return EXIT_FAILURE;
+	if ((i = slot_find(map, hash, key)) != -1 && !replace)
+		return -1;
 
-        map_add(map, "abc", strdup("123"));
-        map_add(map, "def", strdup("456"));
-        map_add(map, "ghi", strdup("789"));
+	if (!(mapping = mapping_create(NULL, map->copy(key), value, hash, map->key_destroy, map->value_destroy)))
+		return -1;
 
-        if (!(mapper = mapper_create(map)))
-        {
-            map_destroy(&map);
-            return EXIT_FAILURE;
-        }
+	if (i != -1)
+	{
+		mapping_release(map->slots[i].mapping);
+		map->slots[i].mapping = mapping;
 
-        while (mapper_has_next(mapper) == 1)
-        {
-            const Mapping *mapping = mapper_next_mapping(mapper);
+		return 0;
+	}
 
-            printf("%s -> %s\n", (char *)mapping_key(mapping), (char *)mapping_value(mapping));
-        }
+	slot_place(map->slots, map->size, map_bucket(map, map->size, hash), mapping);
+	++map->items;
 
-        mapper_destroy(&mapper);
-        map_destroy(&map);
+	return 0;
+}
 
-        return EXIT_SUCCESS;
-    }
+/*
 
-The same, but with an apply function:
+=item C<int map_insert_unlocked(Map *map, const void *key, void *value, int replace)>
 
-    #include <slack/std.h>
-    #include <slack/map.h>
+Equivalent to I<map_insert(3)> except that C<map> is not write-locked.
 
-    void action(void *key, void *item, void *data)
-    {
-        printf("%s -> %s\n", (char *)key, (char *)item);
-    }
+=cut
 
-    int main()
-    {
-        Map *map;
+*/
 
-        if (!(map = map_create(free)))
-            return EXIT_FAILURE;
+int map_insert_unlocked(Map *map, const void *key, void *value, int replace)
+{
+	Mapping *mapping;
+	List *chain;
+	size_t hash, h, c;
+	void *copy;
+	int found;
 
-        map_add(map, "abc", strdup("123"));
-        map_add(map, "def", strdup("456"));
-        map_add(map, "ghi", strdup("789"));
-        map_apply(map, action, NULL);
-        map_destroy(&map);
+	if (!map || !key)
+		return set_errno(EINVAL);
 
-        return EXIT_SUCCESS;
-    }
+	if (map->image)
+		return set_errno(EPERM);
 
-The same, but with integer keys:
+	if (map->skiplist)
+		return skip_insert(map, key, value, replace);
 
-    #include <slack/std.h>
-    #include <slack/map.h>
+	if (map->slots)
+		return slot_insert(map, key, value, replace);
 
-    static void *int_copy(const void *key)
-    {
-        return (void *)key;
-    }
+	if (map->old_chain && map_migrate(map, table_migrate_rate) == -1)
+		return -1;
 
-    static int int_cmp(const void *a, const void *b)
-    {
-        return (int)a - (int)b;
-    }
+	/* Concurrent maps only grow here when they are write-locked as a whole */
 
-    static size_t int_hash(size_t size, const void *key)
-    {
-        return (int)key % size;
-    }
+	if (!map->striping || map->striping->exclusive)
+		if ((double)map_items(map) / (double)map->size >= (double)table_resize_factor)
+			if (map_resize(map) == -1)
+				return -1;
 
-    void action(void *key, void *item, void *data)
-    {
-        printf("%d -> %s\n", (int)key, (char *)item);
-    }
+	if (map_hash(map, key, &hash) == -1)
+		return -1;
 
-    int main(int ac, char **av)
-    {
-        Map *map;
+	if ((found = chain_find(map, hash, key, &chain, &c)) == -1)
+		return -1;
 
-        if (!(map = map_create_generic(int_copy, int_cmp, int_hash, NULL, free)))
-            return EXIT_FAILURE;
+	if (found)
+	{
+		if (!replace || !list_remove_unlocked(chain, c))
+			return -1;
 
-        map_add(map, (void *)123, strdup("abc"));
-        map_add(map, (void *)456, strdup("def"));
-        map_add(map, (void *)789, strdup("ghi"));
+		map_tally(map, hash, -1);
+	}
 
-        map_apply(map, action, NULL);
-        map_destroy(&map);
+	h = map_bucket(map, map->size, hash);
 
-        return EXIT_SUCCESS;
-    }
+	if (!map->chain[h] && !(map->chain[h] = chain_create(map)))
+		return -1;
 
-=head1 CAVEAT
+	if (map_copy(map, key, &copy) == -1)
+		return -1;
 
-A C<null> pointer can't be a key. Neither can zero when using integers as
-keys.
+	if (!(mapping = mapping_create(map->pool, copy, value, hash, map->key_destroy, map->value_destroy)))
+		return -1;
 
-If you use an internal iterator in a loop that terminates before the end of
-the map, and fail to call I<map_break(3)>, the internal iterator will leak.
+	if (!list_append_unlocked(map->chain[h], mapping))
+	{
+		if (map->pool)
+			mapping_abandon(mapping);
+		else
+			mapping_release(mapping);
 
-=head1 BUGS
+		return -1;
+	}
 
-Uses I<malloc(3)> directly. The type of memory used and the allocation
-strategy should be decoupled from this code.
+	map_tally(map, hash, 1);
 
-=head1 SEE ALSO
+	return 0;
+}
 
-I<libslack(3)>,
-I<list(3)>,
-I<mem(3)>,
-I<locker(3)>
+/*
 
-=head1 AUTHOR
+=item C<int map_remove(Map *map, const void *key)>
 
-20230824 raf <raf@raf.org>
+Removes C<(key, value)> mapping from C<map> if it is present. If C<map> was
+created with a destroy function, then the value will be destroyed. On
+success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
 
 =cut
 
 */
 
-#endif
+int map_remove(Map *map, const void *key)
+{
+	int ret;
+	int err;
 
-#ifdef TEST
+	if (!map || !key)
+		return set_errno(EINVAL);
 
-#ifndef HAVE_SNPRINTF
-#include <slack/snprintf.h>
-#endif
+	if (map->striping)
+	{
+		stripe_t *stripe;
 
-#if 0
-static void map_print(const char *name, Map *map)
-{
-	size_t i, j;
+		if (striping_lock_key(map, key, 1, &stripe) == -1)
+			return -1;
 
-	if (!map)
-	{
-		printf("%s = nil\n", name);
-		return;
-	}
+		ret = map_remove_unlocked(map, key);
 
-	printf("%s =\n{\n", name);
+		if ((err = pthread_rwlock_unlock(&stripe->lock)))
+			return set_errno(err);
 
-	for (i = 0; i < map->size; ++i)
-	{
-		if (map->chain[i])
-		{
-			List *chain = map->chain[i];
-			ssize_t length = list_length(chain);
+		return ret;
+	}
 
-			if (length == -1)
-				printf("    !!! length == -1 !!!\n");
+	if ((err = map_wrlock(map)))
+		return set_errno(err);
 
-			for (j = 0; j < length; ++j)
-			{
-				Mapping *mapping = (Mapping *)list_item(chain, j);
+	ret = map_remove_unlocked(map, key);
 
-				printf("    [%d/%d] \"%s\" -> \"%s\"\n", i, j, (char *)mapping->key, (char *)mapping->value);
-			}
-		}
-	}
+	if ((err = map_unlock(map)))
+		return set_errno(err);
 
-	printf("}\n");
+	return ret;
 }
-#endif
 
-static void map_histogram(const char *name, Map *map)
-{
-	size_t i;
-	int *histogram;
-	size_t min = 0xffffffff;
-	size_t max = 0x00000000;
-	size_t num_empty = 0;
-	size_t sum = 0;
+/*
 
-	if (!map)
-	{
-		printf("%s = nil\n", name);
-		return;
-	}
+=item C<int map_remove_unlocked(Map *map, const void *key)>
 
-	if (!(histogram = mem_create(map->items, int)))
-	{
-		printf("Failed to allocate histogram for map %s\n", name);
-		return;
-	}
+Equivalent to I<map_remove(3)> except that C<map> is not write-locked.
 
-	memset(histogram, 0, map->items * sizeof(int));
+=cut
 
-	for (i = 0; i < map->size; ++i)
+*/
+
+int map_remove_unlocked(Map *map, const void *key)
+{
+	List *chain;
+	size_t hash, c;
+	int found;
+
+	if (!map || !key)
+		return set_errno(EINVAL);
+
+	if (map->image)
+		return set_errno(EPERM);
+
+	if (map->skiplist)
+		return (skip_remove(map, key)) ? 0 : -1;
+
+	if (map_hash(map, key, &hash) == -1)
+		return -1;
+
+	if (map->slots)
 	{
-		size_t length = list_length(map->chain[i]);
-		if (length == -1)
-		{
-			++num_empty;
-			continue;
-		}
+		ssize_t i;
 
-		++histogram[length];
-		if (length > max)
-			max = length;
-		if (length < min)
-			min = length;
-		sum += length;
+		if ((i = slot_find(map, hash, key)) == -1)
+			return set_errno(ENOENT);
+
+		slot_remove(map, i);
+
+		return 0;
 	}
 
-	printf("%d entries in %d buckets:\n", (int)map->items, (int)map->size);
-	printf("avg = %g\n", (double)sum / (double)map->size);
-	printf("min = %d\n", (int)min);
-	printf("max = %d\n", (int)max);
-	printf("\nhistogram %s =\n{\n", name);
+	if (map->old_chain && map_migrate(map, table_migrate_rate) == -1)
+		return -1;
 
-	for (i = 0; i < map->items; ++i)
-		if (histogram[i])
-			printf("    %d chain%s of length %d\n", histogram[i], (histogram[i] == 1) ? "" : "s", (int)i);
+	if ((found = chain_find(map, hash, key, &chain, &c)) == -1)
+		return -1;
 
-	printf("    %d empty slots\n", num_empty);
+	if (!found)
+		return set_errno(ENOENT);
 
-	printf("}\n");
+	if (!list_remove_unlocked(chain, c))
+		return -1;
+
+	map_tally(map, hash, -1);
+
+	return 0;
 }
 
-static void test_hash(void)
+/*
+
+C<int map_find(const Map *map, const void *key, size_t hash, void **value)>
+
+Searches the hashed (i.e. chained, open addressed or frozen) C<map> for
+C<key>, whose full hash value is C<hash>. If C<key> is found, stores its
+value in C<*value> and returns C<1>. If not, returns C<0>. On error,
+returns C<-1> with C<errno> set appropriately.
+
+*/
+
+static int map_find(const Map *map, const void *key, size_t hash, void **value)
 {
-	FILE *words = fopen("/usr/dict/words", "r");
-	char word[BUFSIZ];
-	Map *map;
+	List *chain;
+	ssize_t i;
+	size_t c;
+	int found;
 
-	if (!(words = fopen("/usr/dict/words", "r")))
+	if (map->image)
 	{
-		if (!(words = fopen("/usr/share/dict/words", "r")))
-		{
-			printf("Failed to open /usr/dict/words or /usr/share/dict/words\n");
-			exit(EXIT_FAILURE);
-		}
-	}
+		if ((i = frozen_find(map, key, hash)) == -1)
+			return 0;
 
-	if (!(map = map_create(free)))
-	{
-		printf("Failed to create map\n");
-		exit(EXIT_FAILURE);
+		*value = (frozen_slots(map)[i].value) ? map->image + frozen_slots(map)[i].value : NULL;
+
+		return 1;
 	}
 
-	while (fgets(word, BUFSIZ, words))
+	if (map->slots)
 	{
-		char *eow = strchr(word, '\n');
-		if (eow)
-			*eow = nul;
+		if ((i = slot_find(map, hash, key)) == -1)
+			return 0;
 
-		map_add(map, word, mem_strdup(word));
+		*value = map->slots[i].mapping->value;
+
+		return 1;
 	}
 
-	fclose(words);
+	if ((found = chain_find(map, hash, key, &chain, &c)) != 1)
+		return found;
 
-	map_histogram("dict", map);
-	map_release(map);
-}
+	*value = ((Mapping *)list_item_unlocked(chain, c))->value;
 
-static int sort_cmp(const char **a, const char **b)
-{
-	return strcmp(*a, *b);
+	return 1;
 }
 
-static void test_action(char *key, char *value, char *cat)
-{
-	size_t len = strlen(cat);
-	snprintf(cat + len, BUFSIZ, "%s%s=%s", (len) ? ", " : "", key, value);
-}
+/*
 
-typedef struct Point Point;
-struct Point
-{
-	int x;
-	int y;
-};
+=item C<void *map_get(Map *map, const void *key)>
 
-static Point *point_create(int x, int y)
+Returns the value associated with C<key> in C<map>, or C<null> if there is
+none. On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+void *map_get(Map *map, const void *key)
 {
-	Point *point = mem_create(1, Point);
+	void *ret;
+	int err;
 
-	if (!point)
-		return NULL;
+	if (!map || !key)
+		return set_errnull(EINVAL);
 
-	point->x = x;
-	point->y = y;
+	if (map->striping)
+	{
+		stripe_t *stripe;
 
-	return point;
-}
+		if (striping_lock_key(map, key, 0, &stripe) == -1)
+			return NULL;
 
-static Point *point_copy(Point *point)
-{
-	return point_create(point->x, point->y);
-}
+		ret = map_get_unlocked(map, key);
 
-static int point_cmp(Point *a, Point *b)
-{
-	if (a->x > b->x)
-		return 1;
-	if (a->y > b->y)
-		return 1;
-	if (a->x == b->x && a->y == b->y)
-		return 0;
-	return -1;
-}
+		if ((err = pthread_rwlock_unlock(&stripe->lock)))
+			return set_errnull(err);
 
-static size_t point_hash(size_t size, Point *point)
-{
-	return (point->x * 31 + point->y * 37) % size;
-}
+		return ret;
+	}
 
-static void point_release(Point *point)
-{
-	mem_release(point);
-}
+	if ((err = map_rdlock(map)))
+		return set_errnull(err);
 
-static int direct_copy(int key)
-{
-	return key;
-}
+	ret = map_get_unlocked(map, key);
 
-static int direct_cmp(int a, int b)
-{
-	return a - b;
-}
+	if ((err = map_unlock(map)))
+		return set_errnull(err);
 
-static size_t direct_hash(size_t size, int key)
-{
-	return key % size;
+	return ret;
 }
 
-#define RD 0
-#define WR 1
-Map *mtmap = NULL;
-Locker *locker = NULL;
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-#ifdef PTHREAD_RWLOCK_INITIALIZER
-pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
-#else
-pthread_rwlock_t rwlock;
-#endif
-int barrier[2];
-int size[2];
-const int lim = 1000;
-int debug = 0;
-int errors = 0;
+/*
 
-void *produce(void *arg)
+=item C<void *map_get_unlocked(const Map *map, const void *key)>
+
+Equivalent to I<map_get(3)> except that C<map> is not read-locked.
+
+=cut
+
+*/
+
+void *map_get_unlocked(const Map *map, const void *key)
 {
-	int i;
-	int test = *(int *)arg;
+	void *value;
+	size_t hash;
+	int found;
 
-	for (i = 1; i <= lim; ++i)
+	if (!map || !key)
+		return set_errnull(EINVAL);
+
+	if (map->skiplist)
 	{
-		if (debug)
-			printf("p: add %d\n", i);
+		skipnode_t *node;
 
-		if (map_add(mtmap, (void *)(long)i, (void *)(long)i) == -1)
-			++errors, printf("Test%d: map_add(mtmap, %d), failed (%s)\n", test, i, strerror(errno));
+		if (!(node = skip_find(map, key, NULL)) || map->cmp(node->mapping->key, key))
+			return set_errnull(ENOENT);
 
-		write(size[WR], "", 1);
+		return node->mapping->value;
 	}
 
-	write(barrier[WR], "", 1);
-	return NULL;
+	if (map_hash(map, key, &hash) == -1)
+		return NULL;
+
+	if ((found = map_find(map, key, hash, &value)) == -1)
+		return NULL;
+
+	if (!found)
+		return set_errnull(ENOENT);
+
+	return value;
 }
 
-void *consume(void *arg)
+/*
+
+C<void map_prefetch(const Map *map, size_t hash, int stage)>
+
+Prefetches the memory that a lookup of a key whose full hash value is
+C<hash> in the hashed C<map> will need. Each stage should follow after
+other work, once the memory prefetched by the previous stage has arrived.
+Stage C<0> prefetches the bucket (or home slot, or displacement). Stage
+C<1> prefetches the chain's I<List> (or the mapping in the home slot, or
+the frozen slot of a single key bucket). Stage C<2> prefetches the first
+mapping in the chain (chained maps only).
+
+*/
+
+static void map_prefetch(const Map *map, size_t hash, int stage)
 {
-	int i;
-	int test = *(int *)arg;
-	char ack;
+	size_t h;
 
-	for (i = 1; i <= lim; ++i)
+	if (map->image)
 	{
-		if (debug)
-			printf("c: pop\n");
+		if (!map->items)
+			return;
 
-		while (read(size[RD], &ack, 1) == -1 && errno == EINTR)
-		{}
+		h = hash % map->items;
 
-		if (map_remove(mtmap, (void *)(long)i) == -1)
-		{
-			++errors, printf("Test%d: map_remove(mtmap, %d), failed\n", test, i);
-			break;
-		}
+		if (stage == 0)
+			map_prefetch_address(&frozen_displacements(map)[h]);
+		else if (frozen_displacements(map)[h] > (size_t)-1 / 2 && ~frozen_displacements(map)[h] < map->items)
+			map_prefetch_address(&frozen_slots(map)[~frozen_displacements(map)[h]]);
 
-		if (debug)
-			printf("c: remove %d\n", i);
+		return;
 	}
 
-	if (i != lim + 1)
-		++errors, printf("Test%d: consumer read %d items, not %d\n", test, i - 1, lim);
+	h = map_bucket(map, map->size, hash);
 
-	write(barrier[WR], "", 1);
-	return NULL;
+	if (map->slots)
+	{
+		if (stage == 0)
+			map_prefetch_address(&map->slots[h]);
+		else if (map->slots[h].mapping)
+			map_prefetch_address(map->slots[h].mapping);
+
+		return;
+	}
+
+	if (stage == 0)
+		map_prefetch_address(&map->chain[h]);
+	else if (stage == 1 && map->chain[h])
+		map_prefetch_address(map->chain[h]);
+	else if (stage == 2 && map->chain[h] && list_length_unlocked(map->chain[h]) > 0)
+		map_prefetch_address(list_item_unlocked(map->chain[h], 0));
 }
 
-void *iterate_builtin(void *arg)
-{
-	int i;
-	int t = *(int *)arg;
-	int broken = 0;
+/*
 
-	if (debug)
-		printf("i%d: loop\n", t);
+=item C<ssize_t map_get_many(Map *map, const void **keys, size_t n, void **values)>
 
-	for (i = 0; i < lim / 10; ++i)
-	{
-		map_wrlock(mtmap);
+Looks up the C<n> keys in C<keys> in C<map>, and stores the value
+associated with each one in the corresponding element of C<values> (or
+C<null> if it isn't present). C<map> is only read-locked once for the whole
+batch (for concurrent maps, every stripe is read-locked). The keys are
+processed in groups. Every key in a group is hashed first, and the memory
+for its lookup is prefetched, before any of them are resolved, so the
+cache misses for the keys in a group overlap rather than occurring one
+after another. On success, returns the number of keys that were found. On
+error, returns C<-1> with C<errno> set appropriately.
 
-		while (map_has_next(mtmap) == 1)
-		{
-			int val = (int)(long)map_next(mtmap);
+=cut
 
-			if (debug)
-				printf("i%d: loop %d/%d val %d\n", t, i, lim / 10, val);
+*/
 
-			if (!broken)
+ssize_t map_get_many(Map *map, const void **keys, size_t n, void **values)
+{
+	ssize_t ret;
+	int err;
+
+	if (!map || !keys || !values)
+		return set_errno(EINVAL);
+
+	if ((err = map_rdlock(map)))
+		return set_errno(err);
+
+	ret = map_get_many_unlocked(map, keys, n, values);
+
+	if ((err = map_unlock(map)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<ssize_t map_get_many_unlocked(const Map *map, const void **keys, size_t n, void **values)>
+
+Equivalent to I<map_get_many(3)> except that C<map> is not read-locked.
+
+=cut
+
+*/
+
+ssize_t map_get_many_unlocked(const Map *map, const void **keys, size_t n, void **values)
+{
+	size_t hashes[map_batch_size];
+	size_t base, batch, i;
+	ssize_t found = 0;
+	int ret;
+
+	if (!map || !keys || !values)
+		return set_errno(EINVAL);
+
+	for (base = 0; base < n; base += batch)
+	{
+		batch = (n - base < map_batch_size) ? n - base : map_batch_size;
+
+		for (i = 0; i < batch; ++i)
+			if (!keys[base + i])
+				return set_errno(EINVAL);
+
+		/* Ordered maps have nothing to prefetch ahead of the search */
+
+		if (map->skiplist)
+		{
+			for (i = 0; i < batch; ++i)
 			{
-				map_break(mtmap);
-				broken = 1;
-				break;
+				skipnode_t *node = skip_find(map, keys[base + i], NULL);
+				int match = node && !map->cmp(node->mapping->key, keys[base + i]);
+
+				values[base + i] = (match) ? node->mapping->value : NULL;
+				found += match;
 			}
+
+			continue;
 		}
 
-		map_unlock(mtmap);
+		for (i = 0; i < batch; ++i)
+		{
+			if (map_hash(map, keys[base + i], &hashes[i]) == -1)
+				return -1;
+
+			map_prefetch(map, hashes[i], 0);
+		}
+
+		for (i = 0; i < batch; ++i)
+			map_prefetch(map, hashes[i], 1);
+
+		/* Chained maps need one more hop, from the List to its first Mapping */
+
+		if (map->chain && !map->image)
+			for (i = 0; i < batch; ++i)
+				map_prefetch(map, hashes[i], 2);
+
+		for (i = 0; i < batch; ++i)
+		{
+			if ((ret = map_find(map, keys[base + i], hashes[i], &values[base + i])) == -1)
+				return -1;
+
+			if (!ret)
+				values[base + i] = NULL;
+
+			found += ret;
+		}
 	}
 
-	write(barrier[WR], "", 1);
-	return NULL;
+	return found;
 }
 
-void *iterate_rdlocked(void *arg)
+/*
+
+=item C<const Mapping *map_lower_bound(Map *map, const void *key)>
+
+Returns the first mapping in the ordered C<map> whose key is not less than
+C<key>, or C<null> if there is none. On error, returns C<null> with
+C<errno> set appropriately (C<EINVAL> if C<map> isn't ordered).
+
+=cut
+
+*/
+
+const Mapping *map_lower_bound(Map *map, const void *key)
 {
-	int i;
-	int t = *(int *)arg;
+	const Mapping *ret;
+	int err;
 
-	if (debug)
-		printf("j%d: loop\n", t);
+	if (!map || !key)
+		return set_errnull(EINVAL);
 
-	for (i = 0; i < lim / 10; ++i)
-	{
-		Mapper *mapper = mapper_create_rdlocked(mtmap);
+	if ((err = map_rdlock(map)))
+		return set_errnull(err);
 
-		while (mapper_has_next(mapper) == 1)
-		{
-			int val = (int)(long)mapper_next(mapper);
+	ret = map_lower_bound_unlocked(map, key);
 
-			if (debug)
-				printf("j%d: loop %d/%d val %d\n", t, i, lim / 10, val);
-		}
+	if ((err = map_unlock(map)))
+		return set_errnull(err);
 
-		mapper_release(mapper);
+	return ret;
+}
+
+/*
+
+=item C<const Mapping *map_lower_bound_unlocked(const Map *map, const void *key)>
+
+Equivalent to I<map_lower_bound(3)> except that C<map> is not read-locked.
+
+=cut
+
+*/
+
+const Mapping *map_lower_bound_unlocked(const Map *map, const void *key)
+{
+	skipnode_t *node;
+
+	if (!map || !key || !map->skiplist)
+		return set_errnull(EINVAL);
+
+	if (!(node = skip_find(map, key, NULL)))
+		return set_errnull(ENOENT);
+
+	return node->mapping;
+}
+
+/*
+
+=item C<const Mapping *map_upper_bound(Map *map, const void *key)>
+
+Returns the first mapping in the ordered C<map> whose key is greater than
+C<key>, or C<null> if there is none. On error, returns C<null> with
+C<errno> set appropriately (C<EINVAL> if C<map> isn't ordered).
+
+=cut
+
+*/
+
+const Mapping *map_upper_bound(Map *map, const void *key)
+{
+	const Mapping *ret;
+	int err;
+
+	if (!map || !key)
+		return set_errnull(EINVAL);
+
+	if ((err = map_rdlock(map)))
+		return set_errnull(err);
+
+	ret = map_upper_bound_unlocked(map, key);
+
+	if ((err = map_unlock(map)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<const Mapping *map_upper_bound_unlocked(const Map *map, const void *key)>
+
+Equivalent to I<map_upper_bound(3)> except that C<map> is not read-locked.
+
+=cut
+
+*/
+
+const Mapping *map_upper_bound_unlocked(const Map *map, const void *key)
+{
+	skipnode_t *node;
+
+	if (!map || !key || !map->skiplist)
+		return set_errnull(EINVAL);
+
+	if ((node = skip_find(map, key, NULL)) && !map->cmp(node->mapping->key, key))
+		node = node->next[0];
+
+	if (!node)
+		return set_errnull(ENOENT);
+
+	return node->mapping;
+}
+
+/*
+
+=item C<Mapper *mapper_create(Map *map)>
+
+Creates an iterator for C<map>. The iterator keeps C<map> write-locked until
+it is released with I<mapper_release(3)> or I<mapper_destroy(3)>. Note that
+the iterator itself is not locked, so it must not be shared between threads.
+On success, returns the iterator. On error, returns C<null> with C<errno>
+set appropriately.
+
+=cut
+
+*/
+
+Mapper *mapper_create(Map *map)
+{
+	return mapper_create_wrlocked(map);
+}
+
+/*
+
+C<Mapper *mapper_create_striped(Map *map, int locking)>
+
+Creates an iterator for the concurrent C<map> that locks each stripe in
+turn (for reading if C<locking> is C<1>, or for writing if it is C<2>) as it
+visits the buckets in that stripe. C<map> can't be resized until the
+iterator is released, but the other stripes remain available to other
+threads.
+
+*/
+
+static Mapper *mapper_create_striped(Map *map, int locking)
+{
+	Mapper *mapper;
+	int err;
+
+	if ((err = pthread_rwlock_rdlock(&map->striping->resize)))
+		return set_errnull(err);
+
+	if (!(mapper = mapper_create_unlocked(map)))
+	{
+		pthread_rwlock_unlock(&map->striping->resize);
+		return NULL;
 	}
 
-	write(barrier[WR], "", 1);
-	return NULL;
+	mapper->locking = locking;
+
+	return mapper;
 }
 
-void *iterate_wrlocked(void *arg)
+/*
+
+=item C<Mapper *mapper_create_rdlocked(Map *map)>
+
+Equivalent to I<mapper_create(3)> except that C<map> is read-locked rather
+than write-locked. Use this in preference to I<mapper_create(3)> when no
+calls to I<mapper_remove(3)> will be made during the iteration.
+
+=cut
+
+*/
+
+Mapper *mapper_create_rdlocked(Map *map)
 {
-	int i;
-	int t = *(int *)arg;
+	int err;
+
+	if (!map)
+		return set_errnull(EINVAL);
+
+	if (map->striping)
+		return mapper_create_striped(map, 1);
+
+	if ((err = map_rdlock(map)))
+		return set_errnull(err);
+
+	return mapper_create_unlocked(map);
+}
+
+/*
+
+=item C<Mapper *mapper_create_wrlocked(Map *map)>
+
+Equivalent to I<mapper_create(3)> except that this function name makes the
+fact that C<map> is write-locked explicit.
+
+=cut
+
+*/
+
+Mapper *mapper_create_wrlocked(Map *map)
+{
+	int err;
+
+	if (!map)
+		return set_errnull(EINVAL);
+
+	if (map->striping)
+		return mapper_create_striped(map, 2);
+
+	if ((err = map_wrlock(map)))
+		return set_errnull(err);
+
+	return mapper_create_unlocked(map);
+}
+
+/*
+
+=item C<Mapper *mapper_create_unlocked(Map *map)>
+
+Equivalent to I<mapper_create(3)> except that C<map> is not write-locked.
+
+=cut
+
+*/
+
+Mapper *mapper_create_unlocked(Map *map)
+{
+	Mapper *mapper;
+
+	if (!map)
+		return set_errnull(EINVAL);
+
+	if (!(mapper = mem_new(Mapper))) /* XXX decouple */
+		return NULL;
+
+	mapper->map = map;
+	mapper->chain_index = -1;
+	mapper->item_index = -1;
+	mapper->next_chain_index = -1;
+	mapper->next_item_index = -1;
+	mapper->origin = 0;
+	mapper->stripe = -1;
+	mapper->locking = 0;
+	mapper->node = (map->skiplist) ? map->skiplist->head : NULL;
+
+	/*
+	** Open addressed maps are iterated starting after an empty slot so that
+	** no cluster spans the start and end of the iteration. Then the mappings
+	** shifted back by mapper_remove() are always still to be visited.
+	*/
+
+	if (map->slots)
+		while (map->slots[mapper->origin].mapping)
+			++mapper->origin;
+
+	return mapper;
+}
+
+/*
+
+=item C<void mapper_release(Mapper *mapper)>
+
+Releases (deallocates) C<mapper> and unlocks the associated map.
+
+=cut
+
+*/
+
+void mapper_release(Mapper *mapper)
+{
+	int err;
+
+	if (!mapper)
+		return;
+
+	if (mapper->locking)
+	{
+		if (mapper->stripe != -1)
+			pthread_rwlock_unlock(&mapper->map->striping->stripe[mapper->stripe].lock);
+
+		if ((err = pthread_rwlock_unlock(&mapper->map->striping->resize)))
+		{
+			set_errno(err);
+			return;
+		}
+
+		mem_release(mapper);
+		return;
+	}
+
+	if ((err = map_unlock(mapper->map)))
+	{
+		set_errno(err);
+		return;
+	}
+
+	mem_release(mapper);
+}
+
+/*
+
+=item C<void mapper_release_unlocked(Mapper *mapper)>
+
+Equivalent to I<mapper_release(3)> except that the associated map is not
+unlocked.
+
+=cut
+
+*/
+
+void mapper_release_unlocked(Mapper *mapper)
+{
+	if (!mapper)
+		return;
+
+	mem_release(mapper);
+}
+
+/*
+
+=item C<void *mapper_destroy(Mapper **mapper)>
+
+Destroys (deallocates and sets to C<null>) C<*mapper> and unlocks the
+associated map. Returns C<null>. On error, sets C<errno> appropriately.
+
+=cut
+
+*/
+
+void *mapper_destroy(Mapper **mapper)
+{
+	if (mapper && *mapper)
+	{
+		mapper_release(*mapper);
+		*mapper = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+=item C<void *mapper_destroy_unlocked(Mapper **mapper)>
+
+Equivalent to I<mapper_destroy(3)> except that the associated map is not
+unlocked.
+
+=cut
+
+*/
+
+void *mapper_destroy_unlocked(Mapper **mapper)
+{
+	if (mapper && *mapper)
+	{
+		mapper_release_unlocked(*mapper);
+		*mapper = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+C<List *mapper_chain(Mapper *mapper, size_t c)>
+
+Returns bucket C<c> of the chained map that C<mapper> is iterating over,
+counting any old buckets (left over from an unfinished resize) before the
+new buckets. The buckets of concurrent maps are visited one stripe at a
+time, and each stripe is locked (if C<mapper> is locking) before its
+buckets are visited.
+
+*/
+
+static List *mapper_chain(Mapper *mapper, size_t c)
+{
+	const Map *map = mapper->map;
+	size_t n, per, s;
+
+	if (!map->striping)
+		return (c < map->old_size) ? map->old_chain[c] : map->chain[c - map->old_size];
+
+	n = map->striping->num_stripes;
+	per = map->size / n;
+	s = c / per;
+
+	if (mapper->locking && mapper->stripe != (ssize_t)s)
+	{
+		if (mapper->stripe != -1)
+			pthread_rwlock_unlock(&map->striping->stripe[mapper->stripe].lock);
+
+		if (mapper->locking == 2)
+			pthread_rwlock_wrlock(&map->striping->stripe[s].lock);
+		else
+			pthread_rwlock_rdlock(&map->striping->stripe[s].lock);
+
+		mapper->stripe = s;
+	}
+
+	return map->chain[s + (c % per) * n];
+}
+
+#define mapper_chains(map) ((ssize_t)((map)->old_size + (map)->size))
+
+/*
+
+=item C<int mapper_has_next(Mapper *mapper)>
+
+Returns whether or not there is another item in the map over which C<mapper>
+is iterating. On error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int mapper_has_next(Mapper *mapper)
+{
+	List *chain;
+	ssize_t length;
+
+	if (!mapper)
+		return set_errno(EINVAL);
+
+	if (mapper->map->skiplist)
+		return mapper->node->next[0] != NULL;
+
+	/* Every slot of a frozen map is occupied */
+
+	if (mapper->map->image)
+	{
+		mapper->next_chain_index = mapper->chain_index + 1;
+
+		return (size_t)mapper->next_chain_index < mapper->map->items;
+	}
+
+	/* Find the next occupied slot (offset from origin) */
+
+	if (mapper->map->slots)
+	{
+		Map *map = mapper->map;
+		ssize_t k = (mapper->chain_index < 0) ? 0 : mapper->chain_index;
+
+		while (++k <= map->size && !map->slots[(mapper->origin + k) % map->size].mapping)
+			;
+
+		if (k > map->size)
+			return 0;
+
+		mapper->next_chain_index = k;
+
+		return 1;
+	}
+
+	/* Find the current/first chain */
+
+	mapper->next_chain_index = mapper->chain_index;
+	mapper->next_item_index = mapper->item_index;
+
+	if (mapper->next_chain_index == -1)
+		++mapper->next_chain_index;
+
+	while (mapper->next_chain_index < mapper_chains(mapper->map) && !mapper_chain(mapper, mapper->next_chain_index))
+		++mapper->next_chain_index;
+
+	if (mapper->next_chain_index == mapper_chains(mapper->map))
+		return 0;
+
+	chain = mapper_chain(mapper, mapper->next_chain_index);
+
+	/* Find the next item */
+
+	if ((length = list_length_unlocked(chain)) == -1)
+		return -1;
+
+	if (++mapper->next_item_index < length)
+		return 1;
+
+	do
+	{
+		++mapper->next_chain_index;
+
+		while (mapper->next_chain_index < mapper_chains(mapper->map) && !mapper_chain(mapper, mapper->next_chain_index))
+			++mapper->next_chain_index;
+
+		if (mapper->next_chain_index == mapper_chains(mapper->map))
+			return 0;
+
+		chain = mapper_chain(mapper, mapper->next_chain_index);
+
+		if ((length = list_length_unlocked(chain)) == -1)
+			return -1;
+	}
+	while (length == 0);
+
+	mapper->next_item_index = 0;
+
+	return 1;
+}
+
+/*
+
+=item C<void *mapper_next(Mapper *mapper)>
+
+Returns the next item in the map over which C<mapper> is iterating. On
+error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+void *mapper_next(Mapper *mapper)
+{
+	if (!mapper)
+		return set_errnull(EINVAL);
+
+	return mapper_next_mapping(mapper)->value;
+}
+
+/*
+
+=item C<const Mapping *mapper_next_mapping(Mapper *mapper)>
+
+Returns the next mapping (key, value) pair in the map over which C<mapper>
+is iterating. On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+const Mapping *mapper_next_mapping(Mapper *mapper)
+{
+	if (!mapper)
+		return set_errnull(EINVAL);
+
+	if (mapper->map->skiplist)
+	{
+		mapper->node = mapper->node->next[0];
+		mapper->item_index = 0;
+
+		return mapper->node->mapping;
+	}
+
+	mapper->chain_index = mapper->next_chain_index;
+	mapper->item_index = mapper->next_item_index;
+
+	if (mapper->map->image)
+	{
+		const Map *map = mapper->map;
+		const frozen_slot_t *slot = frozen_slots(map) + mapper->chain_index;
+
+		mapper->item_index = 0;
+		mapper->frozen.key = map->image + slot->key;
+		mapper->frozen.value = (slot->value) ? map->image + slot->value : NULL;
+		mapper->frozen.hash = slot->hash;
+		mapper->frozen.key_destroy = NULL;
+		mapper->frozen.value_destroy = NULL;
+
+		return &mapper->frozen;
+	}
+
+	if (mapper->map->slots)
+	{
+		mapper->item_index = 0;
+
+		return mapper->map->slots[(mapper->origin + mapper->chain_index) % mapper->map->size].mapping;
+	}
+
+	return (Mapping *)list_item_unlocked(mapper_chain(mapper, mapper->chain_index), mapper->item_index);
+}
+
+/*
+
+=item C<void mapper_remove(Mapper *mapper)>
+
+Removes the current item in the iteration C<mapper>. The next item in the
+iteration is the item following the removed item, if any. This must be
+called after I<mapper_next(3)>. On error, sets C<errno> appropriately.
+
+=cut
+
+*/
+
+void mapper_remove(Mapper *mapper)
+{
+	List *chain;
+
+	if (!mapper)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	if (mapper->item_index == -1)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	if (mapper->map->image)
+	{
+		set_errno(EPERM);
+		return;
+	}
+
+	/* Step back to the previous node, so the next mapping is unchanged */
+
+	if (mapper->map->skiplist)
+	{
+		mapper->node = skip_remove(mapper->map, mapper->node->mapping->key);
+		mapper->item_index = -1;
+
+		return;
+	}
+
+	/* Revisit the slot, which now holds the next mapping in its cluster (if any) */
+
+	if (mapper->map->slots)
+	{
+		slot_remove(mapper->map, (mapper->origin + mapper->chain_index) % mapper->map->size);
+		--mapper->chain_index;
+		mapper->item_index = -1;
+
+		return;
+	}
+
+	chain = mapper_chain(mapper, mapper->chain_index);
+	map_tally(mapper->map, ((Mapping *)list_item_unlocked(chain, mapper->item_index))->hash, -1);
+	list_remove_unlocked(chain, (size_t)mapper->item_index--);
+}
+
+/*
+
+=item C<int mapper_seek(Mapper *mapper, const void *key)>
+
+Positions C<mapper>, which must be iterating over an ordered map, so that
+the next mapping in the iteration is the first whose key is not less than
+C<key>. Iterating from there until a key is reached that is not less than
+some upper limit visits a range of keys. On success, returns C<0>. On
+error, returns C<-1> with C<errno> set appropriately (C<EINVAL> if the map
+isn't ordered).
+
+=cut
+
+*/
+
+int mapper_seek(Mapper *mapper, const void *key)
+{
+	skipnode_t *update[skip_max_levels];
+
+	if (!mapper || !key || !mapper->map->skiplist)
+		return set_errno(EINVAL);
+
+	skip_find(mapper->map, key, update);
+	mapper->node = update[0];
+	mapper->item_index = -1;
+
+	return 0;
+}
+
+/*
+
+=item C<int map_has_next(Map *map)>
+
+Returns whether or not there is another item in C<map> using an internal
+iterator. The first time this is called, a new internal I<Mapper> will be
+created (Note: There can be only one at any time for a given map). When
+there are no more items, returns C<0> and destroys the internal iterator.
+When it returns C<1>, use I<map_next(3)> to retrieve the next item. On
+error, returns C<-1> with C<errno> set appropriately.
+
+Note: If an iteration using an internal iterator terminates before the end
+of the map, it is the caller's responsibility to call I<map_break(3)>.
+Failure to do so will cause the internal iterator to leak. It will also
+break the next call to I<map_has_next(3)> which will continue where the
+current iteration stopped rather than starting at the beginning again.
+I<map_release(3)> assumes that there is no internal iterator, so it is the
+caller's responsibility to complete the iteration, or call I<map_break(3)>
+before releasing C<map> with I<map_release(3)> or I<map_destroy(3)>.
+
+Note: The internal I<Mapper> does not lock C<map> so this function is not
+threadsafe. It can only be used with maps created in the current function
+(to guarantee that no other thread can access it). This practice should be
+observed even in single-threaded applications to avoid breaking iterator
+semantics (possible with nested function calls). If C<map> is a parameter or
+a variable declared outside the function, it is best to create an explicit
+I<Mapper> instead. If this function is used on such maps instead, it is the
+caller's responsibility to explicitly lock C<map> first with
+I<map_wrlock(3)> and explicitly unlock it with I<map_unlock(3)>. Do this
+even if you are writing single-threaded code, in case your function may one
+day be used in a multi-threaded application.
+
+=cut
+
+*/
+
+int map_has_next(Map *map)
+{
+	int has;
+
+	if (!map)
+		return set_errno(EINVAL);
+
+	if (!map->mapper && !(map->mapper = mapper_create_unlocked(map)))
+		return -1;
+
+	if ((has = mapper_has_next(map->mapper)) != 1)
+		map_break(map);
+
+	return has;
+}
+
+/*
+
+=item C<void map_break(Map *map)>
+
+Unlocks C<map> and destroys its internal iterator. Must be used only when an
+iteration using an internal iterator has terminated before reaching the end
+of C<map>. On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+void map_break(Map *map)
+{
+	if (!map)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	mapper_destroy_unlocked(&map->mapper);
+}
+
+/*
+
+=item C<void *map_next(Map *map)>
+
+Returns the next item in C<map> using its internal iterator. On error,
+returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+void *map_next(Map *map)
+{
+	if (!map || !map->mapper)
+		return set_errnull(EINVAL);
+
+	return mapper_next(map->mapper);
+}
+
+/*
+
+=item C<const Mapping *map_next_mapping(Map *map)>
+
+Returns the next mapping (key, value) pair in C<map> using its internal
+iterator. On error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+const Mapping *map_next_mapping(Map *map)
+{
+	if (!map || !map->mapper)
+		return set_errnull(EINVAL);
+
+	return mapper_next_mapping(map->mapper);
+}
+
+/*
+
+=item C<void map_remove_current(Map *map)>
+
+Removes the current item in C<map> using its internal iterator. The next
+item in the iteration is the item following the removed item, if any. This
+must be called after I<map_next(3)>.
+
+=cut
+
+*/
+
+void map_remove_current(Map *map)
+{
+	if (!map || !map->mapper)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	mapper_remove(map->mapper);
+}
+
+/*
+
+=item C<const void *mapping_key(const Mapping *mapping)>
+
+Returns the key in C<mapping>. On error, returns C<null> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+const void *mapping_key(const Mapping *mapping)
+{
+	if (!mapping)
+		return set_errnull(EINVAL);
+
+	return mapping->key;
+}
+
+/*
+
+=item C<const void *mapping_value(const Mapping *mapping)>
+
+Returns the value in C<mapping>. On error, returns C<null> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+const void *mapping_value(const Mapping *mapping)
+{
+	if (!mapping)
+		return set_errnull(EINVAL);
+
+	return mapping->value;
+}
+
+/*
+
+=item C<List *map_keys(Map *map)>
+
+Creates and returns a list of all of the keys contained in C<map>. It is the
+caller's responsibility to deallocate the new list with I<list_release(3)>
+or I<list_destroy(3)>. It is strongly recommended to use I<list_destroy(3)>,
+because it also sets the pointer variable to C<null>. The keys in the new
+list are owned by C<map>, so the list returned must not outlive C<map>. On
+error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+List *map_keys(Map *map)
+{
+	return map_keys_with_locker(NULL, map);
+}
+
+/*
+
+=item C<List *map_keys_unlocked(Map *map)>
+
+Equivalent to I<map_keys(3)> except that C<map> is not read-locked.
+
+=cut
+
+*/
+
+List *map_keys_unlocked(Map *map)
+{
+	return map_keys_with_locker_unlocked(NULL, map);
+}
+
+/*
+
+=item C<List *map_keys_with_locker(Locker *locker, Map *map)>
+
+Equivalent to I<map_keys(3)> except that multiple threads accessing the list
+returned will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *map_keys_with_locker(Locker *locker, Map *map)
+{
+	List *keys;
+	int err;
+
+	if (!map)
+		return set_errnull(EINVAL);
+
+	if ((err = map_rdlock(map)))
+		return set_errnull(err);
+
+	keys = map_keys_with_locker_unlocked(locker, map);
+
+	if ((err = map_unlock(map)))
+		return set_errnull(err);
+
+	return keys;
+}
+
+/*
+
+=item C<List *map_keys_with_locker_unlocked(Locker *locker, Map *map)>
+
+Equivalent to I<map_keys_with_locker(3)> except that C<map> is not
+read-locked.
+
+=cut
+
+*/
+
+List *map_keys_with_locker_unlocked(Locker *locker, Map *map)
+{
+	Mapper *mapper;
+	List *keys;
+
+	if (!map)
+		return set_errnull(EINVAL);
+
+	if (!(keys = list_create_with_locker(locker, NULL)))
+		return NULL;
+
+	if (!(mapper = mapper_create_unlocked(map)))
+	{
+		list_release(keys);
+		return NULL;
+	}
+
+	while (mapper_has_next(mapper) == 1)
+	{
+		const Mapping *mapping = mapper_next_mapping(mapper);
+
+		if (!list_append(keys, mapping->key))
+		{
+			list_destroy(&keys);
+			break;
+		}
+	}
+
+	mapper_release_unlocked(mapper);
+
+	return keys;
+}
+
+/*
+
+=item C<List *map_values(Map *map)>
+
+Creates and returns a list of all of the values contained in C<map>. It is
+the caller's responsibility to deallocate the new list with
+I<list_release(3)> or I<list_destroy(3)>. It is strongly recommended to use
+I<list_destroy(3)>, because it also sets the pointer variable to C<null>.
+The values in the list are not owned by the list, so it must not outlive the
+owner of the items in C<map>. On error, returns C<null> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+List *map_values(Map *map)
+{
+	return map_values_with_locker(NULL, map);
+}
+
+/*
+
+=item C<List *map_values_unlocked(Map *map)>
+
+Equivalent to I<map_values(3)> except that C<map> is not read-locked.
+
+=cut
+
+*/
+
+List *map_values_unlocked(Map *map)
+{
+	return map_values_with_locker_unlocked(NULL, map);
+}
+
+/*
+
+=item C<List *map_values_with_locker(Locker *locker, Map *map)>
+
+Equivalent to I<map_values(3)> except that multiple threads accessing the
+list returned will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *map_values_with_locker(Locker *locker, Map *map)
+{
+	List *values;
+	int err;
+
+	if (!map)
+		return set_errnull(EINVAL);
+
+	if ((err = map_rdlock(map)))
+		return set_errnull(err);
+
+	values = map_values_with_locker_unlocked(locker, map);
+
+	if ((err = map_unlock(map)))
+		return set_errnull(err);
+
+	return values;
+}
+
+/*
+
+=item C<List *map_values_with_locker_unlocked(Locker *locker, Map *map)>
+
+Equivalent to I<map_values_with_locker(3)> except that C<map> is not
+read-locked.
+
+=cut
+
+*/
+
+List *map_values_with_locker_unlocked(Locker *locker, Map *map)
+{
+	Mapper *mapper;
+	List *values;
+
+	if (!map)
+		return set_errnull(EINVAL);
+
+	if (!(values = list_create_with_locker(locker, NULL)))
+		return NULL;
+
+	if (!(mapper = mapper_create_unlocked(map)))
+	{
+		list_release(values);
+		return NULL;
+	}
+
+	while (mapper_has_next(mapper) == 1)
+	{
+		const Mapping *mapping = mapper_next_mapping(mapper);
+
+		if (!list_append(values, mapping->value))
+		{
+			list_destroy(&values);
+			break;
+		}
+	}
+
+	mapper_release_unlocked(mapper);
+
+	return values;
+}
+
+/*
+
+=item C<void map_apply(Map *map, map_action_t *action, void *data)>
+
+Invokes C<action> for each of C<map>'s items. The arguments passed to
+C<action> are the key, the item, and C<data>. On error, sets C<errno>
+appropriately.
+
+=cut
+
+*/
+
+void map_apply(Map *map, map_action_t *action, void *data)
+{
+	map_apply_wrlocked(map, action, data);
+}
+
+/*
+
+=item C<void map_apply_rdlocked(Map *map, map_action_t *action, void *data)>
+
+Equivalent to I<map_apply(3)> except that C<map> is read-locked rather than
+write-locked. Use this in preference to I<map_apply(3)> when C<map> and its
+items will not be modified during the iteration.
+
+=cut
+
+*/
+
+void map_apply_rdlocked(Map *map, map_action_t *action, void *data)
+{
+	int err;
+
+	if (!map || !action)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	if ((err = map_rdlock(map)))
+	{
+		set_errno(err);
+		return;
+	}
+
+	map_apply_unlocked(map, action, data);
+
+	if ((err = map_unlock(map)))
+	{
+		set_errno(err);
+		return;
+	}
+}
+
+/*
+
+=item C<void map_apply_wrlocked(Map *map, map_action_t *action, void *data)>
+
+Equivalent to I<map_apply(3)> except that this function name makes the fact
+that C<map> is write-locked explicit.
+
+=cut
+
+*/
+
+void map_apply_wrlocked(Map *map, map_action_t *action, void *data)
+{
+	int err;
+
+	if (!map || !action)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	if ((err = map_wrlock(map)))
+	{
+		set_errno(err);
+		return;
+	}
+
+	map_apply_unlocked(map, action, data);
+
+	if ((err = map_unlock(map)))
+	{
+		set_errno(err);
+		return;
+	}
+}
+
+/*
+
+=item C<void map_apply_unlocked(Map *map, map_action_t *action, void *data)>
+
+Equivalent to I<map_apply(3)> except that C<map> is not write-locked.
+
+=cut
+
+*/
+
+void map_apply_unlocked(Map *map, map_action_t *action, void *data)
+{
+	Mapper *mapper;
+
+	if (!map || !action)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	if (!(mapper = mapper_create_unlocked(map)))
+		return;
+
+	while (mapper_has_next(mapper) == 1)
+	{
+		const Mapping *mapping = mapper_next_mapping(mapper);
+		action(mapping->key, mapping->value, data);
+	}
+
+	mapper_release_unlocked(mapper);
+}
+
+/*
+
+=item C<ssize_t map_size(Map *map)>
+
+Returns the number of mappings in C<map>. On error, returns C<-1> with
+C<errno> set appropriately.
+
+=cut
+
+*/
+
+ssize_t map_size(Map *map)
+{
+	size_t size;
+	int err;
+
+	if (!map)
+		return set_errno(EINVAL);
+
+	if ((err = map_rdlock(map)))
+		return set_errno(err);
+
+	size = map_items(map);
+
+	if ((err = map_unlock(map)))
+		return set_errno(err);
+
+	return size;
+}
+
+/*
+
+=item C<ssize_t map_size_unlocked(const Map *map)>
+
+Equivalent to I<map_size(3)> except that C<map> is not read-locked.
+
+=cut
+
+*/
+
+ssize_t map_size_unlocked(const Map *map)
+{
+	if (!map)
+		return set_errno(EINVAL);
+
+	return map_items(map);
+}
+
+/*
+
+C<int freeze_place(const char **keys, size_t *slots, const size_t *members, size_t count, size_t size, size_t *displacement, char *taken)>
+
+Finds a seed that places the C<size> keys of one bucket (whose indexes are
+C<members>) into distinct free slots of a perfect hash table with C<count>
+slots, marks those slots as C<taken>, records each key's slot in C<slots>,
+and stores the seed in C<*displacement>. On success, returns C<0>. On error
+(if no seed up to I<frozen_max_seed> works), returns C<-1> with C<errno> set
+to C<ERANGE>.
+
+*/
+
+static int freeze_place(const char **keys, size_t *slots, const size_t *members, size_t count, size_t size, size_t *displacement, char *taken)
+{
+	size_t seed, i, j;
+
+	for (seed = 1; seed <= frozen_max_seed; ++seed)
+	{
+		for (i = 0; i < size; ++i)
+		{
+			slots[members[i]] = string_hash_seeded(keys[members[i]], seed) % count;
+
+			if (taken[slots[members[i]]])
+				break;
+
+			taken[slots[members[i]]] = 1;
+		}
+
+		if (i == size)
+		{
+			*displacement = seed;
+			return 0;
+		}
+
+		for (j = 0; j < i; ++j)
+			taken[slots[members[j]]] = 0;
+	}
+
+	return set_errno(ERANGE);
+}
+
+/*
+
+C<int freeze_write(const char *path, const char *image, size_t size)>
+
+Writes the C<size> bytes of C<image> to a new file, flushes it to disk, and
+renames it to C<path>, so processes that have the previous file mapped into
+memory are unaffected, and a crash can't leave a partial file at C<path>.
+On success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
+
+*/
+
+static int freeze_write(const char *path, const char *image, size_t size)
+{
+	char *tmp;
+	ssize_t bytes;
+	size_t written;
+	int fd, saved, synced = 0;
+
+	if (!(tmp = mem_create(strlen(path) + 32, char)))
+		return -1;
+
+	snprintf(tmp, strlen(path) + 32, "%s.%d.tmp", path, (int)getpid());
+
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+	{
+		mem_release(tmp);
+		return -1;
+	}
+
+	for (written = 0; written < size; written += bytes)
+	{
+		if ((bytes = write(fd, image + written, size - written)) == -1)
+		{
+			if (errno == EINTR)
+			{
+				bytes = 0;
+				continue;
+			}
+
+			break;
+		}
+	}
+
+	if (written < size || !(synced = (fsync(fd) != -1)) || close(fd) == -1 || rename(tmp, path) == -1)
+	{
+		saved = errno;
+		if (!synced)
+			close(fd);
+		unlink(tmp);
+		mem_release(tmp);
+		return set_errno(saved);
+	}
+
+	mem_release(tmp);
+
+	return 0;
+}
+
+/*
+
+=item C<int map_freeze(Map *map, const char *path, map_length_t *length)>
+
+Writes the mappings in C<map>, whose keys must be strings, to the file
+C<path> as a frozen image that can be opened with I<map_open_mmap(3)>. The
+values are copied into the image. C<length> returns the number of bytes in
+a value. If C<length> is C<null>, the values must be strings (and their
+nul bytes are included). C<null> values (and values of length zero) are
+stored as C<null>. Each value is
+aligned for any type of the word size. C<path> is replaced atomically, so
+processes that already have a previous image open keep using it
+undisturbed. C<map> is read-locked during the operation. On success,
+returns C<0>. On error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int map_freeze(Map *map, const char *path, map_length_t *length)
+{
+	Mapper *mapper;
+	const char **keys = NULL;
+	const void **values = NULL;
+	size_t *hashes = NULL, *slots = NULL, *lengths = NULL, *start = NULL, *members = NULL, *displacement;
+	char *taken = NULL, *image = NULL;
+	frozen_slot_t *slot;
+	frozen_t *header;
+	size_t count, size, largest, i, b, offset;
+	int ret = -1;
+	int err;
+
+	if (!map || !path)
+		return set_errno(EINVAL);
+
+	if ((err = map_rdlock(map)))
+		return set_errno(err);
+
+	count = map_items(map);
+
+	if (!(keys = mem_create(count + 1, const char *)) ||
+		!(values = mem_create(count + 1, const void *)) ||
+		!(hashes = mem_create(count + 1, size_t)) ||
+		!(slots = mem_create(count + 1, size_t)) ||
+		!(lengths = mem_create(count + 1, size_t)) ||
+		!(start = mem_create(count + 2, size_t)) ||
+		!(members = mem_create(count + 1, size_t)) ||
+		!(taken = mem_create(count + 1, char)) ||
+		!(mapper = mapper_create_unlocked(map)))
+		goto done;
+
+	for (i = 0; i < count && mapper_has_next(mapper) == 1; ++i)
+	{
+		const Mapping *mapping = mapper_next_mapping(mapper);
+
+		keys[i] = mapping->key;
+		values[i] = mapping->value;
+		hashes[i] = string_hash(keys[i]);
+		lengths[i] = (!values[i]) ? 0 : (length) ? length(values[i]) : strlen(values[i]) + 1;
+	}
+
+	mapper_release_unlocked(mapper);
+
+	/* Sort the keys by bucket (counting sort) */
+
+	memset(start, 0, (count + 2) * sizeof(size_t));
+	memset(taken, 0, (count + 1) * sizeof(char));
+
+	for (i = 0; i < count; ++i)
+		++start[hashes[i] % count + 2];
+
+	for (b = 0, largest = 0; b < count; ++b)
+	{
+		if (start[b + 2] > largest)
+			largest = start[b + 2];
+
+		start[b + 2] += start[b + 1];
+	}
+
+	for (i = 0; i < count; ++i)
+		members[start[hashes[i] % count + 1]++] = i;
+
+	/* Now start[b] is the first member of bucket b. Lay out the image. */
+
+	size = sizeof(frozen_t) + count * (sizeof(size_t) + sizeof(frozen_slot_t));
+
+	for (i = 0; i < count; ++i)
+	{
+		if (lengths[i])
+			size += sizeof(size_t) - 1 + lengths[i];
+
+		size += strlen(keys[i]) + 1;
+	}
+
+	if (!(image = mem_create(size, char)))
+		goto done;
+
+	memset(image, 0, size);
+	displacement = (size_t *)(image + sizeof(frozen_t));
+
+	/* Place the largest buckets first, while there are plenty of free slots */
+
+	for (; largest > 1; --largest)
+		for (b = 0; b < count; ++b)
+			if (start[b + 1] - start[b] == largest)
+				if (freeze_place(keys, slots, members + start[b], count, largest, &displacement[b], taken) == -1)
+					goto done;
+
+	/* Put the keys that have a bucket to themselves into the remaining slots */
+
+	for (b = 0, i = 0; b < count; ++b)
+	{
+		if (start[b + 1] - start[b] != 1)
+			continue;
+
+		while (taken[i])
+			++i;
+
+		taken[i] = 1;
+		slots[members[start[b]]] = i;
+		displacement[b] = ~i;
+	}
+
+	/* Copy the mappings into their slots */
+
+	header = (frozen_t *)image;
+	memcpy(header->magic, frozen_magic, sizeof(frozen_magic));
+	header->version = frozen_version;
+	header->word = sizeof(size_t);
+	header->count = count;
+	slot = (frozen_slot_t *)(displacement + count);
+	offset = sizeof(frozen_t) + count * (sizeof(size_t) + sizeof(frozen_slot_t));
+
+	for (i = 0; i < count; ++i)
+	{
+		frozen_slot_t *s = &slot[slots[i]];
+
+		s->hash = hashes[i];
+
+		if (lengths[i])
+		{
+			offset += (sizeof(size_t) - offset % sizeof(size_t)) % sizeof(size_t);
+			s->value = offset;
+			memcpy(image + offset, values[i], lengths[i]);
+			offset += lengths[i];
+		}
+
+		s->key = offset;
+		strcpy(image + offset, keys[i]);
+		offset += strlen(keys[i]) + 1;
+	}
+
+	header->size = offset;
+	ret = freeze_write(path, image, offset);
+
+done:
+	if ((err = map_unlock(map)))
+		ret = set_errno(err);
+
+	err = errno;
+	mem_release(keys);
+	mem_release(values);
+	mem_release(hashes);
+	mem_release(slots);
+	mem_release(lengths);
+	mem_release(start);
+	mem_release(members);
+	mem_release(taken);
+	mem_release(image);
+	errno = err;
+
+	return ret;
+}
+
+/*
+
+=back
+
+=head1 ERRORS
+
+On error, C<errno> is set either by an underlying function, or as follows:
+
+=over 4
+
+=item C<EINVAL>
+
+When arguments are C<null> or out of range.
+
+=item C<ENOENT>
+
+When I<map_get(3)> tries to get, or I<map_remove(3)> tries to remove, a
+non-existent mapping.
+
+=item C<EPERM>
+
+When an attempt is made to modify a frozen map.
+
+=back
+
+=head1 MT-Level
+
+I<MT-Disciplined>
+
+By default, I<Map>s are not I<MT-Safe> because most programs are
+single-threaded, and synchronisation doesn't come for free. Even in
+multi-threaded programs, not all I<Map>s are necessarily shared between
+multiple threads.
+
+When a I<Map> is shared between multiple threads which need to be
+synchronised, the method of synchronisation must be carefully selected by
+the client code. There are tradeoffs between concurrency and overhead. The
+greater the concurrency, the greater the overhead. More locks give greater
+concurrency, but have greater overhead. Readers/Writer locks can give
+greater concurrency than Mutex, locks but have greater overhead. One lock
+for each I<Map> may be required, or one lock for all (or a set of) I<Map>s
+may be more appropriate.
+
+Generally, the best synchronisation strategy for a given application can
+only be determined by testing/benchmarking the written application. It is
+important to be able to experiment with the synchronisation strategy at this
+stage of development without pain.
+
+To facilitate this, I<Map>s can be created with
+I<map_create_with_locker(3)>, which takes a I<Locker> argument. The
+I<Locker> specifies a lock and a set of functions for manipulating the lock.
+Each I<Map> can have its own lock by creating a separate I<Locker> for each
+I<Map>. Multiple I<Map>s can share the same lock by sharing the same
+I<Locker>. Only the application developer can determine what is appropriate
+for each application on a case by case basis.
+
+I<MT-Disciplined> means that the application developer has a mechanism for
+specifying the synchronisation requirements to be applied to library code.
+
+=head1 EXAMPLES
+
+Create a map that doesn't own its items, populate it, and then iterate over
+its values with the internal iterator to print the values:
+
+    #include <slack/std.h>
+    #include <slack/map.h>
+
+    int main()
+    {
+        Map *map;
+
+        if (!(map = map_create(NULL)))
+            return EXIT_FAILURE;
+
+        map_add(map, "abc", "123");
+        map_add(map, "def", "456");
+        map_add(map, "ghi", "789");
+
+        while (map_has_next(map) == 1)
+            printf("%s\n", (char *)map_next(map));
+
+        map_destroy(&map);
+
+        return EXIT_SUCCESS;
+    }
+
+Create a map that does own its items, populate it, and then iterate over its
+items with an external iterator to print its keys and values:
+
+    #include <slack/std.h>
+    #include <slack/map.h>
+
+    int main()
+    {
+        Map *map;
+        Mapper *mapper;
+
+        if (!(map = map_create(free)))
+            return EXIT_FAILURE;
+
+        map_add(map, "abc", strdup("123"));
+        map_add(map, "def", strdup("456"));
+        map_add(map, "ghi", strdup("789"));
+
+        if (!(mapper = mapper_create(map)))
+        {
+            map_destroy(&map);
+            return EXIT_FAILURE;
+        }
+
+        while (mapper_has_next(mapper) == 1)
+        {
+            const Mapping *mapping = mapper_next_mapping(mapper);
+
+            printf("%s -> %s\n", (char *)mapping_key(mapping), (char *)mapping_value(mapping));
+        }
+
+        mapper_destroy(&mapper);
+        map_destroy(&map);
+
+        return EXIT_SUCCESS;
+    }
+
+The same, but with an apply function:
+
+    #include <slack/std.h>
+    #include <slack/map.h>
+
+    void action(void *key, void *item, void *data)
+    {
+        printf("%s -> %s\n", (char *)key, (char *)item);
+    }
+
+    int main()
+    {
+        Map *map;
+
+        if (!(map = map_create(free)))
+            return EXIT_FAILURE;
+
+        map_add(map, "abc", strdup("123"));
+        map_add(map, "def", strdup("456"));
+        map_add(map, "ghi", strdup("789"));
+        map_apply(map, action, NULL);
+        map_destroy(&map);
+
+        return EXIT_SUCCESS;
+    }
+
+The same, but with integer keys:
+
+    #include <slack/std.h>
+    #include <slack/map.h>
+
+    static void *int_copy(const void *key)
+    {
+        return (void *)key;
+    }
+
+    static int int_cmp(const void *a, const void *b)
+    {
+        return (int)a - (int)b;
+    }
+
+    static size_t int_hash(size_t size, const void *key)
+    {
+        return (int)key % size;
+    }
+
+    void action(void *key, void *item, void *data)
+    {
+        printf("%d -> %s\n", (int)key, (char *)item);
+    }
+
+    int main(int ac, char **av)
+    {
+        Map *map;
+
+        if (!(map = map_create_generic(int_copy, int_cmp, int_hash, NULL, free)))
+            return EXIT_FAILURE;
+
+        map_add(map, (void *)123, strdup("abc"));
+        map_add(map, (void *)456, strdup("def"));
+        map_add(map, (void *)789, strdup("ghi"));
+
+        map_apply(map, action, NULL);
+        map_destroy(&map);
+
+        return EXIT_SUCCESS;
+    }
+
+=head1 CAVEAT
+
+A C<null> pointer can't be a key. Neither can zero when using integers as
+keys.
+
+If you use an internal iterator in a loop that terminates before the end of
+the map, and fail to call I<map_break(3)>, the internal iterator will leak.
+
+=head1 BUGS
+
+Uses I<malloc(3)> directly. The type of memory used and the allocation
+strategy should be decoupled from this code.
+
+=head1 SEE ALSO
+
+I<libslack(3)>,
+I<list(3)>,
+I<mem(3)>,
+I<locker(3)>
+
+=head1 AUTHOR
+
+20230824 raf <raf@raf.org>
+
+=cut
+
+*/
+
+#endif
+
+#ifdef TEST
+
+#ifndef HAVE_SNPRINTF
+#include <slack/snprintf.h>
+#endif
+
+#include <sys/time.h>
+
+#if 0
+static void map_print(const char *name, Map *map)
+{
+	size_t i, j;
+
+	if (!map)
+	{
+		printf("%s = nil\n", name);
+		return;
+	}
+
+	printf("%s =\n{\n", name);
+
+	for (i = 0; i < map->size; ++i)
+	{
+		if (map->chain[i])
+		{
+			List *chain = map->chain[i];
+			ssize_t length = list_length(chain);
+
+			if (length == -1)
+				printf("    !!! length == -1 !!!\n");
+
+			for (j = 0; j < length; ++j)
+			{
+				Mapping *mapping = (Mapping *)list_item(chain, j);
+
+				printf("    [%d/%d] \"%s\" -> \"%s\"\n", i, j, (char *)mapping->key, (char *)mapping->value);
+			}
+		}
+	}
+
+	printf("}\n");
+}
+#endif
+
+static void map_histogram(const char *name, Map *map)
+{
+	size_t i;
+	int *histogram;
+	size_t min = 0xffffffff;
+	size_t max = 0x00000000;
+	size_t num_empty = 0;
+	size_t sum = 0;
+
+	if (!map)
+	{
+		printf("%s = nil\n", name);
+		return;
+	}
+
+	if (!(histogram = mem_create(map->items, int)))
+	{
+		printf("Failed to allocate histogram for map %s\n", name);
+		return;
+	}
+
+	memset(histogram, 0, map->items * sizeof(int));
+
+	for (i = 0; i < map->size; ++i)
+	{
+		size_t length = list_length(map->chain[i]);
+		if (length == -1)
+		{
+			++num_empty;
+			continue;
+		}
+
+		++histogram[length];
+		if (length > max)
+			max = length;
+		if (length < min)
+			min = length;
+		sum += length;
+	}
+
+	printf("%d entries in %d buckets:\n", (int)map->items, (int)map->size);
+	printf("avg = %g\n", (double)sum / (double)map->size);
+	printf("min = %d\n", (int)min);
+	printf("max = %d\n", (int)max);
+	printf("\nhistogram %s =\n{\n", name);
+
+	for (i = 0; i < map->items; ++i)
+		if (histogram[i])
+			printf("    %d chain%s of length %d\n", histogram[i], (histogram[i] == 1) ? "" : "s", (int)i);
+
+	printf("    %d empty slots\n", num_empty);
+
+	printf("}\n");
+}
+
+static void test_hash(void)
+{
+	FILE *words = fopen("/usr/dict/words", "r");
+	char word[BUFSIZ];
+	Map *map;
+
+	if (!(words = fopen("/usr/dict/words", "r")))
+	{
+		if (!(words = fopen("/usr/share/dict/words", "r")))
+		{
+			printf("Failed to open /usr/dict/words or /usr/share/dict/words\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (!(map = map_create(free)))
+	{
+		printf("Failed to create map\n");
+		exit(EXIT_FAILURE);
+	}
+
+	while (fgets(word, BUFSIZ, words))
+	{
+		char *eow = strchr(word, '\n');
+		if (eow)
+			*eow = nul;
+
+		map_add(map, word, mem_strdup(word));
+	}
+
+	fclose(words);
+
+	map_histogram("dict", map);
+	map_release(map);
+}
+
+static int sort_cmp(const char **a, const char **b)
+{
+	return strcmp(*a, *b);
+}
+
+static void test_action(char *key, char *value, char *cat)
+{
+	size_t len = strlen(cat);
+	snprintf(cat + len, BUFSIZ, "%s%s=%s", (len) ? ", " : "", key, value);
+}
+
+typedef struct Point Point;
+struct Point
+{
+	int x;
+	int y;
+};
+
+static Point *point_create(int x, int y)
+{
+	Point *point = mem_create(1, Point);
+
+	if (!point)
+		return NULL;
+
+	point->x = x;
+	point->y = y;
+
+	return point;
+}
+
+static Point *point_copy(Point *point)
+{
+	return point_create(point->x, point->y);
+}
+
+static int point_cmp(Point *a, Point *b)
+{
+	if (a->x > b->x)
+		return 1;
+	if (a->y > b->y)
+		return 1;
+	if (a->x == b->x && a->y == b->y)
+		return 0;
+	return -1;
+}
+
+static size_t point_hash(size_t size, Point *point)
+{
+	return (point->x * 31 + point->y * 37) % size;
+}
+
+static void point_release(Point *point)
+{
+	mem_release(point);
+}
+
+static int direct_copy(int key)
+{
+	return key;
+}
+
+static int direct_cmp(int a, int b)
+{
+	return a - b;
+}
+
+static size_t direct_hash(size_t size, int key)
+{
+	return key % size;
+}
+
+static size_t clumped_hash(size_t size, int key)
+{
+	return (key % 4) % size;
+}
+
+static size_t int_length(const int *value)
+{
+	return sizeof(*value);
+}
+
+static int many_test(Map *map, int fill)
+{
+	const void *keys[50];
+	void *values[50];
+	char key[50][8];
+	int i, bad = 0;
+
+	for (i = 0; fill && i < 100; ++i)
+	{
+		snprintf(key[0], sizeof(key[0]), "m%d", i);
+		map_add(map, key[0], mem_strdup(key[0]));
+	}
+
+	for (i = 0; i < 50; ++i)
+	{
+		snprintf(key[i], sizeof(key[i]), "m%d", i * 4);
+		keys[i] = key[i];
+	}
+
+	if (map_get_many(map, keys, 50, values) != 25)
+		return -1;
+
+	for (i = 0; i < 50; ++i)
+		if ((i < 25) ? !values[i] || strcmp(values[i], keys[i]) : values[i] != NULL)
+			++bad;
+
+	return bad;
+}
+
+static size_t counted_size = 0;
+static int counted_calls = 0;
+
+static size_t counted_hash(size_t size, int key)
+{
+	counted_size = size;
+	++counted_calls;
+
+	return key % size;
+}
+
+static double bench_elapsed(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+
+	return (end.tv_sec - start->tv_sec) + (end.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static void bench_map(const char *name, Map *map, int n)
+{
+	struct timeval start;
+	double add, get, rem;
+	int i, found = 0;
+
+	if (!map)
+	{
+		printf("Failed to create %s map\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 1; i <= n; ++i)
+		map_add(map, (void *)(long)i, (void *)(long)i);
+	add = bench_elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 1; i <= 2 * n; ++i)
+		found += (map_get(map, (void *)(long)i) != NULL);
+	get = bench_elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 1; i <= n; ++i)
+		map_remove(map, (void *)(long)i);
+	rem = bench_elapsed(&start);
+
+	printf("%-8s %d adds %.3fs, %d gets (%d hits) %.3fs, %d removes %.3fs\n", name, n, add, 2 * n, found, get, n, rem);
+	map_release(map);
+}
+
+static void bench_load(const char *name, Map *map, Pool *pool, int n)
+{
+	struct timeval start;
+	char key[32];
+	double load;
+	int i;
+
+	if (!map)
+	{
+		printf("Failed to create %s map\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < n; ++i)
+	{
+		snprintf(key, sizeof(key), "key%d", i);
+		map_add(map, key, NULL);
+	}
+	load = bench_elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	map_release(map);
+	pool_release(pool);
+
+	printf("%-8s %d string adds %.3fs, release %.3fs\n", name, n, load, bench_elapsed(&start));
+}
+
+static double bench_gets(Map *map, int n, int *found)
+{
+	struct timeval start;
+	char key[32];
+	int i;
+
+	gettimeofday(&start, NULL);
+	for (*found = 0, i = 0; i < 2 * n; ++i)
+	{
+		snprintf(key, sizeof(key), "key%d", i);
+		*found += (map_get(map, key) != NULL);
+	}
+
+	return bench_elapsed(&start);
+}
+
+static void bench_frozen(int n)
+{
+	struct timeval start;
+	char key[32], path[64];
+	double freeze, open, get;
+	Map *map, *frozen;
+	int i, found;
+
+	snprintf(path, sizeof(path), "/tmp/libslack.map.%d", (int)getpid());
+
+	if (!(map = map_create(NULL)))
+	{
+		printf("Failed to create map\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < n; ++i)
+	{
+		snprintf(key, sizeof(key), "key%d", i);
+		map_add(map, key, "value");
+	}
+
+	get = bench_gets(map, n, &found);
+	printf("%-8s %d string gets (%d hits) %.3fs\n", "chained", 2 * n, found, get);
+
+	gettimeofday(&start, NULL);
+	map_freeze(map, path, NULL);
+	freeze = bench_elapsed(&start);
+	map_release(map);
+
+	gettimeofday(&start, NULL);
+	if (!(frozen = map_open_mmap(path)))
+	{
+		printf("Failed to open frozen map\n");
+		exit(EXIT_FAILURE);
+	}
+	open = bench_elapsed(&start);
+
+	get = bench_gets(frozen, n, &found);
+	printf("%-8s %d string gets (%d hits) %.3fs, freeze %.3fs, open %.6fs\n", "frozen", 2 * n, found, get, freeze, open);
+	map_release(frozen);
+	unlink(path);
+}
+
+static void bench_sorted(const char *name, Map *map, int n)
+{
+	struct timeval start;
+	char key[32];
+	double add, sort;
+	List *keys;
+	int i;
+
+	if (!map)
+	{
+		printf("Failed to create %s map\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < n; ++i)
+	{
+		snprintf(key, sizeof(key), "key%d", i);
+		map_add(map, key, NULL);
+	}
+	add = bench_elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	keys = map_keys(map);
+	if (!map->skiplist)
+		list_sort(keys, (list_cmp_t *)sort_cmp);
+	sort = bench_elapsed(&start);
+
+	printf("%-8s %d string adds %.3fs, sorted keys %.3fs\n", name, n, add, sort);
+	list_release(keys);
+	map_release(map);
+}
+
+static void bench_many(const char *name, Map *map, int n)
+{
+	struct timeval start;
+	const void **keys;
+	void **values;
+	char *key;
+	double get, many;
+	int i, found;
+
+	if (!map || !(keys = mem_create(2 * n, const void *)) || !(values = mem_create(2 * n, void *)) || !(key = mem_create(2 * n * 16, char)))
+	{
+		printf("Failed to create %s map\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Look the keys up in a scattered order, with half of them absent */
+
+	for (i = 0; i < 2 * n; ++i)
+	{
+		snprintf(key + i * 16, 16, "key%d", i);
+
+		if (i < n)
+			map_add(map, key + i * 16, "value");
+	}
+
+	for (i = 0; i < 2 * n; ++i)
+		keys[i] = key + (size_t)((i * 2654435761U) % (2 * n)) * 16;
+
+	gettimeofday(&start, NULL);
+	for (found = 0, i = 0; i < 2 * n; ++i)
+		found += (map_get(map, keys[i]) != NULL);
+	get = bench_elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < 2 * n; i += 1000)
+		map_get_many(map, keys + i, 1000, values + i);
+	many = bench_elapsed(&start);
+
+	printf("%-8s %d string gets (%d hits) %.3fs, map_get_many %.3fs\n", name, 2 * n, found, get, many);
+	mem_release(keys);
+	mem_release(values);
+	mem_release(key);
+	map_release(map);
+}
+
+static void *bench_reader(void *arg)
+{
+	Map *map = arg;
+	long i;
+
+	for (i = 0; i < 1000000; ++i)
+		map_get(map, (void *)(1 + i % 100000));
+
+	return NULL;
+}
+
+static void bench_threads(const char *name, Map *map)
+{
+	struct timeval start;
+	pthread_t id[4];
+	long i;
+
+	if (!map)
+	{
+		printf("Failed to create %s map\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 1; i <= 100000; ++i)
+		map_add(map, (void *)i, (void *)i);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < 4; ++i)
+		pthread_create(&id[i], NULL, bench_reader, map);
+	for (i = 0; i < 4; ++i)
+		pthread_join(id[i], NULL);
+
+	printf("%-8s 4 threads x 1000000 gets %.3fs\n", name, bench_elapsed(&start));
+	map_release(map);
+}
+
+static void test_bench(void)
+{
+	pthread_rwlock_t lock;
+	Locker *locker;
+	Pool *pool;
+	int n = 1000000;
+
+	bench_map("chained", map_create_generic((map_copy_t *)direct_copy, (map_cmp_t *)direct_cmp, (map_hash_t *)direct_hash, NULL, NULL), n);
+	bench_map("flat", map_create_flat_generic_with_locker_sized(NULL, 11, (map_copy_t *)direct_copy, (map_cmp_t *)direct_cmp, (map_hash_t *)direct_hash, NULL, NULL), n);
+
+	bench_load("malloc", map_create(NULL), NULL, n);
+	pool = pool_create(n * 64);
+	bench_load("pool", map_create_with_pool(pool, NULL), pool, n);
+	bench_frozen(n);
+	bench_sorted("chained", map_create(NULL), n);
+	bench_sorted("ordered", map_create_ordered(NULL), n);
+	bench_many("chained", map_create(NULL), n);
+	bench_many("flat", map_create_flat(NULL), n);
+
+	pthread_rwlock_init(&lock, NULL);
+	locker = locker_create_rwlock(&lock);
+	bench_threads("rwlock", map_create_generic_with_locker(locker, (map_copy_t *)direct_copy, (map_cmp_t *)direct_cmp, (map_hash_t *)direct_hash, NULL, NULL));
+	bench_threads("striped", map_create_concurrent_generic(0, (map_copy_t *)direct_copy, (map_cmp_t *)direct_cmp, (map_hash_t *)direct_hash, NULL, NULL));
+	locker_release(locker);
+	pthread_rwlock_destroy(&lock);
+}
+
+#define RD 0
+#define WR 1
+Map *mtmap = NULL;
+Locker *locker = NULL;
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+#ifdef PTHREAD_RWLOCK_INITIALIZER
+pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+#else
+pthread_rwlock_t rwlock;
+#endif
+int barrier[2];
+int size[2];
+const int lim = 1000;
+int debug = 0;
+int errors = 0;
+
+void *produce(void *arg)
+{
+	int i;
+	int test = *(int *)arg;
+
+	for (i = 1; i <= lim; ++i)
+	{
+		if (debug)
+			printf("p: add %d\n", i);
+
+		if (map_add(mtmap, (void *)(long)i, (void *)(long)i) == -1)
+			++errors, printf("Test%d: map_add(mtmap, %d), failed (%s)\n", test, i, strerror(errno));
+
+		write(size[WR], "", 1);
+	}
+
+	write(barrier[WR], "", 1);
+	return NULL;
+}
+
+void *consume(void *arg)
+{
+	int i;
+	int test = *(int *)arg;
+	char ack;
+
+	for (i = 1; i <= lim; ++i)
+	{
+		if (debug)
+			printf("c: pop\n");
+
+		while (read(size[RD], &ack, 1) == -1 && errno == EINTR)
+		{}
+
+		if (map_remove(mtmap, (void *)(long)i) == -1)
+		{
+			++errors, printf("Test%d: map_remove(mtmap, %d), failed\n", test, i);
+			break;
+		}
+
+		if (debug)
+			printf("c: remove %d\n", i);
+	}
+
+	if (i != lim + 1)
+		++errors, printf("Test%d: consumer read %d items, not %d\n", test, i - 1, lim);
+
+	write(barrier[WR], "", 1);
+	return NULL;
+}
+
+void *iterate_builtin(void *arg)
+{
+	int i;
+	int t = *(int *)arg;
+	int broken = 0;
+
+	if (debug)
+		printf("i%d: loop\n", t);
+
+	for (i = 0; i < lim / 10; ++i)
+	{
+		map_wrlock(mtmap);
+
+		while (map_has_next(mtmap) == 1)
+		{
+			int val = (int)(long)map_next(mtmap);
+
+			if (debug)
+				printf("i%d: loop %d/%d val %d\n", t, i, lim / 10, val);
+
+			if (!broken)
+			{
+				map_break(mtmap);
+				broken = 1;
+				break;
+			}
+		}
+
+		map_unlock(mtmap);
+	}
+
+	write(barrier[WR], "", 1);
+	return NULL;
+}
+
+void *iterate_rdlocked(void *arg)
+{
+	int i;
+	int t = *(int *)arg;
+
+	if (debug)
+		printf("j%d: loop\n", t);
+
+	for (i = 0; i < lim / 10; ++i)
+	{
+		Mapper *mapper = mapper_create_rdlocked(mtmap);
+
+		while (mapper_has_next(mapper) == 1)
+		{
+			int val = (int)(long)mapper_next(mapper);
+
+			if (debug)
+				printf("j%d: loop %d/%d val %d\n", t, i, lim / 10, val);
+		}
+
+		mapper_release(mapper);
+	}
+
+	write(barrier[WR], "", 1);
+	return NULL;
+}
+
+void *iterate_wrlocked(void *arg)
+{
+	int i;
+	int t = *(int *)arg;
+
+	if (debug)
+		printf("k%d: loop\n", t);
+
+	for (i = 0; i < lim / 10; ++i)
+	{
+		Mapper *mapper = mapper_create_wrlocked(mtmap);
+
+		while (mapper_has_next(mapper) == 1)
+		{
+			int val = (int)(long)mapper_next(mapper);
+
+			if (debug)
+				printf("k%d: loop %d/%d val %d\n", t, i, lim / 10, val);
+		}
+
+		mapper_release(mapper);
+	}
+
+	write(barrier[WR], "", 1);
+	return NULL;
+}
+
+pthread_mutex_t rand_mutex[1] = { PTHREAD_MUTEX_INITIALIZER };
+
+void *reader(void *arg)
+{
+	int i;
+	int t = *(int *)arg;
+
+	if (debug)
+		printf("r%d: loop\n", t);
+
+	for (i = 0; i < lim / 10; ++i)
+	{
+		int key, value, r;
+		List *keys, *values;
+
+		pthread_mutex_lock(rand_mutex);
+		r = rand();
+		pthread_mutex_unlock(rand_mutex);
+
+		map_rdlock(mtmap);
+		key = 1 + (int)((double)(map_size_unlocked(mtmap) - 1) * r / (RAND_MAX + 1.0));
+		value = (int)(long)map_get_unlocked(mtmap, (void *)(long)key);
+		map_unlock(mtmap);
+
+		keys = map_keys(mtmap);
+		values = map_values(mtmap);
+
+		if (debug)
+			printf("r%d: loop %d/%d key/val %d/%d, #keys %d, #values %d\n", t, i, lim / 10, key, value, (int)list_length(keys), (int)list_length(values));
+
+		list_destroy(&keys);
+		list_destroy(&values);
+	}
+
+	write(barrier[WR], "", 1);
+	return NULL;
+}
+
+void mt_test(int test, Locker *locker)
+{
+	if (locker)
+		mtmap = map_create_generic_with_locker(locker, (map_copy_t *)direct_copy, (map_cmp_t *)direct_cmp, (map_hash_t *)direct_hash, NULL, NULL);
+	else
+		mtmap = map_create_concurrent_generic(4, (map_copy_t *)direct_copy, (map_cmp_t *)direct_cmp, (map_hash_t *)direct_hash, NULL, NULL);
+
+	if (!mtmap)
+		++errors, printf("Test%d: map_create_generic_with_locker(NULL) failed\n", test);
+	else
+	{
+		static int iid[13] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+		pthread_attr_t attr;
+		pthread_t id;
+		int i;
+		char ack;
+
+		if (pipe(size) == -1 || pipe(barrier) == -1)
+		{
+			++errors, printf("Test%d: failed to perform test: pipe() failed\n", test);
+			return;
+		}
+
+		srand(getpid() ^ time(NULL));
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		pthread_create(&id, &attr, produce, &test);
+		pthread_create(&id, &attr, consume, &test);
+		pthread_create(&id, &attr, iterate_builtin, iid + 0);
+		pthread_create(&id, &attr, iterate_builtin, iid + 1);
+		pthread_create(&id, &attr, iterate_builtin, iid + 2);
+		pthread_create(&id, &attr, iterate_builtin, iid + 3);
+		pthread_create(&id, &attr, iterate_rdlocked, iid + 4);
+		pthread_create(&id, &attr, iterate_rdlocked, iid + 5);
+		pthread_create(&id, &attr, iterate_rdlocked, iid + 6);
+		pthread_create(&id, &attr, iterate_wrlocked, iid + 7);
+		pthread_create(&id, &attr, iterate_wrlocked, iid + 8);
+		pthread_create(&id, &attr, iterate_wrlocked, iid + 9);
+		pthread_create(&id, &attr, reader, iid + 10);
+		pthread_create(&id, &attr, reader, iid + 11);
+		pthread_create(&id, &attr, reader, iid + 12);
+		pthread_attr_destroy(&attr);
+
+		for (i = 0; i < 15; ++i)
+			while (read(barrier[RD], &ack, 1) == -1 && errno == EINTR)
+			{}
+
+		map_destroy(&mtmap);
+		if (mtmap)
+			++errors, printf("Test%d: map_destroy(&mtmap) failed\n", test);
+
+		close(size[RD]);
+		close(size[WR]);
+		close(barrier[RD]);
+		close(barrier[WR]);
+	}
+}
+
+void *stripe_worker(void *arg)
+{
+	long base = *(int *)arg * 10000L;
+	long i;
+
+	for (i = base + 1; i <= base + 10000; ++i)
+		if (map_add(mtmap, (void *)i, (void *)i) == -1)
+			++errors, printf("Test231: map_add(mtmap, %ld) failed (%s)\n", i, strerror(errno));
+
+	for (i = base + 1; i <= base + 10000; ++i)
+		if ((long)map_get(mtmap, (void *)i) != i)
+			++errors, printf("Test231: map_get(mtmap, %ld) failed\n", i);
+
+	for (i = base + 1; i <= base + 10000; i += 2)
+		if (map_remove(mtmap, (void *)i) == -1)
+			++errors, printf("Test231: map_remove(mtmap, %ld) failed (%s)\n", i, strerror(errno));
+
+	return NULL;
+}
+
+void stripe_test(int test)
+{
+	static int tid[4] = { 0, 1, 2, 3 };
+	pthread_t id[4];
+	Mapper *mapper;
+	long i;
+	int t, seen, bad = 0;
+
+	if (!(mtmap = map_create_concurrent_generic(8, (map_copy_t *)direct_copy, (map_cmp_t *)direct_cmp, (map_hash_t *)direct_hash, NULL, NULL)))
+	{
+		++errors, printf("Test%d: map_create_concurrent_generic() failed\n", test);
+		return;
+	}
+
+	for (t = 0; t < 4; ++t)
+		pthread_create(&id[t], NULL, stripe_worker, tid + t);
+
+	/* Iterate while the workers are adding and removing */
+
+	for (t = 0; t < 10; ++t)
+	{
+		if (!(mapper = mapper_create_rdlocked(mtmap)))
+		{
+			++errors, printf("Test%d: mapper_create_rdlocked(mtmap) failed\n", test);
+			break;
+		}
+
+		for (seen = 0; mapper_has_next(mapper) == 1; ++seen)
+			if (!mapper_next_mapping(mapper))
+				++bad;
+
+		mapper_release(mapper);
+
+		if (seen > 40000)
+			++bad;
+	}
+
+	for (t = 0; t < 4; ++t)
+		pthread_join(id[t], NULL);
+
+	if (bad)
+		++errors, printf("Test%d: iteration during concurrent updates failed %d times\n", test, bad);
+
+	if (map_size(mtmap) != 20000)
+		++errors, printf("Test%d: map_size(mtmap) = %d, not 20000\n", test, (int)map_size(mtmap));
+
+	for (bad = 0, i = 1; i <= 40000; ++i)
+		if ((long)map_get(mtmap, (void *)i) != ((i & 1) ? 0 : i))
+			++bad;
+
+	if (bad)
+		++errors, printf("Test%d: map_get() after concurrent updates failed %d times\n", test, bad);
+
+	map_destroy(&mtmap);
+}
+
+#define TEST_ACT(i, action) \
+	if (!(action)) \
+		++errors, printf("Test%d: %s failed\n", (i), (#action));
+
+#define TEST_INT_ACT(i, action) \
+	if ((action) == -1) \
+		++errors, printf("Test%d: %s failed\n", (i), (#action));
+
+#define TEST_EQ(i, action, value) \
+	if ((val = (action)) != (value)) \
+		++errors, printf("Test%d: %s failed (returned %d, not %d)\n", (i), (#action), val, (value));
+
+#define TEST_NEQ(i, action, value) \
+	if ((val = (action)) == (value)) \
+		++errors, printf("Test%d: %s failed (returned %d)\n", (i), (#action), val);
+
+#define CHECK_ITEM(i, action, key, result) \
+	if (!(value = (char *)(action)) || strcmp(value, (result))) \
+		++errors, printf("Test%d: %s failed (mapping \"%s\" is \"%s\", not \"%s\")\n", (i), (#action), (key), value, (result));
+
+#define CHECK_LIST_ITEM(i, action, list, item, value) \
+	if (!list_item((list), (item)) || strcmp(list_item((list), (item)), (value))) \
+		++errors, printf("Test%d: %s failed (item %d is \"%s\", not \"%s\")\n", (i), (#action), (item), (char *)list_item(list, (item)), (value));
+
+#define CHECK_LIST(i, desc, list) \
+	if (list_length(list) != 4) \
+		++errors, printf("Test%d: %s failed (%d items, not 4)\n", (i), (desc), (int)list_length(list)); \
+	else \
+	{ \
+		TEST_ACT((i), list_sort((list), (list_cmp_t *)sort_cmp)); \
+		CHECK_LIST_ITEM((i), list_sort((list), sort_cmp), (list), 0, "abc") \
+		CHECK_LIST_ITEM((i), list_sort((list), sort_cmp), (list), 1, "def") \
+		CHECK_LIST_ITEM((i), list_sort((list), sort_cmp), (list), 2, "ghi") \
+		CHECK_LIST_ITEM((i), list_sort((list), sort_cmp), (list), 3, "jkl") \
+	}
+
+int main(int ac, char **av)
+{
+	Map *map;
+	Mapper *mapper;
+	List *keys, *values;
+	const void *ckey;
+	const char *cvalue;
+	char *value;
+	char cat[BUFSIZ];
+	void *ptr;
+	int val;
+
+	if (ac == 2 && !strcmp(av[1], "help"))
+	{
+		printf("usage: %s [help|debug|hash|bench]\n", *av);
+		return EXIT_SUCCESS;
+	}
+
+	if (ac == 2 && !strcmp(av[1], "hash"))
+	{
+		test_hash();
+		return EXIT_SUCCESS;
+	}
+
+	if (ac == 2 && !strcmp(av[1], "bench"))
+	{
+		test_bench();
+		return EXIT_SUCCESS;
+	}
+
+	printf("Testing: %s\n", "map");
+
+	/* Test map_create, map_add, map_get */
+
+	TEST_ACT(1, map = map_create(NULL))
+	else
+	{
+		TEST_INT_ACT(2, map_add(map, "abc", "abc"))
+		TEST_INT_ACT(3, map_add(map, "def", "def"))
+		TEST_INT_ACT(4, map_add(map, "ghi", "ghi"))
+		TEST_INT_ACT(5, map_add(map, "jkl", "jkl"))
+
+		CHECK_ITEM(6, map_get(map, "abc"), "abc", "abc")
+		CHECK_ITEM(7, map_get(map, "def"), "def", "def")
+		CHECK_ITEM(8, map_get(map, "ghi"), "ghi", "ghi")
+		CHECK_ITEM(9, map_get(map, "jkl"), "jkl", "jkl")
+		if ((value = (char *)map_get(map, "zzz")))
+			++errors, printf("Test10: map_get(\"zzz\") failed\n");
+
+		/* Test mapper_create, mapper_has_next, mapper_next, map_destroy */
+
+		TEST_ACT(11, mapper = mapper_create(map))
+		else
+		{
+			TEST_ACT(12, keys = list_create(NULL))
+
+			while (mapper_has_next(mapper) == 1)
+			{
+				void *item = mapper_next(mapper);
+				TEST_ACT(13, item)
+				else TEST_ACT(13, list_append(keys, item))
+			}
+
+			mapper_destroy(&mapper);
+			if (mapper)
+				++errors, printf("Test14: mapper_destroy(&mapper) failed (%p, not NULL)", (void *)mapper);
+
+			CHECK_LIST(15, "mapper_has_next/mapper_next", keys)
+			list_destroy(&keys);
+		}
+
+		/* Test mapper_next_mapping, mapping_key, mapping_value */
+
+		TEST_ACT(16, mapper = mapper_create(map))
+		else
+		{
+			TEST_ACT(16, keys = list_create(NULL))
+			TEST_ACT(16, values = list_create(NULL))
+
+			while (mapper_has_next(mapper) == 1)
+			{
+				const Mapping *mapping = mapper_next_mapping(mapper);
+
+				if (!mapping)
+					++errors, printf("Test17: mapper_next_mapping() failed\n");
+				else
+				{
+					TEST_ACT(17, ckey = mapping_key((void *)mapping))
+					else TEST_ACT(17, list_append(keys, (void *)ckey))
+					TEST_ACT(17, cvalue = mapping_value(mapping))
+					else TEST_ACT(17, list_append(values, (void *)cvalue))
+				}
+			}
+
+			mapper_destroy(&mapper);
+			if (mapper)
+				++errors, printf("Test18: mapper_destroy(&mapper) failed (%p, not NULL)", (void *)mapper);
+
+			CHECK_LIST(19, "mapper_has_next/mapper_next_mapping", keys)
+			list_destroy(&keys);
+			CHECK_LIST(20, "mapper_has_next/mapper_next_mapping", values)
+			list_destroy(&values);
+		}
+
+		/* Test map_has_next, map_next */
+
+		TEST_ACT(21, keys = list_create(NULL))
+
+		while (map_has_next(map) == 1)
+		{
+			void *item;
+
+			TEST_ACT(22, item = map_next(map))
+			else TEST_ACT(22, list_append(keys, item))
+		}
+
+		CHECK_LIST(23, "map_has_next/map_next", keys)
+		list_destroy(&keys);
+
+		/* Test map_next_mapping */
+
+		TEST_ACT(24, keys = list_create(NULL))
+		TEST_ACT(24, values = list_create(NULL))
+
+		while (map_has_next(map) == 1)
+		{
+			const Mapping *mapping;
+
+			TEST_ACT(25, mapping = map_next_mapping(map))
+			else
+			{
+				TEST_ACT(25, ckey = mapping_key(mapping))
+				else TEST_ACT(25, list_append(keys, (void *)ckey))
+				TEST_ACT(25, cvalue = mapping_value(mapping))
+				else TEST_ACT(25, list_append(values, (void *)cvalue))
+			}
+		}
+
+		CHECK_LIST(26, "map_has_next/map_next_mapping", keys)
+		list_destroy(&keys);
+		CHECK_LIST(27, "map_has_next/map_next_mapping", values)
+		list_destroy(&values);
+
+		/* Test map_keys */
+
+		TEST_ACT(28, keys = map_keys(map))
+		else
+		{
+			CHECK_LIST(29, "map_keys", keys)
+			list_destroy(&keys);
+		}
+
+		/* Test map_values */
+
+		TEST_ACT(30, values = map_values(map))
+		else
+		{
+			CHECK_LIST(31, "map_values", values)
+			list_destroy(&values);
+		}
+
+		/* Test map_remove */
+
+		TEST_ACT(32, map_remove(map, "zzz") == -1)
+		TEST_ACT(33, map_remove(map, "abc") != -1)
+		TEST_ACT(34, map_remove(map, "def") != -1)
+		TEST_ACT(35, map_remove(map, "ghi") != -1)
+		TEST_ACT(36, map_remove(map, "jkl") != -1)
+
+		map_destroy(&map);
+		if (map)
+			++errors, printf("Test37: map_destroy(&map) failed (%p, not NULL)\n", (void *)map);
+	}
+
+	/* Test map_apply */
+
+	TEST_ACT(38, map = map_create(NULL))
+	else
+	{
+		TEST_ACT(39, map_add(map, "1", "7") == 0)
+		TEST_ACT(40, map_add(map, "2", "6") == 0)
+		TEST_ACT(41, map_add(map, "3", "5") == 0)
+		TEST_ACT(42, map_add(map, "4", "4") == 0)
+		TEST_ACT(43, map_add(map, "5", "3") == 0)
+		TEST_ACT(44, map_add(map, "6", "2") == 0)
+		TEST_ACT(45, map_add(map, "7", "1") == 0)
+
+		CHECK_ITEM(46, map_get(map, "1"), "1", "7")
+		CHECK_ITEM(47, map_get(map, "2"), "2", "6")
+		CHECK_ITEM(48, map_get(map, "3"), "3", "5")
+		CHECK_ITEM(49, map_get(map, "4"), "4", "4")
+		CHECK_ITEM(50, map_get(map, "5"), "5", "3")
+		CHECK_ITEM(51, map_get(map, "6"), "6", "2")
+		CHECK_ITEM(52, map_get(map, "7"), "7", "1")
+
+		cat[0] = nul;
+		map_apply(map, (map_action_t *)test_action, cat);
+		if (strcmp(cat, "5=3, 3=5, 7=1, 4=4, 1=7, 6=2, 2=6"))
+			++errors, printf("Test53: map_apply(cat) failed (cat = \"%s\", not \"%s\")\n", cat, "5=3, 3=5, 7=1, 4=4, 1=7, 6=2, 2=6");
+
+		map_destroy(&map);
+		if (map)
+			++errors, printf("Test54: map_destroy(&map) failed (%p, not NULL)\n", (void *)map);
+	}
+
+	/* Test mapper_remove, map_size */
+
+	TEST_ACT(55, map = map_create(NULL))
+	else
+	{
+		TEST_ACT(56, map_add(map, "1", "7") == 0)
+		TEST_ACT(57, map_add(map, "2", "6") == 0)
+		TEST_ACT(58, map_add(map, "3", "5") == 0)
+		TEST_ACT(59, map_add(map, "4", "4") == 0)
+		TEST_ACT(60, map_add(map, "5", "3") == 0)
+		TEST_ACT(61, map_add(map, "6", "2") == 0)
+		TEST_ACT(62, map_add(map, "7", "1") == 0)
+
+		TEST_ACT(63, mapper = mapper_create(map))
+		else
+		{
+			while (mapper_has_next(mapper) == 1)
+			{
+				void *item;
+
+				TEST_ACT(64, item = mapper_next(mapper))
+				mapper_remove(mapper);
+			}
+
+			mapper_destroy(&mapper);
+			if (mapper)
+				++errors, printf("Test65: mapper_destroy(&mapper) failed (%p, not NULL)\n", (void *)mapper);
+
+			TEST_EQ(66, map_size(map), 0)
+		}
+
+		map_destroy(&map);
+		if (map)
+			++errors, printf("Test67: map_destroy(&map) failed (%p, not NULL)\n", (void *)map);
+	}
+
+	/* Test map_remove_current */
+
+	TEST_ACT(68, map = map_create(NULL))
+	else
+	{
+		TEST_ACT(69, map_add(map, "1", "1") == 0)
+		TEST_ACT(70, map_add(map, "2", "2") == 0)
+		TEST_ACT(71, map_add(map, "3", "3") == 0)
+		TEST_ACT(72, map_add(map, "4", "4") == 0)
+
+		while (map_has_next(map) == 1)
+		{
+			void *item;
+
+			TEST_ACT(73, item = map_next(map))
+			map_remove_current(map);
+		}
+
+		TEST_EQ(74, map_size(map), 0)
+		mapper_destroy(&mapper);
+		map_destroy(&map);
+	}
+
+	/* Test map_create_generic (Point -> char *) */
+
+#define ADD_POINT(i, xpos, ypos, value, rc) \
+	point->x = (xpos); \
+	point->y = (ypos); \
+	TEST_ACT((i), map_add(map, point, (value)) == (rc))
+
+#define GET_POINT(i, xpos, ypos, str) \
+	point->x = (xpos); \
+	point->y = (ypos); \
+	if (!(value = map_get(map, point))) \
+		++errors, printf("Test%d: map_get(generic) failed\n", (i)); \
+	else if (strcmp(value, (str))) \
+		++errors, printf("Test%d: map_get(generic) failed (\"%s\", not \"%s\")\n", (i), value, (str));
+
+	TEST_ACT(75, map = map_create_generic((map_copy_t *)point_copy, (map_cmp_t *)point_cmp, (map_hash_t *)point_hash, (map_release_t *)point_release, NULL))
+	else
+	{
+		Point *point = point_create(0, 0);
+
+		ADD_POINT(76, 0, 0, "(0, 0)", 0)
+		ADD_POINT(77, 1, 0, "(1, 0)", 0)
+		ADD_POINT(78, 0, 1, "(0, 1)", 0)
+		ADD_POINT(79, 1, 1, "(1, 1)", 0)
+		ADD_POINT(80, -1, 0, "(-1, 0)", 0)
+		ADD_POINT(81, 0, -1, "(0, -1)", 0)
+		ADD_POINT(82, -1, -1, "(-1, -1)", 0)
+		ADD_POINT(83, 2, 0, "(2, 0)", 0)
+		ADD_POINT(84, 0, 2, "(0, 2)", 0)
+		ADD_POINT(85, 2, 2, "(2, 2)", 0)
+		ADD_POINT(86, -2, 0, "(-2, 0)", 0)
+		ADD_POINT(87, 0, -2, "(0, -2)", 0)
+		ADD_POINT(88, -2, -2, "(-2, -2)", 0)
+		ADD_POINT(89, 0, 0, "(0, 0)", -1)
+		TEST_EQ(90, map_size(map), 13)
+
+		GET_POINT(91, 0, 0, "(0, 0)")
+		GET_POINT(92, 1, 0, "(1, 0)")
+		GET_POINT(93, 0, 1, "(0, 1)")
+		GET_POINT(94, 1, 1, "(1, 1)")
+		GET_POINT(95, -1, 0, "(-1, 0)")
+		GET_POINT(96, 0, -1, "(0, -1)")
+		GET_POINT(97, -1, -1, "(-1, -1)")
+		GET_POINT(98, 2, 0, "(2, 0)")
+		GET_POINT(99, 0, 2, "(0, 2)")
+		GET_POINT(100, 2, 2, "(2, 2)")
+		GET_POINT(101, -2, 0, "(-2, 0)")
+		GET_POINT(102, 0, -2, "(0, -2)")
+		GET_POINT(103, -2, -2, "(-2, -2)")
+		point_release(point);
+		map_destroy(&map);
+	}
+
+	/* Test map_create_generic (int -> int) and map growth */
+
+	TEST_ACT(104, map = map_create_generic((map_copy_t *)direct_copy, (map_cmp_t *)direct_cmp, (map_hash_t *)direct_hash, NULL, NULL))
+	else
+	{
+		TEST_ACT(105, map_add(map, (void *)1, (void *)1) == 0)
+		TEST_ACT(106, map_add(map, (void *)2, (void *)2) == 0)
+		TEST_ACT(107, map_add(map, (void *)3, (void *)3) == 0)
+		TEST_ACT(108, map_add(map, (void *)4, (void *)4) == 0)
+		TEST_ACT(109, map_add(map, (void *)5, (void *)5) == 0)
+		TEST_ACT(110, map_add(map, (void *)6, (void *)6) == 0)
+		TEST_ACT(111, map_add(map, (void *)7, (void *)7) == 0)
+		TEST_ACT(112, map_add(map, (void *)8, (void *)8) == 0)
+		TEST_ACT(113, map_add(map, (void *)9, (void *)9) == 0)
+		TEST_ACT(114, map_add(map, (void *)10, (void *)10) == 0)
+		TEST_ACT(115, map_add(map, (void *)11, (void *)11) == 0)
+		TEST_ACT(116, map_add(map, (void *)12, (void *)12) == 0)
+		TEST_ACT(117, map_add(map, (void *)13, (void *)13) == 0)
+		TEST_ACT(118, map_add(map, (void *)14, (void *)14) == 0)
+		TEST_ACT(119, map_add(map, (void *)15, (void *)15) == 0)
+		TEST_ACT(120, map_add(map, (void *)16, (void *)16) == 0)
+		TEST_ACT(121, map_add(map, (void *)17, (void *)17) == 0)
+		TEST_ACT(122, map_add(map, (void *)18, (void *)18) == 0)
+		TEST_ACT(123, map_add(map, (void *)19, (void *)19) == 0)
+		TEST_ACT(124, map_add(map, (void *)20, (void *)20) == 0)
+		TEST_ACT(125, map_add(map, (void *)21, (void *)21) == 0)
+		TEST_ACT(126, map_add(map, (void *)22, (void *)22) == 0)
+		TEST_ACT(127, map_add(map, (void *)23, (void *)23) == 0)
+		TEST_ACT(128, map_add(map, (void *)24, (void *)24) == 0)
+		TEST_ACT(129, map_add(map, (void *)25, (void *)25) == 0)
+		TEST_ACT(130, map_add(map, (void *)25, (void *)25) != 0)
+		TEST_EQ(130, map_size(map), 25)
+
+		TEST_EQ(131, (int)(long)map_get(map, (void *)1), 1)
+		TEST_EQ(132, (int)(long)map_get(map, (void *)2), 2)
+		TEST_EQ(133, (int)(long)map_get(map, (void *)3), 3)
+		TEST_EQ(134, (int)(long)map_get(map, (void *)4), 4)
+		TEST_EQ(135, (int)(long)map_get(map, (void *)5), 5)
+		TEST_EQ(136, (int)(long)map_get(map, (void *)6), 6)
+		TEST_EQ(137, (int)(long)map_get(map, (void *)7), 7)
+		TEST_EQ(138, (int)(long)map_get(map, (void *)8), 8)
+		TEST_EQ(139, (int)(long)map_get(map, (void *)9), 9)
+		TEST_EQ(140, (int)(long)map_get(map, (void *)10), 10)
+		TEST_EQ(141, (int)(long)map_get(map, (void *)11), 11)
+		TEST_EQ(142, (int)(long)map_get(map, (void *)12), 12)
+		TEST_EQ(143, (int)(long)map_get(map, (void *)13), 13)
+		TEST_EQ(144, (int)(long)map_get(map, (void *)14), 14)
+		TEST_EQ(145, (int)(long)map_get(map, (void *)15), 15)
+		TEST_EQ(146, (int)(long)map_get(map, (void *)16), 16)
+		TEST_EQ(147, (int)(long)map_get(map, (void *)17), 17)
+		TEST_EQ(148, (int)(long)map_get(map, (void *)18), 18)
+		TEST_EQ(149, (int)(long)map_get(map, (void *)19), 19)
+		TEST_EQ(150, (int)(long)map_get(map, (void *)20), 20)
+		TEST_EQ(151, (int)(long)map_get(map, (void *)21), 21)
+		TEST_EQ(152, (int)(long)map_get(map, (void *)22), 22)
+		TEST_EQ(153, (int)(long)map_get(map, (void *)23), 23)
+		TEST_EQ(154, (int)(long)map_get(map, (void *)24), 24)
+		TEST_EQ(155, (int)(long)map_get(map, (void *)25), 25)
+		map_destroy(&map);
+	}
 
-	if (debug)
-		printf("k%d: loop\n", t);
+	/* Test map_create_flat, map_add, map_put, map_get, map_remove */
 
-	for (i = 0; i < lim / 10; ++i)
+	TEST_ACT(156, map = map_create_flat(free))
+	else
 	{
-		Mapper *mapper = mapper_create_wrlocked(mtmap);
-
-		while (mapper_has_next(mapper) == 1)
+		TEST_INT_ACT(157, map_add(map, "abc", mem_strdup("abc")))
+		TEST_INT_ACT(158, map_add(map, "def", mem_strdup("def")))
+		TEST_INT_ACT(159, map_add(map, "ghi", mem_strdup("ghi")))
+		TEST_INT_ACT(160, map_add(map, "jkl", mem_strdup("jkl")))
+		TEST_EQ(161, map_add(map, "abc", "abc"), -1)
+		TEST_EQ(162, map_size(map), 4)
+		CHECK_ITEM(163, map_get(map, "abc"), "abc", "abc")
+		CHECK_ITEM(164, map_get(map, "def"), "def", "def")
+		CHECK_ITEM(165, map_get(map, "ghi"), "ghi", "ghi")
+		CHECK_ITEM(166, map_get(map, "jkl"), "jkl", "jkl")
+		if ((value = (char *)map_get(map, "zzz")))
+			++errors, printf("Test167: map_get(\"zzz\") failed\n");
+		TEST_INT_ACT(168, map_put(map, "def", mem_strdup("DEF")))
+		TEST_EQ(169, map_size(map), 4)
+		CHECK_ITEM(170, map_get(map, "def"), "def", "DEF")
+		TEST_INT_ACT(171, map_remove(map, "abc"))
+		TEST_EQ(172, map_remove(map, "abc"), -1)
+		TEST_EQ(173, map_size(map), 3)
+		if ((value = (char *)map_get(map, "abc")))
+			++errors, printf("Test174: map_get(\"abc\") after map_remove failed\n");
+		CHECK_ITEM(175, map_get(map, "ghi"), "ghi", "ghi")
+
+		/* Test mapper and map_keys on a flat map */
+
+		TEST_ACT(176, keys = map_keys(map))
+		else
 		{
-			int val = (int)(long)mapper_next(mapper);
-
-			if (debug)
-				printf("k%d: loop %d/%d val %d\n", t, i, lim / 10, val);
+			TEST_EQ(177, list_length(keys), 3)
+			list_destroy(&keys);
 		}
 
-		mapper_release(mapper);
+		TEST_ACT(178, map_disown(map) == (map_release_t *)free)
+		TEST_EQ(179, map_own(map, (map_release_t *)free), 0)
+		CHECK_ITEM(180, map_get(map, "jkl"), "jkl", "jkl")
+		map_destroy(&map);
+		if (map)
+			++errors, printf("Test181: map_destroy(&map) failed\n");
 	}
 
-	write(barrier[WR], "", 1);
-	return NULL;
-}
+	/* Test flat map growth, clustering, and removal while iterating */
 
-pthread_mutex_t rand_mutex[1] = { PTHREAD_MUTEX_INITIALIZER };
+	TEST_ACT(182, map = map_create_flat_generic_with_locker_sized(NULL, 11, (map_copy_t *)direct_copy, (map_cmp_t *)direct_cmp, (map_hash_t *)clumped_hash, NULL, NULL))
+	else
+	{
+		int i, bad = 0;
+
+		for (i = 1; i <= 100; ++i)
+			if (map_add(map, (void *)(long)i, (void *)(long)(i * 10)) == -1)
+				++bad;
+		if (bad)
+			++errors, printf("Test183: map_add() x 100 failed %d times\n", bad);
+
+		TEST_EQ(184, map_size(map), 100)
+		if (map->size < 100 * 4 / 3)
+			++errors, printf("Test185: flat map failed to grow (size %d)\n", (int)map->size);
+
+		for (bad = 0, i = 1; i <= 100; ++i)
+			if ((long)map_get(map, (void *)(long)i) != i * 10)
+				++bad;
+		if (bad)
+			++errors, printf("Test186: map_get() x 100 failed %d times\n", bad);
+
+		for (bad = 0, i = 2; i <= 100; i += 2)
+			if (map_remove(map, (void *)(long)i) == -1)
+				++bad;
+		if (bad)
+			++errors, printf("Test187: map_remove() x 50 failed %d times\n", bad);
+
+		TEST_EQ(188, map_size(map), 50)
+
+		for (bad = 0, i = 1; i <= 100; ++i)
+			if ((long)map_get(map, (void *)(long)i) != ((i & 1) ? i * 10 : 0))
+				++bad;
+		if (bad)
+			++errors, printf("Test189: map_get() after map_remove() failed %d times\n", bad);
+
+		TEST_ACT(190, mapper = mapper_create(map))
+		else
+		{
+			int seen = 0;
 
-void *reader(void *arg)
-{
-	int i;
-	int t = *(int *)arg;
+			while (mapper_has_next(mapper) == 1)
+			{
+				const Mapping *mapping = mapper_next_mapping(mapper);
 
-	if (debug)
-		printf("r%d: loop\n", t);
+				if (!mapping)
+				{
+					++errors, printf("Test191: mapper_next_mapping() failed\n");
+					break;
+				}
 
-	for (i = 0; i < lim / 10; ++i)
-	{
-		int key, value, r;
-		List *keys, *values;
+				++seen;
 
-		pthread_mutex_lock(rand_mutex);
-		r = rand();
-		pthread_mutex_unlock(rand_mutex);
+				if ((long)mapping_key(mapping) % 3 == 0)
+					mapper_remove(mapper);
+			}
 
-		map_rdlock(mtmap);
-		key = 1 + (int)((double)(map_size_unlocked(mtmap) - 1) * r / (RAND_MAX + 1.0));
-		value = (int)(long)map_get_unlocked(mtmap, (void *)(long)key);
-		map_unlock(mtmap);
+			TEST_EQ(192, seen, 50)
+			mapper_destroy(&mapper);
+		}
 
-		keys = map_keys(mtmap);
-		values = map_values(mtmap);
+		TEST_EQ(193, map_size(map), 33)
 
-		if (debug)
-			printf("r%d: loop %d/%d key/val %d/%d, #keys %d, #values %d\n", t, i, lim / 10, key, value, (int)list_length(keys), (int)list_length(values));
+		for (bad = 0, i = 1; i <= 100; ++i)
+			if ((long)map_get(map, (void *)(long)i) != ((i & 1 && i % 3) ? i * 10 : 0))
+				++bad;
+		if (bad)
+			++errors, printf("Test194: map_get() after mapper_remove() failed %d times\n", bad);
 
-		list_destroy(&keys);
-		list_destroy(&values);
+		map_destroy(&map);
 	}
 
-	write(barrier[WR], "", 1);
-	return NULL;
-}
+	/* Test incremental resizing of chained maps */
 
-void mt_test(int test, Locker *locker)
-{
-	mtmap = map_create_generic_with_locker(locker, (map_copy_t *)direct_copy, (map_cmp_t *)direct_cmp, (map_hash_t *)direct_hash, NULL, NULL);
-	if (!mtmap)
-		++errors, printf("Test%d: map_create_generic_with_locker(NULL) failed\n", test);
+	TEST_ACT(195, map = map_create_generic((map_copy_t *)direct_copy, (map_cmp_t *)direct_cmp, (map_hash_t *)direct_hash, NULL, NULL))
 	else
 	{
-		static int iid[13] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
-		pthread_attr_t attr;
-		pthread_t id;
-		int i;
-		char ack;
+		int i, bad = 0, resizing = 0, seen = 0;
 
-		if (pipe(size) == -1 || pipe(barrier) == -1)
+		for (i = 1; i <= 1000; ++i)
 		{
-			++errors, printf("Test%d: failed to perform test: pipe() failed\n", test);
-			return;
+			if (map_add(map, (void *)(long)i, (void *)(long)i) == -1)
+				++bad;
+
+			if (map->old_chain)
+			{
+				++resizing;
+
+				if ((long)map_get(map, (void *)1) != 1 || (long)map_get(map, (void *)(long)i) != i)
+					++bad;
+			}
 		}
 
-		srand(getpid() ^ time(NULL));
-		pthread_attr_init(&attr);
-		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-		pthread_create(&id, &attr, produce, &test);
-		pthread_create(&id, &attr, consume, &test);
-		pthread_create(&id, &attr, iterate_builtin, iid + 0);
-		pthread_create(&id, &attr, iterate_builtin, iid + 1);
-		pthread_create(&id, &attr, iterate_builtin, iid + 2);
-		pthread_create(&id, &attr, iterate_builtin, iid + 3);
-		pthread_create(&id, &attr, iterate_rdlocked, iid + 4);
-		pthread_create(&id, &attr, iterate_rdlocked, iid + 5);
-		pthread_create(&id, &attr, iterate_rdlocked, iid + 6);
-		pthread_create(&id, &attr, iterate_wrlocked, iid + 7);
-		pthread_create(&id, &attr, iterate_wrlocked, iid + 8);
-		pthread_create(&id, &attr, iterate_wrlocked, iid + 9);
-		pthread_create(&id, &attr, reader, iid + 10);
-		pthread_create(&id, &attr, reader, iid + 11);
-		pthread_create(&id, &attr, reader, iid + 12);
-		pthread_attr_destroy(&attr);
+		if (bad)
+			++errors, printf("Test196: map_add()/map_get() x 1000 failed %d times\n", bad);
+		if (!resizing)
+			++errors, printf("Test197: map_add() x 1000 never resized incrementally\n");
+		TEST_EQ(198, map_size(map), 1000)
 
-		for (i = 0; i < 15; ++i)
-			while (read(barrier[RD], &ack, 1) == -1 && errno == EINTR)
-			{}
+		for (--i; !map->old_chain; ++i)
+			map_add(map, (void *)(long)(i + 1), (void *)(long)(i + 1));
 
-		map_destroy(&mtmap);
-		if (mtmap)
-			++errors, printf("Test%d: map_destroy(&mtmap) failed\n", test);
+		TEST_EQ(199, map_put(map, (void *)1, (void *)-1), 0)
+		TEST_EQ(200, map_size(map), i)
+		TEST_EQ(201, (int)(long)map_get(map, (void *)1), -1)
+		TEST_EQ(202, map_remove(map, (void *)2), 0)
+		TEST_EQ(203, map_remove(map, (void *)2), -1)
+		TEST_EQ(204, map_size(map), i - 1)
 
-		close(size[RD]);
-		close(size[WR]);
-		close(barrier[RD]);
-		close(barrier[WR]);
-	}
-}
+		TEST_ACT(205, map->old_chain != NULL)
+		TEST_ACT(206, mapper = mapper_create(map))
+		else
+		{
+			while (mapper_has_next(mapper) == 1)
+				if (mapper_next(mapper))
+					++seen;
 
-#define TEST_ACT(i, action) \
-	if (!(action)) \
-		++errors, printf("Test%d: %s failed\n", (i), (#action));
+			TEST_EQ(207, seen, i - 1)
+			mapper_destroy(&mapper);
+		}
 
-#define TEST_INT_ACT(i, action) \
-	if ((action) == -1) \
-		++errors, printf("Test%d: %s failed\n", (i), (#action));
+		for (bad = 0; i > 1000; --i)
+			if (map_remove(map, (void *)(long)i) == -1)
+				++bad;
+		if (bad)
+			++errors, printf("Test208: map_remove() during resize failed %d times\n", bad);
 
-#define TEST_EQ(i, action, value) \
-	if ((val = (action)) != (value)) \
-		++errors, printf("Test%d: %s failed (returned %d, not %d)\n", (i), (#action), val, (value));
+		TEST_EQ(209, map_size(map), 999)
+		TEST_ACT(210, map->old_chain == NULL)
+		map_destroy(&map);
+	}
 
-#define TEST_NEQ(i, action, value) \
-	if ((val = (action)) == (value)) \
-		++errors, printf("Test%d: %s failed (returned %d)\n", (i), (#action), val);
+	/* Test power of two sizes and cached hash values */
 
-#define CHECK_ITEM(i, action, key, result) \
-	if (!(value = (char *)(action)) || strcmp(value, (result))) \
-		++errors, printf("Test%d: %s failed (mapping \"%s\" is \"%s\", not \"%s\")\n", (i), (#action), (key), value, (result));
+	TEST_ACT(211, map = map_create(free))
+	else
+	{
+		char key[32];
+		int i, bad = 0;
 
-#define CHECK_LIST_ITEM(i, action, list, item, value) \
-	if (!list_item((list), (item)) || strcmp(list_item((list), (item)), (value))) \
-		++errors, printf("Test%d: %s failed (item %d is \"%s\", not \"%s\")\n", (i), (#action), (item), (char *)list_item(list, (item)), (value));
+		TEST_ACT(212, map->masked && map->size == 16)
 
-#define CHECK_LIST(i, desc, list) \
-	if (list_length(list) != 4) \
-		++errors, printf("Test%d: %s failed (%d items, not 4)\n", (i), (desc), (int)list_length(list)); \
-	else \
-	{ \
-		TEST_ACT((i), list_sort((list), (list_cmp_t *)sort_cmp)); \
-		CHECK_LIST_ITEM((i), list_sort((list), sort_cmp), (list), 0, "abc") \
-		CHECK_LIST_ITEM((i), list_sort((list), sort_cmp), (list), 1, "def") \
-		CHECK_LIST_ITEM((i), list_sort((list), sort_cmp), (list), 2, "ghi") \
-		CHECK_LIST_ITEM((i), list_sort((list), sort_cmp), (list), 3, "jkl") \
-	}
+		for (i = 0; i < 1000; ++i)
+		{
+			snprintf(key, sizeof(key), "key%d", i);
+			if (map_add(map, key, mem_strdup(key)) == -1)
+				++bad;
+		}
 
-int main(int ac, char **av)
-{
-	Map *map;
-	Mapper *mapper;
-	List *keys, *values;
-	const void *ckey;
-	const char *cvalue;
-	char *value;
-	char cat[BUFSIZ];
-	void *ptr;
-	int val;
+		for (i = 0; i < 1000; ++i)
+		{
+			snprintf(key, sizeof(key), "key%d", i);
+			if (!(value = map_get(map, key)) || strcmp(value, key))
+				++bad;
+		}
 
-	if (ac == 2 && !strcmp(av[1], "help"))
-	{
-		printf("usage: %s [help|debug|hash]\n", *av);
-		return EXIT_SUCCESS;
+		if (bad)
+			++errors, printf("Test213: map_add()/map_get() x 1000 failed %d times\n", bad);
+		TEST_ACT(214, map->size > 16 && (map->size & (map->size - 1)) == 0)
+		map_destroy(&map);
 	}
 
-	if (ac == 2 && !strcmp(av[1], "hash"))
+	TEST_ACT(215, map = map_create_generic((map_copy_t *)direct_copy, (map_cmp_t *)direct_cmp, (map_hash_t *)counted_hash, NULL, NULL))
+	else
 	{
-		test_hash();
-		return EXIT_SUCCESS;
-	}
+		int i;
 
-	printf("Testing: %s\n", "map");
+		TEST_ACT(216, !map->masked && map->size == 11)
 
-	/* Test map_create, map_add, map_get */
+		for (i = 1; i <= 100; ++i)
+			map_add(map, (void *)(long)i, (void *)(long)i);
 
-	TEST_ACT(1, map = map_create(NULL))
+		TEST_EQ(217, (int)counted_size, 26214401)
+		TEST_EQ(218, counted_calls, 100)
+		TEST_EQ(219, (int)(long)map_get(map, (void *)50), 50)
+		map_destroy(&map);
+	}
+
+	/* Test map_create_concurrent (single threaded) */
+
+	TEST_ACT(220, map = map_create_concurrent(3, free))
 	else
 	{
-		TEST_INT_ACT(2, map_add(map, "abc", "abc"))
-		TEST_INT_ACT(3, map_add(map, "def", "def"))
-		TEST_INT_ACT(4, map_add(map, "ghi", "ghi"))
-		TEST_INT_ACT(5, map_add(map, "jkl", "jkl"))
+		char key[32];
+		int i, bad = 0;
 
-		CHECK_ITEM(6, map_get(map, "abc"), "abc", "abc")
-		CHECK_ITEM(7, map_get(map, "def"), "def", "def")
-		CHECK_ITEM(8, map_get(map, "ghi"), "ghi", "ghi")
-		CHECK_ITEM(9, map_get(map, "jkl"), "jkl", "jkl")
-		if ((value = (char *)map_get(map, "zzz")))
-			++errors, printf("Test10: map_get(\"zzz\") failed\n");
+		TEST_ACT(221, map->striping && map->striping->num_stripes == 4 && map->size == 16)
 
-		/* Test mapper_create, mapper_has_next, mapper_next, map_destroy */
+		for (i = 0; i < 1000; ++i)
+		{
+			snprintf(key, sizeof(key), "%d", i);
+			if (map_add(map, key, mem_strdup(key)) == -1)
+				++bad;
+		}
 
-		TEST_ACT(11, mapper = mapper_create(map))
+		for (i = 0; i < 1000; ++i)
+		{
+			snprintf(key, sizeof(key), "%d", i);
+			if (!(value = map_get(map, key)) || strcmp(value, key))
+				++bad;
+		}
+
+		if (bad)
+			++errors, printf("Test222: map_add()/map_get() x 1000 failed %d times\n", bad);
+
+		TEST_EQ(223, map_size(map), 1000)
+		TEST_ACT(224, map->size > 16 && !map->old_chain)
+		TEST_EQ(225, map_put(map, "7", mem_strdup("seven")), 0)
+		CHECK_ITEM(226, map_get(map, "7"), "7", "seven")
+		TEST_EQ(227, map_remove(map, "8"), 0)
+		TEST_EQ(228, map_size(map), 999)
+
+		TEST_ACT(229, mapper = mapper_create(map))
 		else
 		{
-			TEST_ACT(12, keys = list_create(NULL))
+			int seen = 0;
 
 			while (mapper_has_next(mapper) == 1)
 			{
-				void *item = mapper_next(mapper);
-				TEST_ACT(13, item)
-				else TEST_ACT(13, list_append(keys, item))
+				mapper_next(mapper);
+				++seen;
+				mapper_remove(mapper);
 			}
 
 			mapper_destroy(&mapper);
-			if (mapper)
-				++errors, printf("Test14: mapper_destroy(&mapper) failed (%p, not NULL)", (void *)mapper);
 
-			CHECK_LIST(15, "mapper_has_next/mapper_next", keys)
-			list_destroy(&keys);
+			if (seen != 999 || map_size(map) != 0)
+				++errors, printf("Test229: mapper_remove() on concurrent map failed (seen %d, size %d)\n", seen, (int)map_size(map));
 		}
 
-		/* Test mapper_next_mapping, mapping_key, mapping_value */
+		map_destroy(&map);
+	}
 
-		TEST_ACT(16, mapper = mapper_create(map))
+	/* Test map_create_with_pool */
+
+	{
+		Pool *pool;
+
+		TEST_ACT(232, pool = pool_create(64 * 1024))
 		else
 		{
-			TEST_ACT(16, keys = list_create(NULL))
-			TEST_ACT(16, values = list_create(NULL))
-
-			while (mapper_has_next(mapper) == 1)
+			TEST_ACT(233, map = map_create_with_pool(pool, free))
+			else
 			{
-				const Mapping *mapping = mapper_next_mapping(mapper);
+				char key[32];
+				int i, bad = 0;
 
-				if (!mapping)
-					++errors, printf("Test17: mapper_next_mapping() failed\n");
-				else
+				for (i = 0; i < 500; ++i)
 				{
-					TEST_ACT(17, ckey = mapping_key((void *)mapping))
-					else TEST_ACT(17, list_append(keys, (void *)ckey))
-					TEST_ACT(17, cvalue = mapping_value(mapping))
-					else TEST_ACT(17, list_append(values, (void *)cvalue))
+					snprintf(key, sizeof(key), "k%d", i);
+					if (map_add(map, key, mem_strdup(key)) == -1)
+						++bad;
+				}
+
+				for (i = 0; i < 500; ++i)
+				{
+					snprintf(key, sizeof(key), "k%d", i);
+					if (!(value = map_get(map, key)) || strcmp(value, key))
+						++bad;
 				}
+
+				if (bad)
+					++errors, printf("Test234: map_add()/map_get() x 500 failed %d times\n", bad);
+
+				TEST_EQ(235, map_size(map), 500)
+				TEST_EQ(236, map_put(map, "k1", mem_strdup("one")), 0)
+				CHECK_ITEM(237, map_get(map, "k1"), "k1", "one")
+				TEST_EQ(238, map_remove(map, "k2"), 0)
+				TEST_EQ(239, map_size(map), 499)
+
+				/* Fill the pool */
+
+				for (i = 500; map_add(map, (snprintf(key, sizeof(key), "k%d", i), key), NULL) == 0; ++i)
+					;
+
+				TEST_ACT(240, errno == ENOSPC && i > 500 && i < 5000)
+				CHECK_ITEM(241, map_get(map, "k499"), "k499", "k499")
+				map_destroy(&map);
+			}
+
+			pool_destroy(&pool);
+		}
+	}
+
+	/* Test map_freeze and map_open_mmap */
+
+	{
+		static const int numbers[4] = { 0, 1, 1000, -1 };
+		char path[64], key[32], expected[32];
+		Map *frozen;
+		FILE *junk;
+		int i, bad = 0;
+
+		snprintf(path, sizeof(path), "/tmp/libslack.map.%d", (int)getpid());
+
+		TEST_ACT(242, map = map_create(free))
+		else
+		{
+			for (i = 0; i < 1000; ++i)
+			{
+				snprintf(key, sizeof(key), "k%d", i);
+				snprintf(expected, sizeof(expected), "v%d", i);
+				map_add(map, key, mem_strdup(expected));
 			}
 
-			mapper_destroy(&mapper);
-			if (mapper)
-				++errors, printf("Test18: mapper_destroy(&mapper) failed (%p, not NULL)", (void *)mapper);
+			TEST_EQ(243, map_freeze(map, path, NULL), 0)
+			TEST_ACT(244, frozen = map_open_mmap(path))
+			else
+			{
+				Mapper *mapper;
+
+				for (i = 0; i < 1000; ++i)
+				{
+					snprintf(key, sizeof(key), "k%d", i);
+					snprintf(expected, sizeof(expected), "v%d", i);
+					if (!(value = map_get(frozen, key)) || strcmp(value, expected))
+						++bad;
+				}
+
+				if (bad)
+					++errors, printf("Test245: map_get() x 1000 on frozen map failed %d times\n", bad);
+
+				TEST_EQ(246, map_size(frozen), 1000)
+				TEST_ACT(247, !map_get(frozen, "k1000") && errno == ENOENT)
+				TEST_ACT(248, map_add(frozen, "x", NULL) == -1 && errno == EPERM)
+				TEST_ACT(249, map_remove(frozen, "k1") == -1 && errno == EPERM)
+
+				TEST_ACT(250, mapper = mapper_create(frozen))
+				else
+				{
+					int seen = 0;
+
+					for (bad = 0; mapper_has_next(mapper) == 1; ++seen)
+					{
+						const Mapping *mapping = mapper_next_mapping(mapper);
 
-			CHECK_LIST(19, "mapper_has_next/mapper_next_mapping", keys)
-			list_destroy(&keys);
-			CHECK_LIST(20, "mapper_has_next/mapper_next_mapping", values)
-			list_destroy(&values);
-		}
+						if (strcmp((char *)mapping_key(mapping) + 1, (char *)mapping_value(mapping) + 1) || map_get(map, mapping_key(mapping)) == NULL)
+							++bad;
+					}
 
-		/* Test map_has_next, map_next */
+					mapper_destroy(&mapper);
 
-		TEST_ACT(21, keys = list_create(NULL))
+					if (seen != 1000 || bad)
+						++errors, printf("Test250: mapper_next_mapping() on frozen map failed (seen %d, bad %d)\n", seen, bad);
+				}
 
-		while (map_has_next(map) == 1)
-		{
-			void *item;
+				/* Replace the image while it is mapped */
 
-			TEST_ACT(22, item = map_next(map))
-			else TEST_ACT(22, list_append(keys, item))
-		}
+				map_remove(map, "k7");
+				TEST_EQ(251, map_freeze(map, path, NULL), 0)
+				CHECK_ITEM(252, map_get(frozen, "k7"), "k7", "v7")
+				map_destroy(&frozen);
 
-		CHECK_LIST(23, "map_has_next/map_next", keys)
-		list_destroy(&keys);
+				TEST_ACT(253, (frozen = map_open_mmap(path)) && map_size(frozen) == 999 && !map_get(frozen, "k7") && map_get(frozen, "k8"))
+				map_destroy(&frozen);
+			}
 
-		/* Test map_next_mapping */
+			map_destroy(&map);
+		}
 
-		TEST_ACT(24, keys = list_create(NULL))
-		TEST_ACT(24, values = list_create(NULL))
+		/* Test binary values */
 
-		while (map_has_next(map) == 1)
+		TEST_ACT(254, map = map_create(NULL))
+		else
 		{
-			const Mapping *mapping;
+			for (i = 0; i < 4; ++i)
+				snprintf(key, sizeof(key), "%d", numbers[i]), map_add(map, key, (void *)&numbers[i]);
 
-			TEST_ACT(25, mapping = map_next_mapping(map))
+			map_add(map, "null", NULL);
+			TEST_EQ(255, map_freeze(map, path, (map_length_t *)int_length), 0)
+			map_destroy(&map);
+
+			TEST_ACT(256, frozen = map_open_mmap(path))
 			else
 			{
-				TEST_ACT(25, ckey = mapping_key(mapping))
-				else TEST_ACT(25, list_append(keys, (void *)ckey))
-				TEST_ACT(25, cvalue = mapping_value(mapping))
-				else TEST_ACT(25, list_append(values, (void *)cvalue))
-			}
-		}
+				for (bad = 0, i = 0; i < 4; ++i)
+				{
+					int *number;
 
-		CHECK_LIST(26, "map_has_next/map_next_mapping", keys)
-		list_destroy(&keys);
-		CHECK_LIST(27, "map_has_next/map_next_mapping", values)
-		list_destroy(&values);
+					snprintf(key, sizeof(key), "%d", numbers[i]);
+					if (!(number = map_get(frozen, key)) || *number != numbers[i] || (size_t)number % sizeof(size_t))
+						++bad;
+				}
 
-		/* Test map_keys */
+				errno = 0;
 
-		TEST_ACT(28, keys = map_keys(map))
-		else
-		{
-			CHECK_LIST(29, "map_keys", keys)
-			list_destroy(&keys);
+				if (bad || map_get(frozen, "null") || errno)
+					++errors, printf("Test257: map_get() on frozen map with binary values failed %d times\n", bad);
+
+				map_destroy(&frozen);
+			}
 		}
 
-		/* Test map_values */
+		/* Test empty and invalid images */
 
-		TEST_ACT(30, values = map_values(map))
+		TEST_ACT(258, map = map_create(NULL))
 		else
 		{
-			CHECK_LIST(31, "map_values", values)
-			list_destroy(&values);
+			TEST_EQ(259, map_freeze(map, path, NULL), 0)
+			map_destroy(&map);
 		}
 
-		/* Test map_remove */
+		TEST_ACT(260, (frozen = map_open_mmap(path)) && map_size(frozen) == 0 && !map_get(frozen, "k0") && errno == ENOENT)
+		map_destroy(&frozen);
 
-		TEST_ACT(32, map_remove(map, "zzz") == -1)
-		TEST_ACT(33, map_remove(map, "abc") != -1)
-		TEST_ACT(34, map_remove(map, "def") != -1)
-		TEST_ACT(35, map_remove(map, "ghi") != -1)
-		TEST_ACT(36, map_remove(map, "jkl") != -1)
+		if ((junk = fopen(path, "w")))
+		{
+			fputs("slackmap but not really a frozen map", junk);
+			fclose(junk);
+		}
 
-		map_destroy(&map);
-		if (map)
-			++errors, printf("Test37: map_destroy(&map) failed (%p, not NULL)\n", (void *)map);
+		TEST_ACT(261, !map_open_mmap(path) && errno == EINVAL)
+		unlink(path);
+		TEST_ACT(262, !map_open_mmap(path) && errno == ENOENT)
 	}
 
-	/* Test map_apply */
+	/* Test ordered maps */
 
-	TEST_ACT(38, map = map_create(NULL))
+	TEST_ACT(263, map = map_create_ordered(free))
 	else
 	{
-		TEST_ACT(39, map_add(map, "1", "7") == 0)
-		TEST_ACT(40, map_add(map, "2", "6") == 0)
-		TEST_ACT(41, map_add(map, "3", "5") == 0)
-		TEST_ACT(42, map_add(map, "4", "4") == 0)
-		TEST_ACT(43, map_add(map, "5", "3") == 0)
-		TEST_ACT(44, map_add(map, "6", "2") == 0)
-		TEST_ACT(45, map_add(map, "7", "1") == 0)
-
-		CHECK_ITEM(46, map_get(map, "1"), "1", "7")
-		CHECK_ITEM(47, map_get(map, "2"), "2", "6")
-		CHECK_ITEM(48, map_get(map, "3"), "3", "5")
-		CHECK_ITEM(49, map_get(map, "4"), "4", "4")
-		CHECK_ITEM(50, map_get(map, "5"), "5", "3")
-		CHECK_ITEM(51, map_get(map, "6"), "6", "2")
-		CHECK_ITEM(52, map_get(map, "7"), "7", "1")
-
-		cat[0] = nul;
-		map_apply(map, (map_action_t *)test_action, cat);
-		if (strcmp(cat, "7=1, 1=7, 2=6, 3=5, 4=4, 5=3, 6=2"))
-			++errors, printf("Test53: map_apply(cat) failed (cat = \"%s\", not \"%s\")\n", cat, "7=1, 1=7, 2=6, 3=5, 4=4, 5=3, 6=2");
+		const Mapping *mapping;
+		Mapper *mapper;
+		List *keys;
+		char key[32], prev[32];
+		int i, seen, bad = 0;
 
-		map_destroy(&map);
-		if (map)
-			++errors, printf("Test54: map_destroy(&map) failed (%p, not NULL)\n", (void *)map);
-	}
+		for (i = 0; i < 200; ++i)
+		{
+			snprintf(key, sizeof(key), "k%03d", i * 37 % 200);
+			snprintf(prev, sizeof(prev), "v%03d", i * 37 % 200);
+			if (map_add(map, key, mem_strdup(prev)) == -1)
+				++bad;
+		}
 
-	/* Test mapper_remove, map_size */
+		if (bad)
+			++errors, printf("Test264: map_add() x 200 on ordered map failed %d times\n", bad);
 
-	TEST_ACT(55, map = map_create(NULL))
-	else
-	{
-		TEST_ACT(56, map_add(map, "1", "7") == 0)
-		TEST_ACT(57, map_add(map, "2", "6") == 0)
-		TEST_ACT(58, map_add(map, "3", "5") == 0)
-		TEST_ACT(59, map_add(map, "4", "4") == 0)
-		TEST_ACT(60, map_add(map, "5", "3") == 0)
-		TEST_ACT(61, map_add(map, "6", "2") == 0)
-		TEST_ACT(62, map_add(map, "7", "1") == 0)
+		TEST_EQ(265, map_size(map), 200)
 
-		TEST_ACT(63, mapper = mapper_create(map))
+		TEST_ACT(266, mapper = mapper_create(map))
 		else
 		{
-			while (mapper_has_next(mapper) == 1)
+			for (*prev = '\0', seen = 0, bad = 0; mapper_has_next(mapper) == 1; ++seen)
 			{
-				void *item;
+				mapping = mapper_next_mapping(mapper);
 
-				TEST_ACT(64, item = mapper_next(mapper))
-				mapper_remove(mapper);
+				if (strcmp(prev, mapping_key(mapping)) >= 0 || strcmp((char *)mapping_key(mapping) + 1, (char *)mapping_value(mapping) + 1))
+					++bad;
+
+				snprintf(prev, sizeof(prev), "%s", (char *)mapping_key(mapping));
 			}
 
 			mapper_destroy(&mapper);
-			if (mapper)
-				++errors, printf("Test65: mapper_destroy(&mapper) failed (%p, not NULL)\n", (void *)mapper);
 
-			TEST_EQ(66, map_size(map), 0)
+			if (seen != 200 || bad)
+				++errors, printf("Test266: ordered map iteration failed (seen %d, out of order %d)\n", seen, bad);
 		}
 
-		map_destroy(&map);
-		if (map)
-			++errors, printf("Test67: map_destroy(&map) failed (%p, not NULL)\n", (void *)map);
-	}
+		TEST_ACT(267, (keys = map_keys(map)) && list_length(keys) == 200 && !strcmp(list_item(keys, 0), "k000") && !strcmp(list_item(keys, 199), "k199"))
+		list_destroy(&keys);
+		CHECK_ITEM(268, map_get(map, "k123"), "k123", "v123")
+		TEST_ACT(269, !map_get(map, "k200") && errno == ENOENT)
+		TEST_ACT(270, (mapping = map_lower_bound(map, "k0505")) && !strcmp(mapping_key(mapping), "k051"))
+		TEST_ACT(271, (mapping = map_lower_bound(map, "k050")) && !strcmp(mapping_key(mapping), "k050"))
+		TEST_ACT(272, (mapping = map_upper_bound(map, "k050")) && !strcmp(mapping_key(mapping), "k051"))
+		TEST_ACT(273, !map_upper_bound(map, "k199") && errno == ENOENT)
 
-	/* Test map_remove_current */
+		/* Scan the range [k100, k110) */
 
-	TEST_ACT(68, map = map_create(NULL))
-	else
-	{
-		TEST_ACT(69, map_add(map, "1", "1") == 0)
-		TEST_ACT(70, map_add(map, "2", "2") == 0)
-		TEST_ACT(71, map_add(map, "3", "3") == 0)
-		TEST_ACT(72, map_add(map, "4", "4") == 0)
+		TEST_ACT(274, mapper = mapper_create(map))
+		else
+		{
+			mapper_seek(mapper, "k100");
 
-		while (map_has_next(map) == 1)
+			for (seen = 0; mapper_has_next(mapper) == 1; ++seen)
+			{
+				mapping = mapper_next_mapping(mapper);
+
+				if (strcmp(mapping_key(mapping), "k110") >= 0)
+					break;
+
+				if (!seen && strcmp(mapping_key(mapping), "k100"))
+					seen = -100;
+			}
+
+			mapper_destroy(&mapper);
+
+			if (seen != 10)
+				++errors, printf("Test274: mapper_seek() range scan failed (seen %d, not 10)\n", seen);
+		}
+
+		/* Remove the even keys while iterating */
+
+		TEST_ACT(275, mapper = mapper_create(map))
+		else
 		{
-			void *item;
+			for (seen = 0; mapper_has_next(mapper) == 1; ++seen)
+				if (mapper_next(mapper) && seen % 2 == 0)
+					mapper_remove(mapper);
 
-			TEST_ACT(73, item = map_next(map))
-			map_remove_current(map);
+			mapper_destroy(&mapper);
+
+			if (seen != 200 || map_size(map) != 100)
+				++errors, printf("Test275: mapper_remove() on ordered map failed (seen %d, size %d)\n", seen, (int)map_size(map));
 		}
 
-		TEST_EQ(74, map_size(map), 0)
+		TEST_ACT(276, (keys = map_keys(map)) && list_length(keys) == 100 && !strcmp(list_item(keys, 0), "k001") && !strcmp(list_item(keys, 99), "k199"))
+		list_destroy(&keys);
+		TEST_EQ(277, map_put(map, "k001", mem_strdup("one")), 0)
+		CHECK_ITEM(278, map_get(map, "k001"), "k001", "one")
+		TEST_EQ(279, map_size(map), 100)
+		TEST_EQ(280, map_remove(map, "k001"), 0)
+		TEST_ACT(281, map_remove(map, "k001") == -1 && errno == ENOENT)
+		map_destroy(&map);
+
+		TEST_ACT(282, (map = map_create(NULL)) && !map_lower_bound(map, "k") && errno == EINVAL && (mapper = mapper_create(map)) && mapper_seek(mapper, "k") == -1 && errno == EINVAL)
 		mapper_destroy(&mapper);
 		map_destroy(&map);
 	}
 
-	/* Test map_create_generic (Point -> char *) */
-
-#define ADD_POINT(i, xpos, ypos, value, rc) \
-	point->x = (xpos); \
-	point->y = (ypos); \
-	TEST_ACT((i), map_add(map, point, (value)) == (rc))
-
-#define GET_POINT(i, xpos, ypos, str) \
-	point->x = (xpos); \
-	point->y = (ypos); \
-	if (!(value = map_get(map, point))) \
-		++errors, printf("Test%d: map_get(generic) failed\n", (i)); \
-	else if (strcmp(value, (str))) \
-		++errors, printf("Test%d: map_get(generic) failed (\"%s\", not \"%s\")\n", (i), value, (str));
-
-	TEST_ACT(75, map = map_create_generic((map_copy_t *)point_copy, (map_cmp_t *)point_cmp, (map_hash_t *)point_hash, (map_release_t *)point_release, NULL))
+	TEST_ACT(283, map = map_create_ordered_generic_with_locker(NULL, (map_copy_t *)direct_copy, (map_cmp_t *)direct_cmp, NULL, NULL))
 	else
 	{
-		Point *point = point_create(0, 0);
+		const Mapping *mapping;
+		int i, bad = 0;
 
-		ADD_POINT(76, 0, 0, "(0, 0)", 0)
-		ADD_POINT(77, 1, 0, "(1, 0)", 0)
-		ADD_POINT(78, 0, 1, "(0, 1)", 0)
-		ADD_POINT(79, 1, 1, "(1, 1)", 0)
-		ADD_POINT(80, -1, 0, "(-1, 0)", 0)
-		ADD_POINT(81, 0, -1, "(0, -1)", 0)
-		ADD_POINT(82, -1, -1, "(-1, -1)", 0)
-		ADD_POINT(83, 2, 0, "(2, 0)", 0)
-		ADD_POINT(84, 0, 2, "(0, 2)", 0)
-		ADD_POINT(85, 2, 2, "(2, 2)", 0)
-		ADD_POINT(86, -2, 0, "(-2, 0)", 0)
-		ADD_POINT(87, 0, -2, "(0, -2)", 0)
-		ADD_POINT(88, -2, -2, "(-2, -2)", 0)
-		ADD_POINT(89, 0, 0, "(0, 0)", -1)
-		TEST_EQ(90, map_size(map), 13)
+		for (i = 100; i > 0; --i)
+			map_add(map, (void *)(long)i, (void *)(long)i);
 
-		GET_POINT(91, 0, 0, "(0, 0)")
-		GET_POINT(92, 1, 0, "(1, 0)")
-		GET_POINT(93, 0, 1, "(0, 1)")
-		GET_POINT(94, 1, 1, "(1, 1)")
-		GET_POINT(95, -1, 0, "(-1, 0)")
-		GET_POINT(96, 0, -1, "(0, -1)")
-		GET_POINT(97, -1, -1, "(-1, -1)")
-		GET_POINT(98, 2, 0, "(2, 0)")
-		GET_POINT(99, 0, 2, "(0, 2)")
-		GET_POINT(100, 2, 2, "(2, 2)")
-		GET_POINT(101, -2, 0, "(-2, 0)")
-		GET_POINT(102, 0, -2, "(0, -2)")
-		GET_POINT(103, -2, -2, "(-2, -2)")
-		point_release(point);
+		for (i = 1; map_has_next(map) == 1; ++i)
+			if ((long)mapping_key(map_next_mapping(map)) != i)
+				++bad;
+
+		if (i != 101 || bad)
+			++errors, printf("Test283: int ordered map iteration failed (%d keys, %d out of order)\n", i - 1, bad);
+
+		TEST_ACT(284, (mapping = map_upper_bound(map, (void *)50)) && (long)mapping_key(mapping) == 51)
 		map_destroy(&map);
 	}
 
-	/* Test map_create_generic (int -> int) and map growth */
+	/* Test map_get_many */
 
-	TEST_ACT(104, map = map_create_generic((map_copy_t *)direct_copy, (map_cmp_t *)direct_cmp, (map_hash_t *)direct_hash, NULL, NULL))
-	else
 	{
-		TEST_ACT(105, map_add(map, (void *)1, (void *)1) == 0)
-		TEST_ACT(106, map_add(map, (void *)2, (void *)2) == 0)
-		TEST_ACT(107, map_add(map, (void *)3, (void *)3) == 0)
-		TEST_ACT(108, map_add(map, (void *)4, (void *)4) == 0)
-		TEST_ACT(109, map_add(map, (void *)5, (void *)5) == 0)
-		TEST_ACT(110, map_add(map, (void *)6, (void *)6) == 0)
-		TEST_ACT(111, map_add(map, (void *)7, (void *)7) == 0)
-		TEST_ACT(112, map_add(map, (void *)8, (void *)8) == 0)
-		TEST_ACT(113, map_add(map, (void *)9, (void *)9) == 0)
-		TEST_ACT(114, map_add(map, (void *)10, (void *)10) == 0)
-		TEST_ACT(115, map_add(map, (void *)11, (void *)11) == 0)
-		TEST_ACT(116, map_add(map, (void *)12, (void *)12) == 0)
-		TEST_ACT(117, map_add(map, (void *)13, (void *)13) == 0)
-		TEST_ACT(118, map_add(map, (void *)14, (void *)14) == 0)
-		TEST_ACT(119, map_add(map, (void *)15, (void *)15) == 0)
-		TEST_ACT(120, map_add(map, (void *)16, (void *)16) == 0)
-		TEST_ACT(121, map_add(map, (void *)17, (void *)17) == 0)
-		TEST_ACT(122, map_add(map, (void *)18, (void *)18) == 0)
-		TEST_ACT(123, map_add(map, (void *)19, (void *)19) == 0)
-		TEST_ACT(124, map_add(map, (void *)20, (void *)20) == 0)
-		TEST_ACT(125, map_add(map, (void *)21, (void *)21) == 0)
-		TEST_ACT(126, map_add(map, (void *)22, (void *)22) == 0)
-		TEST_ACT(127, map_add(map, (void *)23, (void *)23) == 0)
-		TEST_ACT(128, map_add(map, (void *)24, (void *)24) == 0)
-		TEST_ACT(129, map_add(map, (void *)25, (void *)25) == 0)
-		TEST_ACT(130, map_add(map, (void *)25, (void *)25) != 0)
-		TEST_EQ(130, map_size(map), 25)
-
-		TEST_EQ(131, (int)(long)map_get(map, (void *)1), 1)
-		TEST_EQ(132, (int)(long)map_get(map, (void *)2), 2)
-		TEST_EQ(133, (int)(long)map_get(map, (void *)3), 3)
-		TEST_EQ(134, (int)(long)map_get(map, (void *)4), 4)
-		TEST_EQ(135, (int)(long)map_get(map, (void *)5), 5)
-		TEST_EQ(136, (int)(long)map_get(map, (void *)6), 6)
-		TEST_EQ(137, (int)(long)map_get(map, (void *)7), 7)
-		TEST_EQ(138, (int)(long)map_get(map, (void *)8), 8)
-		TEST_EQ(139, (int)(long)map_get(map, (void *)9), 9)
-		TEST_EQ(140, (int)(long)map_get(map, (void *)10), 10)
-		TEST_EQ(141, (int)(long)map_get(map, (void *)11), 11)
-		TEST_EQ(142, (int)(long)map_get(map, (void *)12), 12)
-		TEST_EQ(143, (int)(long)map_get(map, (void *)13), 13)
-		TEST_EQ(144, (int)(long)map_get(map, (void *)14), 14)
-		TEST_EQ(145, (int)(long)map_get(map, (void *)15), 15)
-		TEST_EQ(146, (int)(long)map_get(map, (void *)16), 16)
-		TEST_EQ(147, (int)(long)map_get(map, (void *)17), 17)
-		TEST_EQ(148, (int)(long)map_get(map, (void *)18), 18)
-		TEST_EQ(149, (int)(long)map_get(map, (void *)19), 19)
-		TEST_EQ(150, (int)(long)map_get(map, (void *)20), 20)
-		TEST_EQ(151, (int)(long)map_get(map, (void *)21), 21)
-		TEST_EQ(152, (int)(long)map_get(map, (void *)22), 22)
-		TEST_EQ(153, (int)(long)map_get(map, (void *)23), 23)
-		TEST_EQ(154, (int)(long)map_get(map, (void *)24), 24)
-		TEST_EQ(155, (int)(long)map_get(map, (void *)25), 25)
+		char path[64];
+		const void *keys[2] = { "m1", NULL };
+		void *values[2];
+		Map *frozen = NULL;
+
+		snprintf(path, sizeof(path), "/tmp/libslack.map.%d", (int)getpid());
+
+		TEST_ACT(285, (map = map_create(free)) && many_test(map, 1) == 0)
+		TEST_ACT(286, map && map_freeze(map, path, NULL) == 0 && (frozen = map_open_mmap(path)) && many_test(frozen, 0) == 0)
+		map_destroy(&frozen);
+		unlink(path);
+		TEST_ACT(287, map && map_get_many(map, keys, 0, values) == 0)
+		TEST_ACT(288, map && map_get_many(map, keys, 2, values) == -1 && errno == EINVAL)
+		map_destroy(&map);
+		TEST_ACT(289, (map = map_create_flat(free)) && many_test(map, 1) == 0)
+		map_destroy(&map);
+		TEST_ACT(290, (map = map_create_concurrent(0, free)) && many_test(map, 1) == 0)
+		map_destroy(&map);
+		TEST_ACT(291, (map = map_create_ordered(free)) && many_test(map, 1) == 0)
 		map_destroy(&map);
 	}
 
+	/* Test concurrent maps with multiple threads */
+
+	mt_test(230, NULL);
+	stripe_test(231);
+
 	/* Test MT Safety */
 
 	debug = ac == 2 && !strcmp(av[1], "debug");
@@ -3148,10 +6603,10 @@ int main(int ac, char **av)
 		locker = locker_create_rwlock(&rwlock);
 
 	if (!locker)
-		++errors, printf("Test220: locker_create_rwlock() failed\n");
+		++errors, printf("Test292: locker_create_rwlock() failed\n");
 	else
 	{
-		mt_test(220, locker);
+		mt_test(292, locker);
 		locker_destroy(&locker);
 	}
 
@@ -3161,32 +6616,34 @@ int main(int ac, char **av)
 		locker = locker_create_mutex(&mutex);
 
 	if (!locker)
-		++errors, printf("Test221: locker_create_mutex() failed\n");
+		++errors, printf("Test293: locker_create_mutex() failed\n");
 	else
 	{
-		mt_test(221, locker);
+		mt_test(293, locker);
 		locker_destroy(&locker);
 	}
 
 	/* Test assumption: sizeof(int) <= sizeof(void *) */
 
 	if (sizeof(int) > sizeof(void *))
-		++errors, printf("Test 222: assumption failed: sizeof(int) > sizeof(void *): int maps are limited to %d bytes\n", (int)sizeof(void *));
+		++errors, printf("Test294: assumption failed: sizeof(int) > sizeof(void *): int maps are limited to %d bytes\n", (int)sizeof(void *));
 
 	/* Test assumption: memset(&ptr, 0, sizeof(void *)) same as NULL */
 
 	memset(&ptr, 0, sizeof(void *));
 	if (ptr != NULL)
-		++errors, printf("Test223: assumption failed: memset(&ptr, 0, sizeof(void *)) not same as NULL\n");
+		++errors, printf("Test295: assumption failed: memset(&ptr, 0, sizeof(void *)) not same as NULL\n");
 
 	if (errors)
-		printf("%d/223 tests failed\n", errors);
+		printf("%d/295 tests failed\n", errors);
 	else
 		printf("All tests passed\n");
 
 	printf("\n");
 	printf("    Note: You can also perform hash tests.\n");
 	printf("    Rerun the test with \"%s hash\".\n", *av);
+	printf("    Note: You can also compare the performance of each kind of map.\n");
+	printf("    Rerun the test with \"%s bench\".\n", *av);
 
 	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
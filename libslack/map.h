@@ -25,6 +25,7 @@
 #include <slack/hdr.h>
 #include <slack/list.h>
 #include <slack/locker.h>
+#include <slack/mem.h>
 
 typedef struct Map Map;
 typedef struct Mapper Mapper;
@@ -34,6 +35,7 @@ typedef list_copy_t map_copy_t;
 typedef list_cmp_t map_cmp_t;
 typedef size_t map_hash_t(size_t table_size, const void *key);
 typedef void map_action_t(void *key, void *item, void *data);
+typedef size_t map_length_t(const void *value);
 
 _begin_decls
 Map *map_create(map_release_t *destroy);
@@ -48,6 +50,17 @@ Map *map_create_generic(map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_
 Map *map_create_generic_sized(size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy);
 Map *map_create_generic_with_locker(Locker *locker, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy);
 Map *map_create_generic_with_locker_sized(Locker *locker, size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy);
+Map *map_create_flat(map_release_t *destroy);
+Map *map_create_flat_with_locker(Locker *locker, map_release_t *destroy);
+Map *map_create_flat_generic_with_locker_sized(Locker *locker, size_t size, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy);
+Map *map_create_concurrent(size_t stripes, map_release_t *destroy);
+Map *map_create_concurrent_generic(size_t stripes, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy);
+Map *map_create_with_pool(Pool *pool, map_release_t *destroy);
+Map *map_create_generic_with_pool(Pool *pool, map_copy_t *copy, map_cmp_t *cmp, map_hash_t *hash, map_release_t *key_destroy, map_release_t *value_destroy);
+Map *map_create_ordered(map_release_t *destroy);
+Map *map_create_ordered_with_locker(Locker *locker, map_release_t *destroy);
+Map *map_create_ordered_generic_with_locker(Locker *locker, map_copy_t *copy, map_cmp_t *cmp, map_release_t *key_destroy, map_release_t *value_destroy);
+Map *map_open_mmap(const char *path);
 int map_rdlock(const Map *map);
 int map_wrlock(const Map *map);
 int map_unlock(const Map *map);
@@ -67,6 +80,12 @@ int map_remove(Map *map, const void *key);
 int map_remove_unlocked(Map *map, const void *key);
 void *map_get(Map *map, const void *key);
 void *map_get_unlocked(const Map *map, const void *key);
+ssize_t map_get_many(Map *map, const void **keys, size_t n, void **values);
+ssize_t map_get_many_unlocked(const Map *map, const void **keys, size_t n, void **values);
+const Mapping *map_lower_bound(Map *map, const void *key);
+const Mapping *map_lower_bound_unlocked(const Map *map, const void *key);
+const Mapping *map_upper_bound(Map *map, const void *key);
+const Mapping *map_upper_bound_unlocked(const Map *map, const void *key);
 Mapper *mapper_create(Map *map);
 Mapper *mapper_create_rdlocked(Map *map);
 Mapper *mapper_create_wrlocked(Map *map);
@@ -79,6 +98,7 @@ int mapper_has_next(Mapper *mapper);
 void *mapper_next(Mapper *mapper);
 const Mapping *mapper_next_mapping(Mapper *mapper);
 void mapper_remove(Mapper *mapper);
+int mapper_seek(Mapper *mapper, const void *key);
 int map_has_next(Map *map);
 void map_break(Map *map);
 void *map_next(Map *map);
@@ -100,6 +120,7 @@ void map_apply_wrlocked(Map *map, map_action_t *action, void *data);
 void map_apply_unlocked(Map *map, map_action_t *action, void *data);
 ssize_t map_size(Map *map);
 ssize_t map_size_unlocked(const Map *map);
+int map_freeze(Map *map, const char *path, map_length_t *length);
 _end_decls
 
 #endif
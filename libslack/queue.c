@@ -0,0 +1,1528 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230824 raf <raf@raf.org>
+*/
+
+/*
+
+=head1 NAME
+
+I<libslack(queue)> - lock-free queue module
+
+=head1 SYNOPSIS
+
+    #include <slack/std.h>
+    #include <slack/queue.h>
+
+    typedef struct Queue Queue;
+    typedef struct Ring Ring;
+    typedef void queue_release_t(void *item);
+    typedef void ring_release_t(void *item);
+
+    Queue *queue_create(size_t size, queue_release_t *destroy);
+    void queue_release(Queue *queue);
+    void *queue_destroy(Queue **queue);
+    ssize_t queue_size(const Queue *queue);
+    ssize_t queue_length(const Queue *queue);
+    int queue_push(Queue *queue, void *item);
+    int queue_push_wait(Queue *queue, void *item, long sec, long usec);
+    int queue_shift(Queue *queue, void **item);
+    int queue_shift_wait(Queue *queue, void **item, long sec, long usec);
+    Ring *ring_create(size_t size, ring_release_t *destroy);
+    void ring_release(Ring *ring);
+    void *ring_destroy(Ring **ring);
+    ssize_t ring_size(const Ring *ring);
+    ssize_t ring_length(const Ring *ring);
+    int ring_push(Ring *ring, void *item);
+    int ring_push_wait(Ring *ring, void *item, long sec, long usec);
+    int ring_shift(Ring *ring, void **item);
+    int ring_shift_wait(Ring *ring, void **item, long sec, long usec);
+
+=head1 DESCRIPTION
+
+This module provides two bounded first-in, first-out containers for passing
+items (C<void *>) between threads without locks. A I<Queue> may be used by
+any number of producer threads and any number of consumer threads at once.
+A I<Ring> may only be used by a single producer thread and a single
+consumer thread at once, but is cheaper still.
+
+Unlike a I<List> shared by several threads (see I<list(3)>), neither
+container needs a I<Locker>. Items are added and removed with atomic
+operations, and the parts of each container that are written by producers
+and by consumers are kept in separate cache lines, so that producers and
+consumers don't slow each other down. Their capacity is fixed when they are
+created. When a container is full, I<queue_push(3)> and I<ring_push(3)>
+fail immediately, and when it is empty, I<queue_shift(3)> and
+I<ring_shift(3)> fail immediately. The I<_wait> variants block the calling
+thread instead (with an optional timeout) until there is room or there is
+an item. On Linux, blocked threads sleep on a I<futex(2)>, and are only
+woken up (with a system call) when there are blocked threads to wake up.
+Elsewhere, a mutex and condition variable are used for blocking, but still
+only when a thread needs to block.
+
+These containers may own their items. Containers created with a
+non-C<null> destroy function use that function to destroy any items that
+remain in the container when the container itself is destroyed.
+
+Both containers require the compiler's C<__atomic> builtin functions (i.e.
+I<gcc(1)> or I<clang(1)>).
+
+=over 4
+
+=cut
+
+*/
+
+#ifndef _BSD_SOURCE
+#define _BSD_SOURCE /* For timercmp() and syscall() in glibc */
+#endif
+
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE /* New name for _BSD_SOURCE */
+#endif
+
+#ifndef _NETBSD_SOURCE
+#define _NETBSD_SOURCE /* For timercmp() on NetBSD-5.0.2 */
+#endif
+
+#include "config.h"
+#include "std.h"
+
+#include <pthread.h>
+
+#include <sys/time.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "queue.h"
+#include "mem.h"
+#include "err.h"
+
+/* The size of a cache line (or more) */
+
+#define CACHE_LINE 64
+
+typedef struct queue_cell_t queue_cell_t;
+typedef struct queue_event_t queue_event_t;
+typedef int queue_op_t(void *container, void **item);
+
+struct queue_cell_t
+{
+	size_t seq;              /* the position that the cell is ready for */
+	void *item;              /* the item, if the cell is full */
+};
+
+struct queue_event_t
+{
+	unsigned int seq;        /* incremented to wake up waiters (the futex) */
+	unsigned int waiters;    /* the number of waiting threads */
+#ifndef __linux__
+	pthread_mutex_t lock;    /* protects seq when blocking */
+	pthread_cond_t cond;     /* signalled when seq is incremented */
+#endif
+};
+
+struct Queue
+{
+	queue_cell_t *cell;      /* the vector of cells */
+	size_t mask;             /* the number of cells minus one */
+	queue_release_t *destroy; /* item destructor, if any */
+	char pad0[CACHE_LINE];
+	size_t tail;             /* the position of the next push (producers) */
+	char pad1[CACHE_LINE - sizeof(size_t)];
+	size_t head;             /* the position of the next shift (consumers) */
+	char pad2[CACHE_LINE - sizeof(size_t)];
+	queue_event_t pushed;    /* consumers wait here for items */
+	char pad3[CACHE_LINE];
+	queue_event_t shifted;   /* producers wait here for room */
+	char pad4[CACHE_LINE];
+};
+
+struct Ring
+{
+	void **item;             /* the vector of items */
+	size_t mask;             /* the number of items minus one */
+	ring_release_t *destroy; /* item destructor, if any */
+	char pad0[CACHE_LINE];
+	size_t tail;             /* the position of the next push (producer) */
+	size_t head_cache;       /* the producer's last look at head */
+	char pad1[CACHE_LINE - 2 * sizeof(size_t)];
+	size_t head;             /* the position of the next shift (consumer) */
+	size_t tail_cache;       /* the consumer's last look at tail */
+	char pad2[CACHE_LINE - 2 * sizeof(size_t)];
+	queue_event_t pushed;    /* the consumer waits here for an item */
+	char pad3[CACHE_LINE];
+	queue_event_t shifted;   /* the producer waits here for room */
+	char pad4[CACHE_LINE];
+};
+
+#ifndef TEST
+
+#define load_relaxed(ptr) __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#define load_acquire(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define store_release(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+#define fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+/*
+
+C<size_t capacity(size_t size)>
+
+Returns C<size> rounded up to a power of two (at least C<2>), or C<0> if
+C<size> is zero or too large.
+
+*/
+
+static size_t capacity(size_t size)
+{
+	size_t n;
+
+	if (!size || size > (size_t)-1 / 2 + 1)
+		return 0;
+
+	for (n = 2; n < size; n <<= 1)
+		;
+
+	return n;
+}
+
+/*
+
+C<void event_init(queue_event_t *event)>
+
+Initialises C<event>.
+
+*/
+
+static void event_init(queue_event_t *event)
+{
+	event->seq = 0;
+	event->waiters = 0;
+#ifndef __linux__
+	pthread_mutex_init(&event->lock, NULL);
+	pthread_cond_init(&event->cond, NULL);
+#endif
+}
+
+/*
+
+C<void event_fini(queue_event_t *event)>
+
+Releases any resources used by C<event>.
+
+*/
+
+static void event_fini(queue_event_t *event)
+{
+#ifndef __linux__
+	pthread_mutex_destroy(&event->lock);
+	pthread_cond_destroy(&event->cond);
+#endif
+}
+
+/*
+
+C<void event_wake(queue_event_t *event)>
+
+Wakes up a thread waiting on C<event>, if there are any. This must be
+called after every push or shift. Unless there are waiting threads, it
+costs a memory fence and a load.
+
+*/
+
+static void event_wake(queue_event_t *event)
+{
+	fence();
+
+	if (!load_relaxed(&event->waiters))
+		return;
+
+#ifdef __linux__
+	__atomic_add_fetch(&event->seq, 1, __ATOMIC_SEQ_CST);
+	syscall(SYS_futex, &event->seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+	pthread_mutex_lock(&event->lock);
+	__atomic_add_fetch(&event->seq, 1, __ATOMIC_SEQ_CST);
+	pthread_cond_signal(&event->cond);
+	pthread_mutex_unlock(&event->lock);
+#endif
+}
+
+/*
+
+C<int event_wait(queue_event_t *event, unsigned int seq, const struct timeval *deadline)>
+
+Blocks the calling thread until C<event> is woken up after its sequence
+number was C<seq>, or until the absolute time C<deadline> (if not C<null>).
+May also return early, for no reason. Returns C<0> when woken up. Returns
+C<-1> with C<errno> set to C<ETIMEDOUT> after the deadline.
+
+*/
+
+static int event_wait(queue_event_t *event, unsigned int seq, const struct timeval *deadline)
+{
+	struct timespec ts;
+#ifdef __linux__
+	struct timeval now;
+
+	if (deadline)
+	{
+		gettimeofday(&now, NULL);
+
+		if (!timercmp(&now, deadline, <))
+			return set_errno(ETIMEDOUT);
+
+		timersub(deadline, &now, &now);
+		ts.tv_sec = now.tv_sec;
+		ts.tv_nsec = now.tv_usec * 1000;
+	}
+
+	if (syscall(SYS_futex, &event->seq, FUTEX_WAIT_PRIVATE, seq, (deadline) ? &ts : NULL, NULL, 0) == -1 && errno == ETIMEDOUT)
+		return -1;
+
+	return 0;
+#else
+	int err = 0;
+
+	if (deadline)
+	{
+		ts.tv_sec = deadline->tv_sec;
+		ts.tv_nsec = deadline->tv_usec * 1000;
+	}
+
+	pthread_mutex_lock(&event->lock);
+
+	while (load_relaxed(&event->seq) == seq && err != ETIMEDOUT)
+	{
+		if (deadline)
+			err = pthread_cond_timedwait(&event->cond, &event->lock, &ts);
+		else
+			pthread_cond_wait(&event->cond, &event->lock);
+	}
+
+	pthread_mutex_unlock(&event->lock);
+
+	return (err == ETIMEDOUT) ? set_errno(ETIMEDOUT) : 0;
+#endif
+}
+
+/*
+
+C<int event_loop(queue_op_t *op, void *container, void **item, queue_event_t *event, long sec, long usec)>
+
+Calls C<op> with C<container> and C<item> until it succeeds, waiting on
+C<event> between attempts. If C<sec> is not negative, gives up after C<sec>
+seconds and C<usec> microseconds. On success, returns C<0>. On error,
+returns C<-1> with C<errno> set to C<ETIMEDOUT>.
+
+*/
+
+static int event_loop(queue_op_t *op, void *container, void **item, queue_event_t *event, long sec, long usec)
+{
+	struct timeval deadline;
+	unsigned int seq;
+
+	if (!op(container, item))
+		return 0;
+
+	if (sec >= 0)
+	{
+		gettimeofday(&deadline, NULL);
+		deadline.tv_sec += sec + usec / 1000000;
+		deadline.tv_usec += usec % 1000000;
+
+		if (deadline.tv_usec >= 1000000)
+		{
+			deadline.tv_sec += 1;
+			deadline.tv_usec -= 1000000;
+		}
+	}
+
+	for (;;)
+	{
+		/* Register as a waiter before the last attempt, so no wakeup is missed */
+
+		seq = load_acquire(&event->seq);
+		__atomic_add_fetch(&event->waiters, 1, __ATOMIC_SEQ_CST);
+		fence();
+
+		if (!op(container, item))
+			break;
+
+		if (event_wait(event, seq, (sec >= 0) ? &deadline : NULL) == -1)
+		{
+			__atomic_sub_fetch(&event->waiters, 1, __ATOMIC_SEQ_CST);
+
+			return (!op(container, item)) ? 0 : set_errno(ETIMEDOUT);
+		}
+
+		__atomic_sub_fetch(&event->waiters, 1, __ATOMIC_SEQ_CST);
+	}
+
+	__atomic_sub_fetch(&event->waiters, 1, __ATOMIC_SEQ_CST);
+
+	return 0;
+}
+
+/*
+
+=item C<Queue *queue_create(size_t size, queue_release_t *destroy)>
+
+Creates a I<Queue> that can hold C<size> items (rounded up to a power of
+two, and at least C<2>), for use by any number of producer and consumer
+threads. C<destroy> is the item destructor function for items remaining in
+the queue when it is destroyed. It is the caller's responsibility to
+deallocate the new queue with I<queue_release(3)> or I<queue_destroy(3)>.
+It is strongly recommended to use I<queue_destroy(3)>, because it also
+sets the pointer variable to C<null>. On success, returns the new queue. On
+error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Queue *queue_create(size_t size, queue_release_t *destroy)
+{
+	Queue *queue;
+	size_t i;
+
+	if (!(size = capacity(size)))
+		return set_errnull(EINVAL);
+
+	if (!(queue = mem_new(Queue)))
+		return NULL;
+
+	if (!(queue->cell = mem_create(size, queue_cell_t)))
+	{
+		mem_release(queue);
+		return NULL;
+	}
+
+	for (i = 0; i < size; ++i)
+		queue->cell[i].seq = i;
+
+	queue->mask = size - 1;
+	queue->destroy = destroy;
+	queue->tail = 0;
+	queue->head = 0;
+	event_init(&queue->pushed);
+	event_init(&queue->shifted);
+
+	return queue;
+}
+
+/*
+
+=item C<void queue_release(Queue *queue)>
+
+Releases (deallocates) C<queue>, destroying any remaining items with its
+destroy function, if any. No other thread may be using C<queue>.
+
+=cut
+
+*/
+
+void queue_release(Queue *queue)
+{
+	void *item = NULL;
+
+	if (!queue)
+		return;
+
+	if (queue->destroy)
+		while (!queue_shift(queue, &item))
+			queue->destroy(item);
+
+	event_fini(&queue->pushed);
+	event_fini(&queue->shifted);
+	mem_release(queue->cell);
+	mem_release(queue);
+}
+
+/*
+
+=item C<void *queue_destroy(Queue **queue)>
+
+Destroys (deallocates and sets to C<null>) C<*queue>. Returns C<null>.
+B<Note:> queues shared by multiple threads must not be destroyed until
+after all threads have finished with them.
+
+=cut
+
+*/
+
+void *queue_destroy(Queue **queue)
+{
+	if (queue && *queue)
+	{
+		queue_release(*queue);
+		*queue = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+=item C<ssize_t queue_size(const Queue *queue)>
+
+Returns the number of items that C<queue> can hold. On error, returns C<-1>
+with C<errno> set appropriately.
+
+=cut
+
+*/
+
+ssize_t queue_size(const Queue *queue)
+{
+	if (!queue)
+		return set_errno(EINVAL);
+
+	return queue->mask + 1;
+}
+
+/*
+
+=item C<ssize_t queue_length(const Queue *queue)>
+
+Returns the number of items in C<queue>. When other threads are using
+C<queue>, this is only a snapshot that may already be out of date. On
+error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+ssize_t queue_length(const Queue *queue)
+{
+	size_t head, tail;
+
+	if (!queue)
+		return set_errno(EINVAL);
+
+	head = load_acquire(&queue->head);
+	tail = load_acquire(&queue->tail);
+
+	/* Other threads may have shifted and pushed in between */
+
+	return (tail - head > queue->mask) ? queue->mask + 1 : tail - head;
+}
+
+/*
+
+=item C<int queue_push(Queue *queue, void *item)>
+
+Adds C<item> to the end of C<queue>, without blocking. Safe to call from
+any number of threads at once. On success, returns C<0>. On error, returns
+C<-1> with C<errno> set appropriately (C<EAGAIN> if C<queue> is full).
+
+=cut
+
+*/
+
+int queue_push(Queue *queue, void *item)
+{
+	queue_cell_t *cell;
+	size_t pos, seq;
+
+	if (!queue)
+		return set_errno(EINVAL);
+
+	for (pos = load_relaxed(&queue->tail);;)
+	{
+		cell = &queue->cell[pos & queue->mask];
+		seq = load_acquire(&cell->seq);
+
+		if (seq == pos)
+		{
+			if (__atomic_compare_exchange_n(&queue->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if ((ssize_t)(seq - pos) < 0)
+			return set_errno(EAGAIN);
+		else
+			pos = load_relaxed(&queue->tail);
+	}
+
+	cell->item = item;
+	store_release(&cell->seq, pos + 1);
+	event_wake(&queue->pushed);
+
+	return 0;
+}
+
+/*
+
+C<int queue_push_op(void *queue, void **item)>
+
+Calls I<queue_push(3)> with C<queue> and C<*item>, for I<event_loop()>.
+
+*/
+
+static int queue_push_op(void *queue, void **item)
+{
+	return queue_push(queue, *item);
+}
+
+/*
+
+=item C<int queue_push_wait(Queue *queue, void *item, long sec, long usec)>
+
+Equivalent to I<queue_push(3)> except that, when C<queue> is full, the
+calling thread blocks until there is room for C<item>. If C<sec> is not
+negative, gives up after C<sec> seconds and C<usec> microseconds, with
+C<errno> set to C<ETIMEDOUT>.
+
+=cut
+
+*/
+
+int queue_push_wait(Queue *queue, void *item, long sec, long usec)
+{
+	if (!queue)
+		return set_errno(EINVAL);
+
+	return event_loop(queue_push_op, queue, &item, &queue->shifted, sec, usec);
+}
+
+/*
+
+=item C<int queue_shift(Queue *queue, void **item)>
+
+Removes the first item from C<queue>, without blocking, and stores it in
+C<*item>. Safe to call from any number of threads at once. On success,
+returns C<0>. On error, returns C<-1> with C<errno> set appropriately
+(C<EAGAIN> if C<queue> is empty).
+
+=cut
+
+*/
+
+int queue_shift(Queue *queue, void **item)
+{
+	queue_cell_t *cell;
+	size_t pos, seq;
+
+	if (!queue || !item)
+		return set_errno(EINVAL);
+
+	for (pos = load_relaxed(&queue->head);;)
+	{
+		cell = &queue->cell[pos & queue->mask];
+		seq = load_acquire(&cell->seq);
+
+		if (seq == pos + 1)
+		{
+			if (__atomic_compare_exchange_n(&queue->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if ((ssize_t)(seq - (pos + 1)) < 0)
+			return set_errno(EAGAIN);
+		else
+			pos = load_relaxed(&queue->head);
+	}
+
+	*item = cell->item;
+	store_release(&cell->seq, pos + queue->mask + 1);
+	event_wake(&queue->shifted);
+
+	return 0;
+}
+
+/*
+
+C<int queue_shift_op(void *queue, void **item)>
+
+Calls I<queue_shift(3)> with C<queue> and C<item>, for I<event_loop()>.
+
+*/
+
+static int queue_shift_op(void *queue, void **item)
+{
+	return queue_shift(queue, item);
+}
+
+/*
+
+=item C<int queue_shift_wait(Queue *queue, void **item, long sec, long usec)>
+
+Equivalent to I<queue_shift(3)> except that, when C<queue> is empty, the
+calling thread blocks until there is an item. If C<sec> is not negative,
+gives up after C<sec> seconds and C<usec> microseconds, with C<errno> set
+to C<ETIMEDOUT>.
+
+=cut
+
+*/
+
+int queue_shift_wait(Queue *queue, void **item, long sec, long usec)
+{
+	if (!queue || !item)
+		return set_errno(EINVAL);
+
+	return event_loop(queue_shift_op, queue, item, &queue->pushed, sec, usec);
+}
+
+/*
+
+=item C<Ring *ring_create(size_t size, ring_release_t *destroy)>
+
+Creates a I<Ring> that can hold C<size> items (rounded up to a power of
+two, and at least C<2>), for use by a single producer thread and a single
+consumer thread. C<destroy> is the item destructor function for items
+remaining in the ring when it is destroyed. It is the caller's
+responsibility to deallocate the new ring with I<ring_release(3)> or
+I<ring_destroy(3)>. It is strongly recommended to use I<ring_destroy(3)>,
+because it also sets the pointer variable to C<null>. On success, returns
+the new ring. On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Ring *ring_create(size_t size, ring_release_t *destroy)
+{
+	Ring *ring;
+
+	if (!(size = capacity(size)))
+		return set_errnull(EINVAL);
+
+	if (!(ring = mem_new(Ring)))
+		return NULL;
+
+	if (!(ring->item = mem_create(size, void *)))
+	{
+		mem_release(ring);
+		return NULL;
+	}
+
+	ring->mask = size - 1;
+	ring->destroy = destroy;
+	ring->tail = ring->head_cache = 0;
+	ring->head = ring->tail_cache = 0;
+	event_init(&ring->pushed);
+	event_init(&ring->shifted);
+
+	return ring;
+}
+
+/*
+
+=item C<void ring_release(Ring *ring)>
+
+Releases (deallocates) C<ring>, destroying any remaining items with its
+destroy function, if any. No other thread may be using C<ring>.
+
+=cut
+
+*/
+
+void ring_release(Ring *ring)
+{
+	void *item = NULL;
+
+	if (!ring)
+		return;
+
+	if (ring->destroy)
+		while (!ring_shift(ring, &item))
+			ring->destroy(item);
+
+	event_fini(&ring->pushed);
+	event_fini(&ring->shifted);
+	mem_release(ring->item);
+	mem_release(ring);
+}
+
+/*
+
+=item C<void *ring_destroy(Ring **ring)>
+
+Destroys (deallocates and sets to C<null>) C<*ring>. Returns C<null>.
+B<Note:> rings must not be destroyed until after both the producer and
+consumer threads have finished with them.
+
+=cut
+
+*/
+
+void *ring_destroy(Ring **ring)
+{
+	if (ring && *ring)
+	{
+		ring_release(*ring);
+		*ring = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+=item C<ssize_t ring_size(const Ring *ring)>
+
+Returns the number of items that C<ring> can hold. On error, returns C<-1>
+with C<errno> set appropriately.
+
+=cut
+
+*/
+
+ssize_t ring_size(const Ring *ring)
+{
+	if (!ring)
+		return set_errno(EINVAL);
+
+	return ring->mask + 1;
+}
+
+/*
+
+=item C<ssize_t ring_length(const Ring *ring)>
+
+Returns the number of items in C<ring>. When another thread is using
+C<ring>, this is only a snapshot that may already be out of date. On error,
+returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+ssize_t ring_length(const Ring *ring)
+{
+	size_t head, tail;
+
+	if (!ring)
+		return set_errno(EINVAL);
+
+	head = load_acquire(&ring->head);
+	tail = load_acquire(&ring->tail);
+
+	return tail - head;
+}
+
+/*
+
+=item C<int ring_push(Ring *ring, void *item)>
+
+Adds C<item> to the end of C<ring>, without blocking. Must only be called
+by the producer thread. On success, returns C<0>. On error, returns C<-1>
+with C<errno> set appropriately (C<EAGAIN> if C<ring> is full).
+
+=cut
+
+*/
+
+int ring_push(Ring *ring, void *item)
+{
+	size_t tail;
+
+	if (!ring)
+		return set_errno(EINVAL);
+
+	tail = ring->tail;
+
+	if (tail - ring->head_cache > ring->mask && tail - (ring->head_cache = load_acquire(&ring->head)) > ring->mask)
+		return set_errno(EAGAIN);
+
+	ring->item[tail & ring->mask] = item;
+	store_release(&ring->tail, tail + 1);
+	event_wake(&ring->pushed);
+
+	return 0;
+}
+
+/*
+
+C<int ring_push_op(void *ring, void **item)>
+
+Calls I<ring_push(3)> with C<ring> and C<*item>, for I<event_loop()>.
+
+*/
+
+static int ring_push_op(void *ring, void **item)
+{
+	return ring_push(ring, *item);
+}
+
+/*
+
+=item C<int ring_push_wait(Ring *ring, void *item, long sec, long usec)>
+
+Equivalent to I<ring_push(3)> except that, when C<ring> is full, the
+calling thread blocks until there is room for C<item>. If C<sec> is not
+negative, gives up after C<sec> seconds and C<usec> microseconds, with
+C<errno> set to C<ETIMEDOUT>.
+
+=cut
+
+*/
+
+int ring_push_wait(Ring *ring, void *item, long sec, long usec)
+{
+	if (!ring)
+		return set_errno(EINVAL);
+
+	return event_loop(ring_push_op, ring, &item, &ring->shifted, sec, usec);
+}
+
+/*
+
+=item C<int ring_shift(Ring *ring, void **item)>
+
+Removes the first item from C<ring>, without blocking, and stores it in
+C<*item>. Must only be called by the consumer thread. On success, returns
+C<0>. On error, returns C<-1> with C<errno> set appropriately (C<EAGAIN> if
+C<ring> is empty).
+
+=cut
+
+*/
+
+int ring_shift(Ring *ring, void **item)
+{
+	size_t head;
+
+	if (!ring || !item)
+		return set_errno(EINVAL);
+
+	head = ring->head;
+
+	if (head == ring->tail_cache && head == (ring->tail_cache = load_acquire(&ring->tail)))
+		return set_errno(EAGAIN);
+
+	*item = ring->item[head & ring->mask];
+	store_release(&ring->head, head + 1);
+	event_wake(&ring->shifted);
+
+	return 0;
+}
+
+/*
+
+C<int ring_shift_op(void *ring, void **item)>
+
+Calls I<ring_shift(3)> with C<ring> and C<item>, for I<event_loop()>.
+
+*/
+
+static int ring_shift_op(void *ring, void **item)
+{
+	return ring_shift(ring, item);
+}
+
+/*
+
+=item C<int ring_shift_wait(Ring *ring, void **item, long sec, long usec)>
+
+Equivalent to I<ring_shift(3)> except that, when C<ring> is empty, the
+calling thread blocks until there is an item. If C<sec> is not negative,
+gives up after C<sec> seconds and C<usec> microseconds, with C<errno> set
+to C<ETIMEDOUT>.
+
+=cut
+
+*/
+
+int ring_shift_wait(Ring *ring, void **item, long sec, long usec)
+{
+	if (!ring || !item)
+		return set_errno(EINVAL);
+
+	return event_loop(ring_shift_op, ring, item, &ring->pushed, sec, usec);
+}
+
+/*
+
+=back
+
+=head1 ERRORS
+
+On error, C<errno> is set either by an underlying function, or as follows:
+
+=over 4
+
+=item C<EINVAL>
+
+When arguments are C<null> or out of range.
+
+=item C<EAGAIN>
+
+When pushing onto a full container, or shifting from an empty one, without
+waiting.
+
+=item C<ETIMEDOUT>
+
+When a I<_wait> function times out.
+
+=back
+
+=head1 MT-Level
+
+I<MT-Safe> (I<Queue>)
+
+I<MT-Safe> for one producer thread and one consumer thread (I<Ring>)
+
+Creating and destroying containers is not I<MT-Safe>. A container must be
+created before it is shared, and may only be destroyed after all of the
+threads that use it have finished with it.
+
+=head1 EXAMPLES
+
+Pass items from several producer threads to several consumer threads,
+waiting when the queue is full or empty:
+
+    #include <slack/std.h>
+    #include <slack/queue.h>
+
+    #define THREADS 4
+    #define ITEMS 1000
+
+    Queue *queue;
+
+    void *produce(void *arg)
+    {
+        long i;
+
+        for (i = 1; i <= ITEMS; ++i)
+            queue_push_wait(queue, (void *)i, -1, 0);
+
+        return NULL;
+    }
+
+    void *consume(void *arg)
+    {
+        long *sum = arg;
+        void *item;
+        int i;
+
+        for (i = 0; i < ITEMS; ++i)
+            if (queue_shift_wait(queue, &item, -1, 0) == 0)
+                *sum += (long)item;
+
+        return NULL;
+    }
+
+    int main()
+    {
+        pthread_t producer[THREADS], consumer[THREADS];
+        long sum[THREADS], total = 0;
+        int i;
+
+        if (!(queue = queue_create(64, NULL)))
+            return EXIT_FAILURE;
+
+        for (i = 0; i < THREADS; ++i)
+        {
+            sum[i] = 0;
+            pthread_create(&consumer[i], NULL, consume, &sum[i]);
+            pthread_create(&producer[i], NULL, produce, NULL);
+        }
+
+        for (i = 0; i < THREADS; ++i)
+        {
+            pthread_join(producer[i], NULL);
+            pthread_join(consumer[i], NULL);
+            total += sum[i];
+        }
+
+        printf("%ld\n", total);
+        queue_destroy(&queue);
+
+        return EXIT_SUCCESS;
+    }
+
+Pass items in order from one thread to another without ever blocking:
+
+    #include <slack/std.h>
+    #include <slack/queue.h>
+
+    Ring *ring;
+
+    void *produce(void *arg)
+    {
+        long i;
+
+        for (i = 1; i <= 1000; ++i)
+            while (ring_push(ring, (void *)i) == -1)
+                sched_yield();
+
+        return NULL;
+    }
+
+    int main()
+    {
+        pthread_t producer;
+        void *item;
+        long i;
+
+        if (!(ring = ring_create(256, NULL)))
+            return EXIT_FAILURE;
+
+        pthread_create(&producer, NULL, produce, NULL);
+
+        for (i = 1; i <= 1000; ++i)
+        {
+            while (ring_shift(ring, &item) == -1)
+                sched_yield();
+
+            if ((long)item != i)
+                printf("out of order\n");
+        }
+
+        pthread_join(producer, NULL);
+        ring_destroy(&ring);
+
+        return EXIT_SUCCESS;
+    }
+
+=head1 CAVEAT
+
+Only the oldest items are ever removed, so there is no iteration over the
+items in a container. A I<Ring> that is used by more than one producer
+thread, or by more than one consumer thread, at the same time, will lose
+or duplicate items. Use a I<Queue> for that.
+
+=head1 SEE ALSO
+
+I<libslack(3)>,
+I<list(3)>,
+I<locker(3)>,
+I<futex(2)>
+
+=head1 AUTHOR
+
+20230824 raf <raf@raf.org>
+
+=cut
+
+*/
+
+#endif
+
+#ifdef TEST
+
+#include <slack/list.h>
+#include <slack/locker.h>
+
+#define THREADS 4
+#define ITEMS 100000
+
+int errors = 0;
+int destroyed = 0;
+
+void destroy(void *item)
+{
+	++destroyed;
+}
+
+double elapsed(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+
+	return (end.tv_sec - start->tv_sec) + (end.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/* The shared state for the producer/consumer tests and benchmarks */
+
+typedef struct Share Share;
+
+struct Share
+{
+	Queue *queue;            /* the queue under test, if any */
+	Ring *ring;              /* the ring under test, if any */
+	List *list;              /* the locked list under test, if any */
+	long items;              /* the number of items per thread */
+	int wait;                /* whether to use the blocking variants */
+	long sum;                /* the sum of the items consumed */
+	long bad;                /* the number of items out of order */
+};
+
+void *produce(void *arg)
+{
+	Share *share = arg;
+	long i;
+
+	for (i = 1; i <= share->items; ++i)
+	{
+		if (share->queue)
+		{
+			if (share->wait)
+				queue_push_wait(share->queue, (void *)i, -1, 0);
+			else
+				while (queue_push(share->queue, (void *)i) == -1)
+					sched_yield();
+		}
+		else if (share->ring)
+		{
+			if (share->wait)
+				ring_push_wait(share->ring, (void *)i, -1, 0);
+			else
+				while (ring_push(share->ring, (void *)i) == -1)
+					sched_yield();
+		}
+		else
+			list_push(share->list, (void *)i);
+	}
+
+	return NULL;
+}
+
+void *consume(void *arg)
+{
+	Share *share = arg;
+	void *item = NULL;
+	long i, last = 0;
+
+	for (i = 0; i < share->items; ++i)
+	{
+		if (share->queue)
+		{
+			if (share->wait)
+				queue_shift_wait(share->queue, &item, -1, 0);
+			else
+				while (queue_shift(share->queue, &item) == -1)
+					sched_yield();
+		}
+		else if (share->ring)
+		{
+			if (share->wait)
+				ring_shift_wait(share->ring, &item, -1, 0);
+			else
+				while (ring_shift(share->ring, &item) == -1)
+					sched_yield();
+		}
+		else
+			while (!(item = list_shift(share->list)))
+				sched_yield();
+
+		__atomic_add_fetch(&share->sum, (long)item, __ATOMIC_RELAXED);
+
+		if ((long)item <= last)
+			__atomic_add_fetch(&share->bad, 1, __ATOMIC_RELAXED);
+
+		last = (long)item;
+	}
+
+	return NULL;
+}
+
+/* Runs threads producers and threads consumers, returning the elapsed time */
+
+double run(Share *share, int threads)
+{
+	pthread_t producer[THREADS], consumer[THREADS];
+	struct timeval start;
+	int i;
+
+	share->sum = share->bad = 0;
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < threads; ++i)
+	{
+		pthread_create(&consumer[i], NULL, consume, share);
+		pthread_create(&producer[i], NULL, produce, share);
+	}
+
+	for (i = 0; i < threads; ++i)
+	{
+		pthread_join(producer[i], NULL);
+		pthread_join(consumer[i], NULL);
+	}
+
+	return elapsed(&start);
+}
+
+void bench(void)
+{
+	pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	Locker *locker;
+	Share share;
+	int threads;
+
+	if (!(locker = locker_create_mutex(&mutex)))
+	{
+		printf("Failed to create locker\n");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&share, 0, sizeof share);
+	share.items = 1000000;
+
+	for (threads = 1; threads <= THREADS; threads <<= 1)
+	{
+		share.queue = NULL, share.ring = NULL;
+		share.list = list_create_with_locker(locker, NULL);
+		printf("%d:%d locked list %.3fs\n", threads, threads, run(&share, threads));
+		list_release(share.list);
+		share.list = NULL;
+
+		share.queue = queue_create(1024, NULL);
+		printf("%d:%d queue       %.3fs\n", threads, threads, run(&share, threads));
+		queue_destroy(&share.queue);
+
+		if (threads == 1)
+		{
+			share.ring = ring_create(1024, NULL);
+			printf("%d:%d ring        %.3fs\n", threads, threads, run(&share, threads));
+			ring_destroy(&share.ring);
+		}
+	}
+
+	locker_destroy(&locker);
+}
+
+int main(int ac, char **av)
+{
+	struct timeval start;
+	Queue *queue;
+	Ring *ring;
+	Share share;
+	void *item;
+	long i;
+
+	if (ac == 2 && !strcmp(av[1], "help"))
+	{
+		printf("usage: %s [help|bench]\n", *av);
+		return EXIT_SUCCESS;
+	}
+
+	if (ac == 2 && !strcmp(av[1], "bench"))
+	{
+		bench();
+		return EXIT_SUCCESS;
+	}
+
+	printf("Testing: %s\n", "queue");
+
+	/* Test queue_create, queue_size, queue_push, queue_shift */
+
+	errno = 0;
+
+	if (queue_create(0, NULL) || errno != EINVAL)
+		++errors, printf("Test1: queue_create(0) failed (errno %d, not EINVAL)\n", errno);
+
+	if (!(queue = queue_create(5, destroy)))
+		++errors, printf("Test2: queue_create(5) failed\n");
+	else
+	{
+		if (queue_size(queue) != 8)
+			++errors, printf("Test2: queue_size() failed (%d, not 8)\n", (int)queue_size(queue));
+
+		for (i = 1; i <= 8; ++i)
+			if (queue_push(queue, (void *)i) == -1)
+				++errors, printf("Test3: queue_push(%ld) failed\n", i);
+
+		errno = 0;
+
+		if (queue_push(queue, (void *)9) != -1 || errno != EAGAIN)
+			++errors, printf("Test3: queue_push(full) failed (errno %d, not EAGAIN)\n", errno);
+
+		if (queue_length(queue) != 8)
+			++errors, printf("Test3: queue_length() failed (%d, not 8)\n", (int)queue_length(queue));
+
+		for (i = 1; i <= 8; ++i)
+			if (queue_shift(queue, &item) == -1 || (long)item != i)
+				++errors, printf("Test4: queue_shift() failed (%ld, not %ld)\n", (long)item, i);
+
+		errno = 0;
+
+		if (queue_shift(queue, &item) != -1 || errno != EAGAIN || queue_length(queue) != 0)
+			++errors, printf("Test4: queue_shift(empty) failed (errno %d, not EAGAIN)\n", errno);
+
+		/* Wrap around many times */
+
+		for (i = 1; i <= 1000; ++i)
+		{
+			if (queue_push(queue, (void *)i) == -1 || queue_push(queue, (void *)-i) == -1)
+				++errors, printf("Test5: queue_push(%ld) failed\n", i);
+
+			if (queue_shift(queue, &item) == -1 || (long)item != i || queue_shift(queue, &item) == -1 || (long)item != -i)
+				++errors, printf("Test5: queue_shift() failed (%ld, not %ld)\n", (long)item, -i);
+		}
+
+		/* Test queue_push_wait, queue_shift_wait timeouts */
+
+		gettimeofday(&start, NULL);
+		errno = 0;
+
+		if (queue_shift_wait(queue, &item, 0, 20000) != -1 || errno != ETIMEDOUT || elapsed(&start) < 0.015)
+			++errors, printf("Test6: queue_shift_wait(empty, 20ms) failed (errno %d, %.3fs)\n", errno, elapsed(&start));
+
+		for (i = 1; i <= 8; ++i)
+			queue_push(queue, (void *)i);
+
+		gettimeofday(&start, NULL);
+		errno = 0;
+
+		if (queue_push_wait(queue, (void *)9, 0, 20000) != -1 || errno != ETIMEDOUT || elapsed(&start) < 0.015)
+			++errors, printf("Test7: queue_push_wait(full, 20ms) failed (errno %d, %.3fs)\n", errno, elapsed(&start));
+
+		if (queue_shift_wait(queue, &item, 0, 0) == -1 || (long)item != 1 || queue_push_wait(queue, (void *)9, -1, 0) == -1)
+			++errors, printf("Test8: queue_shift_wait()/queue_push_wait() failed without waiting\n");
+
+		/* Test queue_destroy releases remaining items */
+
+		destroyed = 0;
+
+		if (queue_destroy(&queue) || queue || destroyed != 8)
+			++errors, printf("Test9: queue_destroy() failed (destroyed %d, not 8)\n", destroyed);
+	}
+
+	/* Test ring_create, ring_size, ring_push, ring_shift */
+
+	errno = 0;
+
+	if (ring_create(0, NULL) || errno != EINVAL)
+		++errors, printf("Test10: ring_create(0) failed (errno %d, not EINVAL)\n", errno);
+
+	if (!(ring = ring_create(5, destroy)))
+		++errors, printf("Test11: ring_create(5) failed\n");
+	else
+	{
+		if (ring_size(ring) != 8)
+			++errors, printf("Test11: ring_size() failed (%d, not 8)\n", (int)ring_size(ring));
+
+		for (i = 1; i <= 8; ++i)
+			if (ring_push(ring, (void *)i) == -1)
+				++errors, printf("Test12: ring_push(%ld) failed\n", i);
+
+		errno = 0;
+
+		if (ring_push(ring, (void *)9) != -1 || errno != EAGAIN)
+			++errors, printf("Test12: ring_push(full) failed (errno %d, not EAGAIN)\n", errno);
+
+		if (ring_length(ring) != 8)
+			++errors, printf("Test12: ring_length() failed (%d, not 8)\n", (int)ring_length(ring));
+
+		for (i = 1; i <= 8; ++i)
+			if (ring_shift(ring, &item) == -1 || (long)item != i)
+				++errors, printf("Test13: ring_shift() failed (%ld, not %ld)\n", (long)item, i);
+
+		errno = 0;
+
+		if (ring_shift(ring, &item) != -1 || errno != EAGAIN || ring_length(ring) != 0)
+			++errors, printf("Test13: ring_shift(empty) failed (errno %d, not EAGAIN)\n", errno);
+
+		for (i = 1; i <= 1000; ++i)
+		{
+			if (ring_push(ring, (void *)i) == -1 || ring_push(ring, (void *)-i) == -1)
+				++errors, printf("Test14: ring_push(%ld) failed\n", i);
+
+			if (ring_shift(ring, &item) == -1 || (long)item != i || ring_shift(ring, &item) == -1 || (long)item != -i)
+				++errors, printf("Test14: ring_shift() failed (%ld, not %ld)\n", (long)item, -i);
+		}
+
+		gettimeofday(&start, NULL);
+		errno = 0;
+
+		if (ring_shift_wait(ring, &item, 0, 20000) != -1 || errno != ETIMEDOUT || elapsed(&start) < 0.015)
+			++errors, printf("Test15: ring_shift_wait(empty, 20ms) failed (errno %d, %.3fs)\n", errno, elapsed(&start));
+
+		for (i = 1; i <= 8; ++i)
+			ring_push(ring, (void *)i);
+
+		gettimeofday(&start, NULL);
+		errno = 0;
+
+		if (ring_push_wait(ring, (void *)9, 0, 20000) != -1 || errno != ETIMEDOUT || elapsed(&start) < 0.015)
+			++errors, printf("Test16: ring_push_wait(full, 20ms) failed (errno %d, %.3fs)\n", errno, elapsed(&start));
+
+		if (ring_shift_wait(ring, &item, 0, 0) == -1 || (long)item != 1 || ring_push_wait(ring, (void *)9, -1, 0) == -1)
+			++errors, printf("Test17: ring_shift_wait()/ring_push_wait() failed without waiting\n");
+
+		destroyed = 0;
+
+		if (ring_destroy(&ring) || ring || destroyed != 8)
+			++errors, printf("Test18: ring_destroy() failed (destroyed %d, not 8)\n", destroyed);
+	}
+
+	/* Test argument checking */
+
+	if (queue_size(NULL) != -1 || queue_length(NULL) != -1 || queue_push(NULL, NULL) != -1 || queue_shift(NULL, &item) != -1 || queue_push_wait(NULL, NULL, 0, 0) != -1 || queue_shift_wait(NULL, &item, 0, 0) != -1)
+		++errors, printf("Test19: queue argument checking failed\n");
+
+	if (ring_size(NULL) != -1 || ring_length(NULL) != -1 || ring_push(NULL, NULL) != -1 || ring_shift(NULL, &item) != -1 || ring_push_wait(NULL, NULL, 0, 0) != -1 || ring_shift_wait(NULL, &item, 0, 0) != -1)
+		++errors, printf("Test20: ring argument checking failed\n");
+
+	/* Test MT Safety: several producers and consumers, small queue, blocking */
+
+	memset(&share, 0, sizeof share);
+	share.items = ITEMS;
+	share.wait = 1;
+
+	if (!(share.queue = queue_create(16, NULL)))
+		++errors, printf("Test21: queue_create(16) failed\n");
+	else
+	{
+		run(&share, THREADS);
+
+		if (share.sum != (long)THREADS * ITEMS * (ITEMS + 1) / 2 || queue_length(share.queue) != 0)
+			++errors, printf("Test21: queue with %d producers and %d consumers failed (sum %ld, not %ld)\n", THREADS, THREADS, share.sum, (long)THREADS * ITEMS * (ITEMS + 1) / 2);
+
+		share.wait = 0;
+		run(&share, THREADS);
+
+		if (share.sum != (long)THREADS * ITEMS * (ITEMS + 1) / 2 || queue_length(share.queue) != 0)
+			++errors, printf("Test22: queue with %d producers and %d consumers (spinning) failed (sum %ld, not %ld)\n", THREADS, THREADS, share.sum, (long)THREADS * ITEMS * (ITEMS + 1) / 2);
+
+		queue_destroy(&share.queue);
+	}
+
+	/* Test MT Safety: one producer and one consumer, small ring, in order */
+
+	share.wait = 1;
+
+	if (!(share.ring = ring_create(16, NULL)))
+		++errors, printf("Test23: ring_create(16) failed\n");
+	else
+	{
+		run(&share, 1);
+
+		if (share.sum != (long)ITEMS * (ITEMS + 1) / 2 || share.bad || ring_length(share.ring) != 0)
+			++errors, printf("Test23: ring with 1 producer and 1 consumer failed (sum %ld, not %ld, %ld out of order)\n", share.sum, (long)ITEMS * (ITEMS + 1) / 2, share.bad);
+
+		share.wait = 0;
+		run(&share, 1);
+
+		if (share.sum != (long)ITEMS * (ITEMS + 1) / 2 || share.bad || ring_length(share.ring) != 0)
+			++errors, printf("Test24: ring with 1 producer and 1 consumer (spinning) failed (sum %ld, not %ld, %ld out of order)\n", share.sum, (long)ITEMS * (ITEMS + 1) / 2, share.bad);
+
+		ring_destroy(&share.ring);
+	}
+
+	if (errors)
+		printf("%d/24 tests failed\n", errors);
+	else
+		printf("All tests passed\n");
+
+	printf("\n");
+	printf("    Note: You can also compare the performance of Queue, Ring and a locked List.\n");
+	printf("    Rerun the test with \"%s bench\".\n", *av);
+
+	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,57 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230824 raf <raf@raf.org>
+*/
+
+#ifndef LIBSLACK_QUEUE_H
+#define LIBSLACK_QUEUE_H
+
+#include <sys/types.h>
+
+#include <slack/hdr.h>
+
+typedef struct Queue Queue;
+typedef struct Ring Ring;
+typedef void queue_release_t(void *item);
+typedef void ring_release_t(void *item);
+
+_begin_decls
+Queue *queue_create(size_t size, queue_release_t *destroy);
+void queue_release(Queue *queue);
+void *queue_destroy(Queue **queue);
+ssize_t queue_size(const Queue *queue);
+ssize_t queue_length(const Queue *queue);
+int queue_push(Queue *queue, void *item);
+int queue_push_wait(Queue *queue, void *item, long sec, long usec);
+int queue_shift(Queue *queue, void **item);
+int queue_shift_wait(Queue *queue, void **item, long sec, long usec);
+Ring *ring_create(size_t size, ring_release_t *destroy);
+void ring_release(Ring *ring);
+void *ring_destroy(Ring **ring);
+ssize_t ring_size(const Ring *ring);
+ssize_t ring_length(const Ring *ring);
+int ring_push(Ring *ring, void *item);
+int ring_push_wait(Ring *ring, void *item, long sec, long usec);
+int ring_shift(Ring *ring, void **item);
+int ring_shift_wait(Ring *ring, void **item, long sec, long usec);
+_end_decls
+
+#endif
+
+/* vi:set ts=4 sw=4: */
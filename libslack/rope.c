@@ -0,0 +1,2082 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230824 raf <raf@raf.org>
+*/
+
+/*
+
+=head1 NAME
+
+I<libslack(rope)> - rope (chunked string) module
+
+=head1 SYNOPSIS
+
+    #include <slack/std.h>
+    #include <slack/rope.h>
+
+    typedef struct Rope Rope;
+
+    Rope *rope_create(void);
+    Rope *rope_create_with_locker(Locker *locker);
+    void rope_release(Rope *rope);
+    void *rope_destroy(Rope **rope);
+    int rope_rdlock(const Rope *rope);
+    int rope_wrlock(const Rope *rope);
+    int rope_unlock(const Rope *rope);
+    ssize_t rope_length(const Rope *rope);
+    ssize_t rope_length_unlocked(const Rope *rope);
+    Rope *rope_insert(Rope *rope, ssize_t index, const char *format, ...);
+    Rope *rope_insert_unlocked(Rope *rope, ssize_t index, const char *format, ...);
+    Rope *rope_vinsert(Rope *rope, ssize_t index, const char *format, va_list args);
+    Rope *rope_vinsert_unlocked(Rope *rope, ssize_t index, const char *format, va_list args);
+    Rope *rope_insert_bytes(Rope *rope, ssize_t index, const char *bytes, size_t length);
+    Rope *rope_insert_bytes_unlocked(Rope *rope, ssize_t index, const char *bytes, size_t length);
+    Rope *rope_append(Rope *rope, const char *format, ...);
+    Rope *rope_append_unlocked(Rope *rope, const char *format, ...);
+    Rope *rope_prepend(Rope *rope, const char *format, ...);
+    Rope *rope_prepend_unlocked(Rope *rope, const char *format, ...);
+    Rope *rope_remove_range(Rope *rope, ssize_t index, ssize_t range);
+    Rope *rope_remove_range_unlocked(Rope *rope, ssize_t index, ssize_t range);
+    Rope *rope_replace(Rope *rope, ssize_t index, ssize_t range, const char *format, ...);
+    Rope *rope_replace_unlocked(Rope *rope, ssize_t index, ssize_t range, const char *format, ...);
+    String *rope_substr(const Rope *rope, ssize_t index, ssize_t range);
+    String *rope_substr_unlocked(const Rope *rope, ssize_t index, ssize_t range);
+    String *rope_str(const Rope *rope);
+    String *rope_str_unlocked(const Rope *rope);
+    ssize_t rope_chunks_unlocked(const Rope *rope, struct iovec *iov, size_t max);
+    ssize_t rope_writev(const Rope *rope, int fd);
+    ssize_t rope_writev_unlocked(const Rope *rope, int fd);
+
+=head1 DESCRIPTION
+
+This module provides ropes, strings that are stored as a sequence of
+fixed-size chunks rather than as a single contiguous buffer. A I<String>
+(see I<str(3)>) must move every character after the point of an insertion
+or removal, so building or editing a large string anywhere but at its end
+takes time proportional to its length. A I<Rope> keeps its chunks in a
+balanced tree (a treap) that records how many characters are in each
+subtree, so finding a position, inserting at it, and removing a range from
+it, only take time proportional to the logarithm of the number of chunks
+(plus the size of one chunk). This makes ropes suitable for report
+generators and template expansion, where text is spliced into large
+documents at arbitrary positions.
+
+Small insertions are copied into the spare space of an existing chunk
+whenever possible, so appending many small pieces produces full chunks.
+The contents of a rope can be copied out into a new I<String>, or the
+chunks can be written directly to a file descriptor with I<writev(2)>
+without being joined first.
+
+As with I<String>s, positions can be negative (C<-1> is the position after
+the last character, C<-2> is the position of the last character, and so
+on), and ropes can be synchronised between threads with a I<Locker>.
+Unlike I<String>s, ropes may contain nul characters, because their length
+is always explicit.
+
+=over 4
+
+=cut
+
+*/
+
+#include "config.h"
+#include "std.h"
+
+#include <limits.h>
+
+#include <sys/uio.h>
+
+#include "rope.h"
+#include "mem.h"
+#include "err.h"
+#include "locker.h"
+
+#ifndef va_copy
+#define va_copy(dst, src) __va_copy((dst), (src))
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
+/* The number of bytes in each chunk */
+
+#define ROPE_CHUNK_SIZE 1024
+
+/* The size of the stack buffer that short insertions are formatted into */
+
+#define ROPE_FORMAT_SIZE 512
+
+#ifndef TEST
+
+typedef struct RopeNode RopeNode;
+
+struct RopeNode
+{
+	RopeNode *left;                /* the chunks before this one */
+	RopeNode *right;               /* the chunks after this one */
+	size_t weight;                 /* the number of bytes in this subtree */
+	size_t length;                 /* the number of bytes in this chunk */
+	unsigned int priority;         /* the heap order that keeps the tree balanced */
+	char data[ROPE_CHUNK_SIZE];    /* the bytes */
+};
+
+struct Rope
+{
+	RopeNode *root;                /* the tree of chunks */
+	unsigned int seed;             /* the state of the priority generator */
+	Locker *locker;                /* locking strategy for this rope */
+};
+
+#define weight(node) ((node) ? (node)->weight : 0)
+
+/*
+
+C<static void node_update(RopeNode *node)>
+
+Recalculates the weight of C<node> from its chunk and its children.
+
+*/
+
+static void node_update(RopeNode *node)
+{
+	node->weight = weight(node->left) + node->length + weight(node->right);
+}
+
+/*
+
+C<static int resolve(size_t length, ssize_t *index, ssize_t *range)>
+
+Converts C<*index> (and C<*range>, unless it is C<null>) from the
+caller's notation, where negative values are relative to the end of a rope
+containing C<length> characters, to plain positions, and checks that they
+are within the rope. On success, returns C<0>. On error, returns C<-1> with
+C<errno> set appropriately.
+
+*/
+
+static int resolve(size_t length, ssize_t *index, ssize_t *range)
+{
+	if (*index < 0)
+		*index = length + 1 + *index;
+
+	if (*index < 0 || (size_t)*index > length)
+		return set_errno(EINVAL);
+
+	if (!range)
+		return 0;
+
+	if (*range < 0)
+		*range = length + 1 + *range - *index;
+
+	if (*range < 0 || length < (size_t)(*index + *range))
+		return set_errno(EINVAL);
+
+	return 0;
+}
+
+/*
+
+C<static unsigned int priority(Rope *rope)>
+
+Returns the next pseudo-random priority for a new chunk in C<rope>
+(xorshift32). Priorities don't need to be unpredictable, just well
+distributed.
+
+*/
+
+static unsigned int priority(Rope *rope)
+{
+	unsigned int x = rope->seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return rope->seed = x;
+}
+
+/*
+
+C<static RopeNode *node_create(Rope *rope, const char *bytes, size_t length)>
+
+Creates a new chunk for C<rope> containing the first C<length> bytes of
+C<bytes>. C<length> must not exceed C<ROPE_CHUNK_SIZE>. On success, returns
+the new chunk. On error, returns C<null> with C<errno> set appropriately.
+
+*/
+
+static RopeNode *node_create(Rope *rope, const char *bytes, size_t length)
+{
+	RopeNode *node;
+
+	if (!(node = mem_new(RopeNode)))
+		return NULL;
+
+	node->left = node->right = NULL;
+	node->weight = node->length = length;
+	node->priority = priority(rope);
+	memcpy(node->data, bytes, length);
+
+	return node;
+}
+
+/*
+
+C<static void node_release(RopeNode *node)>
+
+Releases C<node> and all of its descendants.
+
+*/
+
+static void node_release(RopeNode *node)
+{
+	while (node)
+	{
+		RopeNode *right = node->right;
+
+		node_release(node->left);
+		mem_release(node);
+		node = right;
+	}
+}
+
+/*
+
+C<static RopeNode *node_merge(RopeNode *left, RopeNode *right)>
+
+Joins the trees C<left> and C<right>, with all of the chunks in C<left>
+before all of the chunks in C<right>. Returns the new tree.
+
+*/
+
+static RopeNode *node_merge(RopeNode *left, RopeNode *right)
+{
+	if (!left)
+		return right;
+
+	if (!right)
+		return left;
+
+	if (left->priority > right->priority)
+	{
+		left->right = node_merge(left->right, right);
+		node_update(left);
+		return left;
+	}
+
+	right->left = node_merge(left, right->left);
+	node_update(right);
+	return right;
+}
+
+/*
+
+C<static void node_split(RopeNode *node, size_t index, RopeNode **left, RopeNode **right, RopeNode *tail)>
+
+Splits the tree C<node> into C<*left>, containing the first C<index> bytes,
+and C<*right>, containing the rest. If C<index> falls inside a chunk, that
+chunk is truncated, and C<tail> (prepared earlier by I<prepare()>) must
+contain the bytes that followed C<index> in that chunk. Splitting never
+fails, so that callers can allocate everything they need before changing
+the tree.
+
+*/
+
+static void node_split(RopeNode *node, size_t index, RopeNode **left, RopeNode **right, RopeNode *tail)
+{
+	size_t lw;
+
+	if (!node)
+	{
+		*left = *right = NULL;
+		return;
+	}
+
+	lw = weight(node->left);
+
+	if (index <= lw)
+	{
+		node_split(node->left, index, left, &node->left, tail);
+		node_update(node);
+		*right = node;
+	}
+	else if (index >= lw + node->length)
+	{
+		node_split(node->right, index - lw - node->length, &node->right, right, tail);
+		node_update(node);
+		*left = node;
+	}
+	else
+	{
+		RopeNode *after = node->right;
+
+		node->length = index - lw;
+		node->right = NULL;
+		node_update(node);
+		*left = node;
+		*right = node_merge(tail, after);
+	}
+}
+
+/*
+
+C<static int prepare(Rope *rope, size_t index, RopeNode **tail)>
+
+Prepares to split C<rope> at C<index>. If C<index> falls strictly inside a
+chunk, C<*tail> is set to a new chunk containing the bytes after C<index>
+in that chunk, for I<node_split()> to use. Otherwise, C<*tail> is set to
+C<null>. On success, returns C<0>. On error, returns C<-1> with C<errno>
+set appropriately.
+
+*/
+
+static int prepare(Rope *rope, size_t index, RopeNode **tail)
+{
+	RopeNode *node = rope->root;
+
+	*tail = NULL;
+
+	while (node)
+	{
+		size_t lw = weight(node->left);
+
+		if (index <= lw)
+			node = node->left;
+		else if (index >= lw + node->length)
+			index -= lw + node->length, node = node->right;
+		else
+		{
+			size_t offset = index - lw;
+
+			if (!(*tail = node_create(rope, node->data + offset, node->length - offset)))
+				return -1;
+
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/*
+
+C<static RopeNode *node_locate(RopeNode *node, size_t index, size_t *offset, int after)>
+
+Returns the chunk in the tree C<node> that contains position C<index>, and
+sets C<*offset> to the position within that chunk. When C<index> falls
+between two chunks, the earlier chunk is returned (with C<*offset> equal to
+its length), unless C<after> is non-zero, in which case the later chunk is
+returned (with C<*offset> equal to zero). Returns C<null> when there is no
+such chunk.
+
+*/
+
+static RopeNode *node_locate(RopeNode *node, size_t index, size_t *offset, int after)
+{
+	while (node)
+	{
+		size_t lw = weight(node->left);
+
+		if (node->left && (after ? index < lw : index <= lw))
+			node = node->left;
+		else if (after ? index < lw + node->length : index <= lw + node->length)
+		{
+			*offset = index - lw;
+			return node;
+		}
+		else
+			index -= lw + node->length, node = node->right;
+	}
+
+	return NULL;
+}
+
+/*
+
+C<static void node_reweigh(RopeNode *node, size_t index, ssize_t delta, int after)>
+
+Adds C<delta> to the weight of every node on the path from C<node> to the
+chunk that I<node_locate()> finds for C<index> and C<after>. This is what keeps
+the tree consistent after bytes are added to, or removed from, a chunk in
+place.
+
+*/
+
+static void node_reweigh(RopeNode *node, size_t index, ssize_t delta, int after)
+{
+	while (node)
+	{
+		size_t lw = weight(node->left);
+
+		node->weight += delta;
+
+		if (node->left && (after ? index < lw : index <= lw))
+			node = node->left;
+		else if (after ? index < lw + node->length : index <= lw + node->length)
+			break;
+		else
+			index -= lw + node->length, node = node->right;
+	}
+}
+
+/*
+
+C<static RopeNode *chunks_create(Rope *rope, const char *bytes, size_t length)>
+
+Creates a tree of new chunks for C<rope> containing the C<length> bytes at
+C<bytes>. On success, returns the new tree. On error, returns C<null> with
+C<errno> set appropriately.
+
+*/
+
+static RopeNode *chunks_create(Rope *rope, const char *bytes, size_t length)
+{
+	RopeNode *tree = NULL, *node;
+
+	while (length)
+	{
+		size_t n = (length < ROPE_CHUNK_SIZE) ? length : ROPE_CHUNK_SIZE;
+
+		if (!(node = node_create(rope, bytes, n)))
+		{
+			node_release(tree);
+			return NULL;
+		}
+
+		tree = node_merge(tree, node);
+		bytes += n, length -= n;
+	}
+
+	return tree;
+}
+
+/*
+
+C<static void spine_append(RopeNode *node, const char *bytes, size_t length)>
+
+Appends C<length> bytes to the last chunk in the tree C<node>, which must
+have enough spare space for them.
+
+*/
+
+static void spine_append(RopeNode *node, const char *bytes, size_t length)
+{
+	for (;; node = node->right)
+	{
+		node->weight += length;
+
+		if (!node->right)
+			break;
+	}
+
+	memcpy(node->data + node->length, bytes, length);
+	node->length += length;
+}
+
+/*
+
+C<static void spine_prepend(RopeNode *node, const char *bytes, size_t length)>
+
+Prepends C<length> bytes to the first chunk in the tree C<node>, which must
+have enough spare space for them.
+
+*/
+
+static void spine_prepend(RopeNode *node, const char *bytes, size_t length)
+{
+	for (;; node = node->left)
+	{
+		node->weight += length;
+
+		if (!node->left)
+			break;
+	}
+
+	memmove(node->data + length, node->data, node->length);
+	memcpy(node->data, bytes, length);
+	node->length += length;
+}
+
+/*
+
+C<static RopeNode *node_shift(RopeNode *node, RopeNode **first)>
+
+Removes the first chunk from the tree C<node> and stores it in C<*first>.
+Returns the remaining tree.
+
+*/
+
+static RopeNode *node_shift(RopeNode *node, RopeNode **first)
+{
+	if (!node->left)
+	{
+		*first = node;
+		return node->right;
+	}
+
+	node->left = node_shift(node->left, first);
+	node_update(node);
+
+	return node;
+}
+
+/*
+
+C<static void node_copy(const RopeNode *node, size_t index, size_t range, char *buf)>
+
+Copies C<range> bytes, starting at position C<index>, out of the tree
+C<node> into C<buf>.
+
+*/
+
+static void node_copy(const RopeNode *node, size_t index, size_t range, char *buf)
+{
+	while (node && range)
+	{
+		size_t lw = weight(node->left);
+		size_t n;
+
+		if (index < lw)
+		{
+			n = (range < lw - index) ? range : lw - index;
+			node_copy(node->left, index, n, buf);
+			buf += n, range -= n, index = lw;
+		}
+
+		index -= lw;
+
+		if (range && index < node->length)
+		{
+			n = (range < node->length - index) ? range : node->length - index;
+			memcpy(buf, node->data + index, n);
+			buf += n, range -= n, index = node->length;
+		}
+
+		index -= node->length;
+		node = node->right;
+	}
+}
+
+/*
+
+C<static size_t node_gather(const RopeNode *node, struct iovec *iov, size_t max, size_t count)>
+
+Stores the chunks in the tree C<node>, in order, into C<iov>, starting at
+element C<count> and ignoring any beyond C<max>. Returns C<count> plus the
+number of chunks in the tree.
+
+*/
+
+static size_t node_gather(const RopeNode *node, struct iovec *iov, size_t max, size_t count)
+{
+	for (; node; node = node->right)
+	{
+		count = node_gather(node->left, iov, max, count);
+
+		if (count < max)
+		{
+			iov[count].iov_base = (void *)node->data;
+			iov[count].iov_len = node->length;
+		}
+
+		++count;
+	}
+
+	return count;
+}
+
+/*
+
+=item C<Rope *rope_create(void)>
+
+Creates an empty I<Rope>. It is the caller's responsibility to deallocate
+the new rope with I<rope_release(3)> or I<rope_destroy(3)>. On success,
+returns the new rope. On error, returns C<null> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+Rope *rope_create(void)
+{
+	return rope_create_with_locker(NULL);
+}
+
+/*
+
+=item C<Rope *rope_create_with_locker(Locker *locker)>
+
+Equivalent to I<rope_create(3)> except that multiple threads accessing the
+new rope will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+Rope *rope_create_with_locker(Locker *locker)
+{
+	Rope *rope;
+
+	if (!(rope = mem_new(Rope)))
+		return NULL;
+
+	rope->root = NULL;
+	rope->seed = 0x9e3779b9u ^ (unsigned int)(size_t)rope;
+	rope->locker = locker;
+
+	if (!rope->seed)
+		rope->seed = 0x9e3779b9u;
+
+	return rope;
+}
+
+/*
+
+=item C<void rope_release(Rope *rope)>
+
+Releases (deallocates) C<rope>.
+
+=cut
+
+*/
+
+void rope_release(Rope *rope)
+{
+	Locker *locker;
+
+	if (!rope)
+		return;
+
+	if (rope_wrlock(rope))
+		return;
+
+	locker = rope->locker;
+	node_release(rope->root);
+	mem_release(rope);
+	locker_unlock(locker);
+}
+
+/*
+
+=item C<void *rope_destroy(Rope **rope)>
+
+Destroys (deallocates and sets to C<null>) C<*rope>. Returns C<null>.
+B<Note:> ropes shared by multiple threads must not be destroyed until after
+all threads have finished with it.
+
+=cut
+
+*/
+
+void *rope_destroy(Rope **rope)
+{
+	if (rope && *rope)
+	{
+		rope_release(*rope);
+		*rope = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+=item C<int rope_rdlock(const Rope *rope)>
+
+Claims a read lock on C<rope> (if C<rope> was created with a I<Locker>).
+This is needed when multiple read-only I<rope(3)> module functions need to
+be called atomically, and before calling I<rope_chunks_unlocked(3)> and
+reading the chunks. It is the caller's responsibility to call
+I<rope_unlock(3)> after the atomic operation. The only functions that may
+be called on C<rope> between calls to I<rope_rdlock(3)> and
+I<rope_unlock(3)> are any read-only I<rope(3)> module functions whose name
+ends with C<_unlocked>. On success, returns C<0>. On error, returns an
+error code.
+
+=cut
+
+*/
+
+#define rope_rdlock(rope) ((rope) ? locker_rdlock((rope)->locker) : EINVAL)
+#define rope_wrlock(rope) ((rope) ? locker_wrlock((rope)->locker) : EINVAL)
+#define rope_unlock(rope) ((rope) ? locker_unlock((rope)->locker) : EINVAL)
+
+int (rope_rdlock)(const Rope *rope)
+{
+	return rope_rdlock(rope);
+}
+
+/*
+
+=item C<int rope_wrlock(const Rope *rope)>
+
+Claims a write lock on C<rope> (if C<rope> was created with a I<Locker>).
+This is needed when multiple read/write I<rope(3)> module functions need to
+be called atomically. It is the caller's responsibility to call
+I<rope_unlock(3)> after the atomic operation. The only functions that may
+be called on C<rope> between calls to I<rope_wrlock(3)> and
+I<rope_unlock(3)> are any I<rope(3)> module functions whose name ends with
+C<_unlocked>. On success, returns C<0>. On error, returns an error code.
+
+=cut
+
+*/
+
+int (rope_wrlock)(const Rope *rope)
+{
+	return rope_wrlock(rope);
+}
+
+/*
+
+=item C<int rope_unlock(const Rope *rope)>
+
+Unlocks a read lock or a write lock on C<rope> obtained with
+I<rope_rdlock(3)> or I<rope_wrlock(3)> (if C<rope> was created with a
+I<Locker>). On success, returns C<0>. On error, returns an error code.
+
+=cut
+
+*/
+
+int (rope_unlock)(const Rope *rope)
+{
+	return rope_unlock(rope);
+}
+
+/*
+
+=item C<ssize_t rope_length(const Rope *rope)>
+
+Returns the number of characters in C<rope>. On error, returns C<-1> with
+C<errno> set appropriately.
+
+=cut
+
+*/
+
+ssize_t rope_length(const Rope *rope)
+{
+	ssize_t length;
+	int err;
+
+	if (!rope)
+		return set_errno(EINVAL);
+
+	if ((err = rope_rdlock(rope)))
+		return set_errno(err);
+
+	length = rope_length_unlocked(rope);
+
+	if ((err = rope_unlock(rope)))
+		return set_errno(err);
+
+	return length;
+}
+
+/*
+
+=item C<ssize_t rope_length_unlocked(const Rope *rope)>
+
+Equivalent to I<rope_length(3)> except that C<rope> is not read-locked.
+
+=cut
+
+*/
+
+ssize_t rope_length_unlocked(const Rope *rope)
+{
+	if (!rope)
+		return set_errno(EINVAL);
+
+	return weight(rope->root);
+}
+
+/*
+
+=item C<Rope *rope_insert(Rope *rope, ssize_t index, const char *format, ...)>
+
+Adds the string specified by C<format> to C<rope> at position C<index>. If
+C<index> is negative, it refers to a character position relative to the end
+of the rope (C<-1> is the position after the last character, C<-2> is the
+position of the last character, and so on). The arguments may point into
+strings that were copied out of C<rope>, but not into its chunks. On
+success, returns C<rope>. On error, returns C<null> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+Rope *rope_insert(Rope *rope, ssize_t index, const char *format, ...)
+{
+	Rope *ret;
+	va_list args;
+	va_start(args, format);
+	ret = rope_vinsert(rope, index, format, args);
+	va_end(args);
+	return ret;
+}
+
+/*
+
+=item C<Rope *rope_insert_unlocked(Rope *rope, ssize_t index, const char *format, ...)>
+
+Equivalent to I<rope_insert(3)> except that C<rope> is not write-locked.
+
+=cut
+
+*/
+
+Rope *rope_insert_unlocked(Rope *rope, ssize_t index, const char *format, ...)
+{
+	Rope *ret;
+	va_list args;
+	va_start(args, format);
+	ret = rope_vinsert_unlocked(rope, index, format, args);
+	va_end(args);
+	return ret;
+}
+
+/*
+
+=item C<Rope *rope_vinsert(Rope *rope, ssize_t index, const char *format, va_list args)>
+
+Equivalent to I<rope_insert(3)> with the variable argument list specified
+directly as for I<vprintf(3)>.
+
+=cut
+
+*/
+
+Rope *rope_vinsert(Rope *rope, ssize_t index, const char *format, va_list args)
+{
+	Rope *ret;
+	int err;
+
+	if (!rope)
+		return set_errnull(EINVAL);
+
+	if ((err = rope_wrlock(rope)))
+		return set_errnull(err);
+
+	ret = rope_vinsert_unlocked(rope, index, format, args);
+
+	if ((err = rope_unlock(rope)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<Rope *rope_vinsert_unlocked(Rope *rope, ssize_t index, const char *format, va_list args)>
+
+Equivalent to I<rope_vinsert(3)> except that C<rope> is not write-locked.
+
+=cut
+
+*/
+
+Rope *rope_vinsert_unlocked(Rope *rope, ssize_t index, const char *format, va_list args)
+{
+	char buf[ROPE_FORMAT_SIZE];
+	char *tmp;
+	va_list args_copy;
+	Rope *ret;
+	int length;
+
+	if (!rope)
+		return set_errnull(EINVAL);
+
+	if (!format)
+		return rope_insert_bytes_unlocked(rope, index, "", 0);
+
+	va_copy(args_copy, args);
+	length = vsnprintf(buf, ROPE_FORMAT_SIZE, format, args_copy);
+	va_end(args_copy);
+
+	if (length < 0)
+		return NULL;
+
+	if (length < ROPE_FORMAT_SIZE)
+		return rope_insert_bytes_unlocked(rope, index, buf, length);
+
+	if (!(tmp = mem_create(length + 1, char)))
+		return NULL;
+
+	va_copy(args_copy, args);
+	vsnprintf(tmp, length + 1, format, args_copy);
+	va_end(args_copy);
+
+	ret = rope_insert_bytes_unlocked(rope, index, tmp, length);
+	mem_release(tmp);
+
+	return ret;
+}
+
+/*
+
+=item C<Rope *rope_insert_bytes(Rope *rope, ssize_t index, const char *bytes, size_t length)>
+
+Adds the C<length> bytes at C<bytes> (which may include nul bytes) to
+C<rope> at position C<index>. If C<index> is negative, it refers to a
+character position relative to the end of the rope (C<-1> is the position
+after the last character, C<-2> is the position of the last character, and
+so on). C<bytes> must not point into C<rope>'s chunks. If the bytes fit
+into the spare space of the chunk at C<index>, they are copied there.
+Otherwise, the chunk is split at C<index> and the bytes fill the spare
+space on either side of the split before any new chunks are created. On
+success, returns C<rope>. On error, returns C<null> with C<errno> set
+appropriately, and C<rope> is unchanged.
+
+=cut
+
+*/
+
+Rope *rope_insert_bytes(Rope *rope, ssize_t index, const char *bytes, size_t length)
+{
+	Rope *ret;
+	int err;
+
+	if (!rope)
+		return set_errnull(EINVAL);
+
+	if ((err = rope_wrlock(rope)))
+		return set_errnull(err);
+
+	ret = rope_insert_bytes_unlocked(rope, index, bytes, length);
+
+	if ((err = rope_unlock(rope)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<Rope *rope_insert_bytes_unlocked(Rope *rope, ssize_t index, const char *bytes, size_t length)>
+
+Equivalent to I<rope_insert_bytes(3)> except that C<rope> is not
+write-locked.
+
+=cut
+
+*/
+
+Rope *rope_insert_bytes_unlocked(Rope *rope, ssize_t index, const char *bytes, size_t length)
+{
+	RopeNode *chunk, *tail = NULL, *middle = NULL, *left, *right;
+	size_t offset = 0, head, front, next;
+
+	if (!rope || (!bytes && length))
+		return set_errnull(EINVAL);
+
+	if (resolve(weight(rope->root), &index, NULL) == -1)
+		return NULL;
+
+	if (!length)
+		return rope;
+
+	chunk = node_locate(rope->root, index, &offset, 0);
+
+	/* Insert in place when the bytes fit in the chunk at index */
+
+	if (chunk && chunk->length + length <= ROPE_CHUNK_SIZE)
+	{
+		node_reweigh(rope->root, index, length, 0);
+		memmove(chunk->data + offset + length, chunk->data + offset, chunk->length - offset);
+		memcpy(chunk->data + offset, bytes, length);
+		chunk->length += length;
+
+		return rope;
+	}
+
+	/*
+	** Otherwise, split at index. The chunk before the split takes as many
+	** bytes as it has room for, the chunk after the split (if it is the
+	** truncated part of the same chunk) takes the rest if there's room, and
+	** anything left over goes into new chunks in between.
+	*/
+
+	head = (chunk && offset) ? ROPE_CHUNK_SIZE - offset : 0;
+
+	if (head > length)
+		head = length;
+
+	next = (chunk && offset && offset < chunk->length) ? chunk->length - offset : (chunk && !offset) ? chunk->length : ROPE_CHUNK_SIZE;
+	front = (next + length - head <= ROPE_CHUNK_SIZE) ? length - head : 0;
+
+	if (prepare(rope, index, &tail) == -1)
+		return NULL;
+
+	if (length - head - front && !(middle = chunks_create(rope, bytes + head, length - head - front)))
+	{
+		node_release(tail);
+		return NULL;
+	}
+
+	node_split(rope->root, index, &left, &right, tail);
+
+	if (head)
+		spine_append(left, bytes, head);
+
+	if (front)
+		spine_prepend(right, bytes + length - front, front);
+
+	rope->root = node_merge(node_merge(left, middle), right);
+
+	return rope;
+}
+
+/*
+
+=item C<Rope *rope_append(Rope *rope, const char *format, ...)>
+
+Appends the string specified by C<format> to C<rope>. On success, returns
+C<rope>. On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Rope *rope_append(Rope *rope, const char *format, ...)
+{
+	Rope *ret;
+	va_list args;
+	va_start(args, format);
+	ret = rope_vinsert(rope, -1, format, args);
+	va_end(args);
+	return ret;
+}
+
+/*
+
+=item C<Rope *rope_append_unlocked(Rope *rope, const char *format, ...)>
+
+Equivalent to I<rope_append(3)> except that C<rope> is not write-locked.
+
+=cut
+
+*/
+
+Rope *rope_append_unlocked(Rope *rope, const char *format, ...)
+{
+	Rope *ret;
+	va_list args;
+	va_start(args, format);
+	ret = rope_vinsert_unlocked(rope, -1, format, args);
+	va_end(args);
+	return ret;
+}
+
+/*
+
+=item C<Rope *rope_prepend(Rope *rope, const char *format, ...)>
+
+Prepends the string specified by C<format> to C<rope>. On success, returns
+C<rope>. On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Rope *rope_prepend(Rope *rope, const char *format, ...)
+{
+	Rope *ret;
+	va_list args;
+	va_start(args, format);
+	ret = rope_vinsert(rope, 0, format, args);
+	va_end(args);
+	return ret;
+}
+
+/*
+
+=item C<Rope *rope_prepend_unlocked(Rope *rope, const char *format, ...)>
+
+Equivalent to I<rope_prepend(3)> except that C<rope> is not write-locked.
+
+=cut
+
+*/
+
+Rope *rope_prepend_unlocked(Rope *rope, const char *format, ...)
+{
+	Rope *ret;
+	va_list args;
+	va_start(args, format);
+	ret = rope_vinsert_unlocked(rope, 0, format, args);
+	va_end(args);
+	return ret;
+}
+
+/*
+
+=item C<Rope *rope_remove_range(Rope *rope, ssize_t index, ssize_t range)>
+
+Removes C<range> characters from C<rope> starting at C<index>. If C<index>
+or C<range> are negative, they refer to character positions relative to the
+end of the rope (C<-1> is the position after the last character, C<-2> is
+the position of the last character, and so on). On success, returns
+C<rope>. On error, returns C<null> with C<errno> set appropriately, and
+C<rope> is unchanged.
+
+=cut
+
+*/
+
+Rope *rope_remove_range(Rope *rope, ssize_t index, ssize_t range)
+{
+	Rope *ret;
+	int err;
+
+	if (!rope)
+		return set_errnull(EINVAL);
+
+	if ((err = rope_wrlock(rope)))
+		return set_errnull(err);
+
+	ret = rope_remove_range_unlocked(rope, index, range);
+
+	if ((err = rope_unlock(rope)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<Rope *rope_remove_range_unlocked(Rope *rope, ssize_t index, ssize_t range)>
+
+Equivalent to I<rope_remove_range(3)> except that C<rope> is not
+write-locked.
+
+=cut
+
+*/
+
+Rope *rope_remove_range_unlocked(Rope *rope, ssize_t index, ssize_t range)
+{
+	RopeNode *chunk, *first, *last, *left, *middle, *right;
+	size_t offset = 0;
+
+	if (!rope)
+		return set_errnull(EINVAL);
+
+	if (resolve(weight(rope->root), &index, &range) == -1)
+		return NULL;
+
+	if (!range)
+		return rope;
+
+	chunk = node_locate(rope->root, index, &offset, 1);
+
+	/* Remove in place when the range is inside one chunk (but not all of it) */
+
+	if (offset + range <= chunk->length && (size_t)range < chunk->length)
+	{
+		node_reweigh(rope->root, index, -range, 1);
+		memmove(chunk->data + offset, chunk->data + offset + range, chunk->length - offset - range);
+		chunk->length -= range;
+
+		return rope;
+	}
+
+	/*
+	** Otherwise, split at both ends of the range and discard the middle. If
+	** the chunks either side of the gap fit into one, combine them so that
+	** repeated removals don't leave lots of small chunks behind.
+	*/
+
+	if (prepare(rope, index, &first) == -1)
+		return NULL;
+
+	if (prepare(rope, index + range, &last) == -1)
+	{
+		node_release(first);
+		return NULL;
+	}
+
+	node_split(rope->root, index, &left, &right, first);
+	node_split(right, range, &middle, &right, last);
+	node_release(middle);
+
+	if (left && right)
+	{
+		RopeNode *last = left, *first = right;
+
+		while (last->right)
+			last = last->right;
+
+		while (first->left)
+			first = first->left;
+
+		if (last->length + first->length <= ROPE_CHUNK_SIZE)
+		{
+			right = node_shift(right, &first);
+			spine_append(left, first->data, first->length);
+			mem_release(first);
+		}
+	}
+
+	rope->root = node_merge(left, right);
+
+	return rope;
+}
+
+/*
+
+C<static Rope *vreplace(Rope *rope, ssize_t index, ssize_t range, const char *format, va_list args)>
+
+Replaces C<range> characters in C<rope>, starting at C<index>, with the
+string specified by C<format> and C<args>. Shared by I<rope_replace(3)>
+and I<rope_replace_unlocked(3)>. On success, returns C<rope>. On error,
+returns C<null> with C<errno> set appropriately.
+
+*/
+
+static Rope *vreplace(Rope *rope, ssize_t index, ssize_t range, const char *format, va_list args)
+{
+	if (resolve(weight(rope->root), &index, &range) == -1)
+		return NULL;
+
+	if (!rope_remove_range_unlocked(rope, index, range))
+		return NULL;
+
+	return rope_vinsert_unlocked(rope, index, format, args);
+}
+
+/*
+
+=item C<Rope *rope_replace(Rope *rope, ssize_t index, ssize_t range, const char *format, ...)>
+
+Replaces C<range> characters in C<rope>, starting at C<index>, with the
+string specified by C<format>. If C<index> or C<range> are negative, they
+refer to character positions relative to the end of the rope (C<-1> is the
+position after the last character, C<-2> is the position of the last
+character, and so on). On success, returns C<rope>. On error, returns
+C<null> with C<errno> set appropriately. If the range was removed but the
+replacement could not be inserted, the range stays removed.
+
+=cut
+
+*/
+
+Rope *rope_replace(Rope *rope, ssize_t index, ssize_t range, const char *format, ...)
+{
+	Rope *ret;
+	va_list args;
+	int err;
+
+	if (!rope)
+		return set_errnull(EINVAL);
+
+	if ((err = rope_wrlock(rope)))
+		return set_errnull(err);
+
+	va_start(args, format);
+	ret = vreplace(rope, index, range, format, args);
+	va_end(args);
+
+	if ((err = rope_unlock(rope)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<Rope *rope_replace_unlocked(Rope *rope, ssize_t index, ssize_t range, const char *format, ...)>
+
+Equivalent to I<rope_replace(3)> except that C<rope> is not write-locked.
+
+=cut
+
+*/
+
+Rope *rope_replace_unlocked(Rope *rope, ssize_t index, ssize_t range, const char *format, ...)
+{
+	Rope *ret;
+	va_list args;
+
+	if (!rope)
+		return set_errnull(EINVAL);
+
+	va_start(args, format);
+	ret = vreplace(rope, index, range, format, args);
+	va_end(args);
+	return ret;
+}
+
+/*
+
+=item C<String *rope_substr(const Rope *rope, ssize_t index, ssize_t range)>
+
+Creates a new I<String> containing C<range> characters of C<rope>, starting
+at C<index>. If C<index> or C<range> are negative, they refer to character
+positions relative to the end of the rope (C<-1> is the position after the
+last character, C<-2> is the position of the last character, and so on).
+It is the caller's responsibility to deallocate the new string with
+I<str_release(3)> or I<str_destroy(3)>. On success, returns the new string.
+On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+String *rope_substr(const Rope *rope, ssize_t index, ssize_t range)
+{
+	String *ret;
+	int err;
+
+	if (!rope)
+		return set_errnull(EINVAL);
+
+	if ((err = rope_rdlock(rope)))
+		return set_errnull(err);
+
+	ret = rope_substr_unlocked(rope, index, range);
+
+	if ((err = rope_unlock(rope)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<String *rope_substr_unlocked(const Rope *rope, ssize_t index, ssize_t range)>
+
+Equivalent to I<rope_substr(3)> except that C<rope> is not read-locked.
+
+=cut
+
+*/
+
+String *rope_substr_unlocked(const Rope *rope, ssize_t index, ssize_t range)
+{
+	String *ret;
+	char *buf;
+
+	if (!rope)
+		return set_errnull(EINVAL);
+
+	if (resolve(weight(rope->root), &index, &range) == -1)
+		return NULL;
+
+	if (!(buf = mem_create(range + 1, char)))
+		return NULL;
+
+	node_copy(rope->root, index, range, buf);
+	ret = substr(buf, 0, range);
+	mem_release(buf);
+
+	return ret;
+}
+
+/*
+
+=item C<String *rope_str(const Rope *rope)>
+
+Creates a new I<String> containing all of the characters in C<rope>.
+Equivalent to C<rope_substr(rope, 0, -1)>.
+
+=cut
+
+*/
+
+String *rope_str(const Rope *rope)
+{
+	return rope_substr(rope, 0, -1);
+}
+
+/*
+
+=item C<String *rope_str_unlocked(const Rope *rope)>
+
+Equivalent to I<rope_str(3)> except that C<rope> is not read-locked.
+
+=cut
+
+*/
+
+String *rope_str_unlocked(const Rope *rope)
+{
+	return rope_substr_unlocked(rope, 0, -1);
+}
+
+/*
+
+=item C<ssize_t rope_chunks_unlocked(const Rope *rope, struct iovec *iov, size_t max)>
+
+Stores the address and length of each of the first C<max> chunks of
+C<rope>, in order, in C<iov>, which must have room for C<max> elements.
+C<iov> may be C<null> if C<max> is zero. This makes it possible to pass the
+contents of C<rope> to I<writev(2)>, I<sendmsg(2)>, or anything else that
+accepts an I<iovec> array, without copying them. The chunks belong to
+C<rope>, and are only valid until C<rope> is next modified. If C<rope> was
+created with a I<Locker>, the caller must read-lock it with
+I<rope_rdlock(3)> before calling this function, and keep it locked until
+finished with the chunks. On success, returns the total number of chunks
+in C<rope>, which may exceed C<max>. On error, returns C<-1> with C<errno>
+set appropriately.
+
+=cut
+
+*/
+
+ssize_t rope_chunks_unlocked(const Rope *rope, struct iovec *iov, size_t max)
+{
+	if (!rope || (!iov && max))
+		return set_errno(EINVAL);
+
+	return node_gather(rope->root, iov, max, 0);
+}
+
+/*
+
+=item C<ssize_t rope_writev(const Rope *rope, int fd)>
+
+Writes the contents of C<rope> to the file descriptor C<fd> by passing its
+chunks directly to I<writev(2)>, as many at a time as the system allows.
+Partial writes are continued, and writes interrupted by signals are
+restarted. On success, returns the number of bytes written, which is the
+length of C<rope>. On error, returns C<-1> with C<errno> set appropriately
+(some bytes may have been written).
+
+=cut
+
+*/
+
+ssize_t rope_writev(const Rope *rope, int fd)
+{
+	ssize_t ret;
+	int err;
+
+	if (!rope)
+		return set_errno(EINVAL);
+
+	if ((err = rope_rdlock(rope)))
+		return set_errno(err);
+
+	ret = rope_writev_unlocked(rope, fd);
+
+	if ((err = rope_unlock(rope)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<ssize_t rope_writev_unlocked(const Rope *rope, int fd)>
+
+Equivalent to I<rope_writev(3)> except that C<rope> is not read-locked.
+
+=cut
+
+*/
+
+ssize_t rope_writev_unlocked(const Rope *rope, int fd)
+{
+	struct iovec *iov;
+	size_t count, i = 0;
+	ssize_t total = 0, bytes;
+
+	if (!rope)
+		return set_errno(EINVAL);
+
+	if (!(count = node_gather(rope->root, NULL, 0, 0)))
+		return 0;
+
+	if (!(iov = mem_create(count, struct iovec)))
+		return -1;
+
+	node_gather(rope->root, iov, count, 0);
+
+	while (i < count)
+	{
+		int n = (count - i < IOV_MAX) ? count - i : IOV_MAX;
+
+		if ((bytes = writev(fd, iov + i, n)) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			mem_release(iov);
+			return -1;
+		}
+
+		total += bytes;
+
+		while (i < count && (size_t)bytes >= iov[i].iov_len)
+			bytes -= iov[i++].iov_len;
+
+		if (i < count)
+		{
+			iov[i].iov_base = (char *)iov[i].iov_base + bytes;
+			iov[i].iov_len -= bytes;
+		}
+	}
+
+	mem_release(iov);
+
+	return total;
+}
+
+/*
+
+=back
+
+=head1 ERRORS
+
+On error, C<errno> is set either by an underlying function, or as follows:
+
+=over 4
+
+=item C<EINVAL>
+
+When arguments are C<null> or out of range.
+
+=back
+
+=head1 MT-Level
+
+I<MT-Disciplined>
+
+By default, I<Rope>s are not I<MT-Safe>, for the same reasons as
+I<String>s (see I<str(3)>). When a I<Rope> is shared between multiple
+threads, create it with I<rope_create_with_locker(3)>. Each function then
+read-locks or write-locks the rope as appropriate, and I<rope_rdlock(3)>,
+I<rope_wrlock(3)> and I<rope_unlock(3)>, together with the I<_unlocked>
+functions, make it possible to perform several operations atomically.
+
+=head1 EXAMPLES
+
+Expand a template into a large report, and write it out without joining
+the chunks:
+
+    #include <slack/std.h>
+    #include <slack/rope.h>
+
+    int main()
+    {
+        Rope *report;
+        int i;
+
+        if (!(report = rope_create()))
+            return EXIT_FAILURE;
+
+        rope_append(report, "<html>\n<body>\n</body>\n</html>\n");
+
+        for (i = 0; i < 100000; ++i)
+            rope_insert(report, 14, "<p>Row %d</p>\n", 100000 - i);
+
+        rope_replace(report, 0, 6, "<html lang=\"en\">");
+        rope_writev(report, STDOUT_FILENO);
+        rope_destroy(&report);
+
+        return EXIT_SUCCESS;
+    }
+
+Pass the chunks to another I/O function:
+
+    #include <slack/std.h>
+    #include <slack/rope.h>
+
+    int main()
+    {
+        Rope *rope = rope_create();
+        struct iovec *iov;
+        ssize_t count;
+
+        rope_append(rope, "Hello, %s\n", "world");
+
+        if ((count = rope_chunks_unlocked(rope, NULL, 0)) > 0 &&
+            (iov = malloc(count * sizeof *iov)))
+        {
+            rope_chunks_unlocked(rope, iov, count);
+            writev(STDOUT_FILENO, iov, count);
+            free(iov);
+        }
+
+        rope_destroy(&rope);
+
+        return EXIT_SUCCESS;
+    }
+
+=head1 CAVEAT
+
+Ropes are only worthwhile for large strings that are modified away from
+their end. Each chunk occupies about a kilobyte, even when it isn't full,
+and reading a single character means searching the tree, so small strings,
+and strings that are only ever appended to, are better off as I<String>s.
+
+The C<format> strings and arguments passed to I<rope_insert(3)> and
+friends, and the C<bytes> passed to I<rope_insert_bytes(3)>, must not
+point into the rope's own chunks.
+
+=head1 SEE ALSO
+
+I<libslack(3)>,
+I<str(3)>,
+I<locker(3)>,
+I<writev(2)>
+
+=head1 AUTHOR
+
+20230824 raf <raf@raf.org>
+
+=cut
+
+*/
+
+#endif
+
+#ifdef TEST
+
+#include <sys/time.h>
+
+#include <pthread.h>
+
+#include <slack/str.h>
+#include <slack/locker.h>
+
+#define THREADS 4
+#define APPENDS 1000
+
+int errors = 0;
+
+/* A deterministic pseudo-random number generator for the tests */
+
+static unsigned int rng = 12345;
+
+static unsigned int next(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+
+	return rng;
+}
+
+/* Fills buf with length printable (and recognisable) characters */
+
+static void text(char *buf, size_t length)
+{
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+	static unsigned int n = 0;
+	size_t i;
+
+	for (i = 0; i < length; ++i)
+		buf[i] = chars[n++ % (sizeof chars - 1)];
+
+	buf[length] = '\0';
+}
+
+/* Returns whether rope contains exactly the same characters as str */
+
+static int same(Rope *rope, String *str)
+{
+	String *copy = rope_str(rope);
+	int ret;
+
+	ret = copy && str_length(copy) == str_length(str) && memcmp(cstr(copy), cstr(str), str_length(str)) == 0 && rope_length(rope) == str_length(str);
+	str_destroy(&copy);
+
+	return ret;
+}
+
+static int verify(int test, const char *what, Rope *rope, const char *expected)
+{
+	String *copy = rope_str(rope);
+	int ret = 0;
+
+	if (!copy)
+		++errors, printf("Test%d: %s: rope_str() failed (%s)\n", test, what, strerror(errno));
+	else if (strcmp(cstr(copy), expected) || rope_length(rope) != strlen(expected))
+		++errors, printf("Test%d: %s: rope contains \"%s\" (length %d), not \"%s\"\n", test, what, cstr(copy), (int)rope_length(rope), expected);
+	else
+		ret = 1;
+
+	str_destroy(&copy);
+
+	return ret;
+}
+
+void *appender(void *arg)
+{
+	Rope *rope = arg;
+	int i;
+
+	for (i = 0; i < APPENDS; ++i)
+		rope_append(rope, "%c", 'x');
+
+	return NULL;
+}
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+
+	return (end.tv_sec - start->tv_sec) + (end.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/* Compares inserting at the front and in the middle of a large String and Rope */
+
+static void bench(void)
+{
+	static char piece[81];
+	size_t size = 8 * 1024 * 1024;
+	int inserts = 5000;
+	struct timeval start;
+	String *str;
+	Rope *rope;
+	size_t i;
+	int j;
+
+	text(piece, 80);
+	str = str_create_sized(size + 1, NULL);
+	rope = rope_create();
+
+	for (i = 0; i < size; i += 80)
+	{
+		str_append(str, "%s", piece);
+		rope_append(rope, "%s", piece);
+	}
+
+	printf("%d inserts of 80 bytes into %d MB:\n", inserts, (int)(size / (1024 * 1024)));
+
+	gettimeofday(&start, NULL);
+	for (j = 0; j < inserts; ++j)
+		str_prepend(str, "%s", piece);
+	printf("    str_prepend()          %8.3fs\n", elapsed(&start));
+
+	gettimeofday(&start, NULL);
+	for (j = 0; j < inserts; ++j)
+		rope_prepend(rope, "%s", piece);
+	printf("    rope_prepend()         %8.3fs\n", elapsed(&start));
+
+	gettimeofday(&start, NULL);
+	for (j = 0; j < inserts; ++j)
+		str_insert(str, next() % str_length(str), "%s", piece);
+	printf("    str_insert() (random)  %8.3fs\n", elapsed(&start));
+
+	gettimeofday(&start, NULL);
+	for (j = 0; j < inserts; ++j)
+		rope_insert(rope, next() % rope_length(rope), "%s", piece);
+	printf("    rope_insert() (random) %8.3fs\n", elapsed(&start));
+
+	gettimeofday(&start, NULL);
+	for (j = 0; j < inserts; ++j)
+		str_remove_range(str, next() % (str_length(str) - 80), 80);
+	printf("    str_remove_range()     %8.3fs\n", elapsed(&start));
+
+	gettimeofday(&start, NULL);
+	for (j = 0; j < inserts; ++j)
+		rope_remove_range(rope, next() % (rope_length(rope) - 80), 80);
+	printf("    rope_remove_range()    %8.3fs\n", elapsed(&start));
+
+	str_destroy(&str);
+	rope_destroy(&rope);
+}
+
+int main(int ac, char **av)
+{
+	static char buf[8192];
+	pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	pthread_t thread[THREADS];
+	Locker *locker;
+	struct iovec iov[4];
+	String *str, *copy;
+	Rope *rope;
+	FILE *file;
+	ssize_t count, length;
+	size_t total;
+	int i, ok;
+
+	if (ac == 2 && !strcmp(av[1], "help"))
+	{
+		printf("usage: %s [help|bench]\n", *av);
+		return EXIT_SUCCESS;
+	}
+
+	if (ac == 2 && !strcmp(av[1], "bench"))
+	{
+		bench();
+		return EXIT_SUCCESS;
+	}
+
+	printf("Testing: %s\n", "rope");
+
+	/* Test creation, appending, prepending and inserting */
+
+	if (!(rope = rope_create()))
+		++errors, printf("Test1: rope_create() failed (%s)\n", strerror(errno));
+	else
+	{
+		verify(1, "rope_create()", rope, "");
+
+		if (!rope_append(rope, "%s, %s", "Hello", "world"))
+			++errors, printf("Test2: rope_append() failed\n");
+		else
+			verify(2, "rope_append()", rope, "Hello, world");
+
+		if (!rope_prepend(rope, "[%d] ", 1))
+			++errors, printf("Test3: rope_prepend() failed\n");
+		else
+			verify(3, "rope_prepend()", rope, "[1] Hello, world");
+
+		if (!rope_insert(rope, 9, "%s", " there"))
+			++errors, printf("Test4: rope_insert() failed\n");
+		else
+			verify(4, "rope_insert()", rope, "[1] Hello there, world");
+
+		if (!rope_insert(rope, -1, "!") || !rope_insert(rope, -2, "!"))
+			++errors, printf("Test5: rope_insert(negative) failed\n");
+		else
+			verify(5, "rope_insert(negative)", rope, "[1] Hello there, world!!");
+
+		if (!rope_insert(rope, 0, NULL))
+			++errors, printf("Test6: rope_insert(NULL) failed\n");
+		else
+			verify(6, "rope_insert(NULL)", rope, "[1] Hello there, world!!");
+
+		/* Test removing and replacing */
+
+		if (!rope_remove_range(rope, 0, 4))
+			++errors, printf("Test7: rope_remove_range() failed\n");
+		else
+			verify(7, "rope_remove_range()", rope, "Hello there, world!!");
+
+		if (!rope_remove_range(rope, -3, -1))
+			++errors, printf("Test8: rope_remove_range(negative) failed\n");
+		else
+			verify(8, "rope_remove_range(negative)", rope, "Hello there, world");
+
+		if (!rope_replace(rope, 6, 5, "%s", "big wide"))
+			++errors, printf("Test9: rope_replace() failed\n");
+		else
+			verify(9, "rope_replace()", rope, "Hello big wide, world");
+
+		if (!rope_replace(rope, -6, -1, "%s", "rope"))
+			++errors, printf("Test10: rope_replace(negative) failed\n");
+		else
+			verify(10, "rope_replace(negative)", rope, "Hello big wide, rope");
+
+		/* Test substrings */
+
+		if (!(copy = rope_substr(rope, 6, 3)) || strcmp(cstr(copy), "big"))
+			++errors, printf("Test11: rope_substr(6, 3) failed (\"%s\")\n", copy ? cstr(copy) : "null");
+		str_destroy(&copy);
+
+		if (!(copy = rope_substr(rope, -5, -1)) || strcmp(cstr(copy), "rope"))
+			++errors, printf("Test12: rope_substr(-5, -1) failed (\"%s\")\n", copy ? cstr(copy) : "null");
+		str_destroy(&copy);
+
+		/* Test errors */
+
+		length = rope_length(rope);
+
+		if (rope_insert(rope, length + 1, "x") || errno != EINVAL)
+			++errors, printf("Test13: rope_insert(length + 1) failed to fail with EINVAL\n");
+
+		if (rope_insert(rope, -length - 2, "x") || errno != EINVAL)
+			++errors, printf("Test14: rope_insert(-length - 2) failed to fail with EINVAL\n");
+
+		if (rope_remove_range(rope, length - 2, 3) || errno != EINVAL)
+			++errors, printf("Test15: rope_remove_range(beyond the end) failed to fail with EINVAL\n");
+
+		if ((copy = rope_substr(rope, 0, length + 1)) || errno != EINVAL)
+			++errors, printf("Test16: rope_substr(beyond the end) failed to fail with EINVAL\n");
+		str_destroy(&copy);
+
+		if (rope_insert(NULL, 0, "x") || errno != EINVAL || rope_length(NULL) != -1 || rope_insert_bytes(rope, 0, NULL, 1) || errno != EINVAL)
+			++errors, printf("Test17: null arguments failed to fail with EINVAL\n");
+
+		verify(18, "after errors", rope, "Hello big wide, rope");
+
+		rope_destroy(&rope);
+
+		if (rope)
+			++errors, printf("Test19: rope_destroy() failed to set the rope to null\n");
+	}
+
+	/* Test random insertions, removals and replacements against a String */
+
+	rope = rope_create();
+	str = str_create(NULL);
+
+	for (i = 0, ok = 1; ok && i < 20000; ++i)
+	{
+		size_t len = str_length(str);
+		size_t n = next() % ((i % 50) ? 200 : 3000);
+		size_t index = next() % (len + 1);
+		size_t range = (len - index) ? next() % ((len - index < 2500) ? len - index + 1 : 2500) : 0;
+
+		text(buf, n);
+
+		switch (next() % 4)
+		{
+			case 0:
+			case 1:
+				rope_insert(rope, index, "%s", buf);
+				str_insert(str, index, "%s", buf);
+				break;
+
+			case 2:
+				rope_remove_range(rope, index, range);
+				str_remove_range(str, index, range);
+				break;
+
+			case 3:
+				rope_replace(rope, index, range, "%s", buf);
+				str_replace(str, index, range, "%s", buf);
+				break;
+		}
+
+		if (rope_length(rope) != str_length(str) || (i % 500 == 0 && !same(rope, str)))
+			++errors, ok = 0, printf("Test20: random edits: rope differs from string after %d edits\n", i + 1);
+	}
+
+	if (ok && !same(rope, str))
+		++errors, printf("Test20: random edits: rope differs from string at the end\n");
+
+	/* Test that chunks can be gathered and written directly */
+
+	total = 0;
+	count = rope_chunks_unlocked(rope, NULL, 0);
+
+	if (count < rope_length(rope) / 1024 || rope_chunks_unlocked(rope, iov, 4) != count)
+		++errors, printf("Test21: rope_chunks_unlocked() returned %d chunks for %d bytes\n", (int)count, (int)rope_length(rope));
+	else
+	{
+		struct iovec *all = malloc(count * sizeof *all);
+
+		if (all)
+		{
+			rope_chunks_unlocked(rope, all, count);
+
+			for (i = 0; i < count; ++i)
+				total += all[i].iov_len;
+
+			if (total != rope_length(rope) || memcmp(all[0].iov_base, iov[0].iov_base, iov[0].iov_len) || memcmp(all[0].iov_base, cstr(str), all[0].iov_len))
+				++errors, printf("Test22: rope_chunks_unlocked() chunks total %d bytes, not %d\n", (int)total, (int)rope_length(rope));
+
+			free(all);
+		}
+	}
+
+	if (!(file = tmpfile()))
+		++errors, printf("Test23: failed to perform test: tmpfile() failed (%s)\n", strerror(errno));
+	else
+	{
+		String *read = str_create(NULL);
+
+		if ((length = rope_writev(rope, fileno(file))) != str_length(str))
+			++errors, printf("Test23: rope_writev() wrote %d bytes, not %d\n", (int)length, (int)str_length(str));
+
+		rewind(file);
+
+		while ((length = fread(buf, 1, sizeof buf, file)) > 0)
+			str_append(read, "%.*s", (int)length, buf);
+
+		if (str_length(read) != str_length(str) || memcmp(cstr(read), cstr(str), str_length(str)))
+			++errors, printf("Test24: rope_writev() wrote different contents\n");
+
+		str_destroy(&read);
+		fclose(file);
+	}
+
+	rope_destroy(&rope);
+	str_destroy(&str);
+
+	/* Test ropes containing nul bytes */
+
+	rope = rope_create();
+
+	if (!rope_insert_bytes(rope, 0, "a\0b\0c", 5) || !rope_insert_bytes(rope, 2, "\0\0", 2) || rope_length(rope) != 7)
+		++errors, printf("Test25: rope_insert_bytes() with nul bytes failed\n");
+	else if (!(copy = rope_str(rope)) || str_length(copy) != 7 || memcmp(cstr(copy), "a\0\0\0b\0c", 7))
+		++errors, printf("Test26: rope_str() with nul bytes failed\n");
+	str_destroy(&copy);
+	rope_destroy(&rope);
+
+	/* Test a large insertion, longer than one chunk and the format buffer */
+
+	rope = rope_create();
+	text(buf, 5000);
+	str = str_create("%s", buf);
+	rope_append(rope, "%s", buf);
+	rope_insert(rope, 2500, "%s", buf);
+	str_insert(str, 2500, "%s", buf);
+
+	if (!same(rope, str))
+		++errors, printf("Test27: large insertions failed\n");
+
+	rope_remove_range(rope, 100, 9800);
+	str_remove_range(str, 100, 9800);
+
+	if (!same(rope, str) || rope_chunks_unlocked(rope, NULL, 0) != 1)
+		++errors, printf("Test28: large removals failed (%d chunks)\n", (int)rope_chunks_unlocked(rope, NULL, 0));
+
+	rope_destroy(&rope);
+	str_destroy(&str);
+
+	/* Test MT Safety: several threads appending to a rope with a locker */
+
+	if (!(locker = locker_create_mutex(&mutex)))
+		++errors, printf("Test29: failed to perform test: locker_create_mutex() failed\n");
+	else if (!(rope = rope_create_with_locker(locker)))
+		++errors, printf("Test29: rope_create_with_locker() failed\n");
+	else
+	{
+		for (i = 0; i < THREADS; ++i)
+			pthread_create(&thread[i], NULL, appender, rope);
+
+		for (i = 0; i < THREADS; ++i)
+			pthread_join(thread[i], NULL);
+
+		if (rope_length(rope) != THREADS * APPENDS)
+			++errors, printf("Test29: rope with a locker has %d characters, not %d\n", (int)rope_length(rope), THREADS * APPENDS);
+
+		rope_destroy(&rope);
+		locker_destroy(&locker);
+	}
+
+	if (errors)
+		printf("%d/29 tests failed\n", errors);
+	else
+		printf("All tests passed\n");
+
+	printf("\n");
+	printf("    Note: You can also compare the performance of Rope and String.\n");
+	printf("    Rerun the test with \"%s bench\".\n", *av);
+
+	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,71 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230824 raf <raf@raf.org>
+*/
+
+#ifndef LIBSLACK_ROPE_H
+#define LIBSLACK_ROPE_H
+
+#include <stdarg.h>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <slack/hdr.h>
+#include <slack/locker.h>
+#include <slack/str.h>
+
+typedef struct Rope Rope;
+
+_begin_decls
+Rope *rope_create(void);
+Rope *rope_create_with_locker(Locker *locker);
+void rope_release(Rope *rope);
+void *rope_destroy(Rope **rope);
+int rope_rdlock(const Rope *rope);
+int rope_wrlock(const Rope *rope);
+int rope_unlock(const Rope *rope);
+ssize_t rope_length(const Rope *rope);
+ssize_t rope_length_unlocked(const Rope *rope);
+Rope *rope_insert(Rope *rope, ssize_t index, const char *format, ...);
+Rope *rope_insert_unlocked(Rope *rope, ssize_t index, const char *format, ...);
+Rope *rope_vinsert(Rope *rope, ssize_t index, const char *format, va_list args);
+Rope *rope_vinsert_unlocked(Rope *rope, ssize_t index, const char *format, va_list args);
+Rope *rope_insert_bytes(Rope *rope, ssize_t index, const char *bytes, size_t length);
+Rope *rope_insert_bytes_unlocked(Rope *rope, ssize_t index, const char *bytes, size_t length);
+Rope *rope_append(Rope *rope, const char *format, ...);
+Rope *rope_append_unlocked(Rope *rope, const char *format, ...);
+Rope *rope_prepend(Rope *rope, const char *format, ...);
+Rope *rope_prepend_unlocked(Rope *rope, const char *format, ...);
+Rope *rope_remove_range(Rope *rope, ssize_t index, ssize_t range);
+Rope *rope_remove_range_unlocked(Rope *rope, ssize_t index, ssize_t range);
+Rope *rope_replace(Rope *rope, ssize_t index, ssize_t range, const char *format, ...);
+Rope *rope_replace_unlocked(Rope *rope, ssize_t index, ssize_t range, const char *format, ...);
+String *rope_substr(const Rope *rope, ssize_t index, ssize_t range);
+String *rope_substr_unlocked(const Rope *rope, ssize_t index, ssize_t range);
+String *rope_str(const Rope *rope);
+String *rope_str_unlocked(const Rope *rope);
+ssize_t rope_chunks_unlocked(const Rope *rope, struct iovec *iov, size_t max);
+ssize_t rope_writev(const Rope *rope, int fd);
+ssize_t rope_writev_unlocked(const Rope *rope, int fd);
+_end_decls
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -63,6 +63,7 @@ I<libslack(str)> - string module
 
     typedef struct String String;
     typedef struct StringTR StringTR;
+    typedef struct StringView StringView;
 
     enum StringAlignment
     {
@@ -80,6 +81,12 @@ I<libslack(str)> - string module
         TR_SQUASH     = 4
     };
 
+    struct StringView
+    {
+        const char *str;
+        size_t length;
+    };
+
     typedef enum StringAlignment StringAlignment;
     typedef enum StringTROption StringTROption;
 
@@ -111,6 +118,8 @@ I<libslack(str)> - string module
     ssize_t str_set_length_unlocked(String *str, size_t length);
     ssize_t str_recalc_length(String *str);
     ssize_t str_recalc_length_unlocked(String *str);
+    String *str_reserve(String *str, size_t length);
+    String *str_reserve_unlocked(String *str, size_t length);
     String *str_clear(String *str);
     String *str_clear_unlocked(String *str);
     String *str_remove(String *str, ssize_t index);
@@ -179,6 +188,8 @@ I<libslack(str)> - string module
     List *regexpr_with_locker(Locker *locker, const char *pattern, const char *text, int cflags, int eflags);
     int regexpr_compile(regex_t *compiled, const char *pattern, int cflags);
     void regexpr_release(regex_t *compiled);
+    void regexpr_cache_stats(size_t *hits, size_t *misses, size_t *length);
+    void regexpr_cache_clear(void);
     List *str_regexpr_compiled(const regex_t *compiled, const String *text, int eflags);
     List *str_regexpr_compiled_unlocked(const regex_t *compiled, const String *text, int eflags);
     List *str_regexpr_compiled_with_locker(Locker *locker, const regex_t *compiled, const String *text, int eflags);
@@ -279,6 +290,16 @@ I<libslack(str)> - string module
     int str_oct(const String *str);
     int str_oct_unlocked(const String *str);
     int oct(const char *str);
+    StringView str_view(const String *str);
+    StringView cstr_view(const char *str);
+    StringView view_substr(StringView view, ssize_t index, ssize_t range);
+    StringView view_trim(StringView view);
+    StringView view_trim_left(StringView view);
+    StringView view_trim_right(StringView view);
+    int view_cmp(StringView view1, StringView view2);
+    int view_casecmp(StringView view1, StringView view2);
+    ssize_t split_views(StringView text, const char *delim, StringView *views, size_t max);
+    ssize_t regexpr_views(StringView text, const char *delim, int cflags, int eflags, StringView *views, size_t max);
     int strcasecmp(const char *s1, const char *s2);
     int strncasecmp(const char *s1, const char *s2, size_t n);
     size_t strlcpy(char *dst, const char *src, size_t size);
@@ -299,6 +320,19 @@ functions for manipulating them. Some of the functions were modelled on the
 I<list(3)> module. Others were modelled on the string functions and
 operators in I<perlfunc(1)> and I<perlop(1)>. Others came from I<OpenBSD>.
 
+Short strings (up to 31 bytes) are stored inside the I<String> itself, so
+creating one takes a single memory allocation. When a string grows beyond
+that, its data moves to separately allocated memory automatically.
+
+A I<StringView> is a pointer and a length that refers to characters owned by
+a I<String> or an ordinary I<C> string. The view functions slice, trim,
+compare and tokenize text by returning views into the original characters,
+so they never allocate or copy anything.
+
+On x86 processors, splitting, squeezing, translating, quoting and encoding
+examine text 16 bytes at a time using I<SSE2>, or 32 bytes at a time using
+I<AVX2> when the processor supports it.
+
 =over 4
 
 =cut
@@ -335,20 +369,42 @@ operators in I<perlfunc(1)> and I<perlop(1)>. Others came from I<OpenBSD>.
 #include "snprintf.h"
 #endif
 
+/* Bytes of string data stored inside a String (must equal MIN_STRING_SIZE) */
+
+#define INLINE_STRING_SIZE 32
+
 struct String
 {
 	size_t size;    /* number of bytes allocated */
 	size_t length;  /* number of bytes used (including nul) */
-	char *str;      /* vector of characters */
+	char *str;      /* vector of characters (buf for short strings) */
 	Locker *locker; /* locking strategy for this string */
+	char buf[INLINE_STRING_SIZE]; /* storage for short strings */
 };
 
 #define CHARSET 256
 
+/* Sets of up to this many characters can be matched 16 or 32 bytes at a time */
+
+#define SCAN_CHARS 8
+
+typedef struct ScanSet ScanSet;
+
+struct ScanSet
+{
+	unsigned char member[CHARSET];  /* whether or not each byte is in the set */
+	unsigned char chars[SCAN_CHARS]; /* the members, if there are few enough */
+	int count;                       /* number of chars, or -1 if there are too many */
+	int high;                        /* whether or not other bytes from 0x80 may be members */
+	int ctrl;                        /* whether or not other control characters may be members */
+	int space;                       /* whether or not membership is decided by is_space() */
+};
+
 struct StringTR
 {
 	int squash;           /* whether or not to squash duplicate characters */
 	short table[CHARSET]; /* the translation table */
+	ScanSet mapped;       /* the characters that are translated or deleted */
 	Locker *locker;       /* locking strategy for this structure */
 };
 
@@ -372,7 +428,11 @@ TRCode;
 
 /* Minimum string length: must be a power of 2 */
 
-static const size_t MIN_STRING_SIZE = 32;
+static const size_t MIN_STRING_SIZE = INLINE_STRING_SIZE;
+
+/* Whether or not the string data is stored inside the String */
+
+#define is_inline(string) ((string)->str == (string)->buf)
 
 /* Maximum bytes for an empty string: must be a power of 2 greater than MIN_STRING_SIZE */
 
@@ -389,15 +449,258 @@ void (funlockfile)(FILE *stream);
 
 /*
 
+Scanning text for a set of characters (delimiters, or characters that need
+translating or quoting) is done 16 bytes at a time with SSE2, or 32 bytes at
+a time with AVX2 when the CPU supports it. Each block is compared with the
+set's chars (and the high and ctrl ranges) to find candidates, which are
+then checked against the exact membership. Sets with too many chars, short
+text, and other architectures use the scalar member table.
+
+*/
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define SCAN_SSE2
+#include <emmintrin.h>
+#if (defined(__x86_64__) || defined(__i386__)) && (__GNUC__ >= 5 || defined(__clang__))
+#define SCAN_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+#define scan_member(set, c) ((set)->space ? is_space(c) : (set)->member[(unsigned char)(c)])
+
+/* The whitespace characters (is_space() is the same as isspace() in the "C" locale below 0x80) */
+
+static const ScanSet scan_space = { { 0 }, { ' ', '\t', '\n', '\v', '\f', '\r' }, 6, 1, 0, 1 };
+
+/*
+
+C<void scan_set_add(ScanSet *set, unsigned char c)>
+
+Adds C<c> to C<set>.
+
+*/
+
+static void scan_set_add(ScanSet *set, unsigned char c)
+{
+	if (set->member[c])
+		return;
+
+	set->member[c] = 1;
+
+	if (set->count >= 0 && set->count < SCAN_CHARS)
+		set->chars[set->count++] = c;
+	else
+		set->count = -1;
+}
+
+/*
+
+C<void scan_set_init(ScanSet *set, const char *chars)>
+
+Initialises C<set> to contain the characters in the C<nul>-terminated string,
+C<chars>.
+
+*/
+
+static void scan_set_init(ScanSet *set, const char *chars)
+{
+	memset(set->member, 0, CHARSET);
+	set->count = 0;
+	set->high = set->ctrl = set->space = 0;
+
+	while (*chars)
+		scan_set_add(set, (unsigned char)*chars++);
+}
+
+/*
+
+C<size_t scan_set_scalar(const ScanSet *set, const char *s, size_t length, int in)>
+
+Returns the index of the first byte in the C<length> bytes at C<s> that is
+in C<set> (if C<in> is non-zero) or that is not in C<set> (if C<in> is
+zero). Returns C<length> if there is no such byte.
+
+*/
+
+static size_t scan_set_scalar(const ScanSet *set, const char *s, size_t length, int in)
+{
+	size_t i;
+
+	in = !!in;
+
+	for (i = 0; i < length; ++i)
+		if ((scan_member(set, s[i]) != 0) == in)
+			break;
+
+	return i;
+}
+
+#ifdef SCAN_SSE2
+
+/*
+
+C<size_t scan_set_sse2(const ScanSet *set, const char *s, size_t length, int in)>
+
+Equivalent to I<scan_set_scalar()> but examines 16 bytes at a time.
+C<set->count> must not be C<-1>.
+
+*/
+
+static size_t scan_set_sse2(const ScanSet *set, const char *s, size_t length, int in)
+{
+	__m128i chars[SCAN_CHARS];
+	const __m128i ctrl = _mm_set1_epi8(0x1f);
+	const __m128i del = _mm_set1_epi8(0x7f);
+	const __m128i zero = _mm_setzero_si128();
+	size_t i;
+	int c;
+
+	in = !!in;
+
+	for (c = 0; c < set->count; ++c)
+		chars[c] = _mm_set1_epi8((char)set->chars[c]);
+
+	for (i = 0; i + 16 <= length; i += 16)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i *)(s + i));
+		__m128i hits = zero;
+		unsigned int mask, range = 0;
+
+		for (c = 0; c < set->count; ++c)
+			hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, chars[c]));
+
+		if (set->high)
+			range |= (unsigned int)_mm_movemask_epi8(block);
+
+		if (set->ctrl)
+			range |= (unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(_mm_subs_epu8(block, ctrl), zero), _mm_cmpeq_epi8(block, del)));
+
+		mask = (unsigned int)_mm_movemask_epi8(hits);
+		mask = ((in) ? mask : ~mask & 0xffff) | range;
+
+		for (; mask; mask &= mask - 1)
+		{
+			int j = __builtin_ctz(mask);
+
+			if ((scan_member(set, s[i + j]) != 0) == in)
+				return i + j;
+		}
+	}
+
+	return i + scan_set_scalar(set, s + i, length - i, in);
+}
+
+#endif
+
+#ifdef SCAN_AVX2
+
+/*
+
+C<size_t scan_set_avx2(const ScanSet *set, const char *s, size_t length, int in)>
+
+Equivalent to I<scan_set_sse2()> but examines 32 bytes at a time. Only call
+this when the CPU supports AVX2.
+
+*/
+
+__attribute__((target("avx2")))
+static size_t scan_set_avx2(const ScanSet *set, const char *s, size_t length, int in)
+{
+	__m256i chars[SCAN_CHARS];
+	const __m256i ctrl = _mm256_set1_epi8(0x1f);
+	const __m256i del = _mm256_set1_epi8(0x7f);
+	const __m256i zero = _mm256_setzero_si256();
+	size_t i;
+	int c;
+
+	in = !!in;
+
+	for (c = 0; c < set->count; ++c)
+		chars[c] = _mm256_set1_epi8((char)set->chars[c]);
+
+	for (i = 0; i + 32 <= length; i += 32)
+	{
+		__m256i block = _mm256_loadu_si256((const __m256i *)(s + i));
+		__m256i hits = zero;
+		unsigned int mask, range = 0;
+
+		for (c = 0; c < set->count; ++c)
+			hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, chars[c]));
+
+		if (set->high)
+			range |= (unsigned int)_mm256_movemask_epi8(block);
+
+		if (set->ctrl)
+			range |= (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(_mm256_subs_epu8(block, ctrl), zero), _mm256_cmpeq_epi8(block, del)));
+
+		mask = (unsigned int)_mm256_movemask_epi8(hits);
+		mask = ((in) ? mask : ~mask) | range;
+
+		for (; mask; mask &= mask - 1)
+		{
+			int j = __builtin_ctz(mask);
+
+			if ((scan_member(set, s[i + j]) != 0) == in)
+				return i + j;
+		}
+	}
+
+	return i + scan_set_sse2(set, s + i, length - i, in);
+}
+
+#endif
+
+/*
+
+C<size_t scan_set(const ScanSet *set, const char *s, size_t length, int in)>
+
+Returns the index of the first byte in the C<length> bytes at C<s> that is
+in C<set> (if C<in> is non-zero) or that is not in C<set> (if C<in> is
+zero). Returns C<length> if there is no such byte. Uses the fastest
+available implementation. Short runs (e.g. words) are common, so the first
+C<SCAN_PROBE> bytes are examined one at a time.
+
+*/
+
+#define SCAN_PROBE 16
+
+static size_t scan_set(const ScanSet *set, const char *s, size_t length, int in)
+{
+	size_t probe = (length < SCAN_PROBE) ? length : SCAN_PROBE;
+	size_t i;
+
+	if ((i = scan_set_scalar(set, s, probe, in)) < probe || probe == length)
+		return i;
+
+	if (set->count == -1)
+		return i + scan_set_scalar(set, s + i, length - i, in);
+
+#ifdef SCAN_AVX2
+	if (length - i >= 64 && __builtin_cpu_supports("avx2"))
+		return i + scan_set_avx2(set, s + i, length - i, in);
+#endif
+
+#ifdef SCAN_SSE2
+	return i + scan_set_sse2(set, s + i, length - i, in);
+#else
+	return i + scan_set_scalar(set, s + i, length - i, in);
+#endif
+}
+
+/*
+
 C<int grow(String *str, size_t bytes)>
 
 Allocates enough memory to add C<bytes> extra bytes to C<str> if necessary.
-On success, returns C<0>. On error, returns C<-1>.
+Short strings stored inside C<str> are moved to allocated memory when they
+no longer fit. On success, returns C<0>. On error, returns C<-1>.
 
 */
 
 static int grow(String *str, size_t bytes)
 {
+	char *data;
 	int grown = 0;
 
 	while (str->length + bytes > str->size)
@@ -410,6 +713,20 @@ static int grow(String *str, size_t bytes)
 		grown = 1;
 	}
 
+	if (grown && is_inline(str))
+	{
+		if (!(data = mem_create(str->size, char)))
+		{
+			str->size = INLINE_STRING_SIZE;
+			return -1;
+		}
+
+		memcpy(data, str->buf, str->length);
+		str->str = data;
+
+		return 0;
+	}
+
 	if (grown)
 		return mem_resize(&str->str, str->size) ? 0 : -1;
 
@@ -695,11 +1012,43 @@ String *str_vcreate_with_locker_sized(Locker *locker, size_t size, const char *f
 	if (!format)
 		format = "";
 
+	if (!(str = mem_new(String))) /* XXX decouple */
+		return NULL;
+
+	str->locker = locker;
+
+	/* Short strings are stored inside the String */
+
+	if (size <= INLINE_STRING_SIZE)
+	{
+#ifdef va_copy
+		va_copy(args_copy, args);
+		length = vsnprintf(str->buf, INLINE_STRING_SIZE, format, args_copy);
+		va_end(args_copy);
+#else
+		length = vsnprintf(str->buf, INLINE_STRING_SIZE, format, args);
+#endif
+		if (length != -1 && length < INLINE_STRING_SIZE)
+		{
+			str->size = INLINE_STRING_SIZE;
+			str->length = length + 1;
+			str->str = str->buf;
+
+			return str;
+		}
+
+		/* Too long: allocate enough for it the first time (if we know how much) */
+
+		for (size = INLINE_STRING_SIZE << 1; length != -1 && size <= length; size <<= 1)
+			;
+	}
+
 	for (;; size <<= 1)
 	{
 		if (!mem_resize(&buf, size))
 		{
 			mem_release(buf);
+			mem_release(str);
 			return NULL;
 		}
 
@@ -714,16 +1063,9 @@ String *str_vcreate_with_locker_sized(Locker *locker, size_t size, const char *f
 			break;
 	}
 
-	if (!(str = mem_new(String))) /* XXX decouple */
-	{
-		mem_release(buf);
-		return NULL;
-	}
-
 	str->size = size;
 	str->length = length + 1;
 	str->str = buf;
-	str->locker = locker;
 
 	return str;
 }
@@ -881,7 +1223,10 @@ void str_release(String *str)
 		return;
 
 	locker = str->locker;
-	mem_release(str->str);
+
+	if (!is_inline(str))
+		mem_release(str->str);
+
 	mem_release(str);
 	locker_unlock(locker);
 }
@@ -1207,6 +1552,67 @@ ssize_t str_recalc_length_unlocked(String *str)
 
 /*
 
+=item C<String *str_reserve(String *str, size_t length)>
+
+Makes sure that C<str> has room for at least C<length> characters (plus a
+C<nul>) so that it can grow to that length without any further memory
+allocation. Use this before building a long string with many calls to
+I<str_append(3)> when its approximate final length is known. Does not
+change the contents or length of C<str>. On success, returns C<str>. On
+error, returns C<null> with C<errno> set appropriately (C<ENOMEM> if
+C<length> is too large to ever be allocated).
+
+=cut
+
+*/
+
+String *str_reserve(String *str, size_t length)
+{
+	String *ret;
+	int err;
+
+	if (!str)
+		return set_errnull(EINVAL);
+
+	if ((err = str_wrlock(str)))
+		return set_errnull(err);
+
+	ret = str_reserve_unlocked(str, length);
+
+	if ((err = str_unlock(str)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<String *str_reserve_unlocked(String *str, size_t length)>
+
+Equivalent to I<str_reserve(3)> except that C<str> is not write-locked.
+
+=cut
+
+*/
+
+String *str_reserve_unlocked(String *str, size_t length)
+{
+	if (!str)
+		return set_errnull(EINVAL);
+
+	/* Sizes are doubled up to a power of 2, which must not overflow */
+
+	if (length >= ((size_t)-1 >> 1))
+		return set_errnull(ENOMEM);
+
+	if (length >= str->length && grow(str, length + 1 - str->length) == -1)
+		return NULL;
+
+	return str;
+}
+
+/*
+
 =item C<String *str_clear(String *str)>
 
 Makes C<str> the empty string. On success, returns C<str>. On error, returns
@@ -1340,49 +1746,234 @@ String *str_remove_range_unlocked(String *str, ssize_t index, ssize_t range)
 
 /*
 
-=item C<String *str_insert(String *str, ssize_t index, const char *format, ...)>
-
-Adds the string specified by C<format> to C<str> at position C<index>. If
-C<index> is negative, it refers to a character position relative to the end
-of the string (C<-1> is the position after the last character, C<-2> is the
-position of the last character, and so on). On success, returns C<str>. On
-error, returns C<null> with C<errno> set appropriately.
+C<int append_aliases(const String *str, const char *format, va_list args)>
 
-=cut
+Returns whether or not any argument in C<args> that C<format> reads as a
+string (or pointer) points into C<str>'s memory, in which case formatting
+directly into that memory would overwrite the argument (or leave it
+dangling after growing). Also returns true when C<format> contains anything
+that isn't understood (e.g. positional arguments), to be safe.
 
 */
 
-String *str_insert(String *str, ssize_t index, const char *format, ...)
+static int append_aliases(const String *str, const char *format, va_list args)
 {
-	String *ret;
-	va_list args;
-	va_start(args, format);
-	ret = str_vinsert(str, index, format, args);
-	va_end(args);
-	return ret;
-}
-
-/*
+	const char *p;
+	const void *ptr;
+	va_list ap;
+	int ret = 0;
 
-=item C<String *str_insert_unlocked(String *str, ssize_t index, const char *format, ...)>
+	va_copy(ap, args);
 
-Equivalent to I<str_insert(3)> except that C<str> is not write-locked.
+	for (p = format; *p && !ret; ++p)
+	{
+		int longs = 0, size = 0;
 
-=cut
+		if (*p != '%')
+			continue;
 
-*/
+		if (*++p == '%')
+			continue;
 
-String *str_insert_unlocked(String *str, ssize_t index, const char *format, ...)
-{
-	String *ret;
-	va_list args;
-	va_start(args, format);
-	ret = str_vinsert_unlocked(str, index, format, args);
-	va_end(args);
-	return ret;
-}
+		while (*p && strchr("-+ #0'", *p))
+			++p;
 
-/*
+		if (*p == '*')
+		{
+			(void)va_arg(ap, int);
+			++p;
+		}
+		else
+			while (is_digit(*p))
+				++p;
+
+		if (*p == '.' && *++p == '*')
+		{
+			(void)va_arg(ap, int);
+			++p;
+		}
+		else
+			while (is_digit(*p))
+				++p;
+
+		for (; *p && strchr("hlLqjzt", *p); ++p)
+		{
+			if (*p == 'l')
+				++longs;
+			else if (*p != 'h')
+				size = *p;
+		}
+
+		switch (*p)
+		{
+			case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+				if (size == 'j')
+#ifdef HAVE_STDINT_H
+					(void)va_arg(ap, intmax_t);
+#else
+					(void)va_arg(ap, long long);
+#endif
+				else if (size == 'z')
+					(void)va_arg(ap, size_t);
+				else if (size == 't')
+					(void)va_arg(ap, ptrdiff_t);
+				else if (size == 'q' || longs > 1)
+					(void)va_arg(ap, long long);
+				else if (longs && *p != 'c')
+					(void)va_arg(ap, long);
+				else
+					(void)va_arg(ap, int);
+				break;
+
+			case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+				if (size == 'L')
+					(void)va_arg(ap, long double);
+				else
+					(void)va_arg(ap, double);
+				break;
+
+			case 's': case 'p': case 'n':
+				ptr = va_arg(ap, const void *);
+				ret = (const char *)ptr >= str->str && (const char *)ptr < str->str + str->size;
+				break;
+
+			case 'm':
+				break;
+
+			default: /* Including positional arguments (%1$s) */
+				ret = 1;
+				break;
+		}
+
+		if (!*p)
+			break;
+	}
+
+	va_end(ap);
+
+	return ret;
+}
+
+/*
+
+C<String *append(String *str, const char *format, va_list args)>
+
+Appends the string specified by C<format> and C<args> to C<str> by
+formatting it directly into the spare memory after C<str>'s data. If it
+doesn't fit, C<str> grows by exactly as much as is needed, and it is
+formatted again. If any of the arguments point into C<str> itself, the
+string is formatted into a separate I<String> first instead. On success,
+returns C<str>. On error, returns C<null> with C<errno> set appropriately.
+
+*/
+
+static String *append(String *str, const char *format, va_list args)
+{
+	String *tmp, *ret;
+	va_list args_copy;
+	size_t spare;
+	ssize_t length;
+
+	if (!format)
+		format = "";
+
+	if (append_aliases(str, format, args))
+	{
+		if (!(tmp = str_vcreate(format, args)))
+			return NULL;
+
+		ret = str_insert_str_unlocked(str, str->length - 1, tmp);
+		str_release(tmp);
+
+		return ret;
+	}
+
+	spare = str->size - str->length + 1;
+	va_copy(args_copy, args);
+	length = vsnprintf(str->str + str->length - 1, spare, format, args_copy);
+	va_end(args_copy);
+
+	if (length != -1 && length < spare)
+	{
+		str->length += length;
+		return str;
+	}
+
+	/* Didn't fit: undo the truncated attempt */
+
+	str->str[str->length - 1] = '\0';
+
+	/* Old vsnprintf() implementations don't say how much is needed */
+
+	if (length == -1)
+	{
+		if (!(tmp = str_vcreate(format, args)))
+			return NULL;
+
+		ret = str_insert_str_unlocked(str, str->length - 1, tmp);
+		str_release(tmp);
+
+		return ret;
+	}
+
+	if (grow(str, length) == -1)
+		return NULL;
+
+	va_copy(args_copy, args);
+	vsnprintf(str->str + str->length - 1, length + 1, format, args_copy);
+	va_end(args_copy);
+	str->length += length;
+
+	return str;
+}
+
+/*
+
+=item C<String *str_insert(String *str, ssize_t index, const char *format, ...)>
+
+Adds the string specified by C<format> to C<str> at position C<index>. If
+C<index> is negative, it refers to a character position relative to the end
+of the string (C<-1> is the position after the last character, C<-2> is the
+position of the last character, and so on). When adding to the end of
+C<str>, the string is formatted directly into C<str>'s spare memory, unless
+an argument points into C<str> itself. On success, returns C<str>. On error,
+returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+String *str_insert(String *str, ssize_t index, const char *format, ...)
+{
+	String *ret;
+	va_list args;
+	va_start(args, format);
+	ret = str_vinsert(str, index, format, args);
+	va_end(args);
+	return ret;
+}
+
+/*
+
+=item C<String *str_insert_unlocked(String *str, ssize_t index, const char *format, ...)>
+
+Equivalent to I<str_insert(3)> except that C<str> is not write-locked.
+
+=cut
+
+*/
+
+String *str_insert_unlocked(String *str, ssize_t index, const char *format, ...)
+{
+	String *ret;
+	va_list args;
+	va_start(args, format);
+	ret = str_vinsert_unlocked(str, index, format, args);
+	va_end(args);
+	return ret;
+}
+
+/*
 
 =item C<String *str_vinsert(String *str, ssize_t index, const char *format, va_list args)>
 
@@ -1438,6 +2029,9 @@ String *str_vinsert_unlocked(String *str, ssize_t index, const char *format, va_
 	if (str->length - 1 < index)
 		return set_errnull(EINVAL);
 
+	if (index == str->length - 1)
+		return append(str, format, args);
+
 	if (!(tmp = str_vcreate(format, args)))
 		return NULL;
 
@@ -1535,8 +2129,11 @@ String *str_insert_str_unlocked(String *str, ssize_t index, const String *src)
 
 =item C<String *str_append(String *str, const char *format, ...)>
 
-Appends the string specified by C<format> to C<str>. On success, returns
-C<str>. On error, returns C<null> with C<errno> set appropriately.
+Appends the string specified by C<format> to C<str>. The string is
+formatted directly into C<str>'s spare memory (which grows as needed),
+unless an argument points into C<str> itself (e.g. C<cstr(str)>), in which
+case it is formatted separately first. On success, returns C<str>. On
+error, returns C<null> with C<errno> set appropriately.
 
 =cut
 
@@ -2786,6 +3383,12 @@ static StringTR *do_tr_compile_table(StringTR *table, const char *from, ssize_t
 			table->table[fc] = (xto + j < xt) ? tc : TRCODE_DELETE;
 	}
 
+	scan_set_init(&table->mapped, "");
+
+	for (i = 0; i < CHARSET; ++i)
+		if (table->table[i] != TRCODE_NOMAP)
+			scan_set_add(&table->mapped, i);
+
 	if ((err = locker_unlock(table->locker)))
 		return set_errnull(err);
 
@@ -2887,29 +3490,59 @@ static int do_tr_compiled(unsigned char *str, size_t *length, StringTR *table)
 	if ((err = locker_rdlock(table->locker)))
 		return set_errno(err);
 
-	for (r = s = str; (length) ? s - str < *length - 1 : *s; ++s)
+	/* Without squashing, copy the runs of unmapped characters between the mapped ones */
+
+	if (!table->squash && table->mapped.count != -1)
 	{
-		switch (t = table->table[(int)*s])
+		unsigned char *end = str + ((length) ? *length - 1 : strlen((char *)str));
+
+		for (r = s = str; s < end; ++s)
 		{
-			case TRCODE_DELETE:
-				++deleted;
-				++ret;
-				break;
+			size_t run = scan_set(&table->mapped, (char *)s, end - s, 1);
 
-			case TRCODE_NOMAP:
-				if (!table->squash || r == str || r[-1] != *s)
-					*r++ = *s;
-				else
-					++deleted;
+			if (r != s)
+				memmove(r, s, run);
+
+			r += run;
+			s += run;
+
+			if (s == end)
 				break;
 
-			default:
-				if (!table->squash || r == str || r[-1] != t)
-					*r++ = t;
-				else
+			if ((t = table->table[(int)*s]) == TRCODE_DELETE)
+				++deleted;
+			else
+				*r++ = t;
+
+			++ret;
+		}
+	}
+	else
+	{
+		for (r = s = str; (length) ? s - str < *length - 1 : *s; ++s)
+		{
+			switch (t = table->table[(int)*s])
+			{
+				case TRCODE_DELETE:
 					++deleted;
-				++ret;
-				break;
+					++ret;
+					break;
+
+				case TRCODE_NOMAP:
+					if (!table->squash || r == str || r[-1] != *s)
+						*r++ = *s;
+					else
+						++deleted;
+					break;
+
+				default:
+					if (!table->squash || r == str || r[-1] != t)
+						*r++ = t;
+					else
+						++deleted;
+					++ret;
+					break;
+			}
 		}
 	}
 
@@ -3017,148 +3650,748 @@ int tr_compiled(char *str, StringTR *table)
 
 #ifdef HAVE_REGEX_H
 
-/*
+/* Compiled regular expressions cached for regexpr(), str_regsub() and regexpr_split() */
 
-=item C<List *str_regexpr(const char *pattern, const String *text, int cflags, int eflags)>
+#define REGEXPR_CACHE_SIZE 32
 
-I<str_regexpr(3)> is an interface to I<POSIX 1003.2>-compliant regular
-expression matching. C<pattern> is a regular expression. C<text> is the
-string to be searched for matches. C<cflags> is passed to I<regcomp(3)>
-along with C<REG_EXTENDED>. C<eflags> is passed to I<regexec(3)>. On
-success, returns a I<List> of (at most 33) I<String>s containing the
-matching substring followed by the matching substrings of any parenthesised
-subexpressions. It is the caller's responsibility to deallocate the list
-with I<list_release(3)> or I<list_destroy(3)>. On error (including no
-match), returns C<null> with C<errno> set appropriately. Only use this
-function when the regular expression will be used only once. Otherwise, use
-I<regexpr_compile(3)> or I<regcomp(3)> and I<str_regexpr_compiled(3)> or
-I<regexpr_compiled(3)> or I<regexec(3)>.
+typedef struct RegexprEntry RegexprEntry;
 
-Note: If you require perl pattern matching, you could use Philip Hazel's
-I<PCRE> package, C<ftp://ftp.cus.cam.ac.uk/pub/software/programs/pcre/> or
-link against the perl library itself.
+struct RegexprEntry
+{
+	char *pattern;         /* the regular expression */
+	int cflags;            /* the flags it was compiled with */
+	unsigned int hash;     /* hash of pattern and cflags */
+	regex_t compiled[1];   /* the compiled regular expression */
+	char *literal;         /* a string that every match contains, if any */
+	size_t literal_length; /* the length of literal */
+	int exact;             /* whether or not the pattern is just literal */
+	size_t users;          /* number of callers currently using it */
+	int cached;            /* whether or not it is still in the cache */
+	RegexprEntry *prev;    /* the next most recently used entry */
+	RegexprEntry *next;    /* the next least recently used entry */
+};
 
-=cut
+static struct
+{
+	pthread_mutex_t lock; /* protects the rest */
+	RegexprEntry *head;   /* the most recently used entry */
+	RegexprEntry *tail;   /* the least recently used entry */
+	size_t length;        /* number of entries */
+	size_t hits;          /* number of lookups that found an entry */
+	size_t misses;        /* number of lookups that compiled a new entry */
+}
+regexpr_cache = { PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0, 0, 0 };
+
+static pthread_once_t regexpr_cache_once = PTHREAD_ONCE_INIT;
+
+/*
+
+C<unsigned int regexpr_hash(const char *pattern, int cflags)>
+
+Returns a hash of C<pattern> and C<cflags> for the regular expression cache.
 
 */
 
-List *str_regexpr(const char *pattern, const String *text, int cflags, int eflags)
+static unsigned int regexpr_hash(const char *pattern, int cflags)
 {
-	return str_regexpr_with_locker(NULL, pattern, text, cflags, eflags);
+	unsigned int hash = 2166136261u ^ (unsigned int)cflags;
+
+	while (*pattern)
+		hash = (hash ^ (unsigned char)*pattern++) * 16777619u;
+
+	return hash;
 }
 
 /*
 
-=item C<List *str_regexpr_unlocked(const char *pattern, const String *text, int cflags, int eflags)>
-
-Equivalent to I<str_regexpr(3)> except that C<text> is not read-locked.
+C<void regexpr_entry_release(RegexprEntry *entry)>
 
-=cut
+Deallocates C<entry> and its compiled regular expression.
 
 */
 
-List *str_regexpr_unlocked(const char *pattern, const String *text, int cflags, int eflags)
+static void regexpr_entry_release(RegexprEntry *entry)
 {
-	return str_regexpr_with_locker_unlocked(NULL, pattern, text, cflags, eflags);
+	regfree(entry->compiled);
+	mem_release(entry->literal);
+	mem_release(entry->pattern);
+	mem_release(entry);
 }
 
 /*
 
-=item C<List *str_regexpr_with_locker(Locker *locker, const char *pattern, const String *text, int cflags, int eflags)>
-
-Equivalent to I<str_regexpr(3)> except that multiple threads accessing the
-new list will be synchronised by C<locker>.
+C<const char *regexpr_skip_bracket(const char *p)>
 
-=cut
+Returns the position after the bracket expression that starts just after
+C<p>'s opening C<'['>. Returns C<null> if it isn't terminated.
 
 */
 
-List *str_regexpr_with_locker(Locker *locker, const char *pattern, const String *text, int cflags, int eflags)
+static const char *regexpr_skip_bracket(const char *p)
 {
-	List *ret;
-	int err;
+	if (*p == '^')
+		++p;
 
-	if (!pattern || !text)
-		return set_errnull(EINVAL);
+	if (*p == ']')
+		++p;
 
-	if ((err = str_rdlock(text)))
-		return set_errnull(err);
+	while (*p && *p != ']')
+	{
+		if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '='))
+		{
+			const char *q = p + 2;
 
-	ret = str_regexpr_with_locker_unlocked(locker, pattern, text, cflags, eflags);
+			while (*q && (q[0] != p[1] || q[1] != ']'))
+				++q;
 
-	if ((err = str_unlock(text)))
-	{
-		list_release(ret);
-		return set_errnull(err);
+			if (!*q)
+				return NULL;
+
+			p = q + 2;
+		}
+		else
+			++p;
 	}
 
-	return ret;
+	return (*p) ? p + 1 : NULL;
 }
 
 /*
 
-=item C<List *str_regexpr_with_locker_unlocked(Locker *locker, const char *pattern, const String *text, int cflags, int eflags)>
-
-Equivalent to I<str_regexpr_with_locker(3)> except that C<text> is not
-read-locked.
+C<size_t regexpr_drop_last(const char *run, size_t length)>
 
-=cut
+Returns the length of the literal C<run> without its last character (all
+of it, if it is a multibyte character), which a quantifier has made
+optional.
 
 */
 
-List *str_regexpr_with_locker_unlocked(Locker *locker, const char *pattern, const String *text, int cflags, int eflags)
+static size_t regexpr_drop_last(const char *run, size_t length)
 {
-	if (!pattern || !text)
-		return set_errnull(EINVAL);
+	if (length && (unsigned char)run[length - 1] >= 0x80)
+	{
+		while (length && (unsigned char)run[length - 1] >= 0x80)
+			--length;
+	}
+	else if (length)
+		--length;
 
-	return regexpr_with_locker(locker, pattern, text->str, cflags, eflags);
+	return length;
 }
 
 /*
 
-=item C<List *regexpr(const char *pattern, const char *text, int cflags, int eflags)>
-
-Equivalent to I<str_regexpr(3)> but works on an ordinary I<C> string.
+C<void regexpr_analyse(RegexprEntry *entry)>
 
-=cut
+Looks for the longest literal string that every match of C<entry>'s pattern
+must contain, and stores it in C<entry->literal>. Text that doesn't contain
+it can't match, so I<regexec(3)> needn't be called. If the whole pattern is
+a literal string, C<entry->exact> is set, and I<regexec(3)> isn't needed at
+all. Anything not understood ends the current literal, so that the result is
+only ever shorter than it could be. Case-insensitive patterns and patterns
+with alternatives (outside parentheses) have no literal.
 
 */
 
-List *regexpr(const char *pattern, const char *text, int cflags, int eflags)
+static void regexpr_analyse(RegexprEntry *entry)
 {
-	return regexpr_with_locker(NULL, pattern, text, cflags, eflags);
-}
+	const char *p = entry->pattern;
+	size_t size = strlen(p) + 1;
+	size_t length = 0, best = 0;
+	int depth = 0, exact = 1;
+	char *run;
 
-/*
+	entry->literal = NULL;
+	entry->literal_length = 0;
+	entry->exact = 0;
 
-=item C<List *regexpr_with_locker(Locker *locker, const char *pattern, const char *text, int cflags, int eflags)>
+	if (entry->cflags & REG_ICASE)
+		return;
 
-Equivalent to I<regexpr(3)> except that multiple threads accessing the new
-list will be synchronised by C<locker>.
+	if (!(run = mem_create(size, char)))
+		return;
 
-=cut
+	if (!(entry->literal = mem_create(size, char)))
+	{
+		mem_release(run);
+		return;
+	}
 
-*/
+#define end_run() \
+	if (length > best) \
+		memcpy(entry->literal, run, best = length); \
+	length = 0
 
-List *regexpr_with_locker(Locker *locker, const char *pattern, const char *text, int cflags, int eflags)
-{
-	regex_t compiled[1];
-	List *ret;
-	int err;
+	for (; *p; ++p)
+	{
+		switch (*p)
+		{
+			case '\\':
+				if (p[1] && strchr(".[]()*+?{}|^$\\", p[1]))
+				{
+					if (!depth)
+						run[length++] = *++p;
+					else
+						++p;
+					break;
+				}
 
-	if (!pattern || !text)
-		return set_errnull(EINVAL);
+				exact = 0;
+				end_run();
+				if (p[1])
+					++p;
+				break;
 
-	if ((err = regexpr_compile(compiled, pattern, cflags)))
-		return set_errnull(err);
+			case '+':
+				/* Another quantifier after + (e.g. +? or +*) makes the atom optional */
+				if (p[1] && strchr("*?{+", p[1]))
+					length = regexpr_drop_last(run, length);
+				exact = 0;
+				end_run();
+				break;
 
-	ret = regexpr_compiled_with_locker(locker, compiled, text, eflags);
-	regfree(compiled);
+			case '*': case '?': case '{':
+				/* The previous character (all of it, if multibyte) is optional */
+				length = regexpr_drop_last(run, length);
+				exact = 0;
+				end_run();
+				if (*p == '{' && (p = strchr(p, '}')) == NULL)
+					best = 0;
+				break;
 
-	return ret;
-}
+			case '[':
+				exact = 0;
+				end_run();
+				if ((p = regexpr_skip_bracket(p + 1)))
+					--p;
+				else
+					best = 0;
+				break;
 
-/*
+			case '(':
+				++depth;
+				exact = 0;
+				end_run();
+				break;
+
+			case ')':
+				if (depth)
+					--depth;
+				exact = 0;
+				end_run();
+				break;
+
+			case '|':
+				if (!depth)
+				{
+					length = best = 0;
+					p = NULL;
+				}
+				break;
+
+			case '.': case '^': case '$':
+				exact = 0;
+				end_run();
+				break;
+
+			default:
+				if (!depth)
+					run[length++] = *p;
+				break;
+		}
+
+		if (!p)
+			break;
+	}
+
+	end_run();
+
+#undef end_run
+
+	mem_release(run);
+
+	if (!best)
+	{
+		mem_release(entry->literal);
+		entry->literal = NULL;
+		return;
+	}
+
+	entry->literal[best] = '\0';
+	entry->literal_length = best;
+	entry->exact = exact;
+}
+
+/*
+
+C<const char *regexpr_find_literal(const char *s, size_t length, const char *literal, size_t literal_length)>
+
+Returns the first occurrence of C<literal> in the C<length> bytes at C<s>, or
+C<null> if there is none.
+
+*/
+
+static const char *regexpr_find_literal(const char *s, size_t length, const char *literal, size_t literal_length)
+{
+	const char *end = s + length;
+
+	while ((size_t)(end - s) >= literal_length && (s = memchr(s, *literal, end - s - literal_length + 1)))
+	{
+		if (!memcmp(s, literal, literal_length))
+			return s;
+
+		++s;
+	}
+
+	return NULL;
+}
+
+/*
+
+C<int regexpr_entry_exec(const RegexprEntry *entry, const char *str, size_t nmatch, regmatch_t *match, int eflags)>
+
+Equivalent to I<regexec(3)> with C<entry>'s compiled pattern, except that
+text without C<entry>'s literal is rejected without calling I<regexec(3)>,
+and literal patterns are matched without calling it at all.
+
+*/
+
+static int regexpr_entry_exec(const RegexprEntry *entry, const char *str, size_t nmatch, regmatch_t *match, int eflags)
+{
+	const char *found;
+	size_t i;
+
+	if (!entry->literal)
+		return regexec(entry->compiled, str, nmatch, match, eflags);
+
+#ifdef REG_STARTEND
+	if (eflags & REG_STARTEND)
+		found = regexpr_find_literal(str + match[0].rm_so, match[0].rm_eo - match[0].rm_so, entry->literal, entry->literal_length);
+	else
+#endif
+		found = strstr(str, entry->literal);
+
+	if (!found)
+		return REG_NOMATCH;
+
+	if (!entry->exact)
+		return regexec(entry->compiled, str, nmatch, match, eflags);
+
+	if (nmatch && !(entry->cflags & REG_NOSUB))
+	{
+		match[0].rm_so = found - str;
+		match[0].rm_eo = match[0].rm_so + entry->literal_length;
+
+		for (i = 1; i < nmatch; ++i)
+			match[i].rm_so = match[i].rm_eo = -1;
+	}
+
+	return 0;
+}
+
+/*
+
+C<List *regexpr_matches(Locker *locker, const char *text, const regmatch_t *match)>
+
+Returns a new I<List> of the substrings of C<text> in C<match> (as filled in
+by I<regexec(3)> with 33 elements). On error, returns C<null> with C<errno>
+set appropriately.
+
+*/
+
+static List *regexpr_matches(Locker *locker, const char *text, const regmatch_t *match)
+{
+	List *ret;
+	int i;
+
+	if (!(ret = list_create_with_locker(locker, (list_release_t *)str_release)))
+		return NULL;
+
+	for (i = 0; i < 33 && match[i].rm_so != -1; ++i)
+	{
+		String *m = substr(text, (ssize_t)match[i].rm_so, (ssize_t)(match[i].rm_eo - match[i].rm_so));
+
+		if (!m)
+		{
+			list_release(ret);
+			return NULL;
+		}
+
+		if (!list_append(ret, m))
+		{
+			str_release(m);
+			list_release(ret);
+			return NULL;
+		}
+	}
+
+	return ret;
+}
+
+/*
+
+C<void regexpr_cache_child(void)>
+
+Resets the regular expression cache's lock in the child process after
+I<fork(2)>.
+
+*/
+
+static void regexpr_cache_child(void)
+{
+	pthread_mutex_init(&regexpr_cache.lock, NULL);
+}
+
+/*
+
+C<void regexpr_cache_init(void)>
+
+Registers I<regexpr_cache_child()> with I<pthread_atfork(3)>. Called once,
+the first time that the regular expression cache is used.
+
+*/
+
+static void regexpr_cache_init(void)
+{
+	pthread_atfork(NULL, NULL, regexpr_cache_child);
+}
+
+/*
+
+C<void regexpr_cache_unlink(RegexprEntry *entry)>
+
+Removes C<entry> from the regular expression cache's list. The cache must be
+locked.
+
+*/
+
+static void regexpr_cache_unlink(RegexprEntry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		regexpr_cache.head = entry->next;
+
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		regexpr_cache.tail = entry->prev;
+
+	entry->prev = entry->next = NULL;
+}
+
+/*
+
+C<void regexpr_cache_push(RegexprEntry *entry)>
+
+Adds C<entry> to the front (most recently used end) of the regular
+expression cache's list. The cache must be locked.
+
+*/
+
+static void regexpr_cache_push(RegexprEntry *entry)
+{
+	entry->prev = NULL;
+	entry->next = regexpr_cache.head;
+
+	if (regexpr_cache.head)
+		regexpr_cache.head->prev = entry;
+	else
+		regexpr_cache.tail = entry;
+
+	regexpr_cache.head = entry;
+}
+
+/*
+
+C<RegexprEntry *regexpr_cache_find(const char *pattern, int cflags, unsigned int hash)>
+
+Returns the cached entry for C<pattern> and C<cflags>, moved to the front of
+the cache's list and marked as in use. Returns C<null> if there is none. The
+cache must be locked.
+
+*/
+
+static RegexprEntry *regexpr_cache_find(const char *pattern, int cflags, unsigned int hash)
+{
+	RegexprEntry *entry;
+
+	for (entry = regexpr_cache.head; entry; entry = entry->next)
+	{
+		if (entry->hash == hash && entry->cflags == cflags && !strcmp(entry->pattern, pattern))
+		{
+			if (entry != regexpr_cache.head)
+			{
+				regexpr_cache_unlink(entry);
+				regexpr_cache_push(entry);
+			}
+
+			++entry->users;
+
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+
+C<RegexprEntry *regexpr_cache_get(const char *pattern, int cflags, int *err)>
+
+Returns the compiled form of the regular expression, C<pattern>, compiled
+with C<cflags> (as for I<regexpr_compile(3)>), from the cache. If it's not
+in the cache, compiles it and adds it, removing the least recently used
+entry if the cache is full. The entry must be returned with
+I<regexpr_cache_put()> when it is no longer needed. On error, returns
+C<null> with the error code stored in C<*err>.
+
+*/
+
+static RegexprEntry *regexpr_cache_get(const char *pattern, int cflags, int *err)
+{
+	RegexprEntry *entry, *found, *evicted = NULL;
+	unsigned int hash = regexpr_hash(pattern, cflags);
+
+	if ((*err = pthread_once(&regexpr_cache_once, regexpr_cache_init)))
+		return NULL;
+
+	pthread_mutex_lock(&regexpr_cache.lock);
+	entry = regexpr_cache_find(pattern, cflags, hash);
+	(entry) ? ++regexpr_cache.hits : ++regexpr_cache.misses;
+	pthread_mutex_unlock(&regexpr_cache.lock);
+
+	if (entry)
+		return entry;
+
+	/* Compile without holding the lock */
+
+	if (!(entry = mem_new(RegexprEntry)))
+		return *err = errno, NULL;
+
+	if (!(entry->pattern = mem_strdup(pattern)))
+	{
+		*err = errno;
+		mem_release(entry);
+		return NULL;
+	}
+
+	if ((*err = regexpr_compile(entry->compiled, pattern, cflags)))
+	{
+		mem_release(entry->pattern);
+		mem_release(entry);
+		return NULL;
+	}
+
+	entry->cflags = cflags;
+	entry->hash = hash;
+	entry->users = 1;
+	entry->cached = 1;
+	regexpr_analyse(entry);
+
+	/* Another thread may have compiled the same pattern meanwhile */
+
+	pthread_mutex_lock(&regexpr_cache.lock);
+
+	if ((found = regexpr_cache_find(pattern, cflags, hash)))
+	{
+		pthread_mutex_unlock(&regexpr_cache.lock);
+		regexpr_entry_release(entry);
+
+		return found;
+	}
+
+	regexpr_cache_push(entry);
+
+	if (++regexpr_cache.length > REGEXPR_CACHE_SIZE)
+	{
+		evicted = regexpr_cache.tail;
+		regexpr_cache_unlink(evicted);
+		evicted->cached = 0;
+		--regexpr_cache.length;
+
+		if (evicted->users)
+			evicted = NULL; /* Released by the last user */
+	}
+
+	pthread_mutex_unlock(&regexpr_cache.lock);
+
+	if (evicted)
+		regexpr_entry_release(evicted);
+
+	return entry;
+}
+
+/*
+
+C<void regexpr_cache_put(RegexprEntry *entry)>
+
+Returns C<entry>, obtained from I<regexpr_cache_get()>, to the cache. If it
+has been removed from the cache, and this was its last user, it is
+deallocated.
+
+*/
+
+static void regexpr_cache_put(RegexprEntry *entry)
+{
+	int release;
+
+	pthread_mutex_lock(&regexpr_cache.lock);
+	release = (--entry->users == 0 && !entry->cached);
+	pthread_mutex_unlock(&regexpr_cache.lock);
+
+	if (release)
+		regexpr_entry_release(entry);
+}
+
+/*
+
+=item C<List *str_regexpr(const char *pattern, const String *text, int cflags, int eflags)>
+
+I<str_regexpr(3)> is an interface to I<POSIX 1003.2>-compliant regular
+expression matching. C<pattern> is a regular expression. C<text> is the
+string to be searched for matches. C<cflags> is passed to I<regcomp(3)>
+along with C<REG_EXTENDED>. C<eflags> is passed to I<regexec(3)>. On
+success, returns a I<List> of (at most 33) I<String>s containing the
+matching substring followed by the matching substrings of any parenthesised
+subexpressions. It is the caller's responsibility to deallocate the list
+with I<list_release(3)> or I<list_destroy(3)>. On error (including no
+match), returns C<null> with C<errno> set appropriately. The compiled form
+of C<pattern> is cached (see I<regexpr_cache_stats(3)>), so calling this
+repeatedly with the same C<pattern> and C<cflags> only compiles it once. To
+avoid the cache lookup as well, use I<regexpr_compile(3)> or I<regcomp(3)>
+and I<str_regexpr_compiled(3)> or I<regexpr_compiled(3)> or I<regexec(3)>.
+
+Note: If you require perl pattern matching, you could use Philip Hazel's
+I<PCRE> package, C<ftp://ftp.cus.cam.ac.uk/pub/software/programs/pcre/> or
+link against the perl library itself.
+
+=cut
+
+*/
+
+List *str_regexpr(const char *pattern, const String *text, int cflags, int eflags)
+{
+	return str_regexpr_with_locker(NULL, pattern, text, cflags, eflags);
+}
+
+/*
+
+=item C<List *str_regexpr_unlocked(const char *pattern, const String *text, int cflags, int eflags)>
+
+Equivalent to I<str_regexpr(3)> except that C<text> is not read-locked.
+
+=cut
+
+*/
+
+List *str_regexpr_unlocked(const char *pattern, const String *text, int cflags, int eflags)
+{
+	return str_regexpr_with_locker_unlocked(NULL, pattern, text, cflags, eflags);
+}
+
+/*
+
+=item C<List *str_regexpr_with_locker(Locker *locker, const char *pattern, const String *text, int cflags, int eflags)>
+
+Equivalent to I<str_regexpr(3)> except that multiple threads accessing the
+new list will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *str_regexpr_with_locker(Locker *locker, const char *pattern, const String *text, int cflags, int eflags)
+{
+	List *ret;
+	int err;
+
+	if (!pattern || !text)
+		return set_errnull(EINVAL);
+
+	if ((err = str_rdlock(text)))
+		return set_errnull(err);
+
+	ret = str_regexpr_with_locker_unlocked(locker, pattern, text, cflags, eflags);
+
+	if ((err = str_unlock(text)))
+	{
+		list_release(ret);
+		return set_errnull(err);
+	}
+
+	return ret;
+}
+
+/*
+
+=item C<List *str_regexpr_with_locker_unlocked(Locker *locker, const char *pattern, const String *text, int cflags, int eflags)>
+
+Equivalent to I<str_regexpr_with_locker(3)> except that C<text> is not
+read-locked.
+
+=cut
+
+*/
+
+List *str_regexpr_with_locker_unlocked(Locker *locker, const char *pattern, const String *text, int cflags, int eflags)
+{
+	if (!pattern || !text)
+		return set_errnull(EINVAL);
+
+	return regexpr_with_locker(locker, pattern, text->str, cflags, eflags);
+}
+
+/*
+
+=item C<List *regexpr(const char *pattern, const char *text, int cflags, int eflags)>
+
+Equivalent to I<str_regexpr(3)> but works on an ordinary I<C> string.
+
+=cut
+
+*/
+
+List *regexpr(const char *pattern, const char *text, int cflags, int eflags)
+{
+	return regexpr_with_locker(NULL, pattern, text, cflags, eflags);
+}
+
+/*
+
+=item C<List *regexpr_with_locker(Locker *locker, const char *pattern, const char *text, int cflags, int eflags)>
+
+Equivalent to I<regexpr(3)> except that multiple threads accessing the new
+list will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *regexpr_with_locker(Locker *locker, const char *pattern, const char *text, int cflags, int eflags)
+{
+	RegexprEntry *entry;
+	regmatch_t match[33];
+	List *ret;
+	int err;
+
+	if (!pattern || !text)
+		return set_errnull(EINVAL);
+
+	if (!(entry = regexpr_cache_get(pattern, cflags, &err)))
+		return set_errnull(err);
+
+	if ((err = regexpr_entry_exec(entry, text, 33, match, eflags)))
+		ret = set_errnull(err);
+	else
+		ret = regexpr_matches(locker, text, match);
+
+	regexpr_cache_put(entry);
+
+	return ret;
+}
+
+/*
 
 =item C<int regexpr_compile(regex_t *compiled, const char *pattern, int cflags)>
 
@@ -3199,6 +4432,80 @@ void regexpr_release(regex_t *compiled)
 
 /*
 
+=item C<void regexpr_cache_stats(size_t *hits, size_t *misses, size_t *length)>
+
+I<str_regexpr(3)>, I<regexpr(3)>, I<str_regsub(3)>, I<str_regexpr_split(3)>,
+I<regexpr_split(3)> and I<regexpr_views(3)> keep the most recently used
+compiled regular expressions (up to 32 of them) in a cache that is shared by
+all threads, so that calling them repeatedly with the same pattern and
+C<cflags> only compiles the pattern once. I<regexpr_cache_stats(3)> stores
+the number of times that a pattern was found in the cache in C<*hits>, the
+number of times that a pattern had to be compiled in C<*misses>, and the
+number of patterns currently cached in C<*length>. Any of these may be
+C<null>. The counts are since the cache was last cleared with
+I<regexpr_cache_clear(3)>.
+
+=cut
+
+*/
+
+void regexpr_cache_stats(size_t *hits, size_t *misses, size_t *length)
+{
+	pthread_mutex_lock(&regexpr_cache.lock);
+
+	if (hits)
+		*hits = regexpr_cache.hits;
+
+	if (misses)
+		*misses = regexpr_cache.misses;
+
+	if (length)
+		*length = regexpr_cache.length;
+
+	pthread_mutex_unlock(&regexpr_cache.lock);
+}
+
+/*
+
+=item C<void regexpr_cache_clear(void)>
+
+Removes all compiled regular expressions from the cache and resets its
+statistics. Expressions that other threads are still using are deallocated
+when they are finished with.
+
+=cut
+
+*/
+
+void regexpr_cache_clear(void)
+{
+	RegexprEntry *entry, *next, *unused = NULL;
+
+	pthread_mutex_lock(&regexpr_cache.lock);
+
+	for (entry = regexpr_cache.head; entry; entry = next)
+	{
+		next = entry->next;
+		entry->cached = 0;
+
+		if (!entry->users)
+			entry->next = unused, unused = entry;
+	}
+
+	regexpr_cache.head = regexpr_cache.tail = NULL;
+	regexpr_cache.length = regexpr_cache.hits = regexpr_cache.misses = 0;
+
+	pthread_mutex_unlock(&regexpr_cache.lock);
+
+	for (entry = unused; entry; entry = next)
+	{
+		next = entry->next;
+		regexpr_entry_release(entry);
+	}
+}
+
+/*
+
 =item C<List *str_regexpr_compiled(const regex_t *compiled, const String *text, int eflags)>
 
 I<regexpr_compiled(3)> is an interface to the I<POSIX 1003.2> regular
@@ -3317,8 +4624,6 @@ the new list will be synchronised by C<locker>.
 List *regexpr_compiled_with_locker(Locker *locker, const regex_t *compiled, const char *text, int eflags)
 {
 	regmatch_t match[33];
-	List *ret;
-	int i;
 	int err;
 
 	if (!compiled || !text)
@@ -3327,28 +4632,7 @@ List *regexpr_compiled_with_locker(Locker *locker, const regex_t *compiled, cons
 	if ((err = regexec(compiled, text, 33, match, eflags)))
 		return set_errnull(err);
 
-	if (!(ret = list_create_with_locker(locker, (list_release_t *)str_release)))
-		return NULL;
-
-	for (i = 0; i < 33 && match[i].rm_so != -1; ++i)
-	{
-		String *m = substr(text, (ssize_t)match[i].rm_so, (ssize_t)(match[i].rm_eo - match[i].rm_so));
-
-		if (!m)
-		{
-			list_release(ret);
-			return NULL;
-		}
-
-		if (!list_append(ret, m))
-		{
-			str_release(m);
-			list_release(ret);
-			return NULL;
-		}
-	}
-
-	return ret;
+	return regexpr_matches(locker, text, match);
 }
 
 /*
@@ -3381,9 +4665,9 @@ character and a C<\E> sequence without a matching C<\L>, C<\U> or C<\Q> is
 an error. Also note that only 32 levels of nesting are supported.
 
 On success, returns C<text>. On error (including no match), returns C<null>
-with C<errno> set appropriately. Only use this function when the regular
-expression will be used only once. Otherwise, use I<regexpr_compile(3)> or
-I<regcomp(3)> and I<str_regsub_compiled(3)>.
+with C<errno> set appropriately. The compiled form of C<pattern> is cached
+(see I<regexpr_cache_stats(3)>). To avoid the cache lookup as well, use
+I<regexpr_compile(3)> or I<regcomp(3)> and I<str_regsub_compiled(3)>.
 
 =cut
 
@@ -3391,18 +4675,19 @@ I<regcomp(3)> and I<str_regsub_compiled(3)>.
 
 String *str_regsub(const char *pattern, const char *replacement, String *text, int cflags, int eflags, int all)
 {
-	regex_t compiled[1];
 	String *ret;
 	int err;
 
 	if (!pattern || !replacement || !text)
 		return set_errnull(EINVAL);
 
-	if ((err = regexpr_compile(compiled, pattern, cflags)))
+	if ((err = str_wrlock(text)))
 		return set_errnull(err);
 
-	ret = str_regsub_compiled(compiled, replacement, text, eflags, all);
-	regfree(compiled);
+	ret = str_regsub_unlocked(pattern, replacement, text, cflags, eflags, all);
+
+	if ((err = str_unlock(text)))
+		return set_errnull(err);
 
 	return ret;
 }
@@ -3419,18 +4704,24 @@ Equivalent to I<str_regsub(3)> except that C<text> is not write-locked.
 
 String *str_regsub_unlocked(const char *pattern, const char *replacement, String *text, int cflags, int eflags, int all)
 {
-	regex_t compiled[1];
+	RegexprEntry *entry;
 	String *ret;
 	int err;
 
 	if (!pattern || !replacement || !text)
 		return set_errnull(EINVAL);
 
-	if ((err = regexpr_compile(compiled, pattern, cflags)))
+	if (!(entry = regexpr_cache_get(pattern, cflags, &err)))
 		return set_errnull(err);
 
-	ret = str_regsub_compiled_unlocked(compiled, replacement, text, eflags, all);
-	regfree(compiled);
+	/* Text without the pattern's literal can't match */
+
+	if (entry->literal && !strstr(text->str, entry->literal))
+		ret = NULL;
+	else
+		ret = str_regsub_compiled_unlocked(entry->compiled, replacement, text, eflags, all);
+
+	regexpr_cache_put(entry);
 
 	return ret;
 }
@@ -3671,7 +4962,9 @@ On success, returns a new I<List> of I<String> objects. It is the caller's
 responsibility to deallocate the list with I<list_release(3)> or
 I<list_destroy(3)>. On error, returns C<null> with C<errno> set
 appropriately. Note that C<str> is interpreted as a C<nul>-terminated
-string.
+string. The line breaks are found in a single pass over C<str>, and each
+line is created at its final length, with its padding or justification, as
+soon as it is complete.
 
 B<Note:> I<str_fmt(3)> provides straightforward formatting completely
 lacking in any aesthetic sensibilities. If you need awesome paragraph
@@ -3771,188 +5064,220 @@ List *fmt(const char *str, size_t line_width, StringAlignment alignment)
 
 /*
 
-=item C<List *fmt_with_locker(Locker *locker, const char *str, size_t line_width, StringAlignment alignment)>
+C<StringView view_make(const char *str, size_t length)>
 
-Equivalent to I<fmt(3)> except that multiple threads accessing the new list
-will be synchronised by C<locker>.
+Returns a I<StringView> of the C<length> characters starting at C<str>.
 
-=cut
+*/
+
+static StringView view_make(const char *str, size_t length)
+{
+	StringView view;
+
+	view.str = str;
+	view.length = length;
+
+	return view;
+}
+
+/*
+
+C<String *fmt_line(StringView line, size_t words, size_t length, size_t line_width, StringAlignment alignment, int last)>
+
+Creates one line of output for I<fmt_with_locker(3)>. C<line> starts at the
+first of C<words> words and ends at the end of the last one, with any amount
+of whitespace between them. C<length> is the length of the words with a
+single space between each. The line is padded or justified according to
+C<alignment>, C<line_width> and C<last> (the last line of a paragraph is
+not fully justified), and written directly into a new I<String> of exactly
+the right length. On success, returns the new string. On error, returns
+C<null> with C<errno> set appropriately.
 
 */
 
-List *fmt_with_locker(Locker *locker, const char *str, size_t line_width, StringAlignment alignment)
+static String *fmt_line(StringView line, size_t words, size_t length, size_t line_width, StringAlignment alignment, int last)
 {
-	List *para;
-	String *line = NULL;
-	const char *s, *r;
-	ssize_t len;
+	String *ret;
+	const char *s, *r, *end;
+	size_t pad = 0, extra = 0, gaps = words ? words - 1 : 0;
+	char *p;
 
-	if (!str)
-		return set_errnull(EINVAL);
+	if (length < line_width)
+	{
+		if (alignment == ALIGN_RIGHT)
+			pad = line_width - length;
+		else if (alignment == ALIGN_CENTRE)
+			pad = (line_width - length) / 2;
+		else if (alignment == ALIGN_FULL && !last && gaps)
+			extra = line_width - length;
+	}
+
+	if (!(ret = str_create_sized(pad + length + extra + 1, NULL)))
+		return NULL;
+
+	p = ret->str;
+	memset(p, ' ', pad);
+	p += pad;
 
-	switch (alignment)
+	for (s = line.str, end = s + line.length; s < end; )
 	{
-		case ALIGN_LEFT:
-		case ALIGN_RIGHT:
-		case ALIGN_FULL:
+		for (r = s; r < end && !is_space(*r); ++r)
+		{}
+
+		memcpy(p, s, r - s);
+		p += r - s;
+
+		if (r == end)
+			break;
+
+		/* Spread the extra spaces as evenly as possible, more towards the end */
+
+		*p++ = ' ';
+
+		if (extra)
 		{
-			if (!(para = list_create_with_locker(locker, (list_release_t *)str_release)))
-				return NULL;
+			size_t gap = extra / gaps--;
 
-			for (s = str; *s; ++s)
-			{
-				while (is_space(*s))
-					++s;
+			memset(p, ' ', gap);
+			p += gap;
+			extra -= gap;
+		}
 
-				for (r = s; *r && !is_space(*r); ++r)
-				{}
+		for (s = r; s < end && is_space(*s); ++s)
+		{}
+	}
 
-				if (r > s)
-				{
-					if ((len = str_length(line)) == -1)
-						++len;
+	*p = '\0';
+	ret->length = p - ret->str + 1;
 
-					if (len + (len != 0) + (r - s) > line_width)
-					{
-						if (len && !list_append(para, line))
-						{
-							str_release(line);
-							list_release(para);
-							return NULL;
-						}
+	return ret;
+}
 
-						line = NULL;
-					}
+/*
 
-					if (!line)
-					{
-						if (!(line = str_create_sized(line_width, "%.*s", r - s, s)))
-						{
-							list_release(para);
-							return NULL;
-						}
-					}
-					else if (!str_append(line, " %.*s", r - s, s))
-					{
-						str_release(line);
-						list_release(para);
-						return NULL;
-					}
+C<int fmt_append(List *para, StringView line, size_t words, size_t length, size_t line_width, StringAlignment alignment, int last)>
 
-					s = r;
+Appends a line, created by I<fmt_line()>, to C<para>. On success, returns
+C<0>. On error, returns C<-1> with C<errno> set appropriately.
 
-					if (!*s)
-						--s;
-				}
-			}
+*/
 
-			if (str_length(line) > 0 && !list_append(para, line))
-			{
-				str_release(line);
-				list_release(para);
-				return NULL;
-			}
+static int fmt_append(List *para, StringView line, size_t words, size_t length, size_t line_width, StringAlignment alignment, int last)
+{
+	String *str;
 
-			if (alignment == ALIGN_RIGHT)
-			{
-				while (list_has_next(para) == 1)
-				{
-					line = (String *)list_next(para);
-					len = str_length(line);
+	if (!(str = fmt_line(line, words, length, line_width, alignment, last)))
+		return -1;
 
-					if (len >= line_width)
-						continue;
+	if (!list_append(para, str))
+	{
+		str_release(str);
+		return -1;
+	}
 
-					if (!str_prepend(line, "%*s", line_width - len, ""))
-					{
-						list_release(para);
-						return NULL;
-					}
-				}
-			}
-			else if (alignment == ALIGN_FULL)
-			{
-				ssize_t lines;
-				int i;
+	return 0;
+}
 
-				if ((lines = list_length(para)) == -1)
-				{
-					list_release(para);
-					return NULL;
-				}
+/*
 
-				for (i = 0; i < lines - 1; ++i)
-				{
-					size_t extra;
-					size_t gaps;
+=item C<List *fmt_with_locker(Locker *locker, const char *str, size_t line_width, StringAlignment alignment)>
 
-					line = (String *)list_item(para, i);
-					len = str_length(line);
+Equivalent to I<fmt(3)> except that multiple threads accessing the new list
+will be synchronised by C<locker>.
 
-					if (len >= line_width)
-						continue;
+=cut
 
-					extra = line_width - len;
-					gaps = 0;
+*/
 
-					for (s = line->str; *s; ++s)
-						if (*s == ' ')
-							++gaps;
+List *fmt_with_locker(Locker *locker, const char *str, size_t line_width, StringAlignment alignment)
+{
+	List *para;
+	const char *s, *r, *start = NULL, *end = NULL;
+	size_t words = 0, length = 0;
 
-					for (s = line->str; gaps && *s; ++s)
-					{
-						if (*s == ' ')
-						{
-							int gap = extra / gaps;
+	if (!str || (ssize_t)line_width < 0)
+		return set_errnull(EINVAL);
 
-							if (!str_insert(line, s - line->str, "%*s", gap, ""))
-							{
-								list_release(para);
-								return NULL;
-							}
+	if (alignment != ALIGN_LEFT && alignment != ALIGN_RIGHT && alignment != ALIGN_FULL && alignment != ALIGN_CENTRE)
+		return set_errnull(EINVAL);
 
-							extra -= gap;
-							--gaps;
-							s += gap;
-						}
-					}
-				}
-			}
+	if (!(para = list_create_with_locker(locker, (list_release_t *)str_release)))
+		return NULL;
 
-			break;
-		}
+	/*
+	** Lay out the lines in a single pass over the words in str. Each line is
+	** only materialised (at its exact length) once it is known where it
+	** ends. Centred lines end at each sequence of newlines rather than
+	** being wrapped.
+	*/
 
-		case ALIGN_CENTRE:
+	s = str;
+
+	if (alignment == ALIGN_CENTRE)
+	{
+		while (*s == '\n')
+			++s;
+
+		if (*s)
+			start = end = s;
+	}
+
+	for (;; s = r)
+	{
+		while (is_space(*s) && !(alignment == ALIGN_CENTRE && *s == '\n'))
+			++s;
+
+		if (alignment == ALIGN_CENTRE && (*s == '\n' || !*s))
 		{
-			if (!(para = split_with_locker(locker, str, "\n")))
+			if (start && fmt_append(para, view_make(start, end - start), words, length, line_width, alignment, 1) == -1)
+			{
+				list_release(para);
 				return NULL;
+			}
 
-			while (list_has_next(para) == 1)
-			{
-				size_t extra;
-				line = (String *)list_next(para);
-				str_squeeze(line);
-				len = str_length(line);
+			while (*s == '\n')
+				++s;
 
-				if (len >= line_width)
-					continue;
+			if (!*s)
+				break;
 
-				extra = (line_width - len) / 2;
+			/* Lines of nothing but whitespace are kept (as padding) */
 
-				if (extra && !str_prepend(line, "%*s", extra, ""))
-				{
-					list_release(para);
-					return NULL;
-				}
-			}
+			start = end = s, words = length = 0;
+			r = s;
+			continue;
+		}
 
+		if (!*s)
 			break;
-		}
 
-		default:
+		for (r = s; *r && !is_space(*r); ++r)
+		{}
+
+		if (words && alignment != ALIGN_CENTRE && length + 1 + (r - s) > line_width)
 		{
-			return set_errnull(EINVAL);
+			if (fmt_append(para, view_make(start, end - start), words, length, line_width, alignment, 0) == -1)
+			{
+				list_release(para);
+				return NULL;
+			}
+
+			words = 0;
 		}
+
+		if (!words)
+			start = s, length = r - s;
+		else
+			length += 1 + (r - s);
+
+		++words;
+		end = r;
+	}
+
+	if (alignment != ALIGN_CENTRE && words && fmt_append(para, view_make(start, end - start), words, length, line_width, alignment, 1) == -1)
+	{
+		list_release(para);
+		return NULL;
 	}
 
 	return para;
@@ -3976,7 +5301,8 @@ On error, returns C<null> with C<errno> set appropriately.
 static List *do_split_with_locker(Locker *locker, const char *str, ssize_t length, const char *delim)
 {
 	List *ret;
-	const char *s, *r;
+	ScanSet set;
+	const char *s, *r, *end;
 
 	if (!str || !delim)
 		return set_errnull(EINVAL);
@@ -3984,40 +5310,34 @@ static List *do_split_with_locker(Locker *locker, const char *str, ssize_t lengt
 	if (!(ret = list_create_with_locker(locker, (list_release_t *)str_release)))
 		return NULL;
 
-	for (s = str; (length == -1) ? *s : s - str < length; ++s)
+	if (length == -1)
+		length = strlen(str);
+
+	scan_set_init(&set, delim);
+
+	for (s = str, end = str + length; s < end; s = r)
 	{
-		while ((length == -1) ? (*s && strchr(delim, *s)) : (s - str < length && (*s && strchr(delim, *s))))
-			++s;
+		String *token;
 
-		if (!*delim)
-			r = s + 1;
-		else
-			for (r = s; (length == -1) ? (*r && !strchr(delim, *r)) : (r - str < length && (!*r || !strchr(delim, *r))); ++r)
-			{}
+		s += scan_set(&set, s, end - s, 0);
 
-		if (r > s)
-		{
-			String *token = substr(s, 0, r - s);
-			if (!token)
-			{
-				list_release(ret);
-				return NULL;
-			}
+		if (s == end)
+			break;
 
-			if (!list_append(ret, token))
-			{
-				str_release(token);
-				list_release(ret);
-				return NULL;
-			}
+		r = (*delim) ? s + scan_set(&set, s, end - s, 1) : s + 1;
 
-			s = r;
-			if (!*delim)
-				--s;
+		if (!(token = substr(s, 0, r - s)))
+		{
+			list_release(ret);
+			return NULL;
 		}
 
-		if ((length == -1) ? !*s : (s - str == length))
-			break;
+		if (!list_append(ret, token))
+		{
+			str_release(token);
+			list_release(ret);
+			return NULL;
+		}
 	}
 
 	return ret;
@@ -4263,7 +5583,7 @@ List *regexpr_split_with_locker(Locker *locker, const char *str, const char *del
 {
 	List *ret;
 	String *token;
-	regex_t compiled[1];
+	RegexprEntry *entry;
 	regmatch_t match[1];
 	int start, matches;
 	int err;
@@ -4271,18 +5591,18 @@ List *regexpr_split_with_locker(Locker *locker, const char *str, const char *del
 	if (!str || !delim)
 		return set_errnull(EINVAL);
 
-	if ((err = regexpr_compile(compiled, delim, cflags)))
+	if (!(entry = regexpr_cache_get(delim, cflags, &err)))
 		return set_errnull(err);
 
 	if (!(ret = list_create_with_locker(locker, (list_release_t *)str_release)))
 	{
-		regfree(compiled);
+		regexpr_cache_put(entry);
 		return NULL;
 	}
 
 	for (start = 0, matches = 0; str[start]; ++matches)
 	{
-		if (regexec(compiled, str + start, 1, match, eflags))
+		if (regexpr_entry_exec(entry, str + start, 1, match, eflags))
 			break;
 
 		/* Zero length match (at every position), make a token of each character */
@@ -4300,7 +5620,7 @@ List *regexpr_split_with_locker(Locker *locker, const char *str, const char *del
 			if (!(token = substr(str, start, (ssize_t)match[0].rm_so)))
 			{
 				list_release(ret);
-				regfree(compiled);
+				regexpr_cache_put(entry);
 				return NULL;
 			}
 
@@ -4308,7 +5628,7 @@ List *regexpr_split_with_locker(Locker *locker, const char *str, const char *del
 			{
 				str_release(token);
 				list_release(ret);
-				regfree(compiled);
+				regexpr_cache_put(entry);
 				return NULL;
 			}
 		}
@@ -4323,7 +5643,7 @@ List *regexpr_split_with_locker(Locker *locker, const char *str, const char *del
 		if (!(token = str_create("%s", str + start)))
 		{
 			list_release(ret);
-			regfree(compiled);
+			regexpr_cache_put(entry);
 			return NULL;
 		}
 
@@ -4331,12 +5651,12 @@ List *regexpr_split_with_locker(Locker *locker, const char *str, const char *del
 		{
 			str_release(token);
 			list_release(ret);
-			regfree(compiled);
+			regexpr_cache_put(entry);
 			return NULL;
 		}
 	}
 
-	regfree(compiled);
+	regexpr_cache_put(entry);
 	return ret;
 }
 
@@ -4344,10 +5664,143 @@ List *regexpr_split_with_locker(Locker *locker, const char *str, const char *del
 
 /*
 
+C<int join_bytes(String *str, const char *bytes, size_t length)>
+
+Appends the C<length> bytes at C<bytes> to C<str>. I<do_join_with_locker()>
+reserves exactly enough space beforehand, so this is normally just a copy.
+On success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
+
+*/
+
+static int join_bytes(String *str, const char *bytes, size_t length)
+{
+	if (grow(str, length) == -1)
+		return -1;
+
+	memcpy(str->str + str->length - 1, bytes, length);
+	str->length += length;
+	str->str[str->length - 1] = '\0';
+
+	return 0;
+}
+
+/*
+
+C<size_t join_item(const void *item, int strings, const char **bytes)>
+
+Returns the length of the C<list> item C<item> for I<do_join_with_locker()>
+and points C<*bytes> at its characters. If C<strings> is non-zero, C<item>
+is a I<String>, which the caller must have read-locked. Otherwise, it is an
+ordinary I<C> string. A C<null> item has no characters.
+
+*/
+
+static size_t join_item(const void *item, int strings, const char **bytes)
+{
+	if (!item)
+	{
+		*bytes = "";
+		return 0;
+	}
+
+	if (strings)
+	{
+		const String *str = item;
+
+		*bytes = str->str;
+		return str->length - 1;
+	}
+
+	*bytes = item;
+	return strlen(*bytes);
+}
+
+/*
+
+C<String *do_join_with_locker(Locker *locker, const List *list, const char *delim, int strings)>
+
+Joins the items in C<list> (which the caller has read-locked, if
+necessary) with C<delim> inserted between each one. If C<strings> is
+non-zero, the items are I<String> objects, each of which is read-locked
+while it is used. Otherwise, they are ordinary I<C> strings. The total
+length is measured first, so that the result is allocated once, and each
+item is then copied directly into it. On success, returns the resulting
+I<String>. If C<locker> is non-C<null>, multiple threads accessing the new
+string will be synchronised by C<locker>. On error, returns C<null> with
+C<errno> set appropriately.
+
+*/
+
+static String *do_join_with_locker(Locker *locker, const List *list, const char *delim, int strings)
+{
+	String *ret;
+	const char *bytes;
+	size_t total = 0, dlen;
+	ssize_t count, i;
+	int err;
+
+	if ((count = list_length_unlocked(list)) == -1)
+		return NULL;
+
+	dlen = (delim) ? strlen(delim) : 0;
+
+	for (i = 0; i < count; ++i)
+	{
+		const void *item = list_item_unlocked(list, i);
+
+		if (strings && item && (err = str_rdlock((const String *)item)))
+			return set_errnull(err);
+
+		total += join_item(item, strings, &bytes) + (i ? dlen : 0);
+
+		if (strings && item)
+			str_unlock((const String *)item);
+	}
+
+	if (!(ret = str_create_with_locker_sized(locker, total + 1, NULL)))
+		return NULL;
+
+	for (i = 0; i < count; ++i)
+	{
+		const void *item = list_item_unlocked(list, i);
+		size_t length;
+
+		if (i && dlen && join_bytes(ret, delim, dlen) == -1)
+		{
+			str_release(ret);
+			return NULL;
+		}
+
+		if (strings && item && (err = str_rdlock((const String *)item)))
+		{
+			str_release(ret);
+			return set_errnull(err);
+		}
+
+		length = join_item(item, strings, &bytes);
+		err = (length && join_bytes(ret, bytes, length) == -1);
+
+		if (strings && item)
+			str_unlock((const String *)item);
+
+		if (err)
+		{
+			str_release(ret);
+			return NULL;
+		}
+	}
+
+	return ret;
+}
+
+/*
+
 =item C<String *str_join(const List *list, const char *delim)>
 
 Joins the I<String> objects in C<list> with C<delim> inserted between each
-one. On success, returns the resulting I<String>. It is the caller's
+one. The length of the result is measured first, so that it is only
+allocated once. On success, returns the resulting I<String>. It is the caller's
 responsibility to deallocate the string with I<str_release(3)> or
 I<str_destroy(3)>. On error, returns C<null> with C<errno> set
 appropriately.
@@ -4419,55 +5872,7 @@ read-locked.
 
 String *str_join_with_locker_unlocked(Locker *locker, const List *list, const char *delim)
 {
-	String *ret;
-	String *del;
-	Lister *lister;
-	int i;
-
-	if (!list)
-		return set_errnull(EINVAL);
-
-	if (!(ret = str_create_with_locker(locker, NULL)))
-		return NULL;
-
-	if (!(del = str_create(delim ? "%s" : NULL, delim)))
-	{
-		str_release(ret);
-		return NULL;
-	}
-
-	if (!(lister = lister_create_unlocked(list)))
-	{
-		str_release(ret);
-		str_release(del);
-		return NULL;
-	}
-
-	for (i = 0; lister_has_next(lister) == 1; ++i)
-	{
-		String *s = (String *)lister_next(lister);
-
-		if (i && !str_append_str(ret, del))
-		{
-			str_release(ret);
-			str_release(del);
-			lister_release_unlocked(lister);
-			return NULL;
-		}
-
-		if (s && !str_append_str(ret, s))
-		{
-			str_release(ret);
-			str_release(del);
-			lister_release_unlocked(lister);
-			return NULL;
-		}
-	}
-
-	str_release(del);
-	lister_release_unlocked(lister);
-
-	return ret;
+	return do_join_with_locker(locker, list, delim, 1);
 }
 
 /*
@@ -4499,52 +5904,18 @@ string will be synchronised by C<locker>.
 String *join_with_locker(Locker *locker, const List *list, const char *delim)
 {
 	String *ret;
-	String *del;
-	Lister *lister;
-	int i;
+	int err;
 
 	if (!list)
 		return set_errnull(EINVAL);
 
-	if (!(ret = str_create_with_locker(locker, NULL)))
-		return NULL;
-
-	if (!(del = str_create(delim ? "%s" : NULL, delim)))
-	{
-		str_release(ret);
-		return NULL;
-	}
-
-	if (!(lister = lister_create((List *)list)))
-	{
-		str_release(ret);
-		str_release(del);
-		return NULL;
-	}
-
-	for (i = 0; lister_has_next(lister) == 1; ++i)
-	{
-		char *s = (char *)lister_next(lister);
-
-		if (i && !str_append_str(ret, del))
-		{
-			str_release(ret);
-			str_release(del);
-			lister_release(lister);
-			return NULL;
-		}
+	if ((err = list_rdlock(list)))
+		return set_errnull(err);
 
-		if (s && !str_append(ret, "%s", s))
-		{
-			str_release(ret);
-			str_release(del);
-			lister_release(lister);
-			return NULL;
-		}
-	}
+	ret = do_join_with_locker(locker, list, delim, 0);
 
-	str_release(del);
-	lister_release(lister);
+	if ((err = list_unlock(list)))
+		return set_errnull(err);
 
 	return ret;
 }
@@ -4919,6 +6290,41 @@ char *trim_right(char *str)
 
 /*
 
+C<static size_t do_squeeze(char *str, size_t length)>
+
+Removes leading and trailing whitespace from the C<length> bytes at C<str>
+and replaces all other sequences of whitespace with a single space. Returns
+the new length. The result is not C<nul>-terminated.
+
+*/
+
+static size_t do_squeeze(char *str, size_t length)
+{
+	char *s, *r, *end;
+	size_t run;
+
+	for (r = s = str, end = str + length; s < end; s += run, r += run)
+	{
+		while (s < end && is_space(*s))
+			++s;
+
+		if (s == end)
+			break;
+
+		if (r > str)
+			*r++ = ' ';
+
+		run = scan_set(&scan_space, s, end - s, 1);
+
+		if (r != s)
+			memmove(r, s, run);
+	}
+
+	return r - str;
+}
+
+/*
+
 =item C<String *str_squeeze(String *str)>
 
 Trims leading and trailing whitespace from C<str> and replaces all other
@@ -4960,28 +6366,15 @@ Equivalent to I<str_squeeze(3)> except that C<str> is not write-locked.
 
 String *str_squeeze_unlocked(String *str)
 {
-	char *s, *r;
-	int started = 0;
-	int was_space = 0;
+	size_t length;
 
 	if (!str)
 		return set_errnull(EINVAL);
 
-	for (r = s = str->str; s - str->str < str->length - 1; ++s)
-	{
-		if (!is_space(*s))
-		{
-			if (was_space && started)
-				*r++ = ' ';
-			*r++ = *s;
-			started = 1;
-		}
-
-		was_space = is_space(*s);
-	}
+	length = do_squeeze(str->str, str->length - 1);
 
-	if (r - str->str < str->length)
-		if (!str_remove_range_unlocked(str, r - str->str, str->length - 1 - (r - str->str)))
+	if (length < str->length - 1)
+		if (!str_remove_range_unlocked(str, length, str->length - 1 - length))
 			return NULL;
 
 	return str;
@@ -4999,29 +6392,58 @@ Equivalent to I<str_squeeze(3)> but works on an ordinary I<C> string.
 
 char *squeeze(char *str)
 {
-	char *s, *r;
-	int started = 0;
-	int was_space = 0;
-
 	if (!str)
 		return set_errnull(EINVAL);
 
-	for (r = s = str; *s; ++s)
+	str[do_squeeze(str, strlen(str))] = '\0';
+
+	return str;
+}
+
+/*
+
+C<static String *do_quote_with_locker(Locker *locker, const char *str, size_t length, const char *quotable, char quote_char)>
+
+Performs quoting as described in I<str_quote(3)> on the C<length> bytes at
+C<str>. The quotable characters are counted first so that the new string is
+allocated once.
+
+*/
+
+static String *do_quote_with_locker(Locker *locker, const char *str, size_t length, const char *quotable, char quote_char)
+{
+	String *ret;
+	ScanSet set;
+	const char *s, *end = str + length;
+	char *r;
+	size_t quotes, run;
+
+	scan_set_init(&set, quotable);
+
+	for (quotes = 0, s = str; (s += scan_set(&set, s, end - s, 1)) < end; ++s)
+		++quotes;
+
+	if (!(ret = str_create_with_locker_sized(locker, length + quotes + 1, NULL)))
+		return NULL;
+
+	for (r = ret->str, s = str; ; )
 	{
-		if (!is_space(*s))
-		{
-			if (was_space && started)
-				*r++ = ' ';
-			*r++ = *s;
-			started = 1;
-		}
+		run = scan_set(&set, s, end - s, 1);
+		memcpy(r, s, run);
+		r += run;
+		s += run;
+
+		if (s == end)
+			break;
 
-		was_space = is_space(*s);
+		*r++ = quote_char;
+		*r++ = *s++;
 	}
 
 	*r = '\0';
+	ret->length = r - ret->str + 1;
 
-	return str;
+	return ret;
 }
 
 /*
@@ -5108,28 +6530,10 @@ read-locked.
 
 String *str_quote_with_locker_unlocked(Locker *locker, const String *str, const char *quotable, char quote_char)
 {
-	String *ret;
-	size_t i;
-
 	if (!str || !quotable)
 		return set_errnull(EINVAL);
 
-	if (!(ret = str_copy_with_locker_unlocked(locker, str)))
-		return NULL;
-
-	for (i = 0; i < ret->length - 1; ++i)
-	{
-		if (ret->str[i] && strchr(quotable, ret->str[i]))
-		{
-			if (!str_insert(ret, i++, "%c", quote_char))
-			{
-				str_release(ret);
-				return NULL;
-			}
-		}
-	}
-
-	return ret;
+	return do_quote_with_locker(locker, str->str, str->length - 1, quotable, quote_char);
 }
 
 /*
@@ -5160,28 +6564,10 @@ string will be synchronised by C<locker>.
 
 String *quote_with_locker(Locker *locker, const char *str, const char *quotable, char quote_char)
 {
-	String *ret;
-	size_t i;
-
 	if (!str || !quotable)
 		return set_errnull(EINVAL);
 
-	if (!(ret = str_create_with_locker(locker, "%s", str)))
-		return NULL;
-
-	for (i = 0; i < ret->length - 1; ++i)
-	{
-		if (strchr(quotable, ret->str[i]))
-		{
-			if (!str_insert(ret, i++, "%c", quote_char))
-			{
-				str_release(ret);
-				return NULL;
-			}
-		}
-	}
-
-	return ret;
+	return do_quote_with_locker(locker, str, strlen(str), quotable, quote_char);
 }
 
 /*
@@ -5356,8 +6742,12 @@ static String *do_encode_with_locker(Locker *locker, const char *str, size_t len
 {
 	static const char hex[] = "0123456789abcdef";
 	String *encoded;
+	ScanSet set;
 	const char *target;
-	const char *s;
+	const char *s, *end = str + length;
+	char *r;
+	size_t run;
+	int c;
 
 	if (!str || !uncoded || !coded)
 		return set_errnull(EINVAL);
@@ -5365,34 +6755,44 @@ static String *do_encode_with_locker(Locker *locker, const char *str, size_t len
 	if (!(encoded = str_create_with_locker_sized(locker, length * 4 + 1, "")))
 		return NULL;
 
-	for (s = str; s - str < length; ++s)
+	/* The characters that need encoding (non-printable ones are below 0x20, 0x7f or from 0x80) */
+
+	scan_set_init(&set, uncoded);
+
+	if (printable)
+	{
+		for (c = 0; c < CHARSET; ++c)
+			if (!is_print(c))
+				set.member[c] = 1;
+
+		set.high = set.ctrl = 1;
+	}
+
+	for (r = encoded->str, s = str; ; ++s)
 	{
+		run = scan_set(&set, s, end - s, 1);
+		memcpy(r, s, run);
+		r += run;
+		s += run;
+
+		if (s == end)
+			break;
+
+		*r++ = quote_char;
+
 		if (*s && (target = strchr(uncoded, (unsigned char)*s)))
-		{
-			if (!str_append(encoded, "%c%c", (unsigned char)quote_char, coded[target - uncoded]))
-			{
-				str_release(encoded);
-				return NULL;
-			}
-		}
-		else if (printable && !is_print(*s))
-		{
-			if (!str_append(encoded, "%cx%c%c", (unsigned char)quote_char, hex[(unsigned char)*s >> 4], hex[(unsigned char)*s & 0x0f]))
-			{
-				str_release(encoded);
-				return NULL;
-			}
-		}
+			*r++ = coded[target - uncoded];
 		else
 		{
-			if (!str_append(encoded, "%c", (unsigned char)*s))
-			{
-				str_release(encoded);
-				return NULL;
-			}
+			*r++ = 'x';
+			*r++ = hex[(unsigned char)*s >> 4];
+			*r++ = hex[(unsigned char)*s & 0x0f];
 		}
 	}
 
+	*r = '\0';
+	encoded->length = r - encoded->str + 1;
+
 	return encoded;
 }
 
@@ -5419,11 +6819,7 @@ static String *do_decode_with_locker(Locker *locker, const char *str, size_t len
 
 	for (start = str; start - str < length; start = slosh + 1)
 	{
-		for (slosh = start; slosh - str < length; ++slosh)
-			if (*slosh == quote_char)
-				break;
-
-		if (slosh - str == length)
+		if (!(slosh = memchr(start, quote_char, length - (start - str))))
 			break;
 
 		if (printable)
@@ -6022,59 +7418,326 @@ String *str_ucfirst(String *str)
 
 /*
 
-=item C<String *str_ucfirst_unlocked(String *str)>
+=item C<String *str_ucfirst_unlocked(String *str)>
+
+Equivalent to I<str_ucfirst(3)> except that C<str> is not write-locked.
+
+=cut
+
+*/
+
+String *str_ucfirst_unlocked(String *str)
+{
+	if (!str)
+		return set_errnull(EINVAL);
+
+	if (str->length > 1)
+		*str->str = to_upper(*str->str);
+
+	return str;
+}
+
+/*
+
+=item C<char *ucfirst(char *str)>
+
+Converts the first character in C<str> into upper case. On success, returns
+C<str>. On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+char *ucfirst(char *str)
+{
+	if (!str)
+		return set_errnull(EINVAL);
+
+	*str = to_upper(*str);
+
+	return str;
+}
+
+/*
+
+=item C<int str_chop(String *str)>
+
+Removes a character from the end of C<str>. On success, returns the
+character that was removed. On error, returns C<-1> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+int str_chop(String *str)
+{
+	int ret;
+	int err;
+
+	if (!str)
+		return set_errno(EINVAL);
+
+	if ((err = str_wrlock(str)))
+		return set_errno(err);
+
+	ret = str_chop_unlocked(str);
+
+	if ((err = str_unlock(str)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int str_chop_unlocked(String *str)>
+
+Equivalent to I<str_chop(3)> except that C<str> is not write-locked.
+
+=cut
+
+*/
+
+int str_chop_unlocked(String *str)
+{
+	int ret;
+
+	if (!str)
+		return set_errno(EINVAL);
+
+	if (str->length == 1)
+		return set_errno(EINVAL);
+
+	ret = str->str[str->length - 2];
+
+	if (contract(str, str->length - 2, 1) == -1)
+		return -1;
+
+	return ret;
+}
+
+/*
+
+=item C<int chop(char *str)>
+
+Removes a character from the end of C<str>. On success, returns the
+character that was removed. On error, returns C<-1> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+int chop(char *str)
+{
+	int ret;
+
+	if (!str || !*str)
+		return set_errno(EINVAL);
+
+	while (str[1])
+		++str;
+
+	ret = (int)*str;
+	*str = '\0';
+
+	return ret;
+}
+
+/*
+
+=item C<int str_chomp(String *str)>
+
+Removes line ending characters (i.e. C<'\n'> and C<'\r'>) from the end of
+C<str>. On success, returns the number of characters that were removed. On
+error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int str_chomp(String *str)
+{
+	int ret;
+	int err;
+
+	if (!str)
+		return set_errno(EINVAL);
+
+	if ((err = str_wrlock(str)))
+		return set_errno(err);
+
+	ret = str_chomp_unlocked(str);
+
+	if ((err = str_unlock(str)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int str_chomp_unlocked(String *str)>
+
+Equivalent to I<str_chomp(3)> except that C<str> is not write-locked.
+
+=cut
+
+*/
+
+int str_chomp_unlocked(String *str)
+{
+	char *s;
+	size_t length;
+
+	if (!str)
+		return set_errno(EINVAL);
+
+	if (str->length == 1)
+		return 0;
+
+	length = str->length;
+
+	for (s = str->str + str->length - 2; *s == '\n' || *s == '\r'; --s)
+	{
+		if (contract(str, str->length - 2, 1) == -1)
+			return -1;
+	}
+
+	return length - str->length;
+}
+
+/*
+
+=item C<int chomp(char *str)>
+
+Removes line ending characters (i.e. C<'\n'> and C<'\r'>) from the end of
+C<str>. On success, returns the number of characters that were removed. On
+error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int chomp(char *str)
+{
+	char *s;
+
+	if (!str)
+		return set_errno(EINVAL);
+
+	if (str[0] == '\0')
+		return 0;
+
+	while (str[1])
+		++str;
+
+	for (s = str; *s == '\n' || *s == '\r'; --s)
+		*s = '\0';
+
+	return str - s;
+}
+
+/*
+
+=item C<int str_bin(const String *str)>
+
+Returns the integer specified by the binary string, C<str>. C<str> can
+either be a string of C<[0-1]>, or C<"0b"> followed by a string of C<[0-1]>.
+On error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int str_bin(const String *str)
+{
+	int ret;
+	int err;
+
+	if (!str)
+		return set_errno(EINVAL);
+
+	if ((err = str_rdlock(str)))
+		return set_errno(err);
+
+	ret = str_bin_unlocked(str);
+
+	if ((err = str_unlock(str)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int str_bin_unlocked(const String *str)>
 
-Equivalent to I<str_ucfirst(3)> except that C<str> is not write-locked.
+Equivalent to I<str_bin(3)> except that C<str> is not read-locked.
 
 =cut
 
 */
 
-String *str_ucfirst_unlocked(String *str)
+int str_bin_unlocked(const String *str)
 {
 	if (!str)
-		return set_errnull(EINVAL);
-
-	if (str->length > 1)
-		*str->str = to_upper(*str->str);
+		return set_errno(EINVAL);
 
-	return str;
+	return bin(str->str);
 }
 
 /*
 
-=item C<char *ucfirst(char *str)>
+=item C<int bin(const char *str)>
 
-Converts the first character in C<str> into upper case. On success, returns
-C<str>. On error, returns C<null> with C<errno> set appropriately.
+Returns the integer specified by the binary string, C<str>. C<str> can
+either be a string of C<[0-1]>, or C<"0b"> followed by a string of C<[0-1]>.
+On error, returns C<-1> with C<errno> set appropriately.
 
 =cut
 
 */
 
-char *ucfirst(char *str)
+int bin(const char *str)
 {
+	unsigned int ret = 0;
+
 	if (!str)
-		return set_errnull(EINVAL);
+		return set_errno(EINVAL);
 
-	*str = to_upper(*str);
+	if (str[0] == '0' && str[1] == 'b')
+		str += 2;
 
-	return str;
+	for (; *str; ++str)
+	{
+		ret <<= 1;
+
+		switch (*str)
+		{
+			case '0': break;
+			case '1': ret |= 1; break;
+			default:  return set_errno(EINVAL);
+		}
+	}
+
+	return (int)ret;
 }
 
 /*
 
-=item C<int str_chop(String *str)>
+=item C<int str_hex(const String *str)>
 
-Removes a character from the end of C<str>. On success, returns the
-character that was removed. On error, returns C<-1> with C<errno> set
-appropriately.
+Returns the integer specified by the hexadecimal string, C<str>. C<str> can
+either be a string of C<[0-9a-fA-F]>, or C<"0x"> followed by a string of
+C<[0-9a-fA-f]>. On error, returns C<-1> with C<errno> set appropriately.
 
 =cut
 
 */
 
-int str_chop(String *str)
+int str_hex(const String *str)
 {
 	int ret;
 	int err;
@@ -6082,10 +7745,10 @@ int str_chop(String *str)
 	if (!str)
 		return set_errno(EINVAL);
 
-	if ((err = str_wrlock(str)))
+	if ((err = str_rdlock(str)))
 		return set_errno(err);
 
-	ret = str_chop_unlocked(str);
+	ret = str_hex_unlocked(str);
 
 	if ((err = str_unlock(str)))
 		return set_errno(err);
@@ -6095,73 +7758,83 @@ int str_chop(String *str)
 
 /*
 
-=item C<int str_chop_unlocked(String *str)>
+=item C<int str_hex_unlocked(const String *str)>
 
-Equivalent to I<str_chop(3)> except that C<str> is not write-locked.
+Equivalent to I<str_hex(3)> except that C<str> is not read-locked.
 
 =cut
 
 */
 
-int str_chop_unlocked(String *str)
+int str_hex_unlocked(const String *str)
 {
-	int ret;
-
 	if (!str)
 		return set_errno(EINVAL);
 
-	if (str->length == 1)
-		return set_errno(EINVAL);
-
-	ret = str->str[str->length - 2];
-
-	if (contract(str, str->length - 2, 1) == -1)
-		return -1;
-
-	return ret;
+	return hex(str->str);
 }
 
 /*
 
-=item C<int chop(char *str)>
+=item C<int hex(const char *str)>
 
-Removes a character from the end of C<str>. On success, returns the
-character that was removed. On error, returns C<-1> with C<errno> set
-appropriately.
+Returns the integer specified by the hexadecimal string, C<str>. C<str> can
+either be a string of C<[0-9a-fA-F]>, or C<"0x"> followed by a string of
+C<[0-9a-fA-f]>. On error, returns C<-1> with C<errno> set appropriately.
 
 =cut
 
 */
 
-int chop(char *str)
+int hex(const char *str)
 {
-	int ret;
+	unsigned int ret = 0;
 
-	if (!str || !*str)
+	if (!str)
 		return set_errno(EINVAL);
 
-	while (str[1])
-		++str;
+	if (str[0] == '0' && str[1] == 'x')
+		str += 2;
 
-	ret = (int)*str;
-	*str = '\0';
+	for (; *str; ++str)
+	{
+		ret <<= 4;
 
-	return ret;
+		switch (*str)
+		{
+			case '0': case '1': case '2': case '3': case '4':
+			case '5': case '6': case '7': case '8': case '9':
+				ret |= *str - '0';
+				break;
+			case 'a': case 'b': case 'c': case 'd': case 'e': case 'f':
+				ret |= *str - 'a' + 10;
+				break;
+			case 'A': case 'B': case 'C': case 'D': case 'E': case 'F':
+				ret |= *str - 'A' + 10;
+				break;
+			default:
+				return set_errno(EINVAL);
+		}
+	}
+
+	return (int)ret;
 }
 
 /*
 
-=item C<int str_chomp(String *str)>
+=item C<int str_oct(const String *str)>
 
-Removes line ending characters (i.e. C<'\n'> and C<'\r'>) from the end of
-C<str>. On success, returns the number of characters that were removed. On
-error, returns C<-1> with C<errno> set appropriately.
+Returns the integer specified by the binary, octal or hexadecimal string,
+C<str>. C<str> can either be C<"0x"> followed by a string of C<[0-9a-fA-F]>
+(hexadecimal), C<"0b"> followed by a string of C<[0-1]> (binary), or C<"0">
+followed by a string of C<[0-7]> (octal). On error, returns C<-1> with
+C<errno> set appropriately.
 
 =cut
 
 */
 
-int str_chomp(String *str)
+int str_oct(const String *str)
 {
 	int ret;
 	int err;
@@ -6169,10 +7842,10 @@ int str_chomp(String *str)
 	if (!str)
 		return set_errno(EINVAL);
 
-	if ((err = str_wrlock(str)))
+	if ((err = str_rdlock(str)))
 		return set_errno(err);
 
-	ret = str_chomp_unlocked(str);
+	ret = str_oct_unlocked(str);
 
 	if ((err = str_unlock(str)))
 		return set_errno(err);
@@ -6182,344 +7855,417 @@ int str_chomp(String *str)
 
 /*
 
-=item C<int str_chomp_unlocked(String *str)>
+=item C<int str_oct_unlocked(const String *str)>
 
-Equivalent to I<str_chomp(3)> except that C<str> is not write-locked.
+Equivalent to I<str_oct(3)> except that C<str> is not read-locked.
 
 =cut
 
 */
 
-int str_chomp_unlocked(String *str)
+int str_oct_unlocked(const String *str)
 {
-	char *s;
-	size_t length;
-
 	if (!str)
 		return set_errno(EINVAL);
 
-	if (str->length == 1)
-		return 0;
+	return oct(str->str);
+}
 
-	length = str->length;
+/*
 
-	for (s = str->str + str->length - 2; *s == '\n' || *s == '\r'; --s)
+=item C<int oct(const char *str)>
+
+Returns the integer specified by the binary, octal or hexadecimal string,
+C<str>. C<str> can either be C<"0x"> followed by a string of C<[0-9a-fA-F]>
+(hexadecimal), C<"0b"> followed by a string of C<[0-1]> (binary), or C<"0">
+followed by a string of C<[0-7]> (octal). On error, returns C<-1> with
+C<errno> set appropriately.
+
+=cut
+
+*/
+
+int oct(const char *str)
+{
+	unsigned int ret = 0;
+
+	if (!str || str[0] != '0')
+		return set_errno(EINVAL);
+
+	if (str[1] == 'b')
+		return bin(str);
+
+	if (str[1] == 'x')
+		return hex(str);
+
+	for (++str; *str; ++str)
 	{
-		if (contract(str, str->length - 2, 1) == -1)
-			return -1;
+		ret <<= 3;
+
+		switch (*str)
+		{
+			case '0': case '1': case '2': case '3':
+			case '4': case '5': case '6': case '7':
+				ret |= *str - '0';
+				break;
+			default:
+				return set_errno(EINVAL);
+		}
 	}
 
-	return length - str->length;
+	return (int)ret;
 }
 
 /*
 
-=item C<int chomp(char *str)>
+C<StringView view_fail(int errnum)>
 
-Removes line ending characters (i.e. C<'\n'> and C<'\r'>) from the end of
-C<str>. On success, returns the number of characters that were removed. On
-error, returns C<-1> with C<errno> set appropriately.
+Sets C<errno> to C<errnum> and returns a null I<StringView> (one whose
+C<str> is C<null> and whose C<length> is zero).
+
+*/
+
+static StringView view_fail(int errnum)
+{
+	errno = errnum;
+
+	return view_make(NULL, 0);
+}
+
+/*
+
+=item C<StringView str_view(const String *str)>
+
+Returns a I<StringView> of the characters in C<str>. A I<StringView> is a
+pointer and a length that refers to characters owned by something else. It
+is not C<nul>-terminated, it is never allocated or deallocated, and it
+remains valid only until C<str> is next modified or deallocated. When used
+on a string that is shared by multiple threads, I<str_view(3)>, and all use
+of the view, must appear between calls to I<str_rdlock(3)> or
+I<str_wrlock(3)> and I<str_unlock(3)>. On error, returns a null view (whose
+C<str> is C<null>) with C<errno> set appropriately.
 
 =cut
 
 */
 
-int chomp(char *str)
+StringView str_view(const String *str)
 {
-	char *s;
-
 	if (!str)
-		return set_errno(EINVAL);
+		return view_fail(EINVAL);
 
-	if (str[0] == '\0')
-		return 0;
+	return view_make(str->str, str->length - 1);
+}
 
-	while (str[1])
-		++str;
+/*
 
-	for (s = str; *s == '\n' || *s == '\r'; --s)
-		*s = '\0';
+=item C<StringView cstr_view(const char *str)>
 
-	return str - s;
+Equivalent to I<str_view(3)> but works on an ordinary I<C> string. The view
+remains valid only for as long as C<str> is unmodified.
+
+=cut
+
+*/
+
+StringView cstr_view(const char *str)
+{
+	if (!str)
+		return view_fail(EINVAL);
+
+	return view_make(str, strlen(str));
 }
 
 /*
 
-=item C<int str_bin(const String *str)>
+=item C<StringView view_substr(StringView view, ssize_t index, ssize_t range)>
 
-Returns the integer specified by the binary string, C<str>. C<str> can
-either be a string of C<[0-1]>, or C<"0b"> followed by a string of C<[0-1]>.
-On error, returns C<-1> with C<errno> set appropriately.
+Returns a I<StringView> of C<range> characters from C<view>, starting at
+C<index>, without copying them. If C<index> or C<range> are negative, they
+refer to character positions relative to the end of the view (C<-1> is the
+position after the last character, C<-2> is the position of the last
+character, and so on). On error, returns a null view with C<errno> set
+appropriately.
 
 =cut
 
 */
 
-int str_bin(const String *str)
+StringView view_substr(StringView view, ssize_t index, ssize_t range)
 {
-	int ret;
-	int err;
+	if (!view.str)
+		return view_fail(EINVAL);
 
-	if (!str)
-		return set_errno(EINVAL);
+	if (index < 0)
+		index = (ssize_t)view.length + 1 + index;
 
-	if ((err = str_rdlock(str)))
-		return set_errno(err);
+	if (index < 0)
+		return view_fail(EINVAL);
 
-	ret = str_bin_unlocked(str);
+	if (range < 0)
+		range = (ssize_t)view.length + 1 + range - index;
 
-	if ((err = str_unlock(str)))
-		return set_errno(err);
+	if (range < 0 || (size_t)(index + range) > view.length)
+		return view_fail(EINVAL);
 
-	return ret;
+	return view_make(view.str + index, range);
 }
 
 /*
 
-=item C<int str_bin_unlocked(const String *str)>
+=item C<StringView view_trim(StringView view)>
 
-Equivalent to I<str_bin(3)> except that C<str> is not read-locked.
+Returns the part of C<view> that remains after removing leading and trailing
+spaces. On error, returns a null view with C<errno> set appropriately.
 
 =cut
 
 */
 
-int str_bin_unlocked(const String *str)
+StringView view_trim(StringView view)
 {
-	if (!str)
-		return set_errno(EINVAL);
-
-	return bin(str->str);
+	return view_trim_right(view_trim_left(view));
 }
 
 /*
 
-=item C<int bin(const char *str)>
+=item C<StringView view_trim_left(StringView view)>
 
-Returns the integer specified by the binary string, C<str>. C<str> can
-either be a string of C<[0-1]>, or C<"0b"> followed by a string of C<[0-1]>.
-On error, returns C<-1> with C<errno> set appropriately.
+Returns the part of C<view> that remains after removing leading spaces. On
+error, returns a null view with C<errno> set appropriately.
 
 =cut
 
 */
 
-int bin(const char *str)
+StringView view_trim_left(StringView view)
 {
-	unsigned int ret = 0;
-
-	if (!str)
-		return set_errno(EINVAL);
-
-	if (str[0] == '0' && str[1] == 'b')
-		str += 2;
+	if (!view.str)
+		return view_fail(EINVAL);
 
-	for (; *str; ++str)
-	{
-		ret <<= 1;
-
-		switch (*str)
-		{
-			case '0': break;
-			case '1': ret |= 1; break;
-			default:  return set_errno(EINVAL);
-		}
-	}
+	while (view.length && is_space(*view.str))
+		++view.str, --view.length;
 
-	return (int)ret;
+	return view;
 }
 
 /*
 
-=item C<int str_hex(const String *str)>
+=item C<StringView view_trim_right(StringView view)>
 
-Returns the integer specified by the hexadecimal string, C<str>. C<str> can
-either be a string of C<[0-9a-fA-F]>, or C<"0x"> followed by a string of
-C<[0-9a-fA-f]>. On error, returns C<-1> with C<errno> set appropriately.
+Returns the part of C<view> that remains after removing trailing spaces. On
+error, returns a null view with C<errno> set appropriately.
 
 =cut
 
 */
 
-int str_hex(const String *str)
+StringView view_trim_right(StringView view)
 {
-	int ret;
-	int err;
-
-	if (!str)
-		return set_errno(EINVAL);
-
-	if ((err = str_rdlock(str)))
-		return set_errno(err);
-
-	ret = str_hex_unlocked(str);
+	if (!view.str)
+		return view_fail(EINVAL);
 
-	if ((err = str_unlock(str)))
-		return set_errno(err);
+	while (view.length && is_space(view.str[view.length - 1]))
+		--view.length;
 
-	return ret;
+	return view;
 }
 
 /*
 
-=item C<int str_hex_unlocked(const String *str)>
+=item C<int view_cmp(StringView view1, StringView view2)>
 
-Equivalent to I<str_hex(3)> except that C<str> is not read-locked.
+Compares the characters in C<view1> and C<view2>. Returns an integer less
+than, equal to, or greater than zero if C<view1> is found to be less than,
+equal to, or greater than C<view2>, respectively. A view that is a proper
+prefix of the other is less than it. A null view compares equal to an empty
+one.
 
 =cut
 
 */
 
-int str_hex_unlocked(const String *str)
+int view_cmp(StringView view1, StringView view2)
 {
-	if (!str)
-		return set_errno(EINVAL);
+	size_t length = (view1.length < view2.length) ? view1.length : view2.length;
+	int ret;
 
-	return hex(str->str);
+	if (length && (ret = memcmp(view1.str, view2.str, length)))
+		return ret;
+
+	return (view1.length > view2.length) - (view1.length < view2.length);
 }
 
 /*
 
-=item C<int hex(const char *str)>
+=item C<int view_casecmp(StringView view1, StringView view2)>
 
-Returns the integer specified by the hexadecimal string, C<str>. C<str> can
-either be a string of C<[0-9a-fA-F]>, or C<"0x"> followed by a string of
-C<[0-9a-fA-f]>. On error, returns C<-1> with C<errno> set appropriately.
+Equivalent to I<view_cmp(3)> except that the case of the characters is
+ignored.
 
 =cut
 
 */
 
-int hex(const char *str)
+int view_casecmp(StringView view1, StringView view2)
 {
-	unsigned int ret = 0;
-
-	if (!str)
-		return set_errno(EINVAL);
-
-	if (str[0] == '0' && str[1] == 'x')
-		str += 2;
+	size_t length = (view1.length < view2.length) ? view1.length : view2.length;
+	size_t i;
 
-	for (; *str; ++str)
+	for (i = 0; i < length; ++i)
 	{
-		ret <<= 4;
+		int c1 = to_lower(view1.str[i]);
+		int c2 = to_lower(view2.str[i]);
 
-		switch (*str)
-		{
-			case '0': case '1': case '2': case '3': case '4':
-			case '5': case '6': case '7': case '8': case '9':
-				ret |= *str - '0';
-				break;
-			case 'a': case 'b': case 'c': case 'd': case 'e': case 'f':
-				ret |= *str - 'a' + 10;
-				break;
-			case 'A': case 'B': case 'C': case 'D': case 'E': case 'F':
-				ret |= *str - 'A' + 10;
-				break;
-			default:
-				return set_errno(EINVAL);
-		}
+		if (c1 != c2)
+			return c1 - c2;
 	}
 
-	return (int)ret;
+	return (view1.length > view2.length) - (view1.length < view2.length);
 }
 
 /*
 
-=item C<int str_oct(const String *str)>
+=item C<ssize_t split_views(StringView text, const char *delim, StringView *views, size_t max)>
 
-Returns the integer specified by the binary, octal or hexadecimal string,
-C<str>. C<str> can either be C<"0x"> followed by a string of C<[0-9a-fA-F]>
-(hexadecimal), C<"0b"> followed by a string of C<[0-1]> (binary), or C<"0">
-followed by a string of C<[0-7]> (octal). On error, returns C<-1> with
-C<errno> set appropriately.
+Splits C<text> into tokens separated by sequences of characters occurring in
+C<delim>, like I<split(3)>, but without copying anything. Each token is
+stored as a I<StringView> into C<text> in the array C<views>, which has room
+for C<max> views. If there are more than C<max> tokens, only the first
+C<max> are stored. C<views> may be C<null> when C<max> is zero, in order to
+count the tokens. On success, returns the total number of tokens in C<text>,
+which may be greater than C<max>. On error, returns C<-1> with C<errno> set
+appropriately.
 
 =cut
 
 */
 
-int str_oct(const String *str)
+ssize_t split_views(StringView text, const char *delim, StringView *views, size_t max)
 {
-	int ret;
-	int err;
+	ScanSet set;
+	const char *s, *r, *end;
+	size_t count = 0;
 
-	if (!str)
+	if (!text.str || !delim || (max && !views))
 		return set_errno(EINVAL);
 
-	if ((err = str_rdlock(str)))
-		return set_errno(err);
+	scan_set_init(&set, delim);
 
-	ret = str_oct_unlocked(str);
+	for (s = text.str, end = s + text.length; s < end; s = r)
+	{
+		s += scan_set(&set, s, end - s, 0);
 
-	if ((err = str_unlock(str)))
-		return set_errno(err);
+		if (s == end)
+			break;
 
-	return ret;
+		r = (*delim) ? s + scan_set(&set, s, end - s, 1) : s + 1;
+
+		if (count < max)
+			views[count] = view_make(s, r - s);
+
+		++count;
+	}
+
+	return count;
 }
 
+#ifdef HAVE_REGEX_H
+
 /*
 
-=item C<int str_oct_unlocked(const String *str)>
+=item C<ssize_t regexpr_views(StringView text, const char *delim, int cflags, int eflags, StringView *views, size_t max)>
 
-Equivalent to I<str_oct(3)> except that C<str> is not read-locked.
+Splits C<text> into tokens separated by matches of the regular expression
+C<delim>, like I<regexpr_split(3)>, but without copying the tokens. C<views>
+and C<max> are as for I<split_views(3)>. On success, returns the total
+number of tokens in C<text>, which may be greater than C<max>. On error,
+returns C<-1> with C<errno> set appropriately. Where the system's
+I<regexec(3)> does not support C<REG_STARTEND>, C<text> is copied once so
+that it can be C<nul>-terminated, and it must not contain any C<nul>
+characters.
 
 =cut
 
 */
 
-int str_oct_unlocked(const String *str)
+ssize_t regexpr_views(StringView text, const char *delim, int cflags, int eflags, StringView *views, size_t max)
 {
-	if (!str)
+	RegexprEntry *entry;
+	regmatch_t match[1];
+	const char *str;
+	char *copy = NULL;
+	size_t start, count = 0;
+	int err;
+
+	if (!text.str || !delim || (max && !views))
 		return set_errno(EINVAL);
 
-	return oct(str->str);
-}
+	if (!(entry = regexpr_cache_get(delim, cflags, &err)))
+		return set_errno(err);
 
-/*
+#ifdef REG_STARTEND
+	str = text.str;
+	eflags |= REG_STARTEND;
+#else
+	if (!(copy = mem_create(text.length + 1, char)))
+	{
+		regexpr_cache_put(entry);
+		return -1;
+	}
 
-=item C<int oct(const char *str)>
+	memcpy(copy, text.str, text.length);
+	copy[text.length] = '\0';
+	str = copy;
+#endif
 
-Returns the integer specified by the binary, octal or hexadecimal string,
-C<str>. C<str> can either be C<"0x"> followed by a string of C<[0-9a-fA-F]>
-(hexadecimal), C<"0b"> followed by a string of C<[0-1]> (binary), or C<"0">
-followed by a string of C<[0-7]> (octal). On error, returns C<-1> with
-C<errno> set appropriately.
+	for (start = 0; start < text.length; )
+	{
+		match[0].rm_so = 0;
+		match[0].rm_eo = text.length - start;
 
-=cut
+		if (regexpr_entry_exec(entry, str + start, 1, match, eflags))
+			break;
 
-*/
+		/* Zero length match (at every position), make a token of each character */
 
-int oct(const char *str)
-{
-	unsigned int ret = 0;
+		if (match[0].rm_so == 0 && match[0].rm_eo == 0)
+		{
+			++match[0].rm_so;
+			++match[0].rm_eo;
+		}
 
-	if (!str || str[0] != '0')
-		return set_errno(EINVAL);
+		/* Make a token of any text before the match */
 
-	if (str[1] == 'b')
-		return bin(str);
+		if (match[0].rm_so)
+		{
+			if (count < max)
+				views[count] = view_make(text.str + start, match[0].rm_so);
 
-	if (str[1] == 'x')
-		return hex(str);
+			++count;
+		}
 
-	for (++str; *str; ++str)
+		start += match[0].rm_eo;
+	}
+
+	/* Make a token of any text after the last match */
+
+	if (start < text.length)
 	{
-		ret <<= 3;
+		if (count < max)
+			views[count] = view_make(text.str + start, text.length - start);
 
-		switch (*str)
-		{
-			case '0': case '1': case '2': case '3':
-			case '4': case '5': case '6': case '7':
-				ret |= *str - '0';
-				break;
-			default:
-				return set_errno(EINVAL);
-		}
+		++count;
 	}
 
-	return (int)ret;
+	mem_release(copy);
+	regexpr_cache_put(entry);
+
+	return count;
 }
 
+#endif
+
 #ifndef HAVE_STRCASECMP
 
 /*
@@ -6883,9 +8629,20 @@ int vasprintf(char **str, const char *format, va_list args)
 		return -1;
 	}
 
+	len = str_length(tmp);
+
+	/* Short strings are stored inside the String, so copy them */
+
+	if (str && is_inline(tmp))
+	{
+		*str = mem_strdup(cstr(tmp));
+		str_release(tmp);
+
+		return (*str) ? len : -1;
+	}
+
 	if (str)
 		*str = cstr(tmp);
-	len = str_length(tmp);
 	free(tmp);
 
 	return len;
@@ -7730,6 +9487,8 @@ I<perlop(1)>
 
 #ifdef TEST
 
+#include <sys/time.h>
+
 static void str_print(const char *str, size_t length)
 {
 	const char * const encoded = "\a\b\t\n\v\f\r\\";
@@ -8086,6 +9845,195 @@ void mt_test(int test, Locker *locker)
 	}
 }
 
+#ifdef HAVE_REGEX_H
+
+void *regexpr_thread(void *arg)
+{
+	char pattern[32];
+	List *list;
+	int i;
+
+	for (i = 0; i < 1000; ++i)
+	{
+		snprintf(pattern, sizeof pattern, "(%d)+", (i * 7) % 40);
+
+		if ((list = regexpr(pattern, "0123456789", 0, 0)))
+			list_release(list);
+	}
+
+	return NULL;
+}
+
+#endif
+
+/* Text for the scanning tests and benchmark: words, delimiters, whitespace and high bytes */
+
+char *scan_text(size_t length)
+{
+	static const char *words[] = { "alpha", "beta", "gamma,", "delta", "\xe9psilon", "zeta\t", "eta;", "theta" };
+	char *text = mem_create(length + 1, char);
+	size_t i, j, k;
+
+	if (!text)
+		return NULL;
+
+	for (i = j = 0; i < length; ++j)
+	{
+		const char *w = words[(j * 7 + j / 5) % 8];
+
+		while (*w && i < length)
+			text[i++] = *w++;
+
+		if (i < length)
+			text[i++] = (j % 13) ? ' ' : '\n';
+
+		if (j % 11 == 0)
+			for (k = 0; k < 3 && i < length; ++k)
+				text[i++] = ' ';
+	}
+
+	text[length] = '\0';
+
+	return text;
+}
+
+double bench_elapsed(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+
+	return (end.tv_sec - start->tv_sec) + (end.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+void bench_report(const char *name, size_t bytes, struct timeval *start)
+{
+	printf("%-16s %8.1f MB/s\n", name, bytes / bench_elapsed(start) / 1000000.0);
+}
+
+/* Joins and formats lists of a million items */
+
+void bench_join(void)
+{
+	const int items = 1000000;
+	struct timeval start;
+	List *strings, *cstrings, *lines;
+	String *result, *text;
+	size_t length;
+	int i;
+
+	if (!(strings = list_create((list_release_t *)str_release)) || !(cstrings = list_create(free)))
+	{
+		printf("Failed to create lists\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < items; ++i)
+	{
+		list_append(strings, str_create("item%d", i));
+		list_append(cstrings, mem_strdup(cstr((String *)list_item(strings, i))));
+	}
+
+	gettimeofday(&start, NULL);
+	result = str_join(strings, ", ");
+	length = str_length(result);
+	bench_report("str_join (1M)", length, &start);
+	str_destroy(&result);
+
+	gettimeofday(&start, NULL);
+	result = join(cstrings, ", ");
+	bench_report("join (1M)", length, &start);
+
+	gettimeofday(&start, NULL);
+	text = str_join(strings, " ");
+	lines = str_fmt(text, 72, ALIGN_LEFT);
+	bench_report("fmt left (1M)", str_length(text), &start);
+	list_destroy(&lines);
+
+	gettimeofday(&start, NULL);
+	lines = str_fmt(text, 72, ALIGN_FULL);
+	bench_report("fmt full (1M)", str_length(text), &start);
+	list_destroy(&lines);
+
+	str_destroy(&text);
+	str_destroy(&result);
+	list_destroy(&cstrings);
+	list_destroy(&strings);
+}
+
+void test_bench(void)
+{
+	const size_t length = 16 * 1024 * 1024;
+	const int reps = 8;
+	struct timeval start;
+	char *text, *copy;
+	StringTR *table;
+	String *result;
+	size_t count = 0;
+	int i;
+
+	if (!(text = scan_text(length)) || !(copy = mem_create(length + 1, char)) || !(table = tr_compile(";", ",", 0)))
+	{
+		printf("Failed to create text\n");
+		exit(EXIT_FAILURE);
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < reps; ++i)
+	{
+		const char *s;
+
+		for (s = text; *s; )
+		{
+			while (*s && strchr(",; \t\n", *s))
+				++s;
+
+			if (*s)
+				++count;
+
+			while (*s && !strchr(",; \t\n", *s))
+				++s;
+		}
+	}
+	bench_report("split (bytewise)", length * reps, &start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < reps; ++i)
+		count -= split_views(cstr_view(text), ",; \t\n", NULL, 0);
+	bench_report("split_views", length * reps, &start);
+
+	if (count)
+		printf("split_views counted differently\n");
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < reps; ++i)
+		squeeze(strcpy(copy, text));
+	bench_report("squeeze", length * reps, &start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < reps; ++i)
+		tr_compiled(strcpy(copy, text), table);
+	bench_report("tr", length * reps, &start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < reps; ++i)
+		if ((result = quote(text, "\"\\", '\\')))
+			str_release(result);
+	bench_report("quote", length * reps, &start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < reps; ++i)
+		if ((result = encode(text, "\\", "\\", '\\', 1)))
+			str_release(result);
+	bench_report("encode", length * reps, &start);
+
+	tr_release(table);
+	mem_release(copy);
+	mem_release(text);
+
+	bench_join();
+}
+
 int main(int ac, char **av)
 {
 	const char * const testfile = "str_fgetline.test";
@@ -8099,9 +10047,15 @@ int main(int ac, char **av)
 	regex_t re[1];
 #endif
 
-	if (ac == 2 && !strcmp(av[1], "help"))
+	if (ac == 2 && !strcmp(av[1], "help"))
+	{
+		printf("usage: %s [help|debug|bench]\n", *av);
+		return EXIT_SUCCESS;
+	}
+
+	if (ac == 2 && !strcmp(av[1], "bench"))
 	{
-		printf("usage: %s [help|debug]\n", *av);
+		test_bench();
 		return EXIT_SUCCESS;
 	}
 
@@ -9678,6 +11632,651 @@ int main(int ac, char **av)
 	TEST_ASPRINTF(755, asprintf(&t, "%-1024s", "*"), 1024, t, "*                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                               ")
 #endif
 
+	/* Test short strings stored inside the String */
+
+	if (!(a = str_create("%s", "0123456789012345678901234567890")))
+		++errors, printf("Test756: str_create(31 bytes) failed\n");
+	else
+	{
+		if (a->str != a->buf || a->size != 32)
+			++errors, printf("Test756: str_create(31 bytes) failed (not inline)\n");
+
+		if (!str_append(a, "%s", "x") || a->str == a->buf || strcmp(cstr(a), "0123456789012345678901234567890x"))
+			++errors, printf("Test756: str_append() to 32 bytes failed (\"%s\")\n", cstr(a));
+
+		str_destroy(&a);
+	}
+
+	if (!(a = str_create("%s", "01234567890123456789012345678901")) || a->str == a->buf || strcmp(cstr(a), "01234567890123456789012345678901"))
+		++errors, printf("Test757: str_create(32 bytes) failed\n");
+
+	str_destroy(&a);
+
+	if (!(a = str_create("abc")) || !(b = str_copy(a)) || b->str != b->buf)
+		++errors, printf("Test758: str_copy(short) failed (not inline)\n");
+	else
+	{
+		if (!str_prepend(b, "%040d", 0) || !str_insert(a, 1, "%s", "-") || strcmp(cstr(a), "a-bc") || strlen(cstr(b)) != 43 || strcmp(cstr(b) + 40, "abc") || str_set_length(b, 2) != 2 || strcmp(cstr(b), "00"))
+			++errors, printf("Test758: modifying short strings failed (\"%s\", \"%s\")\n", cstr(a), cstr(b));
+	}
+
+	str_destroy(&a);
+	str_destroy(&b);
+
+	/* Test str_reserve, formatting str_append in place */
+
+	if (!(a = str_create("abc")))
+		++errors, printf("Test759: str_create() failed\n");
+	else
+	{
+		char *data;
+
+		if (str_reserve(a, 1000) != a || a->size < 1001 || strcmp(cstr(a), "abc") || str_length(a) != 3)
+			++errors, printf("Test759: str_reserve(1000) failed\n");
+
+		data = cstr(a);
+
+		for (i = 3; i < 1000; i += 10)
+			if (!str_append(a, "%010d", i))
+				break;
+
+		if (cstr(a) != data || str_length(a) != 1003)
+			++errors, printf("Test759: str_append() after str_reserve() reallocated or failed (length %d)\n", (int)str_length(a));
+
+		if (str_reserve(a, 10) != a || str_length(a) != 1003 || str_reserve(NULL, 10))
+			++errors, printf("Test759: str_reserve(shorter) failed\n");
+
+		if (str_reserve(a, (size_t)-3) || errno != ENOMEM || str_reserve(a, (size_t)-1 >> 1) || errno != ENOMEM || str_length(a) != 1003)
+			++errors, printf("Test759: str_reserve(huge) failed to fail with ENOMEM\n");
+
+		str_destroy(&a);
+	}
+
+	if (!(a = str_create("%s", "")))
+		++errors, printf("Test760: str_create() failed\n");
+	else
+	{
+		/* Exactly fill the inline space, then overflow it, then a big one */
+
+		if (!str_append(a, "%s", "0123456789012345678901234567890") || strcmp(cstr(a), "0123456789012345678901234567890") || a->str != a->buf)
+			++errors, printf("Test760: str_append() exactly filling space failed (\"%s\")\n", cstr(a));
+
+		if (!str_append(a, "%c%s", 'x', "yz") || strcmp(cstr(a), "0123456789012345678901234567890xyz") || str_length(a) != 34)
+			++errors, printf("Test760: str_append() overflowing space failed (\"%s\")\n", cstr(a));
+
+		if (!str_append(a, "%5000s|", "end") || str_length(a) != 5035 || strcmp(cstr(a) + 5029, "  end|") || strncmp(cstr(a), "0123456789012345678901234567890xyz   ", 37))
+			++errors, printf("Test760: str_append(5001 bytes) failed (length %d)\n", (int)str_length(a));
+
+		if (!str_append(a, NULL) || str_length(a) != 5035)
+			++errors, printf("Test760: str_append(NULL) failed\n");
+
+		str_destroy(&a);
+	}
+
+	/* Test that appending arguments that point into the string still works */
+
+	if (!(a = str_create("abc")))
+		++errors, printf("Test761: str_create() failed\n");
+	else
+	{
+		for (i = 0; i < 8; ++i)
+			if (!str_append(a, "%s", cstr(a)))
+				break;
+
+		if (str_length(a) != 3 << 8 || strncmp(cstr(a), "abcabcabc", 9) || strcmp(cstr(a) + (3 << 8) - 6, "abcabc"))
+			++errors, printf("Test761: str_append(\"%%s\", cstr(str)) failed (length %d)\n", (int)str_length(a));
+
+		if (!str_insert(a, -1, "%d %.*s %c %*s%s", 7, 2, cstr(a) + 1, 'z', 2, "", cstr(a) + str_length(a) - 3) || strcmp(cstr(a) + (3 << 8), "7 bc z   abc"))
+			++errors, printf("Test761: str_insert(-1, cstr(str) + n) failed (\"%s\")\n", cstr(a) + (3 << 8));
+
+		str_destroy(&a);
+	}
+
+	if (!(a = str_create(NULL)))
+		++errors, printf("Test762: str_create() failed\n");
+	else
+	{
+		for (i = 0; i < 10000; ++i)
+			if (!str_append(a, "%d,", i % 10))
+				break;
+
+		for (i = 0; i < 10000; ++i)
+			if (cstr(a)[2 * i] != '0' + i % 10 || cstr(a)[2 * i + 1] != ',')
+				break;
+
+		if (str_length(a) != 20000 || i != 10000)
+			++errors, printf("Test762: 10000 x str_append() failed (length %d, mismatch at %d)\n", (int)str_length(a), i);
+
+		str_destroy(&a);
+	}
+
+	{
+		const char *text = "  alpha, beta,,gamma  ";
+		StringView views[8], view, null_view = { NULL, 0 };
+
+		view = view_trim(cstr_view(text));
+		if (view.str != text + 2 || view.length != 18)
+			++errors, printf("Test763: view_trim() failed (%d)\n", (int)view.length);
+
+		view = view_trim_left(cstr_view(text));
+		if (view.str != text + 2 || view.length != 20)
+			++errors, printf("Test763: view_trim_left() failed (%d)\n", (int)view.length);
+
+		view = view_trim_right(cstr_view(text));
+		if (view.str != text || view.length != 20)
+			++errors, printf("Test763: view_trim_right() failed (%d)\n", (int)view.length);
+
+		if (split_views(view_trim(cstr_view(text)), ", ", views, 8) != 3 ||
+			views[0].str != text + 2 || views[0].length != 5 ||
+			views[1].str != text + 9 || views[1].length != 4 ||
+			views[2].str != text + 15 || views[2].length != 5)
+			++errors, printf("Test764: split_views() failed\n");
+
+		if (split_views(cstr_view(text), ", ", NULL, 0) != 3)
+			++errors, printf("Test764: split_views(count) failed\n");
+
+		if (split_views(cstr_view(text), ", ", views, 1) != 3 || views[0].str != text + 2 || views[0].length != 5)
+			++errors, printf("Test764: split_views(max 1) failed\n");
+
+		if (split_views(cstr_view("abc"), "", views, 8) != 3 || views[2].str[0] != 'c' || views[2].length != 1)
+			++errors, printf("Test764: split_views(\"\") failed\n");
+
+		if (split_views(cstr_view(", ,"), ", ", views, 8) != 0)
+			++errors, printf("Test764: split_views(only delimiters) failed\n");
+
+		view = view_substr(cstr_view(text), 2, 5);
+		if (view.str != text + 2 || view.length != 5)
+			++errors, printf("Test765: view_substr(2, 5) failed\n");
+
+		view = view_substr(cstr_view(text), -8, -3);
+		if (view.str != text + 15 || view.length != 5)
+			++errors, printf("Test765: view_substr(-8, -3) failed (%d)\n", (int)view.length);
+
+		errno = 0;
+		view = view_substr(cstr_view(text), 20, 5);
+		if (view.str || errno != EINVAL)
+			++errors, printf("Test765: view_substr(out of range) failed\n");
+
+		if (view_cmp(cstr_view("abc"), cstr_view("abc")) != 0 ||
+			view_cmp(cstr_view("ab"), cstr_view("abc")) >= 0 ||
+			view_cmp(cstr_view("abd"), cstr_view("abc")) <= 0 ||
+			view_cmp(view_substr(cstr_view("xabcx"), 1, 3), cstr_view("abc")) != 0 ||
+			view_cmp(null_view, cstr_view("")) != 0)
+			++errors, printf("Test766: view_cmp() failed\n");
+
+		if (view_casecmp(cstr_view("ABC"), cstr_view("abc")) != 0 ||
+			view_casecmp(cstr_view("ABC"), cstr_view("abcd")) >= 0 ||
+			view_casecmp(cstr_view("b"), cstr_view("A")) <= 0)
+			++errors, printf("Test766: view_casecmp() failed\n");
+
+		if (!(a = str_create("one two")))
+			++errors, printf("Test766: str_create() failed\n");
+		else
+		{
+			if (view_cmp(str_view(a), cstr_view("one two")) || str_view(a).str != cstr(a))
+				++errors, printf("Test766: str_view() failed\n");
+
+			str_destroy(&a);
+		}
+
+#ifdef HAVE_REGEX_H
+		if (regexpr_views(view_substr(cstr_view("xa1b22c333dx"), 1, 9), "[0-9]+", REG_EXTENDED, 0, views, 8) != 3 ||
+			view_cmp(views[0], cstr_view("a")) || view_cmp(views[1], cstr_view("b")) || view_cmp(views[2], cstr_view("c")))
+			++errors, printf("Test767: regexpr_views() failed\n");
+
+		if (regexpr_views(cstr_view("abc"), "", 0, 0, views, 8) != 3 || view_cmp(views[1], cstr_view("b")))
+			++errors, printf("Test767: regexpr_views(\"\") failed\n");
+
+		if (regexpr_views(cstr_view("a, b,c"), ", *", REG_EXTENDED, 0, NULL, 0) != 3)
+			++errors, printf("Test767: regexpr_views(count) failed\n");
+#endif
+	}
+
+	{
+		const char * const delim = ", \t\n;";
+		char *text, *ref, *out;
+		StringView views[256], refs[256];
+		size_t len, n, k, m, changed;
+		String *q, *e, *d;
+		StringTR *del;
+		char *r;
+		int bad;
+
+		if (!(text = scan_text(4096)) || !(ref = mem_create(4097, char)) || !(out = mem_create(4097, char)) || !(del = tr_compile("a;", "A", TR_DELETE)))
+			++errors, printf("Test768: failed to create text\n");
+		else
+		{
+			/* Every length and alignment around the block sizes */
+
+			for (bad = 0, len = 0; len <= 300; ++len)
+			{
+				for (m = 0; m < 40; ++m)
+				{
+					const char *s = text + m, *end = s + len;
+
+					for (n = 0; s < end; )
+					{
+						while (s < end && strchr(delim, *s))
+							++s;
+
+						if (s == end)
+							break;
+
+						for (refs[n].str = s; s < end && !strchr(delim, *s); ++s)
+						{}
+
+						refs[n].length = s - refs[n].str;
+						++n;
+					}
+
+					if (split_views(view_substr(cstr_view(text), m, len), delim, views, 256) != n)
+						++bad;
+					else
+						for (k = 0; k < n; ++k)
+							if (views[k].str != refs[k].str || views[k].length != refs[k].length)
+								++bad;
+				}
+			}
+
+			if (bad)
+				++errors, printf("Test768: split_views() differs from bytewise splitting %d times\n", bad);
+
+			if (!(list = split(text, delim)) || list_length(list) != split_views(cstr_view(text), delim, NULL, 0))
+				++errors, printf("Test768: split() differs from split_views()\n");
+
+			list_release(list);
+
+			for (bad = 0, len = 0; len <= 300; ++len)
+			{
+				int started = 0, was_space = 0;
+
+				for (r = ref, k = 0; k < len; ++k)
+				{
+					if (!is_space(text[k]))
+					{
+						if (was_space && started)
+							*r++ = ' ';
+						*r++ = text[k];
+						started = 1;
+					}
+
+					was_space = is_space(text[k]);
+				}
+
+				*r = '\0';
+				memcpy(out, text, len);
+				out[len] = '\0';
+
+				if (strcmp(squeeze(out), ref))
+					++bad;
+			}
+
+			if (bad)
+				++errors, printf("Test769: squeeze() differs from bytewise squeezing %d times\n", bad);
+
+			for (bad = 0, len = 0; len <= 300; ++len)
+			{
+				for (r = ref, changed = k = 0; k < len; ++k)
+				{
+					if (text[k] == 'a' || text[k] == ';')
+						++changed;
+
+					if (text[k] != ';')
+						*r++ = (text[k] == 'a') ? 'A' : text[k];
+				}
+
+				*r = '\0';
+				memcpy(out, text, len);
+				out[len] = '\0';
+
+				if (tr_compiled(out, del) != changed || strcmp(out, ref))
+					++bad;
+			}
+
+			if (bad)
+				++errors, printf("Test770: tr_compiled() differs from bytewise translation %d times\n", bad);
+
+			for (bad = 0, len = 0; len <= 300; ++len)
+			{
+				for (r = ref, k = 0; k < len; ++k)
+				{
+					if (text[k] == 'a' || text[k] == '\t')
+						*r++ = '\\';
+					*r++ = text[k];
+				}
+
+				*r = '\0';
+				memcpy(out, text, len);
+				out[len] = '\0';
+
+				if (!(q = quote(out, "a\t", '\\')) || strcmp(cstr(q), ref) || str_length(q) != r - ref)
+					++bad;
+
+				str_release(q);
+			}
+
+			if (bad)
+				++errors, printf("Test771: quote() differs from bytewise quoting %d times\n", bad);
+
+			for (bad = 0, len = 0; len <= 300; ++len)
+			{
+				memcpy(out, text, len);
+				out[len] = '\0';
+
+				if (!(e = encode(out, "\\a", "\\A", '\\', 1)))
+					++bad;
+				else
+				{
+					for (k = 0; k < str_length(e); ++k)
+						if (!is_print(cstr(e)[k]))
+							break;
+
+					if (k != str_length(e) || !(d = decode(cstr(e), "\\a", "\\A", '\\', 1)) || strcmp(cstr(d), out))
+						++bad;
+					else
+						str_release(d);
+
+					str_release(e);
+				}
+			}
+
+			if (bad)
+				++errors, printf("Test772: encode() and decode() differ from the original text %d times\n", bad);
+		}
+
+		tr_release(del);
+		mem_release(out);
+		mem_release(ref);
+		mem_release(text);
+	}
+
+#ifdef HAVE_REGEX_H
+	{
+		size_t hits, misses, length;
+		pthread_t id[4];
+		char pattern[32];
+
+		regexpr_cache_clear();
+
+		if ((list = regexpr("a+", "baaab", 0, 0)))
+			list_release(list);
+
+		if ((list = regexpr("a+", "bab", 0, 0)))
+			list_release(list);
+
+		if ((list = regexpr("a+", "bab", REG_ICASE, 0)))
+			list_release(list);
+
+		if ((list = regexpr_split("1a2a3", "a+", 0, 0)))
+			list_release(list);
+
+		regexpr_cache_stats(&hits, &misses, &length);
+		if (hits != 2 || misses != 2 || length != 2)
+			++errors, printf("Test773: regexpr_cache_stats() failed (hits %d misses %d length %d, not 2 2 2)\n", (int)hits, (int)misses, (int)length);
+
+		if (!(a = str_create("aaa")) || !str_regsub("a+", "b", a, 0, 0, 0) || strcmp(cstr(a), "b"))
+			++errors, printf("Test773: str_regsub() with a cached pattern failed\n");
+
+		str_release(a);
+
+		regexpr_cache_stats(&hits, NULL, NULL);
+		if (hits != 3)
+			++errors, printf("Test773: str_regsub() didn't use the cache\n");
+
+		errno = 0;
+		if (regexpr("(", "text", 0, 0) || !errno)
+			++errors, printf("Test773: regexpr() with a bad pattern failed\n");
+
+		/* The least recently used patterns are removed first */
+
+		for (i = 0; i < 40; ++i)
+		{
+			snprintf(pattern, sizeof pattern, "x%d", i);
+
+			if ((list = regexpr(pattern, "x1", 0, 0)))
+				list_release(list);
+
+			if ((list = regexpr("a+", "a", 0, 0)))
+				list_release(list);
+		}
+
+		regexpr_cache_stats(&hits, &misses, &length);
+		if (length != 32)
+			++errors, printf("Test774: regexpr cache length is %d, not 32\n", (int)length);
+
+		if ((list = regexpr("a+", "a", 0, 0)))
+			list_release(list);
+
+		if ((list = regexpr("x0", "x0", 0, 0)))
+			list_release(list);
+
+		regexpr_cache_stats(&hits, &misses, NULL);
+		if (hits != 3 + 40 + 1 || misses != 2 + 1 + 40 + 1)
+			++errors, printf("Test774: regexpr cache eviction failed (hits %d misses %d)\n", (int)hits, (int)misses);
+
+		regexpr_cache_clear();
+		regexpr_cache_stats(&hits, &misses, &length);
+		if (hits || misses || length)
+			++errors, printf("Test774: regexpr_cache_clear() failed\n");
+
+		/* Threads sharing (and evicting) cached patterns */
+
+		for (i = 0; i < 4; ++i)
+			if (pthread_create(&id[i], NULL, regexpr_thread, NULL))
+				break;
+
+		while (i--)
+			pthread_join(id[i], NULL);
+
+		regexpr_cache_stats(&hits, &misses, &length);
+		if (hits + misses != 4 * 1000 || length > 32)
+			++errors, printf("Test775: threads using the regexpr cache failed (hits %d misses %d length %d)\n", (int)hits, (int)misses, (int)length);
+
+		regexpr_cache_clear();
+	}
+#endif
+
+#ifdef HAVE_REGEX_H
+	{
+		static const char *patterns[] =
+		{
+			"abc", "a\\.b", "ab*c", "ab+c", "x?yz", "(foo|bar)=v", "foo|bar",
+			"[abc]+def", "[]x]yz", "[[:digit:]]+kg", "a{2}b", "a{0,1}bc",
+			"^key=", "end$", "\\(lit\\)", "a.c", "", "q(r(s)t)u", "\\bword",
+			"caf\xc3\xa9*s", "=", "ab|", "(a|b)c+d", "ab+?c", "a+?", "ab+*c",
+			"ab+{0,1}c"
+		};
+		static const char *texts[] =
+		{
+			"", "abc", "xxabcxx", "a.b", "axb", "ac", "abbbc", "abc abbc",
+			"yz", "xyz", "foo=v", "bar=v", "baz=v", "foo", "bar", "cdef",
+			"]yz", "xyz]yz", "12kg", "kg", "aab", "ab", "bc", "abc",
+			"key=value", "a key=value", "the end", "end of", "(lit)",
+			"lit", "a-c", "qrstu", "qrsu", "word", "a word", "cafs",
+			"caf\xc3\xa9s", "caf\xc3s", "a=b=c", "acd", "bccd", "abd"
+		};
+		regex_t compiled[1];
+		regmatch_t match[1];
+		List *fast, *slow;
+		StringView views[32];
+		size_t p, t;
+		int bad = 0;
+
+		for (p = 0; p < sizeof patterns / sizeof *patterns; ++p)
+		{
+			if (regexpr_compile(compiled, patterns[p], 0))
+			{
+				++errors, printf("Test776: regexpr_compile(\"%s\") failed\n", patterns[p]);
+				continue;
+			}
+
+			for (t = 0; t < sizeof texts / sizeof *texts; ++t)
+			{
+				String *slow_text, *fast_text;
+				ssize_t n;
+
+				/* regexpr() with the cached pattern against regexec() */
+
+				fast = regexpr(patterns[p], texts[t], 0, 0);
+				slow = regexpr_compiled(compiled, texts[t], 0);
+
+				if (!fast != !slow || (fast && (!(a = join(fast, "|")) || !(b = join(slow, "|")) || strcmp(cstr(a), cstr(b)))))
+					++bad, printf("Test776: regexpr(\"%s\", \"%s\") differs from regexec()\n", patterns[p], texts[t]);
+
+				if (fast)
+					str_release(a), str_release(b);
+
+				list_release(fast);
+				list_release(slow);
+
+				/* str_regsub() with the cached pattern against str_regsub_compiled() */
+
+				fast_text = str_create("%s", texts[t]);
+				slow_text = str_create("%s", texts[t]);
+
+				if (!str_regsub(patterns[p], "<$0>", fast_text, 0, 0, 1) != !str_regsub_compiled(compiled, "<$0>", slow_text, 0, 1) || strcmp(cstr(fast_text), cstr(slow_text)))
+					++bad, printf("Test777: str_regsub(\"%s\", \"%s\") differs from str_regsub_compiled()\n", patterns[p], texts[t]);
+
+				str_release(fast_text);
+				str_release(slow_text);
+
+				/* regexpr_split() and regexpr_views() against regexec() one token at a time */
+
+				if (!*patterns[p] || !(fast = regexpr_split(texts[t], patterns[p], 0, 0)))
+					continue;
+
+				n = regexpr_views(cstr_view(texts[t]), patterns[p], 0, 0, views, 32);
+
+				if (n != list_length(fast))
+					++bad, printf("Test778: regexpr_split(\"%s\", \"%s\") and regexpr_views() differ\n", texts[t], patterns[p]);
+				else
+				{
+					const char *s = texts[t];
+					ssize_t k = 0;
+
+					while (*s && !regexec(compiled, s, 1, match, 0))
+					{
+						if (match[0].rm_eo == 0)
+							match[0].rm_so = match[0].rm_eo = 1;
+
+						if (match[0].rm_so)
+						{
+							if (k >= n || views[k].str != s || views[k].length != match[0].rm_so || strncmp(cstr((String *)list_item(fast, k)), s, match[0].rm_so))
+								break;
+
+							++k;
+						}
+
+						s += match[0].rm_eo;
+					}
+
+					if (*s)
+						k += (k < n && views[k].str == s);
+
+					if (k != n)
+						++bad, printf("Test778: regexpr_split(\"%s\", \"%s\") differs from regexec()\n", texts[t], patterns[p]);
+				}
+
+				list_release(fast);
+			}
+
+			regfree(compiled);
+		}
+
+		if (bad)
+			++errors;
+
+		regexpr_cache_clear();
+	}
+#endif
+
+	/* Test joining with exact pre-sizing */
+
+	{
+		String *joined;
+		List *items;
+
+		if (!(items = list_make((list_release_t *)str_release, str_create("one"), str_create(""), NULL)) || !list_append(items, NULL) || !list_append(items, str_create("four")))
+			++errors, printf("Test780: failed to create list\n");
+		else
+		{
+			if (!(joined = str_join(items, ", ")) || strcmp(cstr(joined), "one, , , four") || str_length(joined) != 13)
+				++errors, printf("Test780: str_join() with empty and null items failed (\"%s\")\n", joined ? cstr(joined) : "null");
+			str_destroy(&joined);
+
+			if (!(joined = str_join(items, NULL)) || strcmp(cstr(joined), "onefour"))
+				++errors, printf("Test780: str_join(NULL delim) failed (\"%s\")\n", joined ? cstr(joined) : "null");
+			str_destroy(&joined);
+
+			list_destroy(&items);
+		}
+
+		if (!(items = list_make(NULL, "a", "bc", "", "def", NULL)) || !(joined = join(items, "--")) || strcmp(cstr(joined), "a--bc----def"))
+			++errors, printf("Test781: join() failed\n");
+		else
+			str_destroy(&joined);
+
+		list_destroy(&items);
+
+		if (!(items = list_create(NULL)) || !(joined = join(items, ", ")) || str_length(joined) != 0)
+			++errors, printf("Test781: join() of an empty list failed\n");
+		else
+			str_destroy(&joined);
+
+		list_destroy(&items);
+
+		if (!(items = list_create((list_release_t *)str_release)) || !(a = str_create(NULL)))
+			++errors, printf("Test781: failed to create list\n");
+		else
+		{
+			for (i = 0; i < 10000; ++i)
+			{
+				list_append(items, str_create("%d", i * 7919));
+				str_append(a, "%s%d", i ? "::" : "", i * 7919);
+			}
+
+			if (!(joined = str_join(items, "::")) || str_length(joined) != str_length(a) || strcmp(cstr(joined), cstr(a)))
+				++errors, printf("Test781: str_join() of 10000 items differs from appending them\n");
+
+			str_destroy(&joined);
+			str_destroy(&a);
+			list_destroy(&items);
+		}
+	}
+
+	/* Test formatting text with trailing whitespace and blank centred lines */
+
+	{
+		static const struct
+		{
+			const char *text;
+			StringAlignment alignment;
+			const char *lines;
+		}
+		formats[] =
+		{
+			{ "one two three  \n\t ", ALIGN_LEFT, "one two|three" },
+			{ "one two three  ", ALIGN_RIGHT, "one two|  three" },
+			{ "ab cd ef gh", ALIGN_FULL, "ab   cd|ef gh" },
+			{ "abcdefghij k", ALIGN_FULL, "abcdefghij|k" },
+			{ "\n\n  \nab  cd\n\n", ALIGN_CENTRE, "   | ab cd" },
+			{ "", ALIGN_CENTRE, "" },
+			{ " \n ", ALIGN_LEFT, "" }
+		};
+
+		for (i = 0; i < sizeof formats / sizeof formats[0]; ++i)
+		{
+			List *lines = fmt(formats[i].text, 7, formats[i].alignment);
+			String *joined = (lines) ? str_join(lines, "|") : NULL;
+
+			if (!joined || strcmp(cstr(joined), formats[i].lines))
+				++errors, printf("Test782: fmt(\"%s\", 7, '%c') = \"%s\", not \"%s\"\n", formats[i].text, formats[i].alignment, joined ? cstr(joined) : "null", formats[i].lines);
+
+			str_destroy(&joined);
+			list_destroy(&lines);
+		}
+	}
+
 	/* Test MT Safety */
 
 	debug = av[1] && !strcmp(av[1], "debug");
@@ -9695,10 +12294,10 @@ int main(int ac, char **av)
 		locker = locker_create_rwlock(&rwlock);
 
 	if (!locker)
-		++errors, printf("Test756: locker_create_rwlock() failed\n");
+		++errors, printf("Test783: locker_create_rwlock() failed\n");
 	else
 	{
-		mt_test(756, locker);
+		mt_test(783, locker);
 		locker_destroy(&locker);
 	}
 
@@ -9708,18 +12307,23 @@ int main(int ac, char **av)
 		locker = locker_create_mutex(&mutex);
 
 	if (!locker)
-		++errors, printf("Test757: locker_create_mutex() failed\n");
+		++errors, printf("Test784: locker_create_mutex() failed\n");
 	else
 	{
-		mt_test(757, locker);
+		mt_test(784, locker);
 		locker_destroy(&locker);
 	}
 
 	if (errors)
-		printf("%d/757 tests failed\n", errors);
+		printf("%d/784 tests failed\n", errors);
 	else
 		printf("All tests passed\n");
 
+	printf("\n");
+	printf("    Note: You can also measure the throughput of splitting, squeezing,\n");
+	printf("    translating, quoting, encoding, joining and formatting. Rerun the\n");
+	printf("    test with \"%s bench\".\n", *av);
+
 	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -33,6 +33,7 @@
 
 typedef struct String String;
 typedef struct StringTR StringTR;
+typedef struct StringView StringView;
 
 enum StringAlignment
 {
@@ -50,6 +51,12 @@ enum StringTROption
 	TR_SQUASH     = 4
 };
 
+struct StringView
+{
+	const char *str;
+	size_t length;
+};
+
 typedef enum StringAlignment StringAlignment;
 typedef enum StringTROption StringTROption;
 
@@ -82,6 +89,8 @@ ssize_t str_set_length(String *str, size_t length);
 ssize_t str_set_length_unlocked(String *str, size_t length);
 ssize_t str_recalc_length(String *str);
 ssize_t str_recalc_length_unlocked(String *str);
+String *str_reserve(String *str, size_t length);
+String *str_reserve_unlocked(String *str, size_t length);
 String *str_clear(String *str);
 String *str_clear_unlocked(String *str);
 String *str_remove(String *str, ssize_t index);
@@ -150,6 +159,8 @@ List *regexpr(const char *pattern, const char *text, int cflags, int eflags);
 List *regexpr_with_locker(Locker *locker, const char *pattern, const char *text, int cflags, int eflags);
 int regexpr_compile(regex_t *compiled, const char *pattern, int cflags);
 void regexpr_release(regex_t *compiled);
+void regexpr_cache_stats(size_t *hits, size_t *misses, size_t *length);
+void regexpr_cache_clear(void);
 List *str_regexpr_compiled(const regex_t *compiled, const String *text, int eflags);
 List *str_regexpr_compiled_unlocked(const regex_t *compiled, const String *text, int eflags);
 List *str_regexpr_compiled_with_locker(Locker *locker, const regex_t *compiled, const String *text, int eflags);
@@ -250,6 +261,16 @@ int hex(const char *str);
 int str_oct(const String *str);
 int str_oct_unlocked(const String *str);
 int oct(const char *str);
+StringView str_view(const String *str);
+StringView cstr_view(const char *str);
+StringView view_substr(StringView view, ssize_t index, ssize_t range);
+StringView view_trim(StringView view);
+StringView view_trim_left(StringView view);
+StringView view_trim_right(StringView view);
+int view_cmp(StringView view1, StringView view2);
+int view_casecmp(StringView view1, StringView view2);
+ssize_t split_views(StringView text, const char *delim, StringView *views, size_t max);
+ssize_t regexpr_views(StringView text, const char *delim, int cflags, int eflags, StringView *views, size_t max);
 int strcasecmp(const char *s1, const char *s2);
 int strncasecmp(const char *s1, const char *s2, size_t n);
 #ifndef strlcpy /* This is now a macro on OSX/macOS */